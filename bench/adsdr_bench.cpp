@@ -0,0 +1,547 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <adsdr.hpp>
+
+#include "rx_block_pool.h"
+#include "rx_block_queue.h"
+#include "rx_channelizer.h"
+#include "rx_decimator.h"
+#include "rx_iq_correction.h"
+#include "rx_kernels.h"
+#include "rx_psd.h"
+#include "rx_nco.h"
+#include "rx_resampler.h"
+#include "rx_subscriber.h"
+#include "tx_kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <getopt.h>
+#include <random>
+#include <sstream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace ADSDR;
+
+// Trace of init_sdr checked in with the tests, replayed for the command latency run unless -s is given
+#ifndef ADSDR_BENCH_SPI_TRACE
+#define ADSDR_BENCH_SPI_TRACE ""
+#endif
+
+typedef std::chrono::steady_clock bench_clock;
+
+static const char *command_names[COMMAND_SIZE] = {
+    "GET_TX_LO_FREQ", "SET_TX_LO_FREQ", "GET_TX_SAMP_FREQ", "SET_TX_SAMP_FREQ",
+    "GET_TX_RF_BANDWIDTH", "SET_TX_RF_BANDWIDTH", "GET_TX_ATTENUATION", "SET_TX_ATTENUATION",
+    "GET_TX_FIR_EN", "SET_TX_FIR_EN", "GET_RX_LO_FREQ", "SET_RX_LO_FREQ",
+    "GET_RX_SAMP_FREQ", "SET_RX_SAMP_FREQ", "GET_RX_RF_BANDWIDTH", "SET_RX_RF_BANDWIDTH",
+    "GET_RX_GC_MODE", "SET_RX_GC_MODE", "GET_RX_RF_GAIN", "SET_RX_RF_GAIN",
+    "GET_RX_FIR_EN", "SET_RX_FIR_EN", "SET_DATAPATH_EN", "GET_FPGA_VERSION",
+    "SET_LOOPBACK_EN"
+};
+
+struct bench_options
+{
+    double sample_rate = 10e6;
+    double seconds = 2.0;
+    unsigned int iterations = 100;
+    unsigned int subscribers = 4;
+    unsigned int channels = 64;
+    std::string spi_trace = ADSDR_BENCH_SPI_TRACE;
+    std::string output;
+};
+
+static double elapsed_seconds(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static double cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Runs kernel repeatedly for about half a second and returns ns per sample
+template<typename F>
+static double time_kernel(size_t samples_per_call, F kernel)
+{
+    // Warm up caches and branch predictors
+    for(int i = 0; i < 100; i++)
+    {
+        kernel();
+    }
+
+    uint64_t calls = 0;
+    bench_clock::time_point start = bench_clock::now();
+    do
+    {
+        for(int i = 0; i < 100; i++)
+        {
+            kernel();
+        }
+        calls += 100;
+    }
+    while(elapsed_seconds(start) < 0.5);
+
+    return elapsed_seconds(start) * 1e9 / (double) (calls * samples_per_call);
+}
+
+static void bench_kernels(std::ostream &json)
+{
+    std::mt19937 generator(1);
+    std::uniform_int_distribution<int> value(-2048, 2047);
+
+    std::vector<int16_t> raw(ADSDR_RX_TX_BUF_SIZE / sizeof(int16_t));
+    for(int16_t &v : raw)
+    {
+        v = (int16_t) (value(generator) * 16);
+    }
+    std::vector<sample> decoded(ADSDR_RX_BLOCK_SIZE);
+    rx_power power;
+
+    double decode = time_kernel(ADSDR_RX_BLOCK_SIZE, [&]() {
+        decode_rx_transfer((const unsigned char *) raw.data(), ADSDR_RX_TX_BUF_SIZE, decoded.data());
+    });
+    double decode_power = time_kernel(ADSDR_RX_BLOCK_SIZE, [&]() {
+        decode_rx_transfer((const unsigned char *) raw.data(), ADSDR_RX_TX_BUF_SIZE, decoded.data(), &power);
+    });
+
+    // ns per full rate sample, so it compares directly with the plain decode
+    decimation_config by8;
+    by8.factor = 8;
+    rx_decimator decimator(by8);
+    double decimate = time_kernel(ADSDR_RX_BLOCK_SIZE, [&]() {
+        decimator.decode((const unsigned char *) raw.data(), ADSDR_RX_TX_BUF_SIZE, decoded.data());
+    });
+    iq_correction_config correction_config;
+    rx_iq_correction correction(correction_config, iq_correction_estimate());
+    double correct = time_kernel(ADSDR_RX_BLOCK_SIZE, [&]() {
+        correction.decode((const unsigned char *) raw.data(), ADSDR_RX_TX_BUF_SIZE, decoded.data());
+    });
+    // Decode included, the resampler works in place on a decoded block
+    rx_resampler resampler(0.75);
+    double resample = time_kernel(ADSDR_RX_BLOCK_SIZE, [&]() {
+        decode_rx_transfer((const unsigned char *) raw.data(), ADSDR_RX_TX_BUF_SIZE, decoded.data());
+        resampler.process(decoded.data(), ADSDR_RX_BLOCK_SIZE);
+    });
+    rx_nco nco(1e6, 10e6);
+    double mix = time_kernel(ADSDR_RX_BLOCK_SIZE, [&]() {
+        nco.decode((const unsigned char *) raw.data(), ADSDR_RX_TX_BUF_SIZE, decoded.data());
+    });
+    double mix_decimate = time_kernel(ADSDR_RX_BLOCK_SIZE, [&]() {
+        decimator.decode((const unsigned char *) raw.data(), ADSDR_RX_TX_BUF_SIZE, decoded.data(), nullptr, &nco);
+    });
+
+    const size_t tx_samples = ADSDR_TX_BUF_SIZE / ADSDR_BYTES_PER_SAMPLE;
+    std::vector<sample> source(tx_samples);
+    for(sample &s : source)
+    {
+        s.i = (int16_t) value(generator);
+        s.q = (int16_t) value(generator);
+    }
+    std::vector<unsigned char> encoded(ADSDR_TX_BUF_SIZE);
+
+    double encode = time_kernel(tx_samples, [&]() {
+        encode_tx_transfer(source.data(), tx_samples, encoded.data());
+    });
+
+    json << "  \"decode_rx_transfer\": {\"samples_per_transfer\": " << ADSDR_RX_BLOCK_SIZE
+         << ", \"ns_per_sample\": " << decode << ", \"ns_per_sample_with_power\": " << decode_power << "},\n";
+    json << "  \"decimate_rx_transfer\": {\"factor\": " << by8.factor << ", \"taps\": " << design_decimation_filter(by8.factor).size()
+         << ", \"ns_per_input_sample\": " << decimate << "},\n";
+    json << "  \"correct_rx_transfer\": {\"ns_per_sample\": " << correct << "},\n";
+    json << "  \"resample_rx_transfer\": {\"ratio\": " << resampler.ratio() << ", \"ns_per_input_sample\": " << resample << "},\n";
+    json << "  \"mix_rx_transfer\": {\"ns_per_sample\": " << mix << ", \"ns_per_input_sample_decimated\": " << mix_decimate << "},\n";
+    json << "  \"fill_tx_transfer\": {\"samples_per_transfer\": " << tx_samples
+         << ", \"ns_per_sample\": " << encode << "},\n";
+}
+
+// Event thread to sample API: blocks pushed by one thread, read sample-wise by another
+static void bench_queue(std::ostream &json, const bench_options &options)
+{
+    rx_block_pool pool(ADSDR_RX_BLOCK_POOL_SIZE, ADSDR_RX_BLOCK_SIZE);
+    rx_block_queue queue(ADSDR_RX_QUEUE_BLOCKS);
+    std::atomic<bool> running{true};
+
+    std::thread producer([&]() {
+        uint64_t sequence = 0;
+        while(running.load())
+        {
+            rx_block_ref block = pool.acquire();
+            if(!block)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            rx_block_pool::set_size(block, ADSDR_RX_BLOCK_SIZE);
+            rx_block_pool::set_sequence(block, sequence++);
+            while(!queue.push(block) && running.load())
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    std::vector<sample> destination(ADSDR_RX_BLOCK_SIZE);
+    uint64_t samples = 0;
+    bench_clock::time_point start = bench_clock::now();
+    while(elapsed_seconds(start) < options.seconds / 2)
+    {
+        if(queue.wait(ADSDR_RX_BLOCK_SIZE, 100))
+        {
+            samples += queue.read(destination.data(), destination.size());
+        }
+    }
+    double seconds = elapsed_seconds(start);
+
+    running.store(false);
+    producer.join();
+
+    json << "  \"rx_block_queue\": {\"msamples_per_second\": " << samples / seconds / 1e6 << "},\n";
+}
+
+// Pool to subscribers without copying, every subscriber sees every block
+static void bench_fanout(std::ostream &json, const bench_options &options)
+{
+    rx_block_pool pool(ADSDR_RX_BLOCK_POOL_SIZE, ADSDR_RX_BLOCK_SIZE);
+    std::atomic<uint64_t> received{0};
+
+    std::vector<std::unique_ptr<rx_subscriber>> subscribers;
+    for(unsigned int i = 0; i < options.subscribers; i++)
+    {
+        subscribers.emplace_back(new rx_subscriber([&](const rx_block_ref &block) {
+            received += block->size();
+        }, BACKPRESSURE_BLOCK, ADSDR_RX_SUBSCRIBER_QUEUE_SIZE));
+    }
+
+    uint64_t blocks = 0;
+    bench_clock::time_point start = bench_clock::now();
+    while(elapsed_seconds(start) < options.seconds / 2)
+    {
+        rx_block_ref block = pool.acquire();
+        if(!block)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        rx_block_pool::set_size(block, ADSDR_RX_BLOCK_SIZE);
+        rx_block_pool::set_sequence(block, blocks++);
+        for(auto &subscriber : subscribers)
+        {
+            subscriber->push(block);
+        }
+    }
+    for(auto &subscriber : subscribers)
+    {
+        subscriber->close(true);
+    }
+    double seconds = elapsed_seconds(start);
+
+    json << "  \"subscriber_fanout\": {\"subscribers\": " << options.subscribers
+         << ", \"msamples_per_second\": " << blocks * ADSDR_RX_BLOCK_SIZE / seconds / 1e6
+         << ", \"delivered_msamples_per_second\": " << received.load() / seconds / 1e6 << "},\n";
+}
+
+// Channelizer fed straight from the pool, once on one worker and once on every core
+static double channelizer_rate(const bench_options &options, unsigned int threads)
+{
+    std::mt19937 generator(1);
+    std::uniform_int_distribution<int> value(-2048, 2047);
+    rx_block_pool pool(ADSDR_RX_BLOCK_POOL_SIZE, ADSDR_RX_BLOCK_SIZE);
+
+    channelizer_config config;
+    config.channels = options.channels;
+    config.threads = threads;
+    std::atomic<uint64_t> delivered{0};
+    rx_channelizer channelizer(config, [&](const channelizer_block &block) {
+        delivered += block.samples * config.channels;
+    });
+
+    uint64_t blocks = 0;
+    bench_clock::time_point start = bench_clock::now();
+    while(elapsed_seconds(start) < options.seconds / 2)
+    {
+        rx_block_ref block = pool.acquire();
+        if(!block)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        sample *data = rx_block_pool::writable(block);
+        if(blocks < ADSDR_RX_BLOCK_POOL_SIZE)
+        {
+            for(size_t i = 0; i < ADSDR_RX_BLOCK_SIZE; i++)
+            {
+                data[i].i = (int16_t) value(generator);
+                data[i].q = (int16_t) value(generator);
+            }
+        }
+        rx_block_pool::set_size(block, ADSDR_RX_BLOCK_SIZE);
+        rx_block_pool::set_sequence(block, blocks++);
+        channelizer.write(block);
+    }
+    channelizer.close();
+    return blocks * ADSDR_RX_BLOCK_SIZE / elapsed_seconds(start);
+}
+
+static void bench_channelizer(std::ostream &json, const bench_options &options)
+{
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    double single = channelizer_rate(options, 1);
+    double all = channelizer_rate(options, cores);
+
+    // Channels of a stream at the virtual device sample rate that one core keeps up with
+    json << "  \"channelizer\": {\"channels\": " << options.channels
+         << ", \"msamples_per_second\": " << single / 1e6
+         << ", \"channels_per_core\": " << options.channels * single / options.sample_rate
+         << ", \"threads\": " << cores
+         << ", \"msamples_per_second_all_threads\": " << all / 1e6 << "},\n";
+}
+
+// PSD on one core, every segment with 50% overlap and every 8th segment only
+static void bench_psd(std::ostream &json)
+{
+    std::mt19937 generator(1);
+    std::uniform_int_distribution<int> value(-2048, 2047);
+    rx_block_pool pool(1, ADSDR_RX_BLOCK_SIZE);
+    rx_block_ref block = pool.acquire();
+    sample *data = rx_block_pool::writable(block);
+    for(size_t i = 0; i < ADSDR_RX_BLOCK_SIZE; i++)
+    {
+        data[i].i = (int16_t) value(generator);
+        data[i].q = (int16_t) value(generator);
+    }
+    rx_block_pool::set_size(block, ADSDR_RX_BLOCK_SIZE);
+
+    double ns[2];
+    for(int run = 0; run < 2; run++)
+    {
+        psd_config config;
+        config.max_hold = true;
+        config.segment_decimation = run == 0 ? 1 : 8;
+        rx_psd psd(config, 10e6, [](const psd_frame &) {});
+        uint64_t sequence = 0;
+        ns[run] = time_kernel(ADSDR_RX_BLOCK_SIZE, [&]() {
+            rx_block_pool::set_sequence(block, sequence++);
+            psd.write(*block);
+        });
+    }
+
+    json << "  \"psd\": {\"fft_size\": " << psd_config().fft_size
+         << ", \"msamples_per_second\": " << 1e3 / ns[0]
+         << ", \"msamples_per_second_decimated_8\": " << 1e3 / ns[1] << "},\n";
+}
+
+// Whole path from transfer completion to a subscriber callback on a virtual device
+static void bench_stream(std::ostream &json, const bench_options &options, bool throttle)
+{
+    virtual_device_config config;
+    config.source = VIRTUAL_SOURCE_NOISE;
+    config.sample_rate = options.sample_rate;
+    config.throttle = throttle;
+
+    ADSDR::ADSDR dev(config);
+    std::atomic<uint64_t> received{0};
+    int id = dev.subscribe_rx([&](const rx_block_ref &block) {
+        received += block->size();
+    }, BACKPRESSURE_DROP, ADSDR_RX_SUBSCRIBER_QUEUE_SIZE);
+
+    double cpu_start = cpu_seconds();
+    bench_clock::time_point start = bench_clock::now();
+    dev.start_rx();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    dev.stop_rx();
+    double seconds = elapsed_seconds(start);
+    double cpu = cpu_seconds() - cpu_start;
+
+    rx_subscription_stats stats = dev.subscription_stats(id);
+    dev.unsubscribe_rx(id);
+
+    json << "  \"" << (throttle ? "virtual_stream" : "virtual_stream_unthrottled") << "\": {";
+    if(throttle)
+    {
+        json << "\"sample_rate\": " << options.sample_rate << ", ";
+    }
+    json << "\"seconds\": " << seconds
+         << ", \"msamples_per_second\": " << received.load() / seconds / 1e6
+         << ", \"cpu_percent\": " << 100.0 * cpu / seconds
+         << ", \"overflows\": " << dev.rx_overflow_count()
+         << ", \"subscriber_drops\": " << stats.dropped << "},\n";
+}
+
+static double hit_rate(uint64_t hits, uint64_t misses)
+{
+    return hits + misses == 0 ? 0.0 : (double) hits / (double) (hits + misses);
+}
+
+static void bench_commands(std::ostream &json, const bench_options &options)
+{
+    if(options.spi_trace.empty())
+    {
+        json << "  \"commands\": {\"skipped\": \"no SPI trace given\"}\n";
+        return;
+    }
+
+    ADSDR::ADSDR dev(virtual_device_config{});
+    dev.replay_spi_trace(options.spi_trace);
+    if(!dev.init_sdr())
+    {
+        json << "  \"commands\": {\"skipped\": \"init_sdr failed on the replayed trace\"}\n";
+        return;
+    }
+
+    json << "  \"command_trace\": \"" << options.spi_trace << "\",\n";
+    json << "  \"commands\": [";
+    dev.reset_clock_cache_statistics();
+    uint64_t previous = 0;
+    for(int id = 0; id < COMMAND_SIZE; id++)
+    {
+        // Set commands write back what the matching get command returned
+        command cmd;
+        cmd.cmd = (command_id) id;
+        cmd.param = id == SET_DATAPATH_EN ? 1 : (id == SET_LOOPBACK_EN ? 0 : previous);
+
+        std::vector<double> latencies;
+        spi_stats spi = {};
+        response res = {};
+        for(unsigned int i = 0; i < options.iterations; i++)
+        {
+            dev.reset_spi_statistics();
+            bench_clock::time_point start = bench_clock::now();
+            res = dev.send_cmd(cmd);
+            latencies.push_back(elapsed_seconds(start) * 1e6);
+            spi = dev.spi_statistics();
+        }
+        previous = res.param;
+
+        std::sort(latencies.begin(), latencies.end());
+        double mean = 0;
+        for(double latency : latencies)
+        {
+            mean += latency;
+        }
+        mean /= latencies.size();
+
+        json << (id == 0 ? "\n" : ",\n");
+        json << "    {\"command\": \"" << command_names[id] << "\", \"id\": " << id
+             << ", \"error\": " << res.error
+             << ", \"mean_us\": " << mean
+             << ", \"median_us\": " << latencies[latencies.size() / 2]
+             << ", \"p99_us\": " << latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)]
+             << ", \"spi_transactions\": " << spi.transactions
+             << ", \"spi_bytes\": " << spi.bytes << "}";
+    }
+    json << "\n  ],\n";
+
+    // Every set command repeats its value, so after the first iteration the solutions are memoized
+    clock_cache_stats clocks = dev.clock_cache_statistics();
+    json << "  \"clock_cache\": {"
+         << "\"clock_chain_hit_rate\": " << hit_rate(clocks.clock_chain_hits, clocks.clock_chain_misses)
+         << ", \"bbpll_hit_rate\": " << hit_rate(clocks.bbpll_hits, clocks.bbpll_misses)
+         << ", \"rfpll_hit_rate\": " << hit_rate(clocks.rfpll_hits, clocks.rfpll_misses)
+         << ", \"vco_lut_hit_rate\": " << hit_rate(clocks.vco_lut_hits, clocks.vco_lut_misses)
+         << ", \"lookups\": " << clocks.clock_chain_hits + clocks.clock_chain_misses + clocks.bbpll_hits +
+                                 clocks.bbpll_misses + clocks.rfpll_hits + clocks.rfpll_misses +
+                                 clocks.vco_lut_hits + clocks.vco_lut_misses << "}\n";
+}
+
+static void usage(const char *name)
+{
+    std::cerr << "Usage: " << name << " [options]\n"
+              << "Benchmarks the sample kernels, queues and virtual device streaming, and prints JSON\n\n"
+              << "  -r <hz>         Virtual device sample rate (default 10e6)\n"
+              << "  -t <seconds>    Duration of the throughput runs (default 2)\n"
+              << "  -k <count>      Subscribers in the fan-out run (default 4)\n"
+              << "  -c <count>      Channels in the channelizer run, a power of two (default 64)\n"
+              << "  -s <trace>      SPI trace to replay for the command latency run (default " << ADSDR_BENCH_SPI_TRACE << ")\n"
+              << "  -n <count>      Iterations per command (default 100)\n"
+              << "  -o <file>       Write the JSON to a file instead of stdout\n";
+}
+
+int main(int argc, char *argv[])
+{
+    bench_options options;
+
+    int opt;
+    while((opt = getopt(argc, argv, "r:t:k:c:s:n:o:h")) != -1)
+    {
+        switch(opt)
+        {
+        case 'r': options.sample_rate = atof(optarg); break;
+        case 't': options.seconds = atof(optarg); break;
+        case 'k': options.subscribers = (unsigned int) strtoul(optarg, nullptr, 0); break;
+        case 'c': options.channels = (unsigned int) strtoul(optarg, nullptr, 0); break;
+        case 's': options.spi_trace = optarg; break;
+        case 'n': options.iterations = std::max(1UL, strtoul(optarg, nullptr, 0)); break;
+        case 'o': options.output = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // The library reports commands on stdout, keep that out of the JSON
+    fflush(stdout);
+    int json_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    std::ostringstream json;
+    try
+    {
+        json << "{\n";
+        bench_kernels(json);
+        bench_queue(json, options);
+        bench_fanout(json, options);
+        bench_channelizer(json, options);
+        bench_psd(json);
+        bench_stream(json, options, true);
+        bench_stream(json, options, false);
+        bench_commands(json, options);
+        json << "}\n";
+    }
+    catch(const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout.flush();
+    fflush(stdout);
+
+    std::string text = json.str();
+    FILE *out = options.output.empty() ? fdopen(json_fd, "w") : fopen(options.output.c_str(), "w");
+    if(out == nullptr)
+    {
+        std::cerr << "Error: could not open " << options.output << std::endl;
+        return 1;
+    }
+    fwrite(text.data(), 1, text.size(), out);
+    fclose(out);
+
+    return 0;
+}
@@ -22,6 +22,7 @@
 
 #include <string>
 #include <array>
+#include <complex>
 #include <vector>
 #include <stdexcept>
 #include <iostream>
@@ -41,18 +42,30 @@
 //#define ADSDR_TX_OUT 0x02
 #define ADSDR_RX_IN 0x81
 #define ADSDR_DEBUG_IN 0x82
+#define ADSDR_FPGA_CONFIG_OUT 0x01
 
 #define ADSDR_USB_CTRL_SIZE 64
 #define ADSDR_UART_BUF_SIZE 16
 
 #define ADSDR_BYTES_PER_SAMPLE 4
 
+// RX sample rates the AD9361 clock chain reaches: a 25 MHz ADC clock decimated by 48, up to 61.44 MHz
+#define ADSDR_RX_MIN_SAMP_FREQ 520834
+#define ADSDR_RX_MAX_SAMP_FREQ 61440000
+
 #define ADSDR_RX_TX_BUF_SIZE 1024 * 64
 #define ADSDR_TX_BUF_SIZE 1024 * 32
 #define ADSDR_RX_TX_TRANSFER_QUEUE_SIZE 32
 
 #define ADSDR_RX_TX_QUEUE_SIZE ADSDR_RX_TX_BUF_SIZE * ADSDR_RX_TX_TRANSFER_QUEUE_SIZE
 
+// RX transfers carry two I/Q channels, only the first one is decoded
+#define ADSDR_RX_BLOCK_SIZE (ADSDR_RX_TX_BUF_SIZE / (2 * ADSDR_BYTES_PER_SAMPLE))
+#define ADSDR_RX_BLOCK_POOL_SIZE (8 * ADSDR_RX_TX_TRANSFER_QUEUE_SIZE)
+#define ADSDR_RX_QUEUE_BLOCKS (ADSDR_RX_BLOCK_POOL_SIZE - ADSDR_RX_TX_TRANSFER_QUEUE_SIZE)
+#define ADSDR_RX_SUBSCRIBER_QUEUE_SIZE 16
+#define ADSDR_RECORDER_QUEUE_SIZE 64
+
 // ADSRP vendor commands
 #define ADSDR_GET_VERSION_REQ 0 //---
 #define ADSDR_FPGA_CONFIG_LOAD 0xB2 //---
@@ -180,7 +193,416 @@ namespace ADSDR
     };
 
 
+    class rx_block_pool;
+
+    //! A block of decoded RX samples owned by the RX block pool.
+    class rx_block
+    {
+    public:
+        const sample *data() const { return _data; }
+        size_t size() const { return _size; }
+        uint64_t sequence() const { return _sequence; }
+        // First block after the stream was recovered, samples before it were lost
+        bool gap() const { return _gap; }
+        // Samples lost before a gap() block, estimated from the rate and how long the stream was down
+        uint64_t gap_samples() const { return _gap_samples; }
+
+        // Power relative to full scale, only measured while the squelch is enabled
+        float energy() const { return _energy; }
+        float mean_power() const { return _size > 0 ? _energy / _size : 0.0f; }
+        float peak_power() const { return _peak; }
+
+        const sample *begin() const { return _data; }
+        const sample *end() const { return _data + _size; }
+        const sample &operator[](size_t i) const { return _data[i]; }
+
+    private:
+        friend class rx_block_pool;
+        friend class rx_block_ref;
+        friend class ADSDR_impl;
+
+        sample *_data = nullptr;
+        size_t _size = 0;
+        uint64_t _sequence = 0;
+        float _energy = 0.0f;
+        float _peak = 0.0f;
+        bool _gap = false;
+        uint64_t _gap_samples = 0;
+        std::atomic<unsigned int> _refs{0};
+        rx_block_pool *_pool = nullptr;
+    };
+
+    //! Shared, read-only reference to an rx_block.
+    /*!
+     * The block goes back to the pool when the last reference to it is released.
+     * References must not outlive the ADSDR they were received from.
+     */
+    class rx_block_ref
+    {
+    public:
+        rx_block_ref() = default;
+        rx_block_ref(const rx_block_ref &other);
+        rx_block_ref(rx_block_ref &&other);
+        rx_block_ref &operator=(rx_block_ref other);
+        ~rx_block_ref();
+
+        const rx_block *get() const { return _block; }
+        const rx_block *operator->() const { return _block; }
+        const rx_block &operator*() const { return *_block; }
+        explicit operator bool() const { return _block != nullptr; }
+
+        void reset();
+
+    private:
+        friend class rx_block_pool;
+        friend class ADSDR_impl;
+
+        explicit rx_block_ref(rx_block *block);
+
+        rx_block *_block = nullptr;
+    };
+
+    enum backpressure_policy
+    {
+        BACKPRESSURE_DROP = 0,  // Drop blocks while the subscriber queue is full
+        BACKPRESSURE_BLOCK      // Stall the RX stream until the subscriber catches up
+    };
+
+    struct rx_subscription_stats
+    {
+        uint64_t delivered;
+        uint64_t dropped;
+        uint64_t stalled;   // Times the RX stream waited for a free slot (BACKPRESSURE_BLOCK)
+    };
+
+    enum overflow_policy
+    {
+        OVERFLOW_DROP_NEWEST = 0,   // Discard the block that does not fit
+        OVERFLOW_OVERWRITE_OLDEST,  // Discard the oldest queued block, keeping the latest data
+        OVERFLOW_STOP_STREAM        // Stop receiving until start_rx is called again
+    };
+
+    struct rx_overflow
+    {
+        uint64_t sequence;      // Sequence number of the lost block
+        unsigned long samples;  // Number of samples lost
+        uint64_t count;         // Overflows since start_rx, including this one
+    };
+
+    enum recovery_reason
+    {
+        RECOVERY_STALL = 0,     // The RX endpoint stalled or transfers kept failing
+        RECOVERY_DEVICE_LOST    // The board left the bus
+    };
+
+    struct recovery_config
+    {
+        bool enabled = true;
+        unsigned int reopen_timeout_ms = 10000;   // How long to wait for a lost board to come back with its firmware running
+        unsigned int max_transfer_errors = 8;     // Failed transfers in a row before the endpoint is treated as stalled
+    };
+
+    struct rx_gap
+    {
+        uint64_t sequence;      // Sequence number of the first block after the gap
+        uint64_t lost_samples;  // Estimated from the RX sample rate and how long the stream was down
+        recovery_reason reason;
+        double seconds;         // From the failed transfer until streaming again
+    };
+
+    struct recovery_stats
+    {
+        bool recovering;        // A recovery is in progress
+        uint64_t recoveries;    // Successful recoveries since start_rx
+        uint64_t failures;      // Recoveries that gave up, the stream is stopped after one
+        double last_seconds;
+        double max_seconds;
+        double total_seconds;
+    };
+
+    enum squelch_detector
+    {
+        SQUELCH_MEAN_POWER = 0, // Mean power of the block
+        SQUELCH_PEAK_POWER      // Highest sample power in the block
+    };
+
+    struct squelch_config
+    {
+        squelch_detector detector = SQUELCH_MEAN_POWER;
+        float open_dbfs = -60.0f;       // Open once the detector reaches this level
+        float close_dbfs = -65.0f;      // Close once it falls below this level, must not be above open_dbfs
+        unsigned int hang_blocks = 0;   // Blocks to stay open after falling below close_dbfs
+    };
+
+    struct squelch_stats
+    {
+        bool open;
+        uint64_t passed;
+        uint64_t gated;
+    };
+
+    struct iq_correction_config
+    {
+        bool dc = true;             // Remove the residual DC offset
+        bool iq = true;             // Correct the residual gain and phase imbalance
+        float adaptation = 0.05f;   // Weight of each block in the running estimates, in (0, 1]
+    };
+
+    // Residual errors left by the AD9361 trackers, as estimated by the host
+    struct iq_correction_estimate
+    {
+        float dc_i = 0.0f;          // DC offset in 12 bit sample units
+        float dc_q = 0.0f;
+        float gain = 1.0f;          // Q amplitude relative to I
+        float phase = 0.0f;         // Deviation of Q from quadrature, in radians
+        uint64_t blocks = 0;        // Blocks the estimates were updated from
+    };
+
+    struct decimation_config
+    {
+        unsigned int factor = 1;    // Keep every factor-th filtered sample
+        std::vector<float> taps;    // Lowpass at the input rate, |tap| < 1, designed for factor if empty
+    };
+
+    struct channelizer_config
+    {
+        unsigned int channels = 16;             // Channels M across the RX sample rate, a power of two
+        bool oversampled = false;               // Output at 2 * rate / M so signals on channel edges are not aliased
+        unsigned int taps_per_channel = 12;     // Prototype lowpass length is channels * taps_per_channel
+        std::vector<unsigned int> outputs;      // Channels to deliver, all of them if empty
+        unsigned int threads = 0;               // Worker threads, one per core if 0
+        backpressure_policy policy = BACKPRESSURE_DROP;
+        unsigned int queue_depth = ADSDR_RX_SUBSCRIBER_QUEUE_SIZE;
+    };
+
+    // The channel samples computed from one RX block
+    struct channelizer_block
+    {
+        uint64_t sequence;                      // Sequence number of the RX block
+        bool gap;                               // Samples were lost before this block, the filters started over
+        size_t samples;                         // Samples per channel
+        std::vector<unsigned int> channels;     // Channel c is centered at c * rate / M, channels above M / 2 are negative
+        std::vector<std::complex<float>> data;  // One row of samples per entry in channels, in 12 bit sample units
+
+        const std::complex<float> *channel(size_t index) const { return data.data() + index * samples; }
+    };
+
+    struct channelizer_stats
+    {
+        uint64_t blocks;    // RX blocks channelized
+        uint64_t lost;      // RX blocks missed, each shows up as a gap
+        uint64_t stalled;   // Times the RX stream waited for the channelizer (BACKPRESSURE_BLOCK)
+        uint64_t dropped;   // Blocks dropped because the queue was full (BACKPRESSURE_DROP)
+    };
+
+    enum psd_window
+    {
+        PSD_WINDOW_HANN = 0,
+        PSD_WINDOW_BLACKMAN_HARRIS,     // Lower sidelobes for a wide dynamic range, wider bins
+        PSD_WINDOW_RECTANGULAR
+    };
+
+    enum psd_averaging
+    {
+        PSD_AVERAGE_LINEAR = 0,         // Mean of the segments since the previous frame
+        PSD_AVERAGE_EXPONENTIAL         // Running average that decays over time_constant segments
+    };
+
+    struct psd_config
+    {
+        unsigned int fft_size = 1024;               // Bins per frame, a power of two
+        float overlap = 0.5f;                       // Fraction of a segment shared with the next one, below 1
+        psd_window window = PSD_WINDOW_HANN;
+        psd_averaging averaging = PSD_AVERAGE_LINEAR;
+        unsigned int time_constant = 16;            // Segments, for exponential averaging
+        bool max_hold = false;                      // Also keep the highest power per bin until reset_psd_max_hold
+        double frame_rate = 30.0;                   // Frames per second
+        unsigned int segment_decimation = 1;        // Transform only every n-th segment, samples in between are skipped
+        backpressure_policy policy = BACKPRESSURE_DROP;
+        unsigned int queue_depth = ADSDR_RX_SUBSCRIBER_QUEUE_SIZE;
+    };
+
+    struct psd_frame
+    {
+        uint64_t sequence;              // Frame number
+        uint64_t rx_sequence;           // Last RX block that went into the frame
+        unsigned int segments;          // Segments averaged since the previous frame
+        std::vector<float> power;       // dB relative to a full scale tone, fft_size bins from -rate / 2 to rate / 2
+        std::vector<float> max_hold;    // Same units, only filled with max_hold
+    };
+
+    struct psd_stats
+    {
+        uint64_t frames;    // Frames delivered
+        uint64_t segments;  // Segments transformed
+        uint64_t lost;      // RX blocks missed, no segment spans them
+        uint64_t stalled;   // Times the RX stream waited for the PSD (BACKPRESSURE_BLOCK)
+        uint64_t dropped;   // Blocks dropped because the queue was full (BACKPRESSURE_DROP)
+    };
+
+    struct recording_config
+    {
+        std::string path;           // Base name, .sigmf-data and .sigmf-meta are appended
+        std::string description;    // Stored as core:description
+        bool direct_io = true;      // Bypass the page cache, falls back to buffered writes if the file system refuses
+        backpressure_policy policy = BACKPRESSURE_BLOCK;
+        unsigned int queue_depth = ADSDR_RECORDER_QUEUE_SIZE;  // Blocks waiting to be written
+    };
+
+    struct recording_stats
+    {
+        uint64_t blocks;    // Blocks written
+        uint64_t samples;   // Samples written
+        uint64_t lost;      // Samples missing from the recording, each gap is annotated in the metadata
+        uint64_t stalled;   // Times the RX stream waited for the disk (BACKPRESSURE_BLOCK)
+        uint64_t dropped;   // Blocks dropped because the write queue was full (BACKPRESSURE_DROP)
+        bool direct_io;     // Whether O_DIRECT is in use
+    };
+
+    struct capture_config
+    {
+        unsigned long pre_trigger_samples = 0;   // Samples kept from before the trigger
+        unsigned long post_trigger_samples = 0;  // Samples recorded after the trigger
+        bool hugepages = false;                  // Back the ring with 2 MiB pages if any are reserved
+        // Optionally, a function called from the RX thread for every block that fires the trigger by returning true
+        std::function<bool(const rx_block &)> trigger;
+    };
+
+    struct capture_window
+    {
+        const sample *data;           // Contiguous, valid until the capture is rearmed or disabled
+        unsigned long pre_trigger;    // Samples before the trigger point
+        unsigned long post_trigger;   // Samples from the trigger point on
+        uint64_t trigger_sample;      // Position of the trigger since the capture was enabled
+
+        unsigned long size() const { return pre_trigger + post_trigger; }
+    };
+
+    enum virtual_source
+    {
+        VIRTUAL_SOURCE_TONE = 0,    // Complex tone
+        VIRTUAL_SOURCE_NOISE,       // Complex Gaussian noise
+        VIRTUAL_SOURCE_RAW_FILE,    // Raw USB transfers as sent by the device, 8 bytes per sample
+        VIRTUAL_SOURCE_CI16_FILE    // 12 bit samples stored as ci16_le, such as a SigMF recording
+    };
+
+    struct virtual_device_config
+    {
+        virtual_source source = VIRTUAL_SOURCE_TONE;
+        std::string filename;           // File to replay in a loop, for the file sources
+        double sample_rate = 1e6;       // Rate samples are produced at, in samples per second
+        bool throttle = true;           // Pace at sample_rate, otherwise deliver as fast as transfers are submitted
+        double tone_frequency = 100e3;  // Tone offset in Hz, rounded so the synthesized signal loops seamlessly
+        float amplitude_dbfs = -6.0f;   // Tone amplitude or noise RMS level
+    };
+
+    struct spi_stats
+    {
+        uint64_t transactions;  // AD9361 register transactions
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t bytes;         // Register bytes read or written
+        uint64_t busy_ns;       // Time spent waiting for transactions to complete
+    };
+
+    // Hits and misses of the memo of computed clock solutions, per kind of solution
+    struct clock_cache_stats
+    {
+        uint64_t clock_chain_hits;      // Divider chain for a sample rate
+        uint64_t clock_chain_misses;
+        uint64_t bbpll_hits;            // BBPLL rate for a requested rate and reference clock
+        uint64_t bbpll_misses;
+        uint64_t rfpll_hits;            // RFPLL dividers for an LO frequency and reference clock
+        uint64_t rfpll_misses;
+        uint64_t vco_lut_hits;          // Synthesizer VCO table entry
+        uint64_t vco_lut_misses;
+    };
+
+    struct calibration_cache_config
+    {
+        std::string directory;                  // Where snapshots are kept, created if missing
+        double temperature_tolerance = 10.0;    // Degrees C between a snapshot and the die for a warm start
+    };
+
+    struct calibration_status
+    {
+        bool warm_start;                // The last init_sdr restored a snapshot instead of calibrating
+        std::string snapshot;           // Snapshot restored or written, empty if none
+        std::string reason;             // Why the last init_sdr calibrated, empty on a warm start
+        double temperature;             // Die temperature before init_sdr, degrees C
+        double snapshot_temperature;    // Temperature the snapshot was taken at, degrees C
+        double init_seconds;            // Time init_sdr took
+    };
+
+    struct telemetry_config
+    {
+        unsigned int period_ms = 1000;          // Time between samples
+        unsigned int retune_holdoff_ms = 20;    // No samples for this long after an LO or sample rate change
+    };
+
+    struct telemetry_snapshot
+    {
+        uint64_t samples;               // Samples taken since start_telemetry, the rest is invalid while 0
+        double age_seconds;             // Since the sample was taken
+        double temperature;             // Die temperature, degrees C
+        double rssi_symbol_db;          // RX RSSI over the symbol duration, larger is weaker, 0.25 dB steps
+        double rssi_preamble_db;        // RX RSSI over the preamble duration
+        uint16_t auxadc;                // 12 bit AuxADC word
+        uint64_t skipped;               // Periods skipped during or right after a command, retunes included
+        uint64_t errors;                // Periods whose SPI reads failed
+    };
+
+    struct rssi_scan_config
+    {
+        std::vector<uint64_t> frequencies;  // RX LO frequencies to measure, in Hz
+        unsigned int passes = 1;            // Sweeps over the list
+        bool fastlock = true;               // Store fast lock profiles in the first sweep and recall them later, up to 8 frequencies
+    };
+
+    struct rssi_measurement
+    {
+        uint64_t frequency;         // RX LO frequency, in Hz
+        unsigned int pass;
+        double rssi_symbol_db;      // RX RSSI over the symbol duration, larger is weaker, 0.25 dB steps
+        double rssi_preamble_db;    // RX RSSI over the preamble duration
+        bool locked;                // The RX synthesizer locked before the measurement started
+    };
+
     class ADSDR_impl;
+    class ADSDR;
+
+    struct board
+    {
+        std::string serial;
+        std::shared_ptr<ADSDR> device;  // nullptr if the board could not be opened
+        bool fpga_loaded;
+        bool initialized;               // init_sdr succeeded
+        std::string error;              // Why opening, loading the FPGA or init_sdr failed
+        double open_seconds;            // Connecting to the board
+        double fpga_seconds;            // Checking and loading the FPGA
+        double init_seconds;            // init_sdr
+    };
+
+    struct device_info
+    {
+        std::string serial;             // Empty for a bootloader
+        uint16_t product_id;
+        bool bootloader;                // FX3 waiting for its firmware
+        uint8_t bus;
+        uint8_t address;
+    };
+
+    enum hotplug_event_type
+    {
+        DEVICE_ARRIVED,
+        DEVICE_LEFT
+    };
+
+    struct hotplug_event
+    {
+        hotplug_event_type type;
+        device_info device;
+    };
 
     class ADSDR
     {
@@ -197,6 +619,16 @@ namespace ADSDR
 	 */
         ADSDR(std::string serial_number = "");
 
+	//! Create a virtual ADSDR that needs no hardware.
+	/*!
+	 * Received samples come from a file or a synthesized signal and go through the same transfer,
+	 * decode and delivery path as with a real device, so the streaming path can be exercised and
+	 * benchmarked at real rates. There is no AD9361 behind it: init_sdr fails and radio
+	 * commands are not available. fpga_loaded always returns true.
+	 * \param config: Signal source and rate.
+	 */
+        ADSDR(const virtual_device_config &config);
+
         ~ADSDR();
 
 	//!
@@ -212,6 +644,47 @@ namespace ADSDR
 	 */
 	static std::vector<std::string> list_connected();
 
+	//! List all connected ADSDRs and FX3 bootloaders.
+	/*!
+	 * Devices are enumerated once per process and then tracked with USB hotplug events, so this
+	 * answers from memory without opening any device.
+	 * \return One entry per device, ordered by bus and address.
+	 */
+	static std::vector<device_info> connected_devices();
+
+	//! Get notified when an ADSDR or FX3 bootloader is connected or disconnected.
+	/*!
+	 * The callback is run on the hotplug thread and should return quickly. An ADSDR is reported
+	 * once its serial number has been read.
+	 * \param callback: Called with each arrival and removal.
+	 * \returns An id to pass to unsubscribe_hotplug.
+	 */
+	static int subscribe_hotplug(std::function<void(const hotplug_event &)> callback);
+
+	//! Remove a callback added with subscribe_hotplug.
+	/*!
+	 * \param id: The id returned by subscribe_hotplug.
+	 */
+	static void unsubscribe_hotplug(int id);
+
+	//! Open all connected ADSDRs at the same time.
+	/*!
+	 * Every board is connected to, and its FPGA checked and loaded if needed, on its own thread
+	 * of a pool. A board that fails is reported with its error instead of stopping the others.
+	 * \param fpga_filename: Bitstream for boards whose FPGA is not configured yet, none if empty.
+	 * \param threads: Size of the pool, 0 for one thread per board.
+	 * \return One entry per connected board, with timings.
+	 */
+	static std::vector<board> open_all(const std::string &fpga_filename = "", unsigned int threads = 0);
+
+	//! Run init_sdr on all opened boards at the same time.
+	/*!
+	 * Boards that were not opened or whose FPGA is not loaded are skipped.
+	 * \param boards: Boards from open_all, initialized and init_seconds are filled in.
+	 * \param threads: Size of the pool, 0 for one thread per board.
+	 */
+	static void init_all(std::vector<board> &boards, unsigned int threads = 0);
+
 	//! Check if the FPGA has been loaded.
 	/*!
          * \return true if the FPGA is configured, false if configuration is still needed.
@@ -220,6 +693,9 @@ namespace ADSDR
 
 	//! Load the FPGA with the specified bitstream.
 	/*!
+         * The bitstream is mapped and streamed to the device in large bulk transfers. Loading the
+         * same bitstream as the last one loaded through this ADSDR, while the FPGA still reports
+         * being configured, does nothing and returns FPGA_CONFIG_SKIPPED.
          * \param filename: The filename of the bitstream to load onto the FPGA.
          * \returns An fpga_status value indicating wether the FPGA was successfully configured.
          */
@@ -237,6 +713,224 @@ namespace ADSDR
 	 */
         void stop_rx();
 
+	//! Select what happens when received samples cannot be buffered.
+	/*!
+	 * Overflows are handled one whole block at a time. They occur when the sample queue is full or
+	 * when every pooled block is still held by a consumer.
+	 * May be called while streaming, the new policy and callback apply from the next block.
+	 * \param policy: The overflow policy, OVERFLOW_DROP_NEWEST by default.
+	 * \param overflow_callback: Optionally, a function called from the RX thread for every overflow.
+	 */
+        void set_rx_overflow_policy(overflow_policy policy, std::function<void(const rx_overflow &)> overflow_callback = {});
+
+	//! Number of blocks lost to overflows since start_rx.
+        uint64_t rx_overflow_count() const;
+
+	//! Whether RX is streaming, false after stop_rx or once OVERFLOW_STOP_STREAM halted the stream.
+        bool is_rx_streaming() const;
+
+	//! Configure recovery of the RX stream after USB errors.
+	/*!
+	 * A stalled endpoint is cleared. A board that left the bus is waited for by its serial
+	 * number, reopened, given the bitstream last loaded with load_fpga if its FPGA lost it,
+	 * initialized again if init_sdr had been run, and given back the settings last sent with
+	 * send_cmd. Streaming then restarts and the first block after the gap has rx_block::gap() set.
+	 * Recovery is enabled by default. It covers USB resets and stalls while the board keeps power:
+	 * a board that was power cycled re-enumerates as the FX3 bootloader without a serial number,
+	 * so the recovery times out and the stream stops.
+	 * May be called while streaming, a recovery already running keeps its timeout.
+	 * \param config: Whether to recover and how long to wait.
+	 * \param gap_callback: Optionally, a function called once streaming has resumed.
+	 */
+        void set_rx_recovery(const recovery_config &config, std::function<void(const rx_gap &)> gap_callback = {});
+
+	//! Recoveries since start_rx and how long they took.
+        recovery_stats rx_recovery_stats() const;
+
+	//! Subscribe to received sample blocks.
+	/*!
+	 * All subscribers share the same decoded block without copying it. Each subscriber
+	 * has its own queue and its callback runs on its own thread.
+	 * \param callback: Function called with every received block.
+	 * \param policy: What to do when this subscriber's queue is full. BACKPRESSURE_BLOCK stalls
+	 *                the whole RX stream, so it should only be used for consumers that must not lose data.
+	 * \param queue_depth: Maximum number of blocks queued for this subscriber.
+	 * \returns An id to pass to unsubscribe_rx.
+	 */
+        int subscribe_rx(std::function<void(const rx_block_ref &)> callback,
+                         backpressure_policy policy = BACKPRESSURE_DROP,
+                         unsigned int queue_depth = ADSDR_RX_SUBSCRIBER_QUEUE_SIZE);
+
+	//! Remove a subscriber added with subscribe_rx.
+	/*!
+	 * Blocks until the subscriber's callback has returned. Blocks still queued for it are released.
+	 * \param id: The id returned by subscribe_rx.
+	 */
+        void unsubscribe_rx(int id);
+
+	//! Get delivery statistics of a subscriber.
+	/*!
+	 * \param id: The id returned by subscribe_rx.
+	 */
+        rx_subscription_stats subscription_stats(int id) const;
+
+	//! Enable the squelch.
+	/*!
+	 * Measures the power of every block while decoding it and only delivers blocks while the squelch
+	 * is open. Gated blocks go straight back to the pool without reaching the callback, subscribers
+	 * or sample queue. The pre-trigger capture still sees every block.
+	 * \param config: Detector, thresholds with hysteresis and hang time.
+	 */
+        void enable_squelch(const squelch_config &config);
+
+	//! Disable the squelch, every block is delivered again.
+        void disable_squelch();
+
+	//! Get the state and counters of the squelch.
+        squelch_stats rx_squelch_stats() const;
+
+	//! Enable the DC offset and IQ imbalance correction on the host.
+	/*!
+	 * The residual errors are estimated from the statistics of every block and removed while the
+	 * samples are decoded, before the frequency shift and decimation. A block is corrected with the
+	 * estimates from the blocks before it. Blocks without enough signal do not change the IQ estimates.
+	 * \param config: Which errors to correct and how fast the estimates follow changes.
+	 * \param seed: Estimates to start from, e.g. rx_iq_correction_estimate() of a previous session.
+	 */
+        void enable_iq_correction(const iq_correction_config &config, const iq_correction_estimate &seed = iq_correction_estimate());
+
+	//! Disable the correction, samples are delivered as received again.
+        void disable_iq_correction();
+
+	//! Current estimates of the correction, all zero and unity gain while it is disabled.
+        iq_correction_estimate rx_iq_correction_estimate() const;
+
+	//! Enable decimation of the RX stream on the host.
+	/*!
+	 * Filters and decimates every transfer while decoding it, so blocks are delivered at
+	 * rx_samp_freq / factor and the full rate samples never leave the cache. The filter
+	 * history carries over between blocks and is cleared after an overflow or a gap.
+	 * Throws std::runtime_error while set_rx_output_rate is in effect.
+	 * \param config: Decimation factor and FIR taps. The taps are quantized to Q15.
+	 */
+        void enable_rx_decimation(const decimation_config &config);
+
+	//! Disable RX decimation, blocks are delivered at the full sample rate again.
+	/*!
+	 * Throws std::runtime_error while set_rx_output_rate is in effect.
+	 */
+        void disable_rx_decimation();
+
+	//! Deliver the RX stream at a rate the AD9361 clock chain cannot reach exactly.
+	/*!
+	 * Sets the AD9361 to the nearest rate at or above rate_hz and resamples the stream to rate_hz
+	 * with an arbitrary ratio polyphase filter, keeping its phase across blocks. Rates below
+	 * ADSDR_RX_MIN_SAMP_FREQ are first decimated on the host by an integer factor. Throws
+	 * std::runtime_error if decimation was enabled with enable_rx_decimation, disable it first.
+	 * Blocks are delayed by about 16 samples.
+	 * \param rate_hz: Output sample rate. 0 stops resampling and the host decimation it set up,
+	 * and leaves the AD9361 rate as it is.
+	 * \returns The AD9361 sample rate that was set.
+	 */
+        double set_rx_output_rate(double rate_hz);
+
+	//! Shift the RX stream in frequency on the host.
+	/*!
+	 * Mixes the samples with an oscillator while decoding them, before decimation, so a signal
+	 * tuned off the LO to avoid its DC spike comes out at 0 Hz. A new offset takes effect from the
+	 * next block with the oscillator phase kept continuous, without restarting the stream. The
+	 * current RX sample rate is used, call again after changing it.
+	 * \param offset_hz: Frequency of the wanted signal relative to the LO, within +-sample rate / 2.
+	 *                   0 removes the mixer.
+	 */
+        void set_rx_frequency_shift(double offset_hz);
+
+	//! Current frequency shift in Hz, 0 if the mixer is off.
+        double rx_frequency_shift() const;
+
+	//! Start splitting the RX stream into narrowband channels.
+	/*!
+	 * A polyphase filter bank and one FFT per output sample divide the RX band into M equally
+	 * spaced channels at rate / M (or 2 * rate / M oversampled), for about the cost of one filter.
+	 * Blocks are channelized on a pool of worker threads and delivered in order.
+	 * \param config: Number of channels, prototype filter length, selected outputs and threads.
+	 * \param callback: Called with the channels of every RX block, one call at a time. Must not throw.
+	 */
+        void start_channelizer(const channelizer_config &config, std::function<void(const channelizer_block &)> callback);
+
+	//! Stop the channelizer after the blocks already queued for it.
+	/*!
+	 * \returns The final counters of the channelizer.
+	 */
+        channelizer_stats stop_channelizer();
+
+	//! Start computing averaged power spectra of the RX stream.
+	/*!
+	 * Windowed, overlapping segments are transformed in batches on the thread of an RX
+	 * subscriber and averaged into frames delivered at frame_rate, so a spectrum display never
+	 * copies full rate samples. Must be called after init_sdr, the current RX sample rate sets
+	 * the number of segments per frame.
+	 * \param config: FFT size, window, overlap, averaging, max-hold and frame rate.
+	 * \param callback: Called with every frame. Must not throw.
+	 */
+        void start_psd(const psd_config &config, std::function<void(const psd_frame &)> callback);
+
+	//! Stop computing spectra after the blocks already queued.
+	/*!
+	 * \returns The final counters of the PSD.
+	 */
+        psd_stats stop_psd();
+
+	//! Clear the max-hold trace, it starts over from the next segment.
+        void reset_psd_max_hold();
+
+	//! Start recording received samples to a SigMF data/meta pair.
+	/*!
+	 * Blocks are queued to a writer thread and written from the block pool without copying.
+	 * With BACKPRESSURE_BLOCK a slow disk stalls the RX stream, which shows up in
+	 * recording_status().stalled and eventually as overflows, instead of losing data silently.
+	 * Must be called after init_sdr, the current RX sample rate and LO frequency go into the metadata.
+	 * \param config: File name, I/O mode and write queue.
+	 */
+        void start_recording(const recording_config &config);
+
+	//! Stop recording, flush the data file and write the metadata file.
+	/*!
+	 * \returns The final counters of the recording.
+	 */
+        recording_stats stop_recording();
+
+	//! Get the counters of the current recording.
+        recording_stats recording_status() const;
+
+	//! Enable pre-trigger capture.
+	/*!
+	 * Every received block is also written to a ring holding the configured pre and post trigger
+	 * windows. The ring is allocated here and never while streaming. Use the current sample rate
+	 * to convert a duration into a number of samples.
+	 * \param config: Window sizes, hugepage backing and an optional automatic trigger.
+	 * \returns true if the ring is backed by hugepages.
+	 */
+        bool enable_capture(const capture_config &config);
+
+	//! Disable pre-trigger capture and free the ring. Invalidates any capture_window.
+        void disable_capture();
+
+	//! Fire the capture trigger at the next received block.
+        void trigger_capture();
+
+	//! Wait for a triggered capture to complete.
+	/*!
+	 * Once the post trigger window has been recorded the ring is frozen until rearm_capture is called.
+	 * \param window: Receives the location of the captured samples, no samples are copied.
+	 * \param timeout_ms: Maximum time to wait in milliseconds.
+	 * \returns true if a capture is available, false on timeout.
+	 */
+        bool wait_capture(capture_window &window, unsigned int timeout_ms);
+
+	//! Resume recording into the ring after a capture. Invalidates the previous capture_window.
+        void rearm_capture();
+
 	//! Start transmitting samples.
 	/*!
 	 * \param tx_callback: Optionaly, specify a function to be called once a new sample buffer is available.
@@ -261,6 +955,41 @@ namespace ADSDR
 	 */
         bool get_rx_sample(sample &s);
 
+	//! Wait until received samples are available in the queue.
+	/*
+	 * Sleeps instead of polling available_rx_samples(). The RX stream only wakes the caller once
+	 * at least min_samples are queued, so wakeups come in batches of whole blocks.
+	 * \param min_samples: Number of samples to wait for.
+	 * \param timeout_ms: Maximum time to wait in milliseconds.
+	 * \returns: true if at least min_samples are available, false on timeout.
+	 */
+        bool wait_rx_samples(unsigned long min_samples, unsigned int timeout_ms);
+
+	//! Read samples from the queue, waiting for at least min_samples of them.
+	/*
+	 * \param destination: Buffer receiving up to max_samples samples.
+	 * \param max_samples: Size of the destination buffer.
+	 * \param min_samples: Number of samples to wait for before reading.
+	 * \param timeout_ms: Maximum time to wait in milliseconds.
+	 * \returns: Number of samples read, which is less than min_samples on timeout.
+	 */
+        unsigned long read_rx_samples(sample *destination, unsigned long max_samples,
+                                      unsigned long min_samples = 1, unsigned int timeout_ms = ADSDR_USB_TIMEOUT);
+
+	//! Get an eventfd that becomes readable when received samples are queued.
+	/*
+	 * Allows waiting for samples from poll()/epoll() alongside other file descriptors.
+	 * The descriptor is only signalled once the low water mark set with set_rx_low_water_mark is reached.
+	 * Do not combine with wait_rx_samples/read_rx_samples waits on another thread.
+	 */
+        int rx_event_fd() const;
+
+	//! Set the number of queued samples at which rx_event_fd is signalled.
+	/*
+	 * \param samples: Low water mark in samples, 0 disables the signal.
+	 */
+        void set_rx_low_water_mark(unsigned long samples);
+
 	//! Add a sample to the transmitter queue.
 	/*!
 	 * \param s: the sample to add to the transmitter queue
@@ -268,6 +997,90 @@ namespace ADSDR
 	 */
         bool submit_tx_sample(sample &s);
 
+	//! Record every AD9361 SPI transaction to a binary trace file.
+	/*!
+	 * Each record holds a timestamp, the register address, the direction and the data.
+	 * \param filename: The trace file to create.
+	 */
+        void record_spi_trace(const std::string &filename);
+
+	//! Answer AD9361 SPI transactions from a recorded trace instead of the device.
+	/*!
+	 * Reads of a register return the values recorded for it in order, then keep returning
+	 * the last one. Writes are only counted. Together with a virtual ADSDR this allows init_sdr
+	 * and radio commands to run without hardware.
+	 * \param filename: A trace written by record_spi_trace.
+	 */
+        void replay_spi_trace(const std::string &filename);
+
+	//! Stop recording or replaying, SPI transactions go to the device again.
+        void stop_spi_trace();
+
+	//! Get the SPI transaction counters, for example to check the cost of a command.
+        spi_stats spi_statistics() const;
+
+	//! Reset the SPI transaction counters.
+        void reset_spi_statistics();
+
+	//! Get the hit and miss counters of the per device clock solution memo.
+	/*!
+	 * Sample rate and LO changes look up the clock chain, BBPLL and RFPLL divider solutions
+	 * computed for earlier requests with the same inputs instead of computing them again.
+	 */
+        clock_cache_stats clock_cache_statistics() const;
+
+	//! Reset the clock solution memo counters.
+        void reset_clock_cache_statistics();
+
+	//! Keep calibration snapshots and warm start init_sdr from them.
+	/*!
+	 * After a full init_sdr the calibrated AD9361 state (register image with the calibration
+	 * results and clock chain, gain tables, FIR and fast lock programming) is written to a
+	 * snapshot keyed by serial number, configuration and temperature band. A later init_sdr with
+	 * the same configuration restores the closest snapshot within the temperature tolerance
+	 * instead of calibrating, and calibrates again if the synthesizers do not lock afterwards.
+	 * Not used while an SPI trace is recorded or replayed.
+	 * \param config: Snapshot directory and temperature tolerance.
+	 */
+        void enable_calibration_cache(const calibration_cache_config &config);
+
+	//! Always run the full calibration in init_sdr again.
+        void disable_calibration_cache();
+
+	//! Get how the last init_sdr brought the AD9361 up.
+        calibration_status calibration_state() const;
+
+	//! Sample the die temperature, RX RSSI and AuxADC in the background.
+	/*!
+	 * A sampler thread reads the registers of each period back to back while holding off radio
+	 * commands, and skips the period instead of waiting when a command is in flight or an LO or
+	 * sample rate change settled less than retune_holdoff_ms ago. Stop it before calling init_sdr
+	 * again. Requires init_sdr.
+	 * \param config: Sample period and retune hold off.
+	 */
+        void start_telemetry(const telemetry_config &config = telemetry_config());
+
+	//! Stop the telemetry sampler.
+        void stop_telemetry();
+
+	//! Get the latest telemetry sample without SPI access or locks.
+	/*!
+	 * Safe from any thread while the sampler runs, all zero when it does not.
+	 */
+        telemetry_snapshot telemetry() const;
+
+	//! Measure the RX power at a list of frequencies with the AD9361 RSSI, without streaming.
+	/*!
+	 * For each frequency the RX LO is retuned, an RSSI measurement is restarted once the
+	 * synthesizer locked and read back after the configured RSSI delay, wait and duration, all
+	 * over SPI. Later sweeps over up to 8 frequencies recall fast lock profiles instead of
+	 * tuning the synthesizer again. The receiver must be on (SET_DATAPATH_EN). Radio commands
+	 * wait for the scan, which leaves the LO and RSSI setup as it found them.
+	 * \param config: Frequencies and number of sweeps.
+	 * \returns One measurement per frequency and sweep, in scan order.
+	 */
+        std::vector<rssi_measurement> scan_rssi(const rssi_scan_config &config);
+
 	//! Helper function to generate a ADSDR::command
 	/*!
          * \param command_id: the ID of the desired command
@@ -298,7 +1111,23 @@ namespace ADSDR
 
         void reset_fx3();
 
+        //! Load firmware into every FX3 in bootloader mode.
+        /*!
+         * The image is mapped and sent with several RAM writes in flight. It is only started if
+         * its checksum matches.
+         * \param filename: FX3 boot image (.img).
+         */
         void flash_fx3(std::string filename);
+
+        //! Bring every connected board up to the given firmware.
+        /*!
+         * Boards whose running firmware reports a version string found in the image are left
+         * alone, the others are reset into the bootloader and flashed together with any FX3
+         * already waiting there.
+         * \param filename: FX3 boot image (.img).
+         * \return true if any board was flashed, false if all were current or none was found.
+         */
+        bool update_fx3(std::string filename);
         //
         int get_device_count();
     };
@@ -1485,6 +1485,56 @@ static uint32_t ad9361_rfvco_tableindex(uint32_t freq)
 	return LUT_FTDD_80;
 }
 
+/**
+ * Get the index of a clock solution in the memo.
+ * @param key The requested rate or frequency.
+ * @param ref The reference clock or the other inputs of the solution.
+ * @return The index.
+ */
+static uint32_t ad9361_clock_cache_index(uint64_t key, uint64_t ref)
+{
+	uint64_t hash = (key ^ (ref * 0x9E3779B97F4A7C15ULL)) * 0xFF51AFD7ED558CCDULL;
+
+	return (uint32_t)(hash >> 32) & (CLOCK_CACHE_SIZE - 1);
+}
+
+/**
+ * Find the synthesizer LUT entry for a VCO frequency, memoized per device.
+ * @param phy The AD9361 state structure.
+ * @param tab The LUT for the reference clock range.
+ * @param vco_mhz The VCO frequency [MHz].
+ * @param range The reference clock range.
+ * @param fdd Set true for the FDD LUT.
+ * @return The index of the entry.
+ */
+static int32_t ad9361_vco_lut_index(struct ad9361_rf_phy *phy,
+				    const struct SynthLUT *tab, uint32_t vco_mhz,
+				    uint32_t range, bool fdd)
+{
+	struct ad9361_clock_cache *cache = &phy->clock_cache;
+	struct ad9361_vco_lut_solution *sol;
+	int32_t i = 0;
+
+	sol = &cache->vco_lut[ad9361_clock_cache_index(vco_mhz, (range << 1) | fdd)];
+	if (sol->valid && sol->vco_mhz == vco_mhz && sol->range == range &&
+	    sol->fdd == fdd) {
+		cache->stats.vco_lut_hits++;
+		return sol->index;
+	}
+
+	cache->stats.vco_lut_misses++;
+	while (i < SYNTH_LUT_SIZE && tab[i].VCO_MHz > vco_mhz)
+		i++;
+
+	sol->valid = true;
+	sol->vco_mhz = vco_mhz;
+	sol->range = range;
+	sol->fdd = fdd;
+	sol->index = i;
+
+	return i;
+}
+
 /**
  * Initialize the RFPLL VCO.
  * @param phy The AD9361 state structure.
@@ -1528,8 +1578,8 @@ static int32_t ad9361_rfpll_vco_init(struct ad9361_rf_phy *phy,
 	if (tx)
 		offs = REG_TX_VCO_OUTPUT - REG_RX_VCO_OUTPUT;
 
-	while (i < SYNTH_LUT_SIZE && tab[i].VCO_MHz > vco_freq)
-		i++;
+	i = ad9361_vco_lut_index(phy, tab, (uint32_t)vco_freq, range,
+				 tab == &SynthLUT_FDD[range][0]);
 
 	dev_dbg(&phy->spi->dev, "%s : freq %d MHz : index %"PRId32,
 		__func__, tab[i].VCO_MHz, i);
@@ -4527,7 +4577,7 @@ int32_t ad9361_get_trx_clock_chain(struct ad9361_rf_phy *phy,
  * @param tx_path_clks TX path rates buffer.
  * @return 0 in case of success, negative error code otherwise.
  */
-int32_t ad9361_calculate_rf_clock_chain(struct ad9361_rf_phy *phy,
+static int32_t __ad9361_calculate_rf_clock_chain(struct ad9361_rf_phy *phy,
 					uint32_t tx_sample_rate,
 					uint32_t rate_gov,
 					uint32_t *rx_path_clks,
@@ -4607,7 +4657,7 @@ int32_t ad9361_calculate_rf_clock_chain(struct ad9361_rf_phy *phy,
 
 	if ((index_tx < 0 || index_tx > 6 || index_rx < 0 || index_rx > 6)
 	    && rate_gov < 7 && recursion) {
-		return ad9361_calculate_rf_clock_chain(phy, tx_sample_rate,
+		return __ad9361_calculate_rf_clock_chain(phy, tx_sample_rate,
 						       ++rate_gov, rx_path_clks, tx_path_clks);
 	} else if ((index_tx < 0 || index_tx > 6 || index_rx < 0 || index_rx > 6)) {
 		dev_err(&phy->spi->dev, "%s: Failed to find suitable dividers: %s",
@@ -4643,6 +4693,57 @@ int32_t ad9361_calculate_rf_clock_chain(struct ad9361_rf_phy *phy,
 	return 0;
 }
 
+/**
+ * Calculate the RX and TX path rates to obtain the desired sample rate,
+ * memoized per device.
+ * @param phy The AD9361 state structure.
+ * @param tx_sample_rate The desired sample rate.
+ * @param rate_gov The rate governor option.
+ * @param rx_path_clks RX path rates buffer.
+ * @param tx_path_clks TX path rates buffer.
+ * @return 0 in case of success, negative error code otherwise.
+ */
+int32_t ad9361_calculate_rf_clock_chain(struct ad9361_rf_phy *phy,
+					uint32_t tx_sample_rate,
+					uint32_t rate_gov,
+					uint32_t *rx_path_clks,
+					uint32_t *tx_path_clks)
+{
+	struct ad9361_clock_cache *cache = &phy->clock_cache;
+	struct ad9361_clock_chain_solution *sol;
+	uint32_t rx_intdec, tx_intdec;
+
+	rx_intdec = phy->bypass_rx_fir ? 1 : phy->rx_fir_dec;
+	tx_intdec = phy->bypass_tx_fir ? 1 : phy->tx_fir_int;
+
+	sol = &cache->clock_chain[ad9361_clock_cache_index(tx_sample_rate,
+		(rx_intdec << 16) | (tx_intdec << 8) | (rate_gov << 1) | phy->rx_eq_2tx)];
+
+	if (sol->valid && sol->rate == tx_sample_rate &&
+	    sol->rx_intdec == rx_intdec && sol->tx_intdec == tx_intdec &&
+	    sol->rate_gov == rate_gov && sol->rx_eq_2tx == phy->rx_eq_2tx) {
+		cache->stats.clock_chain_hits++;
+	} else {
+		cache->stats.clock_chain_misses++;
+		sol->ret = __ad9361_calculate_rf_clock_chain(phy, tx_sample_rate,
+				rate_gov, sol->rx_path_clks, sol->tx_path_clks);
+		sol->valid = true;
+		sol->rate = tx_sample_rate;
+		sol->rx_intdec = rx_intdec;
+		sol->tx_intdec = tx_intdec;
+		sol->rate_gov = rate_gov;
+		sol->rx_eq_2tx = phy->rx_eq_2tx;
+	}
+
+	if (sol->ret < 0)
+		return sol->ret;
+
+	memcpy(rx_path_clks, sol->rx_path_clks, sizeof(sol->rx_path_clks));
+	memcpy(tx_path_clks, sol->tx_path_clks, sizeof(sol->tx_path_clks));
+
+	return 0;
+}
+
 /**
  * Set the desired sample rate.
  * @param phy The AD9361 state structure.
@@ -6356,22 +6457,16 @@ uint32_t ad9361_bbpll_recalc_rate(struct refclk_scale *clk_priv,
 
 /**
  * Calculate the closest possible clock rate that can be set.
- * @param refclk_scale The refclk_scale structure.
  * @param rate The clock rate.
  * @param parent_rate The parent clock rate.
  * @return The closest possible clock rate that can be set.
  */
-int32_t ad9361_bbpll_round_rate(struct refclk_scale *clk_priv, uint32_t rate,
-				uint32_t *prate)
+static int32_t __ad9361_bbpll_round_rate(uint32_t rate, uint32_t *prate)
 {
 	uint64_t tmp;
 	uint32_t fract, integer;
 	uint64_t temp;
 
-	if (clk_priv) {
-		// Unused variable - fix compiler warning
-	}
-
 	if (rate > MAX_BBPLL_FREQ)
 		return MAX_BBPLL_FREQ;
 
@@ -6394,6 +6489,39 @@ int32_t ad9361_bbpll_round_rate(struct refclk_scale *clk_priv, uint32_t rate,
 	return tmp;
 }
 
+/**
+ * Calculate the closest possible clock rate that can be set, memoized per
+ * device.
+ * @param refclk_scale The refclk_scale structure.
+ * @param rate The clock rate.
+ * @param parent_rate The parent clock rate.
+ * @return The closest possible clock rate that can be set.
+ */
+int32_t ad9361_bbpll_round_rate(struct refclk_scale *clk_priv, uint32_t rate,
+				uint32_t *prate)
+{
+	struct ad9361_clock_cache *cache;
+	struct ad9361_pll_solution *sol;
+
+	if (!clk_priv || !clk_priv->phy)
+		return __ad9361_bbpll_round_rate(rate, prate);
+
+	cache = &clk_priv->phy->clock_cache;
+	sol = &cache->bbpll[ad9361_clock_cache_index(rate, *prate)];
+	if (sol->valid && sol->freq == rate && sol->parent_rate == *prate) {
+		cache->stats.bbpll_hits++;
+		return sol->ret;
+	}
+
+	cache->stats.bbpll_misses++;
+	sol->ret = __ad9361_bbpll_round_rate(rate, prate);
+	sol->valid = true;
+	sol->freq = rate;
+	sol->parent_rate = *prate;
+
+	return sol->ret;
+}
+
 /**
  * Set the clock rate.
  * @param refclk_scale The refclk_scale structure.
@@ -6502,7 +6630,7 @@ static uint64_t ad9361_calc_rfpll_int_freq(uint64_t parent_rate,
  * @param vco_freq The VCO frequency.
  * @return The RFPLL frequency.
  */
-static int32_t ad9361_calc_rfpll_int_divder(struct ad9361_rf_phy *phy,
+static int32_t __ad9361_calc_rfpll_int_divder(struct ad9361_rf_phy *phy,
 		uint64_t freq, uint64_t parent_rate, uint32_t *integer,
 		uint32_t *fract, int32_t *vco_div, uint64_t *vco_freq)
 {
@@ -6531,6 +6659,46 @@ static int32_t ad9361_calc_rfpll_int_divder(struct ad9361_rf_phy *phy,
 	return 0;
 }
 
+/**
+ * Calculate the RFPLL dividers, memoized per device.
+ * @param freq The RFPLL frequency.
+ * @param parent_rate The parent clock rate.
+ * @param integer The integer value.
+ * @param fract The fractional value.
+ * @param vco_div The VCO divider.
+ * @param vco_freq The VCO frequency.
+ * @return 0 in case of success, negative error code otherwise.
+ */
+static int32_t ad9361_calc_rfpll_int_divder(struct ad9361_rf_phy *phy,
+		uint64_t freq, uint64_t parent_rate, uint32_t *integer,
+		uint32_t *fract, int32_t *vco_div, uint64_t *vco_freq)
+{
+	struct ad9361_clock_cache *cache = &phy->clock_cache;
+	struct ad9361_pll_solution *sol;
+
+	sol = &cache->rfpll[ad9361_clock_cache_index(freq, parent_rate)];
+	if (sol->valid && sol->freq == freq && sol->parent_rate == parent_rate) {
+		cache->stats.rfpll_hits++;
+	} else {
+		cache->stats.rfpll_misses++;
+		sol->ret = __ad9361_calc_rfpll_int_divder(phy, freq, parent_rate,
+				&sol->integer, &sol->fract, &sol->vco_div, &sol->vco_freq);
+		sol->valid = true;
+		sol->freq = freq;
+		sol->parent_rate = parent_rate;
+	}
+
+	if (sol->ret)
+		return sol->ret;
+
+	*integer = sol->integer;
+	*fract = sol->fract;
+	*vco_div = sol->vco_div;
+	*vco_freq = sol->vco_freq;
+
+	return 0;
+}
+
 /**
  * Recalculate the clock rate.
  * @param refclk_scale The refclk_scale structure.
@@ -7168,6 +7336,25 @@ int32_t register_clocks(struct ad9361_rf_phy *phy)
 	return 0;
 }
 
+/**
+ * Free the clocks allocated by register_clocks.
+ * @param phy The AD9361 state structure.
+ * @return None.
+ */
+void unregister_clocks(struct ad9361_rf_phy *phy)
+{
+	uint32_t i;
+
+	for (i = 0; i < NUM_AD9361_CLKS; i++) {
+		free(phy->clks[i]);
+		free(phy->ref_clk_scale[i]);
+		phy->clks[i] = NULL;
+		phy->ref_clk_scale[i] = NULL;
+	}
+	free(phy->clk_data.clks);
+	phy->clk_data.clks = NULL;
+}
+
 /**
  * Perform an RSSI gain step calibration.
  * Note: Before running the function, provide a single tone within the channel
@@ -3287,6 +3287,59 @@ struct ad9361_fastlock {
 	struct ad9361_fastlock_entry entry[2][8];
 };
 
+/* Memo of clock chain and PLL divider solutions, entries per kind (power of 2) */
+#define CLOCK_CACHE_SIZE	128
+
+struct ad9361_clock_chain_solution {
+	bool		valid;
+	uint32_t	rate;
+	uint32_t	rx_intdec;
+	uint32_t	tx_intdec;
+	uint32_t	rate_gov;
+	bool		rx_eq_2tx;
+	int32_t		ret;
+	uint32_t	rx_path_clks[NUM_RX_CLOCKS];
+	uint32_t	tx_path_clks[NUM_TX_CLOCKS];
+};
+
+struct ad9361_pll_solution {
+	bool		valid;
+	uint64_t	freq;
+	uint64_t	parent_rate;
+	int32_t		ret;		/* BBPLL: rounded rate, RFPLL: divider status */
+	uint32_t	integer;
+	uint32_t	fract;
+	int32_t		vco_div;
+	uint64_t	vco_freq;
+};
+
+struct ad9361_vco_lut_solution {
+	bool		valid;
+	uint32_t	vco_mhz;
+	uint32_t	range;
+	bool		fdd;
+	int32_t		index;
+};
+
+struct ad9361_clock_cache_stats {
+	uint32_t	clock_chain_hits;
+	uint32_t	clock_chain_misses;
+	uint32_t	bbpll_hits;
+	uint32_t	bbpll_misses;
+	uint32_t	rfpll_hits;
+	uint32_t	rfpll_misses;
+	uint32_t	vco_lut_hits;
+	uint32_t	vco_lut_misses;
+};
+
+struct ad9361_clock_cache {
+	struct ad9361_clock_chain_solution	clock_chain[CLOCK_CACHE_SIZE];
+	struct ad9361_pll_solution		bbpll[CLOCK_CACHE_SIZE];
+	struct ad9361_pll_solution		rfpll[CLOCK_CACHE_SIZE];
+	struct ad9361_vco_lut_solution		vco_lut[CLOCK_CACHE_SIZE];
+	struct ad9361_clock_cache_stats		stats;
+};
+
 enum dig_tune_flags {
 	BE_VERBOSE = 1,
 	BE_MOREVERBOSE = 2,
@@ -3380,6 +3433,7 @@ struct ad9361_rf_phy {
 	uint32_t				bist_tone_level_dB;
 	uint32_t				bist_tone_mask;
 	bool			bbpll_initialized;
+	struct ad9361_clock_cache	clock_cache;
 };
 
 struct refclk_scale {
@@ -3412,6 +3466,7 @@ int32_t ad9361_spi_write(struct spi_device *spi,
 	uint32_t reg, uint32_t val);
 int32_t ad9361_reset(struct ad9361_rf_phy *phy);
 int32_t register_clocks(struct ad9361_rf_phy *phy);
+void unregister_clocks(struct ad9361_rf_phy *phy);
 int32_t ad9361_init_gain_tables(struct ad9361_rf_phy *phy);
 int32_t ad9361_setup(struct ad9361_rf_phy *phy);
 int32_t ad9361_post_setup(struct ad9361_rf_phy *phy);
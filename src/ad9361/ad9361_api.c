@@ -116,6 +116,7 @@ int32_t ad9361_init (struct ad9361_rf_phy **ad9361_phy, AD9361_InitParam *init_p
 
 	/* Identification number */
 	phy->spi->id_no = init_param->id_no;
+	phy->spi->platform = init_param->platform;
 	phy->id_no = init_param->id_no;
 
 	/* Reference Clock */
@@ -457,6 +458,7 @@ int32_t ad9361_init (struct ad9361_rf_phy **ad9361_phy, AD9361_InitParam *init_p
 	return 0;
 
 out:
+	unregister_clocks(phy);
 	free(phy->spi);
 #ifndef AXI_ADC_NOT_PRESENT
 	free(phy->adc_conv);
@@ -470,6 +472,27 @@ out:
 	return -ENODEV;
 }
 
+/**
+ * Free the AD9361 state structure allocated by ad9361_init. The device itself
+ * is left as it is.
+ * @param phy The AD9361 state structure.
+ * @return 0 in case of success.
+ */
+int32_t ad9361_remove (struct ad9361_rf_phy *phy)
+{
+	unregister_clocks(phy);
+	free(phy->spi);
+#ifndef AXI_ADC_NOT_PRESENT
+	free(phy->adc_conv);
+	free(phy->adc_state);
+#endif
+	free(phy->clk_refin);
+	free(phy->pdata);
+	free(phy);
+
+	return 0;
+}
+
 /**
  * Set the Enable State Machine (ENSM) mode.
  * @param phy The AD9361 current state structure.
@@ -2049,3 +2072,30 @@ int32_t ad9361_get_temperature(struct ad9361_rf_phy *phy,
 
 	return 0;
 }
+
+/**
+ * Get the clock solution memo counters.
+ * @param phy The AD9361 current state structure.
+ * @param stats Hits and misses per kind of solution (clock chain, BBPLL
+ * 				rate, RFPLL dividers, VCO LUT entry).
+ * @return 0 in case of success, negative error code otherwise.
+ */
+int32_t ad9361_get_clock_cache_stats(struct ad9361_rf_phy *phy,
+									 struct ad9361_clock_cache_stats *stats)
+{
+	*stats = phy->clock_cache.stats;
+
+	return 0;
+}
+
+/**
+ * Reset the clock solution memo counters.
+ * @param phy The AD9361 current state structure.
+ * @return 0 in case of success, negative error code otherwise.
+ */
+int32_t ad9361_reset_clock_cache_stats(struct ad9361_rf_phy *phy)
+{
+	memset(&phy->clock_cache.stats, 0, sizeof(phy->clock_cache.stats));
+
+	return 0;
+}
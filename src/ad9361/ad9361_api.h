@@ -283,6 +283,8 @@ typedef struct
 	uint32_t	(*ad9361_rfpll_ext_recalc_rate)(struct refclk_scale *clk_priv);
 	int32_t		(*ad9361_rfpll_ext_round_rate)(struct refclk_scale *clk_priv, uint32_t rate);
 	int32_t		(*ad9361_rfpll_ext_set_rate)(struct refclk_scale *clk_priv, uint32_t rate);
+	/* Platform layer state of the device, see platform.h */
+	struct platform_context *platform;
 }AD9361_InitParam;
 
 typedef struct
@@ -360,6 +362,8 @@ enum ad9361_ensm_mode {
 /******************************************************************************/
 /* Initialize the AD9361 part. */
 int32_t ad9361_init (struct ad9361_rf_phy **ad9361_phy, AD9361_InitParam *init_param);
+/* Free the AD9361 state structure allocated by ad9361_init. */
+int32_t ad9361_remove (struct ad9361_rf_phy *phy);
 /* Set the Enable State Machine (ENSM) mode. */
 int32_t ad9361_set_en_state_machine_mode (struct ad9361_rf_phy *phy, uint32_t mode);
 /* Get the Enable State Machine (ENSM) mode. */
@@ -501,4 +505,9 @@ int32_t ad9361_do_dcxo_tune_fine(struct ad9361_rf_phy *phy,
 /* Get the temperature. */
 int32_t ad9361_get_temperature(struct ad9361_rf_phy *phy,
 							   int32_t *temp);
+/* Get the clock solution memo counters. */
+int32_t ad9361_get_clock_cache_stats(struct ad9361_rf_phy *phy,
+									 struct ad9361_clock_cache_stats *stats);
+/* Reset the clock solution memo counters. */
+int32_t ad9361_reset_clock_cache_stats(struct ad9361_rf_phy *phy);
 #endif
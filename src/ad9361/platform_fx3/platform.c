@@ -46,12 +46,11 @@
 #include "platform.h"
 #include "parameters.h"
 
-libusb_context *_ctx;
-libusb_device_handle *_adsdr_handle;
+/* Per thread, so a replay on one device does not rush the init of another */
+static __thread int _delays_enabled = 1;
 
-void set_libusb_params(libusb_context *ctx, libusb_device_handle *adsdr_handle) {
-	_ctx = ctx;
-	_adsdr_handle = adsdr_handle;
+void set_platform_delays(int enabled) {
+	_delays_enabled = enabled;
 }
 
 /***************************************************************************//**
@@ -81,16 +80,16 @@ void print_buf(const char *msg, unsigned char *buff, int len) {
 //    return ret;
 //}
 
-int txControlToDevice(uint8_t* src, uint32_t size8, uint8_t cmd, uint16_t wValue, uint16_t wIndex)
+int txControlToDevice(struct platform_context *platform, uint8_t* src, uint32_t size8, uint8_t cmd, uint16_t wValue, uint16_t wIndex)
 {
-	if(_adsdr_handle != 0)
+	if(platform != 0 && platform->control != 0)
 	{
 //		printf("txControlToDevice\n");
 		uint8_t bmRequestType = LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT;
 		uint8_t bRequest = cmd;
 		uint32_t timeout_ms = DEV_UPLOAD_TIMEOUT_MS;
 
-		int res = libusb_control_transfer(_adsdr_handle, bmRequestType, bRequest, wValue, wIndex, src, size8, timeout_ms );
+		int res = platform->control(platform->control_user, bmRequestType, bRequest, wValue, wIndex, src, size8, timeout_ms );
 		if ( res != ( int ) size8 ) {
 			fprintf( stderr, "FX3Dev::txControlToDevice() error %d %s\n", res, libusb_error_name(res) );
 			return FX3_ERR_CTRL_TX_FAIL;
@@ -101,16 +100,16 @@ int txControlToDevice(uint8_t* src, uint32_t size8, uint8_t cmd, uint16_t wValue
 	return FX3_ERR_NO_DEVICE_FOUND;
 }
 
-int txControlFromDevice(uint8_t* dest, uint32_t size8 , uint8_t cmd, uint16_t wValue, uint16_t wIndex)
+int txControlFromDevice(struct platform_context *platform, uint8_t* dest, uint32_t size8 , uint8_t cmd, uint16_t wValue, uint16_t wIndex)
 {
-	if(_adsdr_handle != 0)
+	if(platform != 0 && platform->control != 0)
 	{
 //		printf("txControlFromDevice\n");
 		uint8_t bmRequestType = LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN;
 		uint8_t bRequest = cmd;
 		uint32_t timeout_ms = DEV_UPLOAD_TIMEOUT_MS;
 
-		int res = libusb_control_transfer(_adsdr_handle, bmRequestType, bRequest, wValue, wIndex, dest, size8, timeout_ms );
+		int res = platform->control(platform->control_user, bmRequestType, bRequest, wValue, wIndex, dest, size8, timeout_ms );
 //		print_buf("dst", dest, size8);
 		if ( res != ( int ) size8 ) {
 			fprintf( stderr, "FX3Dev::transferDataFromDevice() error %d %s\n", res, libusb_error_name(res) );
@@ -173,14 +172,38 @@ int txControlFromDevice(uint8_t* dest, uint32_t size8 , uint8_t cmd, uint16_t wV
 int spi_write_then_read(struct spi_device *spi,
 							const unsigned char *txbuf, unsigned n_tx,
 							unsigned char *rxbuf, unsigned n_rx)
+{
+	return platform_spi_write_then_read(spi->platform, txbuf, n_tx, rxbuf, n_rx);
+}
+
+/***************************************************************************//**
+ * @brief platform_spi_write_then_read
+*******************************************************************************/
+int platform_spi_write_then_read(struct platform_context *platform,
+							const unsigned char *txbuf, unsigned n_tx,
+							unsigned char *rxbuf, unsigned n_rx)
+{
+	if(platform != 0 && platform->spi_backend != 0)
+	{
+		return platform->spi_backend(platform, platform->spi_backend_user, txbuf, n_tx, rxbuf, n_rx);
+	}
+	return fx3_spi_write_then_read(platform, txbuf, n_tx, rxbuf, n_rx);
+}
+
+/***************************************************************************//**
+ * @brief fx3_spi_write_then_read
+*******************************************************************************/
+int fx3_spi_write_then_read(struct platform_context *platform,
+							const unsigned char *txbuf, unsigned n_tx,
+							unsigned char *rxbuf, unsigned n_rx)
 {
 	uint8_t buff[32];
 	memset(buff, 0, 32);
     memcpy(buff, txbuf, n_tx);
 //    print_buf("send: ", buff, n_tx + n_rx);
-	int ret = txControlToDevice(buff, 32, REG_SPI_WRITE_READ_MULTIPLE_STAGE1, n_tx + n_rx, 0);
+	int ret = txControlToDevice(platform, buff, 32, REG_SPI_WRITE_READ_MULTIPLE_STAGE1, n_tx + n_rx, 0);
 	if(ret < 0) return ret;
-	ret = txControlFromDevice(buff, 32, REG_SPI_WRITE_READ_MULTIPLE_STAGE2, n_tx + n_rx, 0);
+	ret = txControlFromDevice(platform, buff, 32, REG_SPI_WRITE_READ_MULTIPLE_STAGE2, n_tx + n_rx, 0);
 //    print_buf("recv: ", buff, n_tx + n_rx);
 	if(ret < 0) return ret;
 	memcpy(rxbuf, buff + n_tx, n_rx);
@@ -236,7 +259,8 @@ void gpio_set_value(unsigned gpio, int value)
 *******************************************************************************/
 void udelay(unsigned long usecs)
 {
-	usleep(usecs);
+	if(_delays_enabled)
+		usleep(usecs);
 }
 
 /***************************************************************************//**
@@ -244,7 +268,8 @@ void udelay(unsigned long usecs)
 *******************************************************************************/
 void mdelay(unsigned long msecs)
 {
-	usleep(msecs * 1000);
+	if(_delays_enabled)
+		usleep(msecs * 1000);
 }
 
 /***************************************************************************//**
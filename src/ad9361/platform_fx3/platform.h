@@ -140,7 +140,21 @@ enum adc_data_sel {
 /******************************************************************************/
 /************************ Functions Declarations ******************************/
 /******************************************************************************/
-void set_libusb_params(libusb_context *ctx, libusb_device_handle *adsdr_handle);
+struct platform_context;
+typedef int (*platform_control_fn)(void *user, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+								   uint8_t *data, uint16_t length, unsigned int timeout_ms);
+typedef int (*spi_backend_fn)(struct platform_context *platform, void *user, const unsigned char *txbuf, unsigned n_tx,
+							  unsigned char *rxbuf, unsigned n_rx);
+/* Everything the platform layer needs of one device. Owned by the device and handed to the
+ * driver through AD9361_InitParam, which stores it in the spi_device. */
+struct platform_context {
+	platform_control_fn control;	/* Vendor control requests to the FX3 */
+	void *control_user;
+	spi_backend_fn spi_backend;		/* Optional, otherwise SPI goes straight to the FX3 */
+	void *spi_backend_user;
+};
+/* Delays of the calling thread are skipped while disabled, for running the driver against recorded SPI data */
+void set_platform_delays(int enabled);
 int32_t spi_init(uint32_t device_id,
 				 uint8_t  clk_pha,
 				 uint8_t  clk_pol);
@@ -149,6 +163,12 @@ int32_t spi_read(uint8_t *data,
 int spi_write_then_read(struct spi_device *spi,
 		const unsigned char *txbuf, unsigned n_tx,
 		unsigned char *rxbuf, unsigned n_rx);
+int platform_spi_write_then_read(struct platform_context *platform,
+		const unsigned char *txbuf, unsigned n_tx,
+		unsigned char *rxbuf, unsigned n_rx);
+int fx3_spi_write_then_read(struct platform_context *platform,
+		const unsigned char *txbuf, unsigned n_tx,
+		unsigned char *rxbuf, unsigned n_rx);
 void gpio_init(uint32_t device_id);
 void gpio_direction(uint8_t pin, uint8_t direction);
 bool gpio_is_valid(int number);
@@ -162,6 +182,6 @@ unsigned int axiadc_read(struct axiadc_state *st, unsigned long reg);
 void axiadc_write(struct axiadc_state *st, unsigned reg, unsigned val);
 int axiadc_set_pnsel(struct axiadc_state *st, int channel, enum adc_pn_sel sel);
 void axiadc_idelay_set(struct axiadc_state *st, unsigned lane, unsigned val);
-int txControlToDevice(uint8_t* src, uint32_t size8, uint8_t cmd, uint16_t wValue, uint16_t wIndex);
-int txControlFromDevice(uint8_t* dest, uint32_t size8 , uint8_t cmd, uint16_t wValue, uint16_t wIndex);
+int txControlToDevice(struct platform_context *platform, uint8_t* src, uint32_t size8, uint8_t cmd, uint16_t wValue, uint16_t wIndex);
+int txControlFromDevice(struct platform_context *platform, uint8_t* dest, uint32_t size8 , uint8_t cmd, uint16_t wValue, uint16_t wIndex);
 #endif
@@ -87,9 +87,12 @@
 struct device {
 };
 
+struct platform_context;
+
 struct spi_device {
 	struct device	dev;
 	uint8_t 		id_no;
+	struct platform_context *platform;
 };
 
 struct axiadc_state {
@@ -25,10 +25,18 @@ namespace ADSDR {
     {
         _impl.reset(new ADSDR_impl(serial_number));
     }
+
+    ADSDR::ADSDR(const virtual_device_config &config)
+    {
+        _impl.reset(new ADSDR_impl(config));
+    }
     
     ADSDR::~ADSDR() = default;
     
     std::vector<std::string> ADSDR::list_connected() { return ADSDR_impl::list_connected(); }
+    std::vector<device_info> ADSDR::connected_devices() { return ADSDR_impl::connected_devices(); }
+    int ADSDR::subscribe_hotplug(std::function<void(const hotplug_event &)> callback) { return ADSDR_impl::subscribe_hotplug(callback); }
+    void ADSDR::unsubscribe_hotplug(int id) { ADSDR_impl::unsubscribe_hotplug(id); }
 
     bool ADSDR::init_sdr() { return _impl->init_sdr(); }
     
@@ -37,15 +45,73 @@ namespace ADSDR {
     
     void ADSDR::start_rx(std::function<void(const std::vector<sample> &)> rx_callback) { _impl->start_rx(rx_callback); }
     void ADSDR::stop_rx() { _impl->stop_rx(); }
+
+    void ADSDR::set_rx_overflow_policy(overflow_policy policy, std::function<void(const rx_overflow &)> overflow_callback) { _impl->set_rx_overflow_policy(policy, overflow_callback); }
+    uint64_t ADSDR::rx_overflow_count() const { return _impl->rx_overflow_count(); }
+    bool ADSDR::is_rx_streaming() const { return _impl->is_rx_streaming(); }
+    void ADSDR::set_rx_recovery(const recovery_config &config, std::function<void(const rx_gap &)> gap_callback) { _impl->set_rx_recovery(config, gap_callback); }
+    recovery_stats ADSDR::rx_recovery_stats() const { return _impl->rx_recovery_stats(); }
+
+    int ADSDR::subscribe_rx(std::function<void(const rx_block_ref &)> callback, backpressure_policy policy, unsigned int queue_depth) { return _impl->subscribe_rx(callback, policy, queue_depth); }
+    void ADSDR::unsubscribe_rx(int id) { _impl->unsubscribe_rx(id); }
+    rx_subscription_stats ADSDR::subscription_stats(int id) const { return _impl->subscription_stats(id); }
     
+    void ADSDR::enable_squelch(const squelch_config &config) { _impl->enable_squelch(config); }
+    void ADSDR::disable_squelch() { _impl->disable_squelch(); }
+    squelch_stats ADSDR::rx_squelch_stats() const { return _impl->rx_squelch_stats(); }
+    void ADSDR::enable_iq_correction(const iq_correction_config &config, const iq_correction_estimate &seed) { _impl->enable_iq_correction(config, seed); }
+    void ADSDR::disable_iq_correction() { _impl->disable_iq_correction(); }
+    iq_correction_estimate ADSDR::rx_iq_correction_estimate() const { return _impl->rx_iq_correction_estimate(); }
+    void ADSDR::enable_rx_decimation(const decimation_config &config) { _impl->enable_rx_decimation(config); }
+    void ADSDR::disable_rx_decimation() { _impl->disable_rx_decimation(); }
+    double ADSDR::set_rx_output_rate(double rate_hz) { return _impl->set_rx_output_rate(rate_hz); }
+    void ADSDR::set_rx_frequency_shift(double offset_hz) { _impl->set_rx_frequency_shift(offset_hz); }
+    double ADSDR::rx_frequency_shift() const { return _impl->rx_frequency_shift(); }
+
+    void ADSDR::start_channelizer(const channelizer_config &config, std::function<void(const channelizer_block &)> callback) { _impl->start_channelizer(config, callback); }
+    channelizer_stats ADSDR::stop_channelizer() { return _impl->stop_channelizer(); }
+    void ADSDR::start_psd(const psd_config &config, std::function<void(const psd_frame &)> callback) { _impl->start_psd(config, callback); }
+    psd_stats ADSDR::stop_psd() { return _impl->stop_psd(); }
+    void ADSDR::reset_psd_max_hold() { _impl->reset_psd_max_hold(); }
+    void ADSDR::start_recording(const recording_config &config) { _impl->start_recording(config); }
+    recording_stats ADSDR::stop_recording() { return _impl->stop_recording(); }
+    recording_stats ADSDR::recording_status() const { return _impl->recording_status(); }
+
+    bool ADSDR::enable_capture(const capture_config &config) { return _impl->enable_capture(config); }
+    void ADSDR::disable_capture() { _impl->disable_capture(); }
+    void ADSDR::trigger_capture() { _impl->trigger_capture(); }
+    bool ADSDR::wait_capture(capture_window &window, unsigned int timeout_ms) { return _impl->wait_capture(window, timeout_ms); }
+    void ADSDR::rearm_capture() { _impl->rearm_capture(); }
+
     void ADSDR::start_tx(std::function<void(std::vector<sample> &)> tx_callback) { _impl->start_tx(tx_callback); }
     void ADSDR::stop_tx() { _impl->stop_tx(); }
     
     unsigned long ADSDR::available_rx_samples() {return _impl->available_rx_samples(); }
     bool ADSDR::get_rx_sample(sample &s) { return _impl->get_rx_sample(s); }
+    bool ADSDR::wait_rx_samples(unsigned long min_samples, unsigned int timeout_ms) { return _impl->wait_rx_samples(min_samples, timeout_ms); }
+    unsigned long ADSDR::read_rx_samples(sample *destination, unsigned long max_samples, unsigned long min_samples, unsigned int timeout_ms) { return _impl->read_rx_samples(destination, max_samples, min_samples, timeout_ms); }
+    int ADSDR::rx_event_fd() const { return _impl->rx_event_fd(); }
+    void ADSDR::set_rx_low_water_mark(unsigned long samples) { _impl->set_rx_low_water_mark(samples); }
     
     bool ADSDR::submit_tx_sample(sample &s) { return _impl->submit_tx_sample(s); }
     
+    void ADSDR::record_spi_trace(const std::string &filename) { _impl->record_spi_trace(filename); }
+    void ADSDR::replay_spi_trace(const std::string &filename) { _impl->replay_spi_trace(filename); }
+    void ADSDR::stop_spi_trace() { _impl->stop_spi_trace(); }
+    spi_stats ADSDR::spi_statistics() const { return _impl->spi_statistics(); }
+    void ADSDR::reset_spi_statistics() { _impl->reset_spi_statistics(); }
+    clock_cache_stats ADSDR::clock_cache_statistics() const { return _impl->clock_cache_statistics(); }
+    void ADSDR::reset_clock_cache_statistics() { _impl->reset_clock_cache_statistics(); }
+
+    void ADSDR::enable_calibration_cache(const calibration_cache_config &config) { _impl->enable_calibration_cache(config); }
+    void ADSDR::disable_calibration_cache() { _impl->disable_calibration_cache(); }
+    calibration_status ADSDR::calibration_state() const { return _impl->calibration_state(); }
+
+    void ADSDR::start_telemetry(const telemetry_config &config) { _impl->start_telemetry(config); }
+    void ADSDR::stop_telemetry() { _impl->stop_telemetry(); }
+    telemetry_snapshot ADSDR::telemetry() const { return _impl->telemetry(); }
+    std::vector<rssi_measurement> ADSDR::scan_rssi(const rssi_scan_config &config) { return _impl->scan_rssi(config); }
+
     command ADSDR::make_command(command_id id, double param) const { return _impl->make_command(id, param); }
     response ADSDR::send_cmd(command c) const { return _impl->send_cmd(c); }
     
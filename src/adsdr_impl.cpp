@@ -19,27 +19,39 @@
 
 #include <adsdr.hpp>
 #include <cstring>
+#include <algorithm>
 
 #include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include "device_registry.h"
+#include "fpga_loader.h"
+#include "mapped_file.h"
+#include "usb_transport.h"
+#include "virtual_transport.h"
 #include "adsdr_impl.h"
+#include "spi_burst.h"
 #include <linux/errno.h>
 
 #define ADSDR_SERIAL_DSCR_INDEX 3
-#define MAX_SERIAL_LENGTH 256
+// Time the FPGA gets to report DONE after the last byte of the bitstream
+#define FPGA_CONFIG_TIMEOUT_MS 2000
+// Time given to cancelled transfers to complete, past their own USB timeout. A recovery that is
+// still waiting on one after this gives up, since its buffer and handle belong to libusb until then
+#define RECOVERY_DRAIN_TIMEOUT_MS (ADSDR_USB_TIMEOUT + 1000)
+// Slice of the reopen wait after which a recovery checks whether it should give up
+#define RECOVERY_REOPEN_SLICE_MS 100
+// Sample rate requests before giving up on reaching a rate at or above the target
+#define RX_RATE_ATTEMPTS 4
+// RX fast lock profiles of the AD9361
+#define RSSI_SCAN_PROFILES 8
+// Synthesizer lock checks after a retune before measuring anyway, each takes an SPI round trip
+#define RSSI_SCAN_LOCK_POLLS 8
 
 
 using namespace ADSDR;
 
-moodycamel::ReaderWriterQueue<sample> ADSDR_impl::_rx_buf(ADSDR_RX_TX_QUEUE_SIZE);
-moodycamel::ReaderWriterQueue<sample> ADSDR_impl::_tx_buf(ADSDR_RX_TX_QUEUE_SIZE);
-std::vector<sample> ADSDR_impl::_rx_decoder_buf(ADSDR_RX_TX_BUF_SIZE / ADSDR_BYTES_PER_SAMPLE);
-std::function<void(const std::vector<sample> &)> ADSDR_impl::_rx_custom_callback;
-std::vector<sample> ADSDR_impl::_tx_encoder_buf(ADSDR_RX_TX_BUF_SIZE / ADSDR_BYTES_PER_SAMPLE);
-std::function<void(std::vector<sample> &)> ADSDR_impl::_tx_custom_callback;
-
 std::string buf_to_str(unsigned char *buff, int len) {
     std::stringstream ret;
     ret << std::hex;
@@ -49,8 +61,23 @@ std::string buf_to_str(unsigned char *buff, int len) {
     return ret.str();
 }
 
-ADSDR_impl::ADSDR_impl(std::string serial_number)
+ADSDR_impl::ADSDR_impl(std::string serial_number) :
+    ADSDR_impl(std::unique_ptr<transport>(new usb_transport(serial_number)))
+{
+}
+
+ADSDR_impl::ADSDR_impl(const virtual_device_config &config) :
+    ADSDR_impl(std::unique_ptr<transport>(new virtual_transport(config)))
 {
+}
+
+ADSDR_impl::ADSDR_impl(std::unique_ptr<transport> device) : _transport(std::move(device))
+{
+    _platform.control = &transport::platform_control;
+    _platform.control_user = _transport.get();
+    _platform.spi_backend = &spi_trace::write_then_read;
+    _platform.spi_backend_user = &_spi;
+
     ad_default_param = {
         /* Device selection */
         ID_AD9361,	// dev_sel
@@ -285,58 +312,17 @@ ADSDR_impl::ADSDR_impl(std::string serial_number)
         /* External LO clocks */
         NULL,	//(*ad9361_rfpll_ext_recalc_rate)()
         NULL,	//(*ad9361_rfpll_ext_round_rate)()
-        NULL	//(*ad9361_rfpll_ext_set_rate)()
+        NULL,	//(*ad9361_rfpll_ext_set_rate)()
+        /* Platform */
+        &_platform	//platform
     };
 
-    rx_fir_config = {	// BPF PASSBAND 3/20 fs to 1/4 fs
-        3, // rx
-        0, // rx_gain
-        1, // rx_dec
-        {-4, -6, -37, 35, 186, 86, -284, -315,
-         107, 219, -4, 271, 558, -307, -1182, -356,
-         658, 157, 207, 1648, 790, -2525, -2553, 748,
-         865, -476, 3737, 6560, -3583, -14731, -5278, 14819,
-         14819, -5278, -14731, -3583, 6560, 3737, -476, 865,
-         748, -2553, -2525, 790, 1648, 207, 157, 658,
-         -356, -1182, -307, 558, 271, -4, 219, 107,
-         -315, -284, 86, 186, 35, -37, -6, -4,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0}, // rx_coef[128]
-        64, // rx_coef_size
-        {0, 0, 0, 0, 0, 0}, //rx_path_clks[6]
-        0 // rx_bandwidth
-    };
-
-    tx_fir_config = {	// BPF PASSBAND 3/20 fs to 1/4 fs
-        3, // tx
-        -6, // tx_gain
-        1, // tx_int
-        {-4, -6, -37, 35, 186, 86, -284, -315,
-         107, 219, -4, 271, 558, -307, -1182, -356,
-         658, 157, 207, 1648, 790, -2525, -2553, 748,
-         865, -476, 3737, 6560, -3583, -14731, -5278, 14819,
-         14819, -5278, -14731, -3583, 6560, 3737, -476, 865,
-         748, -2553, -2525, 790, 1648, 207, 157, 658,
-         -356, -1182, -307, 558, 271, -4, 219, 107,
-         -315, -284, 86, 186, 35, -37, -6, -4,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0,
-         0, 0, 0, 0, 0, 0, 0, 0}, // tx_coef[128]
-        64, // tx_coef_size
-        {0, 0, 0, 0, 0, 0}, // tx_path_clks[6]
-        0 // tx_bandwidth
-    };
+    // FIR designs for the default rate, set_rx_samp_freq/set_tx_samp_freq switch them with the rate
+    uint32_t samp_freq_hz = ad_default_param.rx_path_clock_frequencies[RX_SAMPL_FREQ];
+    _rx_fir_design = &select_fir_design(samp_freq_hz, ad_default_param.rf_rx_bandwidth_hz);
+    _tx_fir_design = &select_fir_design(samp_freq_hz, ad_default_param.rf_tx_bandwidth_hz);
+    fir_config(*_rx_fir_design, rx_fir_config);
+    fir_config(*_tx_fir_design, tx_fir_config);
 
     //----------------------------------------------------
     m_cmd_list.push_back(&ADSDR_impl::get_tx_lo_freq);
@@ -366,104 +352,13 @@ ADSDR_impl::ADSDR_impl(std::string serial_number)
     m_cmd_list.push_back(&ADSDR_impl::set_loopback_en);
     // ---------------------------------------------------
 
-    libusb_device **devs;
-
-    int ret = libusb_init(&_ctx);
-
-    if(ret < 0)
-    {
-        throw ConnectionError("libusb init error %d: error " + std::to_string(ret));
-    }
-
-    // Set verbosity level
-    libusb_set_debug(_ctx, 3);
-
-    // Retrieve device list
-    int num_devs = (int) libusb_get_device_list(_ctx, &devs);
-    if(num_devs < 0)
-    {
-        throw ConnectionError("libusb device list retrieval error");
-    }
-
-    // Find ADSDR device
-    bool no_match = false;
-    
-    for(int i = 0; i < num_devs; i++)
-    {
-        libusb_device_descriptor desc;
-        int ret = libusb_get_device_descriptor(devs[i], &desc);
-        if(ret < 0)
-        {
-            throw ConnectionError("libusb error getting device descriptor %d: error " + std::to_string(ret));
-        }
-
-        if(desc.idVendor == ADSDR_VENDOR_ID && desc.idProduct == ADSDR_PRODUCT_ID)
-        {
-            int ret = libusb_open(devs[i], &_adsdr_handle);
-            if(ret != 0)
-            {
-                throw ConnectionError("libusb could not open found ADSDR USB device %d: error " + std::to_string(ret));
-            }
-
-
-            // Check if correct serial number
-            if(desc.iSerialNumber)
-            {
-                char serial_num_buf[MAX_SERIAL_LENGTH];
-                ret = libusb_get_string_descriptor_ascii(_adsdr_handle, /*ADSDR_SERIAL_DSCR_INDEX*/desc.iSerialNumber, (unsigned char*)serial_num_buf, MAX_SERIAL_LENGTH);
-                if(ret < 0)
-                {
-                    libusb_close(_adsdr_handle);
-                    _adsdr_handle = nullptr;
-                    throw ConnectionError("1)libusb could not read ADSDR serial number %d: error " + std::to_string(ret) + "___" + std::to_string(desc.iSerialNumber));
-                }
-                else
-                {
-                    std::string dev_serial = std::string(serial_num_buf);
-                    if(dev_serial.find(serial_number) != std::string::npos)
-                    {
-                        // Found!
-                        break;
-                    }
-                    else
-                    {
-                        no_match = true;
-                        libusb_close(_adsdr_handle);
-                        _adsdr_handle = nullptr;
-                    }
-                }
-            }
-            else
-            {
-                std::cout << "ADSDR serial number not found !" << std::endl;
-            }
-        }
-    }
-
-    if(no_match && _adsdr_handle == nullptr)
-    {
-        throw ConnectionError("ADSDR device(s) were found, but did not match specified serial number");
-    }
-    
-    if(_adsdr_handle == nullptr)
-    {
-        throw ConnectionError("no ADSDR device found");
-    }
-
-    // Free the list, unref the devices in it
-    libusb_free_device_list(devs, 1);
-
-    // Found a ADSDR device and opened it. Now claim its interface (ID 0).
-    ret = libusb_claim_interface(_adsdr_handle, 0);
-    if(ret < 0)
-    {
-        throw ConnectionError("could not claim ADSDR interface");
-    }
+    _rx_pool.reset(new rx_block_pool(ADSDR_RX_BLOCK_POOL_SIZE, ADSDR_RX_BLOCK_SIZE));
+    _rx_subscribers = std::make_shared<rx_subscriber_list>();
 
     // Request ADSDR version number
 #if 0
     std::array<unsigned char, ADSDR_USB_CTRL_SIZE> data{};
-    ret = libusb_control_transfer(_adsdr_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN, ADSDR_GET_VERSION_REQ, 0, 0, data.data(), (uint16_t) data.size(), ADSDR_USB_TIMEOUT);
+    int ret = _transport->control(LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN, ADSDR_GET_VERSION_REQ, 0, 0, data.data(), (uint16_t) data.size(), ADSDR_USB_TIMEOUT);
     if(ret < 0)
     {
         throw ConnectionError("1) ADSDR not responding %d: error " + std::to_string(ret));
@@ -496,29 +391,43 @@ ADSDR_impl::ADSDR_impl(std::string serial_number)
         run_rx_tx();
     }));
 
-    set_libusb_params(_ctx, _adsdr_handle);
+    _recovery_worker.reset(new std::thread([this]() {
+        run_recovery();
+    }));
 }
 
 ADSDR_impl::~ADSDR_impl()
 {
+    // Its reads go through the transport torn down below
+    _telemetry.reset();
+
+    // A recovery in progress gives up at its next check
+    {
+        std::lock_guard<std::mutex> lock(_recovery_lock);
+        _run_recovery.store(false);
+    }
+    _recovery_cv.notify_all();
+    _recovery_worker->join();
+
     // TODO: Properly stop all active transfers
     stop_rx();
     stop_tx();
 
-    if(_adsdr_handle != nullptr)
+    // Closed subscribers no longer stall the event thread
+    for(auto &subscriber : *std::atomic_load(&_rx_subscribers))
     {
-        libusb_release_interface(_adsdr_handle, 0);
+        subscriber.second->close();
+    }
 
-        _run_rx_tx.store(false);
+    _run_rx_tx.store(false);
 
-        // This will cause libusb_handle_events() in run_rx_tx() to return once
-        libusb_close(_adsdr_handle);
+    // This will cause handle_events() in run_rx_tx() to return once
+    _transport->interrupt();
 
-        // libusb_handle_events should have returned and the thread can now be joined
-        if(_rx_tx_worker != nullptr)
-        {
-            _rx_tx_worker->join();
-        }
+    // handle_events should have returned and the thread can now be joined
+    if(_rx_tx_worker != nullptr)
+    {
+        _rx_tx_worker->join();
     }
 
     for(libusb_transfer *transfer : _rx_transfers)
@@ -526,24 +435,134 @@ ADSDR_impl::~ADSDR_impl()
         libusb_free_transfer(transfer);
     }
 
+    drop_ad9361();
+
 #if 0
     for(libusb_transfer *transfer : _tx_transfers)
     {
         libusb_free_transfer(transfer);
     }
 #endif
+}
+
+bool ADSDR_impl::init_sdr()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    calibration_status status = {};
+
+    bool initialized = false;
+    if(_calibration == nullptr)
+    {
+        status.reason = "calibration cache disabled";
+    }
+    else if(!_spi.passing_through())
+    {
+        status.reason = "SPI trace active";
+    }
+    else
+    {
+        initialized = warm_start(status);
+    }
 
-    if(_ctx != nullptr)
+    if(!initialized)
     {
-        libusb_exit(_ctx); // close the session
+        initialized = cold_start(status);
     }
+
+    status.init_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    _calibration_status = status;
+    _initialized = initialized;
+    return initialized;
 }
 
-bool ADSDR_impl::init_sdr()
+bool ADSDR_impl::warm_start(calibration_status &status)
+{
+    uint64_t hash = calibration_cache::config_hash(ad_default_param, rx_fir_config, tx_fir_config);
+    status.temperature = calibration_cache::read_temperature(&_platform);
+
+    calibration_snapshot snapshot;
+    std::string path;
+    if(!_calibration->find(_transport->serial(), hash, status.temperature, snapshot, path))
+    {
+        status.reason = "no snapshot within the temperature tolerance";
+        return false;
+    }
+
+    // Rebuild the driver state from the recorded init, without touching the device
+    _spi.replay(snapshot.init_log);
+    set_platform_delays(0);
+    bool rebuilt = setup_ad9361();
+    set_platform_delays(1);
+    bool matched = _spi.replay_matched();
+    _spi.stop();
+
+    if(!rebuilt || !matched)
+    {
+        status.reason = "configuration differs from the snapshot";
+        drop_ad9361();
+        return false;
+    }
+
+    if(!calibration_cache::restore(&_platform, snapshot))
+    {
+        status.reason = "synthesizers did not lock after restoring the snapshot";
+        drop_ad9361();
+        return false;
+    }
+
+    status.warm_start = true;
+    status.snapshot = path;
+    status.snapshot_temperature = snapshot.temperature;
+    return true;
+}
+
+bool ADSDR_impl::cold_start(calibration_status &status)
+{
+    bool keep = _calibration != nullptr && _spi.passing_through();
+    if(keep)
+    {
+        _spi.capture();
+    }
+
+    bool initialized = setup_ad9361();
+    if(!keep)
+    {
+        return initialized;
+    }
+
+    calibration_snapshot snapshot;
+    snapshot.init_log = _spi.take_capture();
+    if(!initialized)
+    {
+        return false;
+    }
+
+    snapshot.serial = _transport->serial();
+    snapshot.config_hash = calibration_cache::config_hash(ad_default_param, rx_fir_config, tx_fir_config);
+    snapshot.temperature = calibration_cache::read_temperature(&_platform);
+    try
+    {
+        calibration_cache::read_registers(&_platform, snapshot.registers);
+        status.snapshot = _calibration->store(snapshot);
+        status.snapshot_temperature = snapshot.temperature;
+    }
+    catch(const std::exception &e)
+    {
+        // The device is calibrated either way, only the next start is slower
+        std::cerr << "init_sdr: calibration snapshot not saved: " << e.what() << std::endl;
+    }
+    return true;
+}
+
+bool ADSDR_impl::setup_ad9361()
 {
-    ad9361_init(&phy, &ad_default_param);
-    ad9361_set_rx_fir_config(phy, rx_fir_config);
-    ad9361_set_tx_fir_config(phy, tx_fir_config);
+    if(ad9361_init(&phy, &ad_default_param) < 0)
+    {
+        phy = nullptr;
+        return false;
+    }
+    load_fir_design(phy, &_platform, true, *_rx_fir_design);
+    load_fir_design(phy, &_platform, false, *_tx_fir_design);
     ad9361_set_no_ch_mode(phy, 1);
     print_ensm_state(phy);
     ad9361_set_en_state_machine_mode(phy, ENSM_MODE_WAIT);
@@ -551,78 +570,79 @@ bool ADSDR_impl::init_sdr()
     return true;
 }
 
-std::vector<std::string> ADSDR_impl::list_connected()
+void ADSDR_impl::drop_ad9361()
 {
-    libusb_device **devs;
-    libusb_context *list_ctx;
-
-    std::vector<std::string> list;
-
-    int ret = libusb_init(&list_ctx);
-    if(ret < 0)
+    if(phy != nullptr)
     {
-        throw ConnectionError("libusb init error %d: error " + std::to_string(ret));
+        ad9361_remove(phy);
+        phy = nullptr;
     }
+}
 
-    // Set verbosity level
-    libusb_set_debug(list_ctx, 3);
-
-    // Retrieve device list
-    int num_devs = (int) libusb_get_device_list(list_ctx, &devs);
-    if(num_devs < 0)
+void ADSDR_impl::update_fir_designs(uint32_t samp_freq_hz)
+{
+    // RX and TX run at the same rate, so both ratios follow it
+    uint32_t bandwidth_hz;
+    ad9361_get_rx_rf_bandwidth(phy, &bandwidth_hz);
+    const fir_design &rx = select_fir_design(samp_freq_hz, bandwidth_hz);
+    if(&rx != _rx_fir_design)
     {
-        throw ConnectionError("libusb device list retrieval error");
+        load_fir_design(phy, &_platform, true, rx);
+        fir_config(rx, rx_fir_config);
+        _rx_fir_design = &rx;
     }
 
-    // Find all ADSDR devices
-    for(int i = 0; i < num_devs; i++)
+    ad9361_get_tx_rf_bandwidth(phy, &bandwidth_hz);
+    const fir_design &tx = select_fir_design(samp_freq_hz, bandwidth_hz);
+    if(&tx != _tx_fir_design)
     {
-        libusb_device_descriptor desc;
-        int ret = libusb_get_device_descriptor(devs[i], &desc);
-        if(ret < 0)
-        {
-            throw ConnectionError("libusb error getting device descriptor %d: error " + std::to_string(ret));
-        }
+        load_fir_design(phy, &_platform, false, tx);
+        fir_config(tx, tx_fir_config);
+        _tx_fir_design = &tx;
+    }
+}
 
-        if(desc.idVendor == ADSDR_VENDOR_ID && desc.idProduct == ADSDR_PRODUCT_ID)
-        {
-	    libusb_device_handle *temp_handle;
-            int ret = libusb_open(devs[i], &temp_handle);
-            if(ret != 0)
-            {
-                throw ConnectionError("libusb could not open found ADSDR USB device %d: error " + std::to_string(ret));
-            }
+std::vector<std::string> ADSDR_impl::list_connected()
+{
+    std::vector<std::string> errors;
+    std::vector<device_info> devices = device_registry::instance().devices(&errors);
 
-        // Check if correct serial number
-        if(desc.iSerialNumber)
+    std::vector<std::string> serials;
+    for(size_t i = 0; i < devices.size(); i++)
+    {
+        if(devices[i].bootloader)
         {
-            char serial_num_buf[MAX_SERIAL_LENGTH];
-            ret = libusb_get_string_descriptor_ascii(temp_handle, /*ADSDR_SERIAL_DSCR_INDEX*/desc.iSerialNumber, (unsigned char *) serial_num_buf, MAX_SERIAL_LENGTH);
-            if(ret < 0)
-            {
-                throw ConnectionError("2) libusb could not read ADSDR serial number %d: error " + std::to_string(ret));
-            }
-            else
-            {
-                list.push_back(std::string(serial_num_buf));
-            }
+            continue;
         }
-        else
-            list.push_back(std::string("12345"));
-	    
-	    libusb_close(temp_handle);
+        if(!errors[i].empty())
+        {
+            throw ConnectionError(errors[i]);
         }
+        serials.push_back(devices[i].serial);
     }
 
-    libusb_exit(list_ctx);
+    return serials;
+}
+
+std::vector<device_info> ADSDR_impl::connected_devices()
+{
+    return device_registry::instance().devices();
+}
+
+int ADSDR_impl::subscribe_hotplug(std::function<void(const hotplug_event &)> callback)
+{
+    return device_registry::instance().subscribe(callback);
+}
 
-    return list;
+void ADSDR_impl::unsubscribe_hotplug(int id)
+{
+    device_registry::instance().unsubscribe(id);
 }
 
 bool ADSDR_impl::fpga_loaded()
 {
     std::array<unsigned char, ADSDR_USB_CTRL_SIZE> stat_buf{};
-    int ret = libusb_control_transfer(_adsdr_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN, ADSDR_FPGA_CONFIG_STATUS, 0, 1, stat_buf.data(), (uint16_t) stat_buf.size(), ADSDR_USB_TIMEOUT);
+    int ret = _transport->control(LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN, ADSDR_FPGA_CONFIG_STATUS, 0, 1, stat_buf.data(), (uint16_t) stat_buf.size(), ADSDR_USB_TIMEOUT);
     if(ret < 0)
     {
         throw ConnectionError("2) ADSDR not responding %d: error " + std::to_string(ret));
@@ -634,16 +654,63 @@ bool ADSDR_impl::fpga_loaded()
 
 fpga_status ADSDR_impl::load_fpga(std::string filename)
 {
-    filename = filename;
+    // A virtual device has no FPGA to configure
+    if(_transport->handle() == nullptr)
+    {
+        return FPGA_CONFIG_SKIPPED;
+    }
+
+    mapped_file image(filename);
+    uint64_t hash = fpga_bitstream_hash(image);
+    if(_fpga_hash_valid && _fpga_hash == hash && fpga_loaded())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_recovery_lock);
+            _fpga_path = filename;
+        }
+        return FPGA_CONFIG_SKIPPED;
+    }
+    _fpga_hash_valid = false;
+
+    // The FX3 is told the size of the bitstream up front, most significant half in wValue
+    uint32_t size = (uint32_t) image.size();
+    int ret = _transport->control(LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT, ADSDR_FPGA_CONFIG_LOAD, (uint16_t) (size >> 16), (uint16_t) (size & 0xFFFF), nullptr, 0, ADSDR_USB_TIMEOUT);
+    if(ret < 0)
+    {
+        throw ConnectionError("Could not start FPGA configuration. libusb error: " + std::to_string(ret));
+    }
+
+    ret = send_fpga_bitstream(*_transport, image);
+    if(ret == LIBUSB_ERROR_NO_DEVICE)
+    {
+        throw ConnectionError("ADSDR disconnected while loading the FPGA");
+    }
+
+    bool configured = ret == 0 && wait_fpga_configured(*_transport, FPGA_CONFIG_TIMEOUT_MS);
+
+    // Hands the bus back from configuration to streaming
+    std::array<unsigned char, ADSDR_USB_CTRL_SIZE> stat_buf{};
+    _transport->control(LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN, ADSDR_FPGA_CONFIG_FINISH, 0, 1, stat_buf.data(), (uint16_t) stat_buf.size(), ADSDR_USB_TIMEOUT);
 
-    return FPGA_CONFIG_SKIPPED; // @camry
+    if(!configured)
+    {
+        return FPGA_CONFIG_ERROR;
+    }
+
+    _fpga_hash = hash;
+    _fpga_hash_valid = true;
+    {
+        std::lock_guard<std::mutex> lock(_recovery_lock);
+        _fpga_path = filename;
+    }
+    return FPGA_CONFIG_DONE;
 }
 
 libusb_transfer* ADSDR_impl::create_rx_transfer(libusb_transfer_cb_fn callback)
 {
     libusb_transfer *transfer = libusb_alloc_transfer(0);
     unsigned char *buf = new unsigned char[ADSDR_RX_TX_BUF_SIZE];
-    libusb_fill_bulk_transfer(transfer, _adsdr_handle, ADSDR_RX_IN, buf, ADSDR_RX_TX_BUF_SIZE, callback, nullptr, ADSDR_USB_TIMEOUT);
+    libusb_fill_bulk_transfer(transfer, _transport->handle(), ADSDR_RX_IN, buf, ADSDR_RX_TX_BUF_SIZE, callback, this, ADSDR_USB_TIMEOUT);
 
     return transfer;
 }
@@ -651,7 +718,7 @@ libusb_transfer* ADSDR_impl::create_rx_transfer(libusb_transfer_cb_fn callback)
 libusb_transfer* ADSDR_impl::create_intr_transfer(libusb_transfer_cb_fn callback){
     libusb_transfer *transfer = libusb_alloc_transfer(0);
     unsigned char *buf = new unsigned char[256];
-    libusb_fill_interrupt_transfer(transfer, _adsdr_handle, ADSDR_DEBUG_IN, buf, 128, callback, nullptr, ADSDR_USB_TIMEOUT);
+    libusb_fill_interrupt_transfer(transfer, _transport->handle(), ADSDR_DEBUG_IN, buf, 128, callback, this, ADSDR_USB_TIMEOUT);
     return transfer;
 }
 
@@ -661,7 +728,7 @@ libusb_transfer* ADSDR_impl::create_tx_transfer(libusb_transfer_cb_fn callback)
 #if 0
     libusb_transfer *transfer = libusb_alloc_transfer(0);
     unsigned char *buf = new unsigned char[ADSDR_TX_BUF_SIZE];
-    libusb_fill_bulk_transfer(transfer, _adsdr_handle, ADSDR_TX_OUT, buf, ADSDR_TX_BUF_SIZE, callback, nullptr, ADSDR_USB_TIMEOUT);
+    libusb_fill_bulk_transfer(transfer, _transport->handle(), ADSDR_TX_OUT, buf, ADSDR_TX_BUF_SIZE, callback, this, ADSDR_USB_TIMEOUT);
     //TODO: transfer size
     return transfer;
 #endif
@@ -671,327 +738,1454 @@ libusb_transfer* ADSDR_impl::create_tx_transfer(libusb_transfer_cb_fn callback)
 
 void ADSDR_impl::rx_callback(libusb_transfer *transfer)
 {
+    ADSDR_impl *self = static_cast<ADSDR_impl *>(transfer->user_data);
+
     if(transfer->status == LIBUSB_TRANSFER_COMPLETED)
     {         
         // Transfer succeeded
+        self->_rx_transfer_errors = 0;
 
-        // Decode samples from transfer buffer into _rx_decoder_buf
+        // Decode samples from transfer buffer into a block from the pool
 //        printf("rx.buf.len: %d\n", transfer->actual_length);
 //        for(int i = 0; i < transfer->actual_length; i++) {
 //            printf("%02X ", transfer->buffer[i]);
 //        }
 //        printf("\n");
 
-        decode_rx_transfer(transfer->buffer, transfer->actual_length, _rx_decoder_buf);
+        rx_block_ref block = self->_rx_pool->acquire();
+        if(!block && self->_rx_overflow_policy == OVERFLOW_OVERWRITE_OLDEST)
+        {
+            // Free a block by evicting the oldest one waiting in the queue
+            rx_block_ref oldest = self->_rx_queue.drop_oldest();
+            if(oldest)
+            {
+                self->handle_rx_overflow(oldest->sequence(), oldest->size());
+                oldest.reset();
+                block = self->_rx_pool->acquire();
+            }
+        }
 
-        if(_rx_custom_callback)
+        uint64_t sequence = self->_rx_sequence++;
+        bool gap = sequence == self->_rx_gap_sequence.load();
+        std::shared_ptr<rx_decimator> decimator = std::atomic_load(&self->_decimator);
+        std::shared_ptr<rx_nco> nco = std::atomic_load(&self->_nco);
+        std::shared_ptr<rx_iq_correction> correction = std::atomic_load(&self->_iq_correction);
+        std::shared_ptr<rx_resampler> resampler = std::atomic_load(&self->_resampler);
+        size_t transfer_samples = transfer->actual_length / (2 * ADSDR_BYTES_PER_SAMPLE);
+        if(decimator != nullptr && (gap || !block))
         {
-            // Run the callback function
-            _rx_custom_callback(_rx_decoder_buf);
+            // The filter must not run across lost samples
+            decimator->reset();
         }
-        else
+        if(resampler != nullptr && (gap || !block))
         {
-            // No callback function specified, add samples to queue
-            for(sample s : _rx_decoder_buf)
+            resampler->reset();
+        }
+        if(nco != nullptr && !block)
+        {
+            nco->skip(transfer_samples);
+        }
+
+        if(block)
+        {
+            std::shared_ptr<rx_squelch> squelch = std::atomic_load(&self->_squelch);
+            rx_power power;
+            rx_power *measured = squelch != nullptr ? &power : nullptr;
+            // The squelch level is the mean over the delivered samples, so measure after resampling
+            rx_power *decoded = resampler != nullptr ? nullptr : measured;
+
+            size_t length;
+            if(decimator != nullptr)
             {
-                bool success = _rx_buf.try_enqueue(s);
-                if(!success)
-                {
-                    // TODO: overflow! handle this
-                }
+                length = decimator->decode(transfer->buffer, transfer->actual_length, rx_block_pool::writable(block), decoded, nco.get(), correction.get());
+            }
+            else if(correction != nullptr)
+            {
+                length = correction->decode(transfer->buffer, transfer->actual_length, rx_block_pool::writable(block), decoded, nco.get());
+            }
+            else if(nco != nullptr)
+            {
+                length = nco->decode(transfer->buffer, transfer->actual_length, rx_block_pool::writable(block), decoded);
+            }
+            else
+            {
+                length = decode_rx_transfer(transfer->buffer, transfer->actual_length, rx_block_pool::writable(block), decoded);
+            }
+            if(resampler != nullptr)
+            {
+                length = resampler->process(rx_block_pool::writable(block), length, measured);
             }
+            rx_block_pool::set_size(block, length);
+            rx_block_pool::set_sequence(block, sequence);
+            rx_block_pool::set_gap(block, gap, gap ? self->_rx_gap_samples.load() : 0);
+
+            if(squelch != nullptr)
+            {
+                const float full_scale_power = (float) ADSDR_SAMPLE_FULL_SCALE * ADSDR_SAMPLE_FULL_SCALE;
+                rx_block_pool::set_power(block, power.energy / full_scale_power, power.peak / full_scale_power);
+            }
+
+            self->deliver_rx_block(block, squelch.get());
+        }
+        else
+        {
+            // All blocks are still held by consumers
+            // Counted in delivered samples, after decimation and resampling
+            self->handle_rx_overflow(sequence, (uint64_t) (transfer_samples * self->rx_stream_rate(1)));
         }
     }
-    else
+    else if(transfer->status == LIBUSB_TRANSFER_NO_DEVICE)
     {
-        // TODO: Handle error
-
+        self->request_recovery(RECOVERY_DEVICE_LOST);
+    }
+    else if(transfer->status == LIBUSB_TRANSFER_STALL)
+    {
+        self->request_recovery(RECOVERY_STALL);
+    }
+    else if(transfer->status == LIBUSB_TRANSFER_ERROR && ++self->_rx_transfer_errors >= std::atomic_load(&self->_recovery_config)->max_transfer_errors)
+    {
+        // A single failed transfer is only a lost block, a run of them means the endpoint is stuck
+        self->request_recovery(RECOVERY_STALL);
     }
 
     // Resubmit the transfer
-    if(transfer->status != LIBUSB_TRANSFER_CANCELLED)
+    bool resubmitted = false;
+    if(transfer->status != LIBUSB_TRANSFER_CANCELLED && !self->_rx_halted.load() && !self->_recovering.load())
     {
-        int ret = libusb_submit_transfer(transfer);
+        int ret = self->_transport->submit(transfer);
 
         if(ret < 0)
         {
-            // TODO: Handle error
+            self->request_recovery(ret == LIBUSB_ERROR_NO_DEVICE ? RECOVERY_DEVICE_LOST : RECOVERY_STALL);
         }
+        resubmitted = ret == 0;
+    }
+
+    // Only counted out once the callback is done, so a recovery never overlaps it
+    if(!resubmitted)
+    {
+        self->_transfers_in_flight--;
     }
 }
 
-void ADSDR_impl::intr_callback(libusb_transfer *transfer)
+void ADSDR_impl::deliver_rx_block(const rx_block_ref &block, rx_squelch *squelch)
 {
-    if(transfer->status == LIBUSB_TRANSFER_COMPLETED)
+    std::shared_ptr<capture_ring> capture = std::atomic_load(&_capture);
+    if(capture != nullptr)
     {
-        // Transfer succeeded
+        capture->write(*block);
+    }
 
-        // Decode samples from transfer buffer into _rx_decoder_buf
-        uint8_t priority = transfer->buffer[0];
-        uint8_t threadId = transfer->buffer[1];
-        uint16_t msg = (transfer->buffer[2] << 8) |
-                       (transfer->buffer[3] << 0);
-        uint32_t param = (transfer->buffer[4] << 24) |
-                         (transfer->buffer[5] << 16) |
-                         (transfer->buffer[6] << 8) |
-                         (transfer->buffer[7] << 0);
+    if(squelch != nullptr && !squelch->update(*block))
+    {
+        // Gated, the block goes back to the pool right away
+        return;
+    }
 
-        printf("[p=%d th=%d msg=%04X par=%08X]: %s\n\n", priority, threadId, msg, param, transfer->buffer + 8);
+    std::shared_ptr<const rx_subscriber_list> subscribers = std::atomic_load(&_rx_subscribers);
+
+    for(auto &subscriber : *subscribers)
+    {
+        subscriber.second->push(block);
     }
-    else
+
+    if(_rx_custom_callback)
     {
-        // TODO: Handle error
+        // Run the callback function
+        _rx_decoder_buf.assign(block->begin(), block->end());
+        _rx_custom_callback(_rx_decoder_buf);
+    }
+    else if(subscribers->empty())
+    {
+        // No callback function or subscriber specified, add block to queue
+        bool success = _rx_queue.push(block);
+        if(!success && _rx_overflow_policy == OVERFLOW_OVERWRITE_OLDEST)
+        {
+            // The consumer may have emptied the queue since the push failed
+            rx_block_ref oldest = _rx_queue.drop_oldest();
+            if(oldest)
+            {
+                handle_rx_overflow(oldest->sequence(), oldest->size());
+            }
+            success = _rx_queue.push(block);
+        }
+        if(!success)
+        {
+            handle_rx_overflow(block->sequence(), block->size());
+        }
+    }
+}
+
+void ADSDR_impl::handle_rx_overflow(uint64_t sequence, size_t samples)
+{
+    uint64_t count = ++_rx_overflows;
 
+    if(_rx_overflow_policy == OVERFLOW_STOP_STREAM)
+    {
+        // Transfers still in flight complete normally but are not resubmitted
+        _rx_halted.store(true);
+        _rx_streaming.store(false);
     }
 
-    // Resubmit the transfer
-    if(transfer->status != LIBUSB_TRANSFER_CANCELLED)
+    std::shared_ptr<std::function<void(const rx_overflow &)>> callback = std::atomic_load(&_rx_overflow_callback);
+    if(callback != nullptr && *callback)
+    {
+        rx_overflow event;
+        event.sequence = sequence;
+        event.samples = samples;
+        event.count = count;
+        (*callback)(event);
+    }
+}
+
+void ADSDR_impl::request_recovery(recovery_reason reason)
+{
+    if(!_rx_streaming.load() || !std::atomic_load(&_recovery_config)->enabled)
     {
-        int ret = libusb_submit_transfer(transfer);
+        return;
+    }
 
-        if(ret < 0)
+    std::lock_guard<std::mutex> lock(_recovery_lock);
+    if(_recovering.load())
+    {
+        // The rest of the transfers fail too once the board is gone
+        if(reason == RECOVERY_DEVICE_LOST)
         {
-            // TODO: Handle error
+            _recovery_reason = reason;
         }
+        return;
+    }
+
+    _recovering.store(true);
+    _recovery_pending = true;
+    _recovery_reason = reason;
+    _recovery_start = std::chrono::steady_clock::now();
+    _recovery_cv.notify_one();
+}
+
+void ADSDR_impl::run_recovery()
+{
+    std::unique_lock<std::mutex> lock(_recovery_lock);
+    while(true)
+    {
+        _recovery_cv.wait(lock, [this]() { return !_run_recovery.load() || _recovery_pending; });
+        if(!_run_recovery.load())
+        {
+            break;
+        }
+        _recovery_pending = false;
+
+        lock.unlock();
+        recover();
+        lock.lock();
+    }
+}
+
+void ADSDR_impl::recover()
+{
+    std::lock_guard<std::mutex> stream(_stream_lock);
+    if(!_rx_streaming.load())
+    {
+        _recovering.store(false);
+        return;
+    }
+
+    // Callbacks stopped resubmitting, take back what is still in flight
+    for(libusb_transfer *transfer : _rx_transfers)
+    {
+        _transport->cancel(transfer);
+    }
+    for(libusb_transfer *transfer : _intr_transfers)
+    {
+        _transport->cancel(transfer);
+    }
+    std::chrono::steady_clock::time_point drain_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(RECOVERY_DRAIN_TIMEOUT_MS);
+    while(_transfers_in_flight.load() > 0 && std::chrono::steady_clock::now() < drain_deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // The old transport and its event thread stay up until the stragglers complete
+    bool drained = _transfers_in_flight.load() == 0;
+
+    recovery_reason reason;
+    std::chrono::steady_clock::time_point start;
+    {
+        std::lock_guard<std::mutex> lock(_recovery_lock);
+        reason = _recovery_reason;
+        start = _recovery_start;
+    }
+
+    bool recovered = false;
+    if(drained && reason == RECOVERY_STALL)
+    {
+        recovered = _transport->clear_halt(ADSDR_RX_IN) == LIBUSB_SUCCESS;
+        if(!recovered)
+        {
+            // An endpoint that cannot be cleared is handled like a board that left the bus
+            reason = RECOVERY_DEVICE_LOST;
+        }
+    }
+    if(drained && !recovered)
+    {
+        recovered = reconnect();
+    }
+    if(!_rx_streaming.load())
+    {
+        // stop_rx was called meanwhile
+        _recovering.store(false);
+        return;
+    }
+    if(recovered)
+    {
+        // For the first block after the gap, no transfer is in flight until restart_rx
+        _rx_gap_samples.store(rx_lost_samples(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()));
+        recovered = restart_rx();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    {
+        std::lock_guard<std::mutex> lock(_recovery_lock);
+        if(recovered)
+        {
+            _recovery_stats.recoveries++;
+            _recovery_stats.last_seconds = seconds;
+            _recovery_stats.max_seconds = max(_recovery_stats.max_seconds, seconds);
+            _recovery_stats.total_seconds += seconds;
+        }
+        else
+        {
+            _recovery_stats.failures++;
+        }
+    }
+
+    if(!recovered)
+    {
+        // The stream stays stopped until start_rx
+        _rx_halted.store(true);
+        _rx_streaming.store(false);
+        _recovering.store(false);
+        std::cerr << "RX stream could not be recovered from " << (reason == RECOVERY_STALL ? "a stall" : "losing the device")
+                  << (drained ? "" : ", cancelled transfers did not complete") << std::endl;
+        return;
+    }
+
+    std::shared_ptr<std::function<void(const rx_gap &)>> gap_callback = std::atomic_load(&_rx_gap_callback);
+    if(gap_callback != nullptr && *gap_callback)
+    {
+        rx_gap gap = {};
+        gap.sequence = _rx_gap_sequence.load();
+        gap.reason = reason;
+        gap.seconds = seconds;
+        gap.lost_samples = _rx_gap_samples.load();
+        (*gap_callback)(gap);
+    }
+}
+
+bool ADSDR_impl::reconnect()
+{
+    std::unique_ptr<transport> fresh;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::atomic_load(&_recovery_config)->reopen_timeout_ms);
+    while(fresh == nullptr && _run_recovery.load() && _rx_streaming.load() && std::chrono::steady_clock::now() < deadline)
+    {
+        fresh = _transport->reopen(std::chrono::milliseconds(RECOVERY_REOPEN_SLICE_MS));
+    }
+    if(fresh == nullptr)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> commands(_command_lock);
+
+    // Nothing is in flight on the old transport anymore, its event thread can be joined
+    _run_rx_tx.store(false);
+    _transport->interrupt();
+    _rx_tx_worker->join();
+
+    _transport = std::move(fresh);
+    _platform.control_user = _transport.get();
+    for(libusb_transfer *transfer : _rx_transfers)
+    {
+        transfer->dev_handle = _transport->handle();
+    }
+    for(libusb_transfer *transfer : _intr_transfers)
+    {
+        transfer->dev_handle = _transport->handle();
+    }
+
+    _run_rx_tx.store(true);
+    _rx_tx_worker.reset(new std::thread([this]() {
+        run_rx_tx();
+    }));
+
+    // A board that lost power comes back with the FPGA unconfigured, load the last bitstream again
+    std::string fpga_path;
+    {
+        std::lock_guard<std::mutex> lock(_recovery_lock);
+        fpga_path = _fpga_path;
+    }
+    try
+    {
+        if(_transport->handle() != nullptr && !fpga_loaded() && (fpga_path.empty() || load_fpga(fpga_path) != FPGA_CONFIG_DONE))
+        {
+            return false;
+        }
+    }
+    catch(const std::exception &e)
+    {
+        std::cerr << "Could not reload the FPGA: " << e.what() << std::endl;
+        return false;
+    }
+
+    // A board that re-enumerated has lost its configuration
+    if(_initialized)
+    {
+        // init_sdr allocates the driver state anew
+        drop_ad9361();
+        if(!init_sdr())
+        {
+            return false;
+        }
+        for(const command &setting : _settings)
+        {
+            ad9364_cmd(setting.cmd, setting.param);
+        }
+    }
+    return true;
+}
+
+uint64_t ADSDR_impl::rx_lost_samples(double seconds)
+{
+    if(phy == nullptr)
+    {
+        return 0;
+    }
+    uint32_t sample_rate;
+    ad9361_get_rx_sampling_freq(phy, &sample_rate);
+    return (uint64_t) (seconds * rx_stream_rate(sample_rate));
+}
+
+bool ADSDR_impl::restart_rx()
+{
+    // Nothing is in flight, so the event thread does not touch the sequence number here
+    _rx_gap_sequence.store(_rx_sequence);
+    _rx_transfer_errors = 0;
+    _recovering.store(false);
+
+    try
+    {
+        for(libusb_transfer *transfer : _rx_transfers)
+        {
+            _transfers_in_flight++;
+            int ret = _transport->submit(transfer);
+            if(ret < 0)
+            {
+                _transfers_in_flight--;
+                throw ConnectionError("Could not submit RX transfer. libusb error: " + std::to_string(ret));
+            }
+        }
+        start_intr();
+    }
+    catch(const ConnectionError &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+
+    deviceStart();
+    return true;
+}
+
+void ADSDR_impl::intr_callback(libusb_transfer *transfer)
+{
+    ADSDR_impl *self = static_cast<ADSDR_impl *>(transfer->user_data);
+
+    if(transfer->status == LIBUSB_TRANSFER_COMPLETED)
+    {
+        // Transfer succeeded
+
+        // Decode samples from transfer buffer into _rx_decoder_buf
+        uint8_t priority = transfer->buffer[0];
+        uint8_t threadId = transfer->buffer[1];
+        uint16_t msg = (transfer->buffer[2] << 8) |
+                       (transfer->buffer[3] << 0);
+        uint32_t param = (transfer->buffer[4] << 24) |
+                         (transfer->buffer[5] << 16) |
+                         (transfer->buffer[6] << 8) |
+                         (transfer->buffer[7] << 0);
+
+        printf("[p=%d th=%d msg=%04X par=%08X]: %s\n\n", priority, threadId, msg, param, transfer->buffer + 8);
+    }
+    else
+    {
+        // TODO: Handle error
+
+    }
+
+    // Resubmit the transfer
+    bool resubmitted = false;
+    if(transfer->status != LIBUSB_TRANSFER_CANCELLED && !self->_recovering.load())
+    {
+        int ret = self->_transport->submit(transfer);
+
+        if(ret < 0)
+        {
+            // TODO: Handle error
+        }
+        resubmitted = ret == 0;
+    }
+
+    if(!resubmitted)
+    {
+        self->_transfers_in_flight--;
+    }
+}
+
+void ADSDR_impl::tx_callback(libusb_transfer* transfer)
+{
+    ADSDR_impl *self = static_cast<ADSDR_impl *>(transfer->user_data);
+
+    if(transfer->status == LIBUSB_TRANSFER_COMPLETED)
+    {
+        // Success
+        if(transfer->actual_length != transfer->length)
+        {
+            std::cout << "actual length != length: " << transfer->actual_length << "; " << transfer->length << std::endl;
+        }
+    }
+    else
+    {
+        // TODO: Handle error
+        if(transfer->status != LIBUSB_TRANSFER_CANCELLED)
+        {
+            std::cerr << "transfer error with status " << transfer->status << std::endl;
+        }
+    }
+
+    // Resubmit the transfer with new data
+    if(transfer->status != LIBUSB_TRANSFER_CANCELLED)
+    {
+        self->fill_tx_transfer(transfer);
+        int ret = self->_transport->submit(transfer);
+
+        if(ret < 0)
+        {
+            // TODO: Handle error
+            std::cerr << "transfer submission error with status " << transfer->status << std::endl;
+        }
+    }
+}
+
+void ADSDR_impl::start_intr()
+{
+    for(libusb_transfer *transfer: _intr_transfers)
+    {
+        _transfers_in_flight++;
+        int ret = _transport->submit(transfer);
+
+        if(ret < 0)
+        {
+            _transfers_in_flight--;
+            throw ConnectionError("Could not submit INTR transfer. libusb error: " + std::to_string(ret));
+        }
+    }
+}
+
+void ADSDR_impl::stop_intr()
+{
+    for(libusb_transfer *transfer: _intr_transfers)
+    {
+        int ret = _transport->cancel(transfer);
+        if(ret == LIBUSB_ERROR_NOT_FOUND || ret == 0)
+        {
+            // Transfer cancelled
+        }
+        else
+        {
+            // Error
+            throw ConnectionError("Could not cancel INTR transfer. libusb error: " + std::to_string(ret));
+        }
+    }
+}
+
+void ADSDR_impl::start_rx(std::function<void(const std::vector<sample> &)> rx_callback)
+{
+    std::lock_guard<std::mutex> stream(_stream_lock);
+
+    _rx_custom_callback = rx_callback;
+    _rx_sequence = 0;
+    _rx_overflows.store(0);
+    _rx_halted.store(false);
+    _rx_transfer_errors = 0;
+    _rx_gap_sequence.store(UINT64_MAX);
+    {
+        std::lock_guard<std::mutex> lock(_recovery_lock);
+        _recovery_stats = {};
+        _recovery_pending = false;
+    }
+    _recovering.store(false);
+    _rx_streaming.store(true);
+
+    for(libusb_transfer *transfer: _rx_transfers)
+    {
+        _transfers_in_flight++;
+        int ret = _transport->submit(transfer);
+
+        if(ret < 0)
+        {
+            _transfers_in_flight--;
+            throw ConnectionError("Could not submit RX transfer. libusb error: " + std::to_string(ret));
+        }
+    }
+
+    start_intr();
+
+    deviceStart();
+}
+
+void ADSDR_impl::stop_rx()
+{
+    // A recovery in progress gives up at its next check
+    _rx_streaming.store(false);
+    std::lock_guard<std::mutex> stream(_stream_lock);
+
+    for(libusb_transfer *transfer: _rx_transfers)
+    {
+        int ret = _transport->cancel(transfer);
+        if(ret == LIBUSB_ERROR_NOT_FOUND || ret == 0)
+        {
+            // Transfer cancelled
+        }
+        else
+        {
+            // Error
+            throw ConnectionError("Could not cancel RX transfer. libusb error: " + std::to_string(ret));
+        }
+    }
+
+    stop_intr();
+}
+
+void ADSDR_impl::start_tx(std::function<void(std::vector<sample> &)> tx_callback)
+{
+    _tx_custom_callback = tx_callback;
+
+    // Fill the tx buffer with empty samples
+    sample empty_sample{0, 0};
+    while(_tx_buf.try_enqueue(empty_sample)) {}
+
+    for(libusb_transfer *transfer: _tx_transfers)
+    {
+        fill_tx_transfer(transfer);
+        int ret = _transport->submit(transfer);
+
+        if(ret < 0)
+        {
+            throw ConnectionError("Could not submit TX transfer. libusb error: " + std::to_string(ret));
+        }
+    }
+}
+
+void ADSDR_impl::stop_tx()
+{
+#if 0
+    for(libusb_transfer *transfer: _tx_transfers)
+    {
+        int ret = _transport->cancel(transfer);
+        if(ret == LIBUSB_ERROR_NOT_FOUND || ret == 0)
+        {
+            // Transfer cancelled
+        }
+        else
+        {
+            // Error
+            throw ConnectionError("Could not cancel TX transfer. libusb error: " + std::to_string(ret));
+        }
+    }
+#endif
+}
+
+int ADSDR_impl::fill_tx_transfer(libusb_transfer* transfer)
+{
+    // Fill the transfer buffer with available samples
+    transfer->length = ADSDR_TX_BUF_SIZE;
+
+    _tx_encoder_buf.resize(transfer->length/ADSDR_BYTES_PER_SAMPLE);
+
+    if(_tx_custom_callback)
+    {
+        _tx_custom_callback(_tx_encoder_buf);
+    }
+    else
+    {
+        for(sample &s : _tx_encoder_buf)
+        {
+            int success = _tx_buf.try_dequeue(s);
+            if(!success)
+            {
+                // TODO: Notify of this? Do something else?
+                // No data available, fill with zeros
+                s.i = 0;
+                s.q = 0;
+            }
+        }
+    }
+
+    encode_tx_transfer(_tx_encoder_buf.data(), transfer->length / ADSDR_BYTES_PER_SAMPLE, transfer->buffer);
+
+    return transfer->length;
+}
+
+void ADSDR_impl::run_rx_tx()
+{
+    while(_run_rx_tx.load()) {
+        _transport->handle_events();
+    }
+}
+
+unsigned long ADSDR_impl::available_rx_samples()
+{
+    return _rx_queue.available();
+}
+
+bool ADSDR_impl::get_rx_sample(sample &s)
+{
+    return _rx_queue.pop(s);
+}
+
+bool ADSDR_impl::wait_rx_samples(unsigned long min_samples, unsigned int timeout_ms)
+{
+    return _rx_queue.wait(min_samples, timeout_ms);
+}
+
+unsigned long ADSDR_impl::read_rx_samples(sample *destination, unsigned long max_samples, unsigned long min_samples, unsigned int timeout_ms)
+{
+    _rx_queue.wait(min(min_samples, max_samples), timeout_ms);
+    return _rx_queue.read(destination, max_samples);
+}
+
+int ADSDR_impl::rx_event_fd() const
+{
+    return _rx_queue.event_fd();
+}
+
+void ADSDR_impl::set_rx_low_water_mark(unsigned long samples)
+{
+    _rx_queue.set_low_water_mark(samples);
+}
+
+bool ADSDR_impl::submit_tx_sample(sample &s)
+{
+    return _tx_buf.try_enqueue(s);
+}
+
+void ADSDR_impl::enable_squelch(const squelch_config &config)
+{
+    std::atomic_store(&_squelch, std::make_shared<rx_squelch>(config));
+}
+
+void ADSDR_impl::disable_squelch()
+{
+    std::atomic_store(&_squelch, std::shared_ptr<rx_squelch>());
+}
+
+squelch_stats ADSDR_impl::rx_squelch_stats()
+{
+    std::shared_ptr<rx_squelch> squelch = std::atomic_load(&_squelch);
+    if(squelch == nullptr)
+    {
+        squelch_stats stats = {true, 0, 0};
+        return stats;
+    }
+    return squelch->stats();
+}
+
+void ADSDR_impl::enable_iq_correction(const iq_correction_config &config, const iq_correction_estimate &seed)
+{
+    std::atomic_store(&_iq_correction, std::make_shared<rx_iq_correction>(config, seed));
+}
+
+void ADSDR_impl::disable_iq_correction()
+{
+    std::atomic_store(&_iq_correction, std::shared_ptr<rx_iq_correction>());
+}
+
+iq_correction_estimate ADSDR_impl::rx_iq_correction_estimate() const
+{
+    std::shared_ptr<rx_iq_correction> correction = std::atomic_load(&_iq_correction);
+    return correction != nullptr ? correction->estimate() : iq_correction_estimate();
+}
+
+void ADSDR_impl::enable_rx_decimation(const decimation_config &config)
+{
+    if(_output_rate != 0.0)
+    {
+        throw std::runtime_error("enable_rx_decimation: the output rate is set, call set_rx_output_rate(0) first");
+    }
+    std::atomic_store(&_decimator, std::make_shared<rx_decimator>(config));
+}
+
+void ADSDR_impl::disable_rx_decimation()
+{
+    if(_output_rate != 0.0)
+    {
+        throw std::runtime_error("disable_rx_decimation: the output rate is set, call set_rx_output_rate(0) first");
+    }
+    std::atomic_store(&_decimator, std::shared_ptr<rx_decimator>());
+}
+
+void ADSDR_impl::set_rx_frequency_shift(double offset_hz)
+{
+    if(offset_hz == 0.0)
+    {
+        std::atomic_store(&_nco, std::shared_ptr<rx_nco>());
+        return;
+    }
+    if(phy == nullptr)
+    {
+        throw std::runtime_error("set_rx_frequency_shift: init_sdr has not been called");
+    }
+
+    uint32_t sample_rate = 0;
+    ad9361_get_rx_sampling_freq(phy, &sample_rate);
+
+    std::shared_ptr<rx_nco> nco = std::atomic_load(&_nco);
+    if(nco != nullptr)
+    {
+        // Retune the running oscillator so the phase stays continuous
+        nco->set_frequency(offset_hz, sample_rate);
+    }
+    else
+    {
+        std::atomic_store(&_nco, std::make_shared<rx_nco>(offset_hz, sample_rate));
+    }
+}
+
+double ADSDR_impl::rx_frequency_shift() const
+{
+    std::shared_ptr<rx_nco> nco = std::atomic_load(&_nco);
+    return nco != nullptr ? nco->frequency() : 0.0;
+}
+
+double ADSDR_impl::rx_stream_rate(uint32_t sample_rate) const
+{
+    std::shared_ptr<rx_decimator> decimator = std::atomic_load(&_decimator);
+    std::shared_ptr<rx_resampler> resampler = std::atomic_load(&_resampler);
+    double rate = sample_rate;
+    if(decimator != nullptr)
+    {
+        rate /= decimator->factor();
+    }
+    if(resampler != nullptr)
+    {
+        rate *= resampler->ratio();
+    }
+    return rate;
+}
+
+double ADSDR_impl::set_rx_output_rate(double rate_hz)
+{
+    if(rate_hz == 0.0)
+    {
+        if(_output_rate != 0.0)
+        {
+            std::atomic_store(&_decimator, std::shared_ptr<rx_decimator>());
+            std::atomic_store(&_resampler, std::shared_ptr<rx_resampler>());
+            _output_rate = 0.0;
+        }
+        return 0.0;
+    }
+    if(!(rate_hz > 0.0 && rate_hz <= ADSDR_RX_MAX_SAMP_FREQ))
+    {
+        throw std::invalid_argument("set_rx_output_rate: rate must be positive and at most " + std::to_string(ADSDR_RX_MAX_SAMP_FREQ) + " Hz");
+    }
+    if(phy == nullptr)
+    {
+        throw std::runtime_error("set_rx_output_rate: init_sdr has not been called");
+    }
+    // The decimation is part of the output rate, a user filter would be lost or applied twice
+    if(_output_rate == 0.0 && std::atomic_load(&_decimator) != nullptr)
+    {
+        throw std::runtime_error("set_rx_output_rate: decimation is enabled, call disable_rx_decimation first");
+    }
+
+    // Below the clock chain's range, decimate on the host down to an integer multiple of the rate
+    unsigned int factor = (unsigned int) std::ceil(ADSDR_RX_MIN_SAMP_FREQ / rate_hz);
+    double target = rate_hz * factor;
+
+    // The clock chain lands within a few Hz of the request, ask for more until it is not below the target
+    uint32_t request = (uint32_t) std::ceil(target);
+    uint32_t actual = 0;
+    for(int attempt = 0; attempt < RX_RATE_ATTEMPTS; attempt++)
+    {
+        response reply = send_cmd(make_command(SET_RX_SAMP_FREQ, request));
+        if(reply.error != CMD_OK)
+        {
+            throw std::runtime_error("set_rx_output_rate: could not set the sample rate to " + std::to_string(request) + " Hz");
+        }
+        memcpy(&actual, &reply.param, sizeof(actual));
+        if(actual >= target)
+        {
+            break;
+        }
+        request += (uint32_t) std::ceil(target - actual);
+    }
+    if(actual < target)
+    {
+        throw std::runtime_error("set_rx_output_rate: no sample rate at or above " + std::to_string(target) + " Hz");
+    }
+
+    if(factor > 1)
+    {
+        decimation_config decimation;
+        decimation.factor = factor;
+        std::atomic_store(&_decimator, std::make_shared<rx_decimator>(decimation));
+    }
+    else
+    {
+        std::atomic_store(&_decimator, std::shared_ptr<rx_decimator>());
+    }
+
+    double ratio = target / actual;
+    std::atomic_store(&_resampler, ratio < 1.0 ? std::make_shared<rx_resampler>(ratio) : std::shared_ptr<rx_resampler>());
+    _output_rate = rate_hz;
+    return actual;
+}
+
+void ADSDR_impl::start_recording(const recording_config &config)
+{
+    if(_recorder != nullptr)
+    {
+        throw std::runtime_error("start_recording: already recording");
+    }
+    if(phy == nullptr)
+    {
+        throw std::runtime_error("start_recording: init_sdr has not been called");
+    }
+
+    uint32_t sample_rate = 0;
+    uint64_t frequency = 0;
+    ad9361_get_rx_sampling_freq(phy, &sample_rate);
+    ad9361_get_rx_lo_freq(phy, &frequency);
+    sample_rate = (uint32_t) std::lround(rx_stream_rate(sample_rate));
+
+    std::shared_ptr<sigmf_recorder> recorder = std::make_shared<sigmf_recorder>(config, sample_rate, frequency);
+    _recorder_subscription = subscribe_rx([recorder](const rx_block_ref &block) {
+        recorder->write(*block);
+    }, config.policy, config.queue_depth);
+    _recorder = recorder;
+}
+
+recording_stats ADSDR_impl::stop_recording()
+{
+    if(_recorder == nullptr)
+    {
+        throw std::runtime_error("stop_recording: not recording");
+    }
+
+    std::shared_ptr<sigmf_recorder> recorder = _recorder;
+    std::shared_ptr<rx_subscriber> subscriber = remove_rx_subscriber(_recorder_subscription);
+    _recorder.reset();
+    _recorder_subscription = -1;
+
+    // Blocks still queued for the writer are written before the files are closed
+    subscriber->close(true);
+    recorder->close();
+
+    recording_stats stats = recorder->stats();
+    rx_subscription_stats subscription = subscriber->stats();
+    stats.stalled = subscription.stalled;
+    stats.dropped = subscription.dropped;
+    return stats;
+}
+
+void ADSDR_impl::start_channelizer(const channelizer_config &config, std::function<void(const channelizer_block &)> callback)
+{
+    if(_channelizer != nullptr)
+    {
+        throw std::runtime_error("start_channelizer: already running");
+    }
+
+    std::shared_ptr<rx_channelizer> channelizer = std::make_shared<rx_channelizer>(config, callback);
+    _channelizer_subscription = subscribe_rx([channelizer](const rx_block_ref &block) {
+        channelizer->write(block);
+    }, config.policy, config.queue_depth);
+    _channelizer = channelizer;
+}
+
+channelizer_stats ADSDR_impl::stop_channelizer()
+{
+    if(_channelizer == nullptr)
+    {
+        throw std::runtime_error("stop_channelizer: not running");
+    }
+
+    std::shared_ptr<rx_channelizer> channelizer = _channelizer;
+    std::shared_ptr<rx_subscriber> subscriber = remove_rx_subscriber(_channelizer_subscription);
+    _channelizer.reset();
+    _channelizer_subscription = -1;
+
+    // Blocks still queued are channelized and delivered before the workers stop
+    subscriber->close(true);
+    channelizer->close();
+
+    channelizer_stats stats = channelizer->stats();
+    rx_subscription_stats subscription = subscriber->stats();
+    stats.stalled = subscription.stalled;
+    stats.dropped = subscription.dropped;
+    return stats;
+}
+
+void ADSDR_impl::start_psd(const psd_config &config, std::function<void(const psd_frame &)> callback)
+{
+    if(_psd != nullptr)
+    {
+        throw std::runtime_error("start_psd: already running");
+    }
+    if(phy == nullptr)
+    {
+        throw std::runtime_error("start_psd: init_sdr has not been called");
+    }
+
+    uint32_t sample_rate = 0;
+    ad9361_get_rx_sampling_freq(phy, &sample_rate);
+
+    std::shared_ptr<rx_psd> psd = std::make_shared<rx_psd>(config, rx_stream_rate(sample_rate), callback);
+    _psd_subscription = subscribe_rx([psd](const rx_block_ref &block) {
+        psd->write(*block);
+    }, config.policy, config.queue_depth);
+    std::atomic_store(&_psd, psd);
+}
+
+psd_stats ADSDR_impl::stop_psd()
+{
+    std::shared_ptr<rx_psd> psd = std::atomic_load(&_psd);
+    if(psd == nullptr)
+    {
+        throw std::runtime_error("stop_psd: not running");
+    }
+
+    std::shared_ptr<rx_subscriber> subscriber = remove_rx_subscriber(_psd_subscription);
+    std::atomic_store(&_psd, std::shared_ptr<rx_psd>());
+    _psd_subscription = -1;
+
+    subscriber->close(true);
+
+    psd_stats stats = psd->stats();
+    rx_subscription_stats subscription = subscriber->stats();
+    stats.stalled = subscription.stalled;
+    stats.dropped = subscription.dropped;
+    return stats;
+}
+
+void ADSDR_impl::reset_psd_max_hold()
+{
+    std::shared_ptr<rx_psd> psd = std::atomic_load(&_psd);
+    if(psd != nullptr)
+    {
+        psd->reset_max_hold();
+    }
+}
+
+recording_stats ADSDR_impl::recording_status()
+{
+    if(_recorder == nullptr)
+    {
+        throw std::runtime_error("recording_status: not recording");
+    }
+
+    recording_stats stats = _recorder->stats();
+    rx_subscription_stats subscription = subscription_stats(_recorder_subscription);
+    stats.stalled = subscription.stalled;
+    stats.dropped = subscription.dropped;
+    return stats;
+}
+
+bool ADSDR_impl::enable_capture(const capture_config &config)
+{
+    std::shared_ptr<capture_ring> capture = std::make_shared<capture_ring>(config);
+    std::atomic_store(&_capture, capture);
+    return capture->hugepages();
+}
+
+void ADSDR_impl::disable_capture()
+{
+    std::atomic_store(&_capture, std::shared_ptr<capture_ring>());
+}
+
+void ADSDR_impl::trigger_capture()
+{
+    std::shared_ptr<capture_ring> capture = std::atomic_load(&_capture);
+    if(capture == nullptr)
+    {
+        throw std::runtime_error("trigger_capture: capture is not enabled");
     }
+    capture->trigger();
 }
 
-void ADSDR_impl::tx_callback(libusb_transfer* transfer)
+bool ADSDR_impl::wait_capture(capture_window &window, unsigned int timeout_ms)
 {
-    if(transfer->status == LIBUSB_TRANSFER_COMPLETED)
+    std::shared_ptr<capture_ring> capture = std::atomic_load(&_capture);
+    if(capture == nullptr)
     {
-        // Success
-        if(transfer->actual_length != transfer->length)
-        {
-            std::cout << "actual length != length: " << transfer->actual_length << "; " << transfer->length << std::endl;
-        }
+        throw std::runtime_error("wait_capture: capture is not enabled");
     }
-    else
+    return capture->wait(window, timeout_ms);
+}
+
+void ADSDR_impl::rearm_capture()
+{
+    std::shared_ptr<capture_ring> capture = std::atomic_load(&_capture);
+    if(capture == nullptr)
     {
-        // TODO: Handle error
-        if(transfer->status != LIBUSB_TRANSFER_CANCELLED)
-        {
-            std::cerr << "transfer error with status " << transfer->status << std::endl;
-        }
+        throw std::runtime_error("rearm_capture: capture is not enabled");
     }
+    capture->rearm();
+}
 
-    // Resubmit the transfer with new data
-    if(transfer->status != LIBUSB_TRANSFER_CANCELLED)
-    {
-        fill_tx_transfer(transfer);
-        int ret = libusb_submit_transfer(transfer);
+void ADSDR_impl::set_rx_overflow_policy(overflow_policy policy, std::function<void(const rx_overflow &)> overflow_callback)
+{
+    std::atomic_store(&_rx_overflow_callback, std::make_shared<std::function<void(const rx_overflow &)>>(overflow_callback));
+    _rx_overflow_policy.store(policy);
+}
 
-        if(ret < 0)
-        {
-            // TODO: Handle error
-            std::cerr << "transfer submission error with status " << transfer->status << std::endl;
-        }
-    }
+uint64_t ADSDR_impl::rx_overflow_count() const
+{
+    return _rx_overflows.load();
 }
 
-void ADSDR_impl::start_intr()
+bool ADSDR_impl::is_rx_streaming() const
 {
-    for(libusb_transfer *transfer: _intr_transfers)
-    {
-        int ret = libusb_submit_transfer(transfer);
+    return _rx_streaming.load();
+}
 
-        if(ret < 0)
-        {
-            throw ConnectionError("Could not submit INTR transfer. libusb error: " + std::to_string(ret));
-        }
+void ADSDR_impl::set_rx_recovery(const recovery_config &config, std::function<void(const rx_gap &)> gap_callback)
+{
+    std::atomic_store(&_rx_gap_callback, std::make_shared<std::function<void(const rx_gap &)>>(gap_callback));
+    std::atomic_store(&_recovery_config, std::shared_ptr<const recovery_config>(std::make_shared<recovery_config>(config)));
+}
+
+recovery_stats ADSDR_impl::rx_recovery_stats() const
+{
+    std::lock_guard<std::mutex> lock(_recovery_lock);
+    recovery_stats stats = _recovery_stats;
+    stats.recovering = _recovering.load();
+    return stats;
+}
+
+int ADSDR_impl::subscribe_rx(std::function<void(const rx_block_ref &)> callback, backpressure_policy policy, unsigned int queue_depth)
+{
+    if(!callback || queue_depth == 0)
+    {
+        throw std::invalid_argument("subscribe_rx: a callback and a non-zero queue depth are required");
     }
+
+    std::shared_ptr<rx_subscriber> subscriber = std::make_shared<rx_subscriber>(callback, policy, queue_depth);
+
+    std::lock_guard<std::mutex> lock(_rx_subscribers_lock);
+    std::shared_ptr<rx_subscriber_list> subscribers = std::make_shared<rx_subscriber_list>(*std::atomic_load(&_rx_subscribers));
+    int id = _rx_next_subscriber_id++;
+    subscribers->push_back(std::make_pair(id, subscriber));
+    std::atomic_store(&_rx_subscribers, std::shared_ptr<const rx_subscriber_list>(subscribers));
+
+    return id;
 }
 
-void ADSDR_impl::stop_intr()
+void ADSDR_impl::unsubscribe_rx(int id)
 {
-    for(libusb_transfer *transfer: _intr_transfers)
+    std::shared_ptr<rx_subscriber> removed = remove_rx_subscriber(id);
+    if(removed == nullptr)
     {
-        int ret = libusb_cancel_transfer(transfer);
-        if(ret == LIBUSB_ERROR_NOT_FOUND || ret == 0)
-        {
-            // Transfer cancelled
-        }
-        else
-        {
-            // Error
-            throw ConnectionError("Could not cancel INTR transfer. libusb error: " + std::to_string(ret));
-        }
+        throw std::invalid_argument("unsubscribe_rx: unknown subscriber " + std::to_string(id));
     }
+
+    // The event thread may still hold a snapshot with this subscriber, closing makes it ignore further blocks
+    removed->close();
 }
 
-void ADSDR_impl::start_rx(std::function<void(const std::vector<sample> &)> rx_callback)
+std::shared_ptr<rx_subscriber> ADSDR_impl::remove_rx_subscriber(int id)
 {
-    _rx_custom_callback = rx_callback;
+    std::shared_ptr<rx_subscriber> removed;
 
-    for(libusb_transfer *transfer: _rx_transfers)
+    std::lock_guard<std::mutex> lock(_rx_subscribers_lock);
+    std::shared_ptr<rx_subscriber_list> subscribers = std::make_shared<rx_subscriber_list>(*std::atomic_load(&_rx_subscribers));
+    for(auto it = subscribers->begin(); it != subscribers->end(); ++it)
     {
-        int ret = libusb_submit_transfer(transfer);
-
-        if(ret < 0)
+        if(it->first == id)
         {
-            throw ConnectionError("Could not submit RX transfer. libusb error: " + std::to_string(ret));
+            removed = it->second;
+            subscribers->erase(it);
+            break;
         }
     }
+    std::atomic_store(&_rx_subscribers, std::shared_ptr<const rx_subscriber_list>(subscribers));
 
-    start_intr();
-
-    deviceStart();
+    return removed;
 }
 
-void ADSDR_impl::stop_rx()
+rx_subscription_stats ADSDR_impl::subscription_stats(int id)
 {
-    for(libusb_transfer *transfer: _rx_transfers)
+    for(auto &subscriber : *std::atomic_load(&_rx_subscribers))
     {
-        int ret = libusb_cancel_transfer(transfer);
-        if(ret == LIBUSB_ERROR_NOT_FOUND || ret == 0)
-        {
-            // Transfer cancelled
-        }
-        else
+        if(subscriber.first == id)
         {
-            // Error
-            throw ConnectionError("Could not cancel RX transfer. libusb error: " + std::to_string(ret));
+            return subscriber.second->stats();
         }
     }
 
-    stop_intr();
+    throw std::invalid_argument("subscription_stats: unknown subscriber " + std::to_string(id));
 }
 
-void ADSDR_impl::start_tx(std::function<void(std::vector<sample> &)> tx_callback)
+void ADSDR_impl::record_spi_trace(const std::string &filename)
 {
-    _tx_custom_callback = tx_callback;
+    _spi.record(filename);
+}
 
-    // Fill the tx buffer with empty samples
-    sample empty_sample{0, 0};
-    while(_tx_buf.try_enqueue(empty_sample)) {}
+void ADSDR_impl::replay_spi_trace(const std::string &filename)
+{
+    _spi.replay(filename);
+}
 
-    for(libusb_transfer *transfer: _tx_transfers)
-    {
-        fill_tx_transfer(transfer);
-        int ret = libusb_submit_transfer(transfer);
+void ADSDR_impl::stop_spi_trace()
+{
+    _spi.stop();
+}
 
-        if(ret < 0)
-        {
-            throw ConnectionError("Could not submit TX transfer. libusb error: " + std::to_string(ret));
-        }
-    }
+spi_stats ADSDR_impl::spi_statistics()
+{
+    return _spi.stats();
 }
 
-void ADSDR_impl::stop_tx()
+void ADSDR_impl::reset_spi_statistics()
 {
-#if 0
-    for(libusb_transfer *transfer: _tx_transfers)
+    _spi.reset_stats();
+}
+
+clock_cache_stats ADSDR_impl::clock_cache_statistics()
+{
+    clock_cache_stats stats = {};
+    if(phy == nullptr)
+    {
+        return stats;
+    }
+
+    ad9361_clock_cache_stats counters;
+    ad9361_get_clock_cache_stats(phy, &counters);
+    stats.clock_chain_hits = counters.clock_chain_hits;
+    stats.clock_chain_misses = counters.clock_chain_misses;
+    stats.bbpll_hits = counters.bbpll_hits;
+    stats.bbpll_misses = counters.bbpll_misses;
+    stats.rfpll_hits = counters.rfpll_hits;
+    stats.rfpll_misses = counters.rfpll_misses;
+    stats.vco_lut_hits = counters.vco_lut_hits;
+    stats.vco_lut_misses = counters.vco_lut_misses;
+    return stats;
+}
+
+void ADSDR_impl::reset_clock_cache_statistics()
+{
+    if(phy != nullptr)
     {
-        int ret = libusb_cancel_transfer(transfer);
-        if(ret == LIBUSB_ERROR_NOT_FOUND || ret == 0)
-        {
-            // Transfer cancelled
-        }
-        else
-        {
-            // Error
-            throw ConnectionError("Could not cancel TX transfer. libusb error: " + std::to_string(ret));
-        }
+        ad9361_reset_clock_cache_stats(phy);
     }
-#endif
 }
 
-int ADSDR_impl::fill_tx_transfer(libusb_transfer* transfer)
+void ADSDR_impl::enable_calibration_cache(const calibration_cache_config &config)
 {
-    // Fill the transfer buffer with available samples
-    transfer->length = ADSDR_TX_BUF_SIZE;
+    _calibration.reset(new calibration_cache(config));
+}
 
-    _tx_encoder_buf.resize(transfer->length/ADSDR_BYTES_PER_SAMPLE);
+void ADSDR_impl::disable_calibration_cache()
+{
+    _calibration.reset();
+}
 
-    if(_tx_custom_callback)
+calibration_status ADSDR_impl::calibration_state()
+{
+    return _calibration_status;
+}
+
+void ADSDR_impl::start_telemetry(const telemetry_config &config)
+{
+    if(_telemetry != nullptr)
     {
-        _tx_custom_callback(_tx_encoder_buf);
+        throw std::runtime_error("start_telemetry: already running");
     }
-    else
+    if(phy == nullptr)
     {
-        for(sample &s : _tx_encoder_buf)
-        {
-            int success = _tx_buf.try_dequeue(s);
-            if(!success)
-            {
-                // TODO: Notify of this? Do something else?
-                // No data available, fill with zeros
-                s.i = 0;
-                s.q = 0;
-            }
-        }
+        throw std::runtime_error("start_telemetry: init_sdr has not been called");
     }
 
-    for(int i = 0; i < transfer->length; i+=ADSDR_BYTES_PER_SAMPLE)
+    // Read once, the sampler writes it back around each frozen AuxADC read
+    int auxadc_config;
     {
-        // SKIP THIS: Convert -1.0 to 1.0 float sample value to signed 16-bit int with range -2048 to 2048
-        int16_t signed_i = _tx_encoder_buf[i/ADSDR_BYTES_PER_SAMPLE].i;
-        int16_t signed_q = _tx_encoder_buf[i/ADSDR_BYTES_PER_SAMPLE].q;
+        std::lock_guard<std::mutex> commands(_command_lock);
+        auxadc_config = spi_read_register(&_platform, REG_AUXADC_CONFIG);
+    }
+    if(auxadc_config < 0)
+    {
+        throw ConnectionError("start_telemetry: could not read the AuxADC configuration");
+    }
 
-        // Unsigned 16-bit ints holding the two's-complement 12-bit sample values
-        uint16_t raw_i;
-        uint16_t raw_q;
+    unsigned int holdoff_ms = config.retune_holdoff_ms;
+    _telemetry.reset(new telemetry_sampler(config, [this, auxadc_config, holdoff_ms](telemetry_registers &registers) {
+        return read_telemetry((uint8_t) auxadc_config, holdoff_ms, registers);
+    }));
+}
 
-        if(signed_i >= 0)
-        {
-            raw_i = (uint16_t) signed_i;
-        }
-        else
-        {
-            raw_i = (((uint16_t) (-signed_i)) ^ ((uint16_t) 0xFFF)) + (uint16_t) 1;
-        }
+void ADSDR_impl::stop_telemetry()
+{
+    _telemetry.reset();
+}
 
-        if(signed_q >= 0)
-        {
-            raw_q = (uint16_t) signed_q;
-        }
-        else
-        {
-            raw_q = (((uint16_t) (-signed_q)) ^ ((uint16_t) 0xFFF)) + (uint16_t) 1;
-        }
+telemetry_snapshot ADSDR_impl::telemetry() const
+{
+    return _telemetry != nullptr ? _telemetry->snapshot() : telemetry_snapshot();
+}
 
-        // Copy raw i/q data into the buffer
-        memcpy(transfer->buffer + i, &raw_q, sizeof(raw_q));
-        memcpy(transfer->buffer + i + sizeof(raw_q), &raw_i, sizeof(raw_i));
+telemetry_read ADSDR_impl::read_telemetry(uint8_t auxadc_config, unsigned int holdoff_ms, telemetry_registers &registers)
+{
+    std::unique_lock<std::mutex> commands(_command_lock, std::try_to_lock);
+    if(!commands.owns_lock() || !_spi.passing_through())
+    {
+        return TELEMETRY_SKIPPED;
+    }
+    // The synthesizers and the RSSI measurement settle after a retune
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if(now - _last_retune_ns.load() < (int64_t) holdoff_ms * 1000000)
+    {
+        return TELEMETRY_SKIPPED;
     }
 
-    return transfer->length;
+    return read_telemetry_registers(&_platform, auxadc_config, registers) < 0 ? TELEMETRY_FAILED : TELEMETRY_SAMPLED;
 }
 
-void ADSDR_impl::decode_rx_transfer(unsigned char *buffer, int actual_length, std::vector<sample> &destination)
+// Signal port for an RX LO frequency: A for 3000-6000 MHz, B for 1600-3000 MHz, C below
+static uint32_t rx_port_for(uint64_t lo_freq_hz)
 {
-    int16_t* pSamplesIn = (short*)buffer;
-    int lenght = actual_length / (sizeof(short) * 2 * 2);
-    destination.resize(lenght);
-    sample* pSamplesOut = destination.data();
-
-    for(int i = 0; i < lenght; i++)
+    if(lo_freq_hz >= 3000000000ULL)
     {
-        pSamplesOut[i].i = pSamplesIn[4*i+0]>>4;
-        pSamplesOut[i].q = pSamplesIn[4*i+1]>>4;
+        return A_BALANCED;
     }
+    return lo_freq_hz >= 1600000000ULL ? B_BALANCED : C_BALANCED;
 }
 
-void ADSDR_impl::run_rx_tx()
+std::chrono::microseconds ADSDR_impl::rssi_measurement_time()
 {
-    while(_run_rx_tx.load()) {
-        libusb_handle_events(_ctx);
+    const rssi_control &rssi = phy->pdata->rssi_ctrl;
+    double us = (double) rssi.rssi_delay + rssi.rssi_wait + rssi.rssi_duration;
+    if(rssi.rssi_unit_is_rx_samples)
+    {
+        uint32_t sample_rate;
+        ad9361_get_rx_sampling_freq(phy, &sample_rate);
+        us = us * 1e6 / sample_rate;
     }
+    // The driver rounds the duration down to whole samples, a tenth covers the clock domains
+    return std::chrono::microseconds((int64_t) std::ceil(us * 1.1));
 }
 
-unsigned long ADSDR_impl::available_rx_samples()
+std::vector<rssi_measurement> ADSDR_impl::scan_rssi(const rssi_scan_config &config)
 {
-    return _rx_buf.size_approx();
-}
+    if(phy == nullptr)
+    {
+        throw std::runtime_error("scan_rssi: init_sdr has not been called");
+    }
+    if(config.frequencies.empty() || config.passes == 0)
+    {
+        throw std::invalid_argument("scan_rssi: nothing to scan");
+    }
 
-bool ADSDR_impl::get_rx_sample(sample &s)
-{
-    return _rx_buf.try_dequeue(s);
-}
+    std::lock_guard<std::mutex> commands(_command_lock);
 
-bool ADSDR_impl::submit_tx_sample(sample &s)
-{
-    return _tx_buf.try_enqueue(s);
+    uint64_t original_lo;
+    uint32_t original_port;
+    ad9361_get_rx_lo_freq(phy, &original_lo);
+    ad9361_get_rx_rf_port_input(phy, &original_port);
+    int rssi_config = spi_read_register(&_platform, REG_RSSI_CONFIG);
+    if(rssi_config < 0)
+    {
+        throw ConnectionError("scan_rssi: could not read the RSSI configuration");
+    }
+
+    // Restarted by SPI write, so no measurement straddles a retune
+    uint8_t triggered = (uint8_t) ((rssi_config & ~(RSSI_MODE_SELECT(~0) | START_RSSI_MEAS)) | RSSI_MODE_SELECT(SPI_WRITE_TO_REGISTER));
+    uint8_t start = triggered | START_RSSI_MEAS;
+    std::chrono::microseconds measurement_time = rssi_measurement_time();
+
+    // Storing a profile costs more SPI than it saves in a single sweep
+    bool fastlock = config.fastlock && config.passes > 1 && config.frequencies.size() <= RSSI_SCAN_PROFILES;
+
+    std::vector<rssi_measurement> measurements;
+    measurements.reserve(config.frequencies.size() * config.passes);
+    uint32_t port = original_port;
+    int status = 0;
+    for(unsigned int pass = 0; pass < config.passes && status >= 0; pass++)
+    {
+        for(size_t i = 0; i < config.frequencies.size() && status >= 0; i++)
+        {
+            rssi_measurement measurement = {};
+            measurement.frequency = config.frequencies[i];
+            measurement.pass = pass;
+
+            if(rx_port_for(measurement.frequency) != port)
+            {
+                port = rx_port_for(measurement.frequency);
+                ad9361_set_rx_rf_port_input(phy, port);
+            }
+            if(fastlock && pass > 0)
+            {
+                ad9361_rx_fastlock_recall(phy, (uint32_t) i);
+            }
+            else
+            {
+                ad9361_set_rx_lo_freq(phy, measurement.frequency);
+                if(fastlock)
+                {
+                    ad9361_rx_fastlock_store(phy, (uint32_t) i);
+                }
+            }
+
+            for(int poll = 0; poll < RSSI_SCAN_LOCK_POLLS && !measurement.locked; poll++)
+            {
+                status = spi_read_register(&_platform, REG_RX_CP_OVERRANGE_VCO_LOCK);
+                measurement.locked = status >= 0 && (status & VCO_LOCK) != 0;
+            }
+
+            // Cleared first, so setting it restarts the measurement whatever the last scan left
+            if(status >= 0)
+            {
+                status = spi_write_burst(&_platform, REG_RSSI_CONFIG, &triggered, 1);
+            }
+            if(status >= 0)
+            {
+                status = spi_write_burst(&_platform, REG_RSSI_CONFIG, &start, 1);
+            }
+            std::this_thread::sleep_for(measurement_time);
+
+            uint8_t rssi[6];
+            if(status >= 0)
+            {
+                status = spi_read_burst(&_platform, REG_PREAMBLE_LSB, rssi, sizeof(rssi));
+            }
+            if(status >= 0)
+            {
+                decode_rx_rssi(rssi, measurement.rssi_symbol_db, measurement.rssi_preamble_db);
+                measurements.push_back(measurement);
+            }
+        }
+    }
+
+    // Tuning leaves fast lock mode
+    ad9361_set_rx_rf_port_input(phy, original_port);
+    ad9361_set_rx_lo_freq(phy, original_lo);
+    uint8_t original = (uint8_t) rssi_config;
+    spi_write_burst(&_platform, REG_RSSI_CONFIG, &original, 1);
+    _last_retune_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+
+    if(status < 0)
+    {
+        throw ConnectionError("scan_rssi: SPI access failed at " + std::to_string(measurements.size()) + " measurements");
+    }
+    return measurements;
 }
 
 command ADSDR_impl::make_command(command_id id, double param) const
@@ -1088,6 +2282,30 @@ command ADSDR_impl::make_command(command_id id, double param) const
     return cmd;
 }
 
+// Commands that change a setting, as opposed to reading one
+static bool is_setting(command_id id)
+{
+    switch(id)
+    {
+    case SET_TX_LO_FREQ:
+    case SET_TX_SAMP_FREQ:
+    case SET_TX_RF_BANDWIDTH:
+    case SET_TX_ATTENUATION:
+    case SET_TX_FIR_EN:
+    case SET_RX_LO_FREQ:
+    case SET_RX_SAMP_FREQ:
+    case SET_RX_RF_BANDWIDTH:
+    case SET_RX_GC_MODE:
+    case SET_RX_RF_GAIN:
+    case SET_RX_FIR_EN:
+    case SET_DATAPATH_EN:
+    case SET_LOOPBACK_EN:
+        return true;
+    default:
+        return false;
+    }
+}
+
 response ADSDR_impl::send_cmd(command cmd)
 {
     response reply;
@@ -1095,7 +2313,26 @@ response ADSDR_impl::send_cmd(command cmd)
     std::cout << " Send cmd: " << cmd.cmd << " param: " << cmd.param << std::endl;
     if(cmd.cmd < COMMAND_SIZE)
     {
+        std::lock_guard<std::mutex> lock(_command_lock);
         reply = ad9364_cmd(cmd.cmd, cmd.param);
+        if(cmd.cmd == SET_RX_LO_FREQ || cmd.cmd == SET_TX_LO_FREQ || cmd.cmd == SET_RX_SAMP_FREQ || cmd.cmd == SET_TX_SAMP_FREQ)
+        {
+            _last_retune_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        if(reply.error == CMD_OK && is_setting(cmd.cmd))
+        {
+            // Replayed in the order the settings were first made
+            auto it = std::find_if(_settings.begin(), _settings.end(), [&](const command &setting) { return setting.cmd == cmd.cmd; });
+            if(it != _settings.end())
+            {
+                it->param = cmd.param;
+            }
+            else
+            {
+                _settings.push_back(cmd);
+            }
+        }
     }
 
     return reply;
@@ -1121,19 +2358,19 @@ adsdr_version ADSDR_impl::version()
 int ADSDR_impl::deviceStart()
 {
     uint8_t buf[1] = {0};
-    return txControlToDevice(buf, 1, DEVICE_START, 0, 0);
+    return txControlToDevice(&_platform, buf, 1, DEVICE_START, 0, 0);
 }
 
 int ADSDR_impl::deviceStop()
 {
     uint8_t buf[1] = {0};
-    return txControlToDevice(buf, 1, DEVICE_STOP, 0, 0);
+    return txControlToDevice(&_platform, buf, 1, DEVICE_STOP, 0, 0);
 }
 
 int ADSDR_impl::deviceReset()
 {
     uint8_t buf[3] = {0, 0, 0xFF};
-    return txControlToDevice(buf, 3, DEVICE_RESET, 0, 0);
+    return txControlToDevice(&_platform, buf, 3, DEVICE_RESET, 0, 0);
 }
 
 
@@ -1246,6 +2483,7 @@ void ADSDR_impl::set_tx_samp_freq(uint64_t *param, char param_no, char* error, u
     if(param_no >= 1)
     {
         memcpy(&sampling_freq_hz, param, sizeof(sampling_freq_hz));
+        update_fir_designs(sampling_freq_hz);
         ad9361_set_tx_sampling_freq(phy, sampling_freq_hz);
         ad9361_get_tx_sampling_freq(phy, &sampling_freq_hz);
 
@@ -1292,6 +2530,9 @@ void ADSDR_impl::set_tx_rf_bandwidth(uint64_t *param, char param_no, char* error
         memcpy(&bandwidth_hz, param, sizeof(bandwidth_hz));
         ad9361_set_tx_rf_bandwidth(phy, bandwidth_hz);
         ad9361_get_tx_rf_bandwidth(phy, &bandwidth_hz);
+        uint32_t sampling_freq_hz;
+        ad9361_get_tx_sampling_freq(phy, &sampling_freq_hz);
+        update_fir_designs(sampling_freq_hz);
 
         *error = CMD_OK;
         memcpy(response, &bandwidth_hz, sizeof(bandwidth_hz));
@@ -1429,19 +2670,8 @@ void ADSDR_impl::set_rx_lo_freq(uint64_t *param, char param_no, char* error, uin
         memcpy(&lo_freq_hz, param, sizeof(lo_freq_hz));
 //        if(!values_nearly_equal(rx_lo_freq, lo_freq_hz)) {
             // Select appropriate signal port/path
-            if (lo_freq_hz >= 3000000000ULL) // 3000-6000 MHz: Port A
-            {
-                port = A_BALANCED;
-                printf("INFO: using RX port A\n\r");
-            } else if (lo_freq_hz >= 1600000000ULL) // 1600-3000 MHz: Port B
-            {
-                port = B_BALANCED;
-                printf("INFO: using RX port B\n\r");
-            } else // 70-1800 MHz: Port C
-            {
-                port = C_BALANCED;
-                printf("INFO: using RX port C\n\r");
-            }
+            port = rx_port_for(lo_freq_hz);
+            printf("INFO: using RX port %c\n\r", port == A_BALANCED ? 'A' : port == B_BALANCED ? 'B' : 'C');
             ad9361_set_rx_rf_port_input(phy, port);
 //        rx_band_select(port);
 
@@ -1496,6 +2726,7 @@ void ADSDR_impl::set_rx_samp_freq(uint64_t *param, char param_no, char* error, u
     {
         sampling_freq_hz = (uint32_t)param[0];
         memcpy(&sampling_freq_hz, param, sizeof(sampling_freq_hz));
+        update_fir_designs(sampling_freq_hz);
         ad9361_set_rx_sampling_freq(phy, sampling_freq_hz);
         ad9361_get_rx_sampling_freq(phy, &sampling_freq_hz);
 
@@ -1542,6 +2773,9 @@ void ADSDR_impl::set_rx_rf_bandwidth(uint64_t *param, char param_no, char* error
         memcpy(&bandwidth_hz, param, sizeof(bandwidth_hz));
         ad9361_set_rx_rf_bandwidth(phy, bandwidth_hz);
         ad9361_get_rx_rf_bandwidth(phy, &bandwidth_hz);
+        uint32_t sampling_freq_hz;
+        ad9361_get_rx_sampling_freq(phy, &sampling_freq_hz);
+        update_fir_designs(sampling_freq_hz);
 
         *error = CMD_OK;
         memcpy(response, &bandwidth_hz, sizeof(bandwidth_hz));
@@ -1815,6 +3049,6 @@ void ADSDR_impl::print_ensm_state(struct ad9361_rf_phy *phy)
 int ADSDR_impl::ad_set_en_dis(bool enabled) {
     printf("ENABLE %d\n", enabled);
     uint8_t tmp;
-    return txControlFromDevice(&tmp, 1, 0xC2, enabled, 1);
+    return txControlFromDevice(&_platform, &tmp, 1, 0xC2, enabled, 1);
 }
 
@@ -23,8 +23,31 @@
 
 #include "adsdr.hpp"
 #include "readerwriterqueue/readerwriterqueue.h"
+#include "calibration_cache.h"
+#include "capture_ring.h"
+#include "fir_bank.h"
+#include "rx_block_pool.h"
+#include "rx_block_queue.h"
+#include "rx_channelizer.h"
+#include "rx_kernels.h"
+#include "rx_squelch.h"
+#include "rx_decimator.h"
+#include "rx_iq_correction.h"
+#include "rx_nco.h"
+#include "rx_psd.h"
+#include "rx_resampler.h"
+#include "rx_subscriber.h"
+#include "sigmf_recorder.h"
+#include "spi_trace.h"
+#include "telemetry_sampler.h"
+#include "transport.h"
+#include "tx_kernels.h"
 #include "libusb.h"
 
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
 extern "C" {
     #include "ad9361_api.h"
     #include "platform.h"
@@ -39,9 +62,13 @@ namespace ADSDR
     {
     public:
         ADSDR_impl(std::string serial_number = "");
+        ADSDR_impl(const virtual_device_config &config);
         ~ADSDR_impl();
 
         static std::vector<std::string> list_connected();
+        static std::vector<device_info> connected_devices();
+        static int subscribe_hotplug(std::function<void(const hotplug_event &)> callback);
+        static void unsubscribe_hotplug(int id);
 	
         bool fpga_loaded();
         fpga_status load_fpga(std::string filename);
@@ -57,14 +84,82 @@ namespace ADSDR
         void start_rx(std::function<void(const std::vector<sample> &)> rx_callback = {});
         void stop_rx();
 
+        void set_rx_overflow_policy(overflow_policy policy, std::function<void(const rx_overflow &)> overflow_callback);
+        uint64_t rx_overflow_count() const;
+        bool is_rx_streaming() const;
+
+        void set_rx_recovery(const recovery_config &config, std::function<void(const rx_gap &)> gap_callback);
+        recovery_stats rx_recovery_stats() const;
+
+        int subscribe_rx(std::function<void(const rx_block_ref &)> callback, backpressure_policy policy, unsigned int queue_depth);
+        void unsubscribe_rx(int id);
+        rx_subscription_stats subscription_stats(int id);
+
+        void enable_squelch(const squelch_config &config);
+        void disable_squelch();
+        squelch_stats rx_squelch_stats();
+
+        void enable_iq_correction(const iq_correction_config &config, const iq_correction_estimate &seed);
+        void disable_iq_correction();
+        iq_correction_estimate rx_iq_correction_estimate() const;
+
+        void enable_rx_decimation(const decimation_config &config);
+        void disable_rx_decimation();
+        // Rate blocks are delivered at when the AD9361 runs at sample_rate
+        double rx_stream_rate(uint32_t sample_rate) const;
+
+        double set_rx_output_rate(double rate_hz);
+
+        void set_rx_frequency_shift(double offset_hz);
+        double rx_frequency_shift() const;
+
+        void start_channelizer(const channelizer_config &config, std::function<void(const channelizer_block &)> callback);
+        channelizer_stats stop_channelizer();
+
+        void start_psd(const psd_config &config, std::function<void(const psd_frame &)> callback);
+        psd_stats stop_psd();
+        void reset_psd_max_hold();
+
+        void start_recording(const recording_config &config);
+        recording_stats stop_recording();
+        recording_stats recording_status();
+
+        bool enable_capture(const capture_config &config);
+        void disable_capture();
+        void trigger_capture();
+        bool wait_capture(capture_window &window, unsigned int timeout_ms);
+        void rearm_capture();
+
         void start_tx(std::function<void(std::vector<sample> &)> tx_callback = {});
         void stop_tx();
 
         unsigned long available_rx_samples();
         bool get_rx_sample(sample &s);
+        bool wait_rx_samples(unsigned long min_samples, unsigned int timeout_ms);
+        unsigned long read_rx_samples(sample *destination, unsigned long max_samples, unsigned long min_samples, unsigned int timeout_ms);
+        int rx_event_fd() const;
+        void set_rx_low_water_mark(unsigned long samples);
 
         bool submit_tx_sample(sample &s);
 
+        void record_spi_trace(const std::string &filename);
+        void replay_spi_trace(const std::string &filename);
+        void stop_spi_trace();
+        spi_stats spi_statistics();
+        void reset_spi_statistics();
+        clock_cache_stats clock_cache_statistics();
+        void reset_clock_cache_statistics();
+
+        void enable_calibration_cache(const calibration_cache_config &config);
+        void disable_calibration_cache();
+        calibration_status calibration_state();
+
+        void start_telemetry(const telemetry_config &config);
+        void stop_telemetry();
+        telemetry_snapshot telemetry() const;
+
+        std::vector<rssi_measurement> scan_rssi(const rssi_scan_config &config);
+
         command make_command(command_id id, double param) const;
         response send_cmd(command cmd);
 
@@ -131,12 +226,27 @@ namespace ADSDR
         void set_loopback_en(uint64_t* param, char param_no, char* error, uint64_t* response);
 
     private:
+        ADSDR_impl(std::unique_ptr<transport> device);
+
         void start_intr();
         void stop_intr();
         void run_rx_tx();
 
         int ad_set_en_dis(bool enabled);
 
+        // ad9361_init and the FIR and ENSM setup that init_sdr runs
+        bool setup_ad9361();
+        // Frees the driver state of an earlier setup_ad9361, if any
+        void drop_ad9361();
+        // Loads the FIR bank designs for a sample rate and the current RF bandwidths
+        void update_fir_designs(uint32_t samp_freq_hz);
+        bool warm_start(calibration_status &status);
+        bool cold_start(calibration_status &status);
+        // One telemetry sample, skipped rather than waiting for or delaying a command
+        telemetry_read read_telemetry(uint8_t auxadc_config, unsigned int holdoff_ms, telemetry_registers &registers);
+        // From the restart of an RSSI measurement until its result is ready
+        std::chrono::microseconds rssi_measurement_time();
+
         void print_ensm_state(struct ad9361_rf_phy *phy);
 
         bool values_nearly_equal(double v1, double v2);
@@ -149,15 +259,35 @@ namespace ADSDR
         static void tx_callback(libusb_transfer *transfer);
         static void intr_callback(libusb_transfer *transfer);
 
-        static int fill_tx_transfer(libusb_transfer *transfer);
+        int fill_tx_transfer(libusb_transfer *transfer);
+
+        std::shared_ptr<rx_subscriber> remove_rx_subscriber(int id);
+        void deliver_rx_block(const rx_block_ref &block, rx_squelch *squelch);
+        void handle_rx_overflow(uint64_t sequence, size_t samples);
 
-        static void decode_rx_transfer(unsigned char *buffer, int actual_length, std::vector<sample> &destination);
+        // Stream recovery, requested from the event thread and run on the recovery thread
+        void request_recovery(recovery_reason reason);
+        void run_recovery();
+        void recover();
+        // Waits for the board to come back, swaps in its new transport and restores its settings
+        bool reconnect();
+        bool restart_rx();
+        // Delivered samples missed while the stream was down for seconds
+        uint64_t rx_lost_samples(double seconds);
 
-        libusb_context* _ctx = nullptr;
-        libusb_device_handle *_adsdr_handle = nullptr;
+        std::unique_ptr<transport> _transport;
+        spi_trace _spi;
+        // Control requests and SPI of this device, for the driver and platform layer
+        platform_context _platform;
 
         std::string _fx3_fw_version;
 
+        // Hash of the last bitstream loaded through load_fpga
+        uint64_t _fpga_hash = 0;
+        bool _fpga_hash_valid = false;
+        // Reloaded when a recovery finds the FPGA unconfigured, guarded by _recovery_lock
+        std::string _fpga_path;
+
         std::atomic<bool> _run_rx_tx{false};
         std::unique_ptr<std::thread> _rx_tx_worker;
 
@@ -165,22 +295,100 @@ namespace ADSDR
         std::array<libusb_transfer *, ADSDR_RX_TX_TRANSFER_QUEUE_SIZE> _tx_transfers;
         std::array<libusb_transfer *, ADSDR_RX_TX_TRANSFER_QUEUE_SIZE> _intr_transfers;
 
-        static std::function<void(const std::vector<sample> &)> _rx_custom_callback;
-        static std::function<void(std::vector<sample> &)> _tx_custom_callback;
-
-        static std::vector<sample> _rx_decoder_buf;
-        static std::vector<sample> _tx_encoder_buf;
-
-        static moodycamel::ReaderWriterQueue<sample> _rx_buf;
-        static moodycamel::ReaderWriterQueue<sample> _tx_buf;
+        std::function<void(const std::vector<sample> &)> _rx_custom_callback;
+        std::function<void(std::vector<sample> &)> _tx_custom_callback;
+
+        std::vector<sample> _rx_decoder_buf = std::vector<sample>(ADSDR_RX_TX_BUF_SIZE / ADSDR_BYTES_PER_SAMPLE);
+        std::vector<sample> _tx_encoder_buf = std::vector<sample>(ADSDR_RX_TX_BUF_SIZE / ADSDR_BYTES_PER_SAMPLE);
+
+        moodycamel::ReaderWriterQueue<sample> _tx_buf{ADSDR_RX_TX_QUEUE_SIZE};
+
+        typedef std::vector<std::pair<int, std::shared_ptr<rx_subscriber>>> rx_subscriber_list;
+
+        // Must outlive the subscribers, which may still hold blocks
+        std::unique_ptr<rx_block_pool> _rx_pool;
+        uint64_t _rx_sequence = 0;
+
+        // Backs the sample based receive API when no callback or subscriber is set
+        rx_block_queue _rx_queue{ADSDR_RX_QUEUE_BLOCKS};
+
+        // Both read on the event thread, the callback is swapped whole with std::atomic_store
+        std::atomic<overflow_policy> _rx_overflow_policy{OVERFLOW_DROP_NEWEST};
+        std::shared_ptr<std::function<void(const rx_overflow &)>> _rx_overflow_callback;
+        std::atomic<uint64_t> _rx_overflows{0};
+        // Set by OVERFLOW_STOP_STREAM, transfers are no longer resubmitted
+        std::atomic<bool> _rx_halted{false};
+
+        // Held while RX streaming is started, stopped or recovered
+        std::mutex _stream_lock;
+        std::atomic<bool> _rx_streaming{false};
+        // RX and interrupt transfers submitted and not completed yet
+        std::atomic<int> _transfers_in_flight{0};
+
+        // Read on the event and recovery threads, swapped whole with std::atomic_store
+        std::shared_ptr<const recovery_config> _recovery_config = std::make_shared<recovery_config>();
+        std::shared_ptr<std::function<void(const rx_gap &)>> _rx_gap_callback;
+        // Set from the first failure until streaming resumes, transfers are not resubmitted meanwhile
+        std::atomic<bool> _recovering{false};
+        std::atomic<bool> _run_recovery{true};
+        unsigned int _rx_transfer_errors = 0;
+        // Sequence number of the block that gets rx_block::gap() set, and its gap_samples()
+        std::atomic<uint64_t> _rx_gap_sequence{UINT64_MAX};
+        std::atomic<uint64_t> _rx_gap_samples{0};
+        mutable std::mutex _recovery_lock;
+        std::condition_variable _recovery_cv;
+        bool _recovery_pending = false;
+        recovery_reason _recovery_reason = RECOVERY_STALL;
+        std::chrono::steady_clock::time_point _recovery_start;
+        recovery_stats _recovery_stats = {};
+        std::unique_ptr<std::thread> _recovery_worker;
+
+        std::shared_ptr<capture_ring> _capture;
+        std::shared_ptr<rx_squelch> _squelch;
+        std::shared_ptr<rx_iq_correction> _iq_correction;
+        std::shared_ptr<rx_decimator> _decimator;
+        std::shared_ptr<rx_nco> _nco;
+        std::shared_ptr<rx_resampler> _resampler;
+        // Rate asked of set_rx_output_rate, 0 when it is off. While set, _decimator is its own
+        double _output_rate = 0.0;
+
+        std::shared_ptr<sigmf_recorder> _recorder;
+        int _recorder_subscription = -1;
+
+        std::shared_ptr<rx_channelizer> _channelizer;
+        int _channelizer_subscription = -1;
+
+        std::shared_ptr<rx_psd> _psd;
+        int _psd_subscription = -1;
+
+        // Copy-on-write, the event thread only ever takes a snapshot
+        std::shared_ptr<const rx_subscriber_list> _rx_subscribers;
+        std::mutex _rx_subscribers_lock;
+        int _rx_next_subscriber_id = 0;
 
         AD9361_InitParam ad_default_param;
         AD9361_RXFIRConfig rx_fir_config;
         AD9361_TXFIRConfig tx_fir_config;
-        ad9361_rf_phy *phy;
+        // Designs loaded into the FIRs, from the FIR bank
+        const fir_design *_rx_fir_design = nullptr;
+        const fir_design *_tx_fir_design = nullptr;
+        ad9361_rf_phy *phy = nullptr;
+
+        std::unique_ptr<calibration_cache> _calibration;
+        calibration_status _calibration_status = {};
 
         std::vector<cmd_function> m_cmd_list;
 
+        // Held while a command runs, so the transport is not swapped under it
+        std::mutex _command_lock;
+        // Last successful value of each setting sent with send_cmd, replayed after a reconnect
+        std::vector<command> _settings;
+        bool _initialized = false;
+
+        // steady_clock time of the last LO or sample rate command, in nanoseconds
+        std::atomic<int64_t> _last_retune_ns{0};
+        std::unique_ptr<telemetry_sampler> _telemetry;
+
         uint64_t tx_lo_freq;
         uint64_t tx_samp_freq;
         uint64_t tx_rf_bandwidth;
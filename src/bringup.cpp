@@ -0,0 +1,108 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <adsdr.hpp>
+
+#include "parallel.h"
+
+#include <chrono>
+
+namespace ADSDR {
+
+    namespace
+    {
+        double seconds_since(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    std::vector<board> ADSDR::open_all(const std::string &fpga_filename, unsigned int threads)
+    {
+        std::vector<std::string> serials = list_connected();
+        std::vector<board> boards(serials.size());
+
+        run_parallel(boards.size(), threads, [&](size_t i) {
+            board &b = boards[i];
+            b = board();
+            b.serial = serials[i];
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            try
+            {
+                b.device = std::make_shared<ADSDR>(b.serial);
+            }
+            catch(const std::exception &e)
+            {
+                b.error = e.what();
+                b.open_seconds = seconds_since(start);
+                return;
+            }
+            b.open_seconds = seconds_since(start);
+
+            start = std::chrono::steady_clock::now();
+            try
+            {
+                b.fpga_loaded = b.device->fpga_loaded();
+                if(!b.fpga_loaded && !fpga_filename.empty())
+                {
+                    b.fpga_loaded = b.device->load_fpga(fpga_filename) == FPGA_CONFIG_DONE;
+                }
+                if(!b.fpga_loaded)
+                {
+                    b.error = fpga_filename.empty() ? "FPGA not loaded" : "FPGA configuration failed";
+                }
+            }
+            catch(const std::exception &e)
+            {
+                b.error = e.what();
+            }
+            b.fpga_seconds = seconds_since(start);
+        });
+
+        return boards;
+    }
+
+    void ADSDR::init_all(std::vector<board> &boards, unsigned int threads)
+    {
+        run_parallel(boards.size(), threads, [&](size_t i) {
+            board &b = boards[i];
+            if(b.device == nullptr || !b.fpga_loaded)
+            {
+                return;
+            }
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            try
+            {
+                b.initialized = b.device->init_sdr();
+                if(!b.initialized)
+                {
+                    b.error = "init_sdr failed";
+                }
+            }
+            catch(const std::exception &e)
+            {
+                b.initialized = false;
+                b.error = e.what();
+            }
+            b.init_seconds = seconds_since(start);
+        });
+    }
+}
@@ -0,0 +1,414 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "calibration_cache.h"
+#include "spi_burst.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Snapshot file, all little endian:
+//   magic
+//   uint16 serial length, serial
+//   uint64 configuration hash
+//   int32  temperature in millidegrees C
+//   register image
+//   uint32 number of transactions, then per transaction
+//     uint16 register address, uint8 flags (bit 0 set for a write), uint8 length, data
+#define CALIBRATION_MAGIC "ADCALSN1"
+#define CALIBRATION_MAGIC_SIZE 8
+#define CALIBRATION_WRITE 0x01
+
+// Time for the synthesizers to relock after their registers are written
+#define CALIBRATION_LOCK_POLLS 20
+#define CALIBRATION_LOCK_POLL_US 1000
+
+using namespace ADSDR;
+
+namespace
+{
+    struct register_range
+    {
+        uint16_t first;
+        uint16_t last;
+    };
+
+    // Tables behind address/data ports, restored from the recorded init writes
+    const register_range table_ports[] = {
+        {REG_TX_FILTER_COEF_ADDR, REG_TX_FILTER_CONF},
+        {REG_RX_FILTER_COEF_ADDR, REG_RX_FILTER_GAIN},
+        {REG_GAIN_TABLE_ADDRESS, REG_GAIN_TABLE_CONFIG},
+        {REG_RX_FAST_LOCK_PROGRAM_ADDR, REG_RX_FAST_LOCK_PROGRAM_CTRL},
+        {REG_TX_FAST_LOCK_PROGRAM_ADDR, REG_TX_FAST_LOCK_PROGRAM_CTRL}
+    };
+
+    // Never written from the image: the soft reset, and the ENSM and calibration control, which
+    // would start calibrations or state changes part way through. The ENSM goes last instead.
+    const register_range image_skipped[] = {
+        {REG_SPI_CONF, REG_SPI_CONF},
+        {REG_ENSM_MODE, REG_STATE}
+    };
+
+    bool in_ranges(uint16_t address, const register_range *ranges, size_t count)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            if(address >= ranges[i].first && address <= ranges[i].last)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool restored_from_image(uint16_t address)
+    {
+        return !in_ranges(address, table_ports, sizeof(table_ports) / sizeof(table_ports[0])) &&
+               !in_ranges(address, image_skipped, sizeof(image_skipped) / sizeof(image_skipped[0]));
+    }
+
+    // Writes image[first..last] in bursts, ascending
+    void write_image(platform_context *platform, const std::array<uint8_t, AD9361_REGISTER_COUNT> &image, uint16_t first, uint16_t last)
+    {
+        uint8_t data[AD9361_SPI_BURST];
+        for(unsigned base = first; base <= last; base += AD9361_SPI_BURST)
+        {
+            unsigned count = min((unsigned) AD9361_SPI_BURST, last - base + 1);
+            unsigned top = base + count - 1;
+            for(unsigned i = 0; i < count; i++)
+            {
+                data[i] = image[top - i];
+            }
+            spi_write_burst(platform, (uint16_t) top, data, count);
+        }
+    }
+
+    void put(std::vector<uint8_t> &buf, uint64_t value, int bytes)
+    {
+        for(int i = 0; i < bytes; i++)
+        {
+            buf.push_back((uint8_t) (value >> (8 * i)));
+        }
+    }
+
+    bool get(const std::vector<uint8_t> &buf, size_t &offset, uint64_t &value, int bytes)
+    {
+        if(offset + bytes > buf.size())
+        {
+            return false;
+        }
+        value = 0;
+        for(int i = 0; i < bytes; i++)
+        {
+            value |= (uint64_t) buf[offset++] << (8 * i);
+        }
+        return true;
+    }
+
+    // FNV-1a
+    template<typename T>
+    void hash_value(uint64_t &hash, const T &value)
+    {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+        for(size_t i = 0; i < sizeof(T); i++)
+        {
+            hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+        }
+    }
+}
+
+calibration_cache::calibration_cache(const calibration_cache_config &config) : _config(config)
+{
+    if(_config.directory.empty())
+    {
+        throw std::invalid_argument("calibration_cache: no directory given");
+    }
+    if(!(_config.temperature_tolerance > 0))
+    {
+        throw std::invalid_argument("calibration_cache: the temperature tolerance must be positive");
+    }
+    if(mkdir(_config.directory.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::runtime_error("calibration_cache: could not create " + _config.directory + ": " + strerror(errno));
+    }
+}
+
+bool calibration_cache::find(const std::string &serial, uint64_t config_hash, double temperature,
+                             calibration_snapshot &snapshot, std::string &path) const
+{
+    // The closest snapshot is either in this band or a neighbouring one
+    bool found = false;
+    double best = _config.temperature_tolerance;
+    int center = band(temperature);
+    for(int b = center - 1; b <= center + 1; b++)
+    {
+        calibration_snapshot candidate;
+        std::string candidate_path = this->path(serial, config_hash, b);
+        if(!load(candidate_path, candidate) || candidate.serial != serial || candidate.config_hash != config_hash)
+        {
+            continue;
+        }
+
+        double distance = std::fabs(candidate.temperature - temperature);
+        if(distance <= best)
+        {
+            best = distance;
+            snapshot = std::move(candidate);
+            path = candidate_path;
+            found = true;
+        }
+    }
+    return found;
+}
+
+std::string calibration_cache::store(const calibration_snapshot &snapshot) const
+{
+    std::vector<uint8_t> buf(CALIBRATION_MAGIC, CALIBRATION_MAGIC + CALIBRATION_MAGIC_SIZE);
+    put(buf, snapshot.serial.size(), 2);
+    buf.insert(buf.end(), snapshot.serial.begin(), snapshot.serial.end());
+    put(buf, snapshot.config_hash, 8);
+    put(buf, (uint32_t) (int32_t) std::lround(snapshot.temperature * 1000), 4);
+    buf.insert(buf.end(), snapshot.registers.begin(), snapshot.registers.end());
+    put(buf, snapshot.init_log.size(), 4);
+    for(const spi_transaction &transaction : snapshot.init_log)
+    {
+        put(buf, transaction.address, 2);
+        put(buf, transaction.write ? CALIBRATION_WRITE : 0, 1);
+        put(buf, transaction.data.size(), 1);
+        buf.insert(buf.end(), transaction.data.begin(), transaction.data.end());
+    }
+
+    // Written aside and renamed, a process starting at the same time never sees half a file
+    std::string path = this->path(snapshot.serial, snapshot.config_hash, band(snapshot.temperature));
+    std::string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if(file == nullptr)
+    {
+        throw std::runtime_error("calibration_cache: could not create " + temporary);
+    }
+    bool written = fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+    written = fclose(file) == 0 && written;
+    if(!written || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        throw std::runtime_error("calibration_cache: could not write " + path);
+    }
+    return path;
+}
+
+uint64_t calibration_cache::config_hash(const AD9361_InitParam &param, const AD9361_RXFIRConfig &rx_fir,
+                                        const AD9361_TXFIRConfig &tx_fir)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    hash_value(hash, param.dev_sel);
+    hash_value(hash, param.reference_clk_rate);
+    hash_value(hash, param.two_rx_two_tx_mode_enable);
+    hash_value(hash, param.one_rx_one_tx_mode_use_rx_num);
+    hash_value(hash, param.one_rx_one_tx_mode_use_tx_num);
+    hash_value(hash, param.frequency_division_duplex_mode_enable);
+    hash_value(hash, param.frequency_division_duplex_independent_mode_enable);
+    hash_value(hash, param.tdd_use_dual_synth_mode_enable);
+    hash_value(hash, param.external_rx_lo_enable);
+    hash_value(hash, param.external_tx_lo_enable);
+    hash_value(hash, param.split_gain_table_mode_enable);
+    hash_value(hash, param.trx_synthesizer_target_fref_overwrite_hz);
+    hash_value(hash, param.rx_synthesizer_frequency_hz);
+    hash_value(hash, param.tx_synthesizer_frequency_hz);
+    hash_value(hash, param.rx_path_clock_frequencies);
+    hash_value(hash, param.tx_path_clock_frequencies);
+    hash_value(hash, param.rf_rx_bandwidth_hz);
+    hash_value(hash, param.rf_tx_bandwidth_hz);
+    hash_value(hash, param.rx_rf_port_input_select);
+    hash_value(hash, param.tx_rf_port_input_select);
+    hash_value(hash, param.tx_attenuation_mdB);
+    hash_value(hash, param.xo_disable_use_ext_refclk_enable);
+    hash_value(hash, param.dcxo_coarse_and_fine_tune);
+    hash_value(hash, param.clk_output_mode_select);
+    hash_value(hash, param.gc_rx1_mode);
+    hash_value(hash, param.gc_rx2_mode);
+
+    hash_value(hash, rx_fir.rx);
+    hash_value(hash, rx_fir.rx_gain);
+    hash_value(hash, rx_fir.rx_dec);
+    hash_value(hash, rx_fir.rx_coef);
+    hash_value(hash, rx_fir.rx_coef_size);
+    hash_value(hash, tx_fir.tx);
+    hash_value(hash, tx_fir.tx_gain);
+    hash_value(hash, tx_fir.tx_int);
+    hash_value(hash, tx_fir.tx_coef);
+    hash_value(hash, tx_fir.tx_coef_size);
+
+    return hash;
+}
+
+double calibration_cache::read_temperature(platform_context *platform)
+{
+    // Same scale as ad9361_get_temp, which needs a phy
+    int raw = spi_read_register(platform, REG_TEMPERATURE);
+    return raw < 0 ? NAN : raw / 1.14;
+}
+
+void calibration_cache::read_registers(platform_context *platform, std::array<uint8_t, AD9361_REGISTER_COUNT> &registers)
+{
+    uint8_t data[AD9361_SPI_BURST];
+    for(unsigned base = 0; base < AD9361_REGISTER_COUNT; base += AD9361_SPI_BURST)
+    {
+        unsigned top = base + AD9361_SPI_BURST - 1;
+        if(spi_read_burst(platform, (uint16_t) top, data, AD9361_SPI_BURST) < 0)
+        {
+            throw std::runtime_error("calibration_cache: register read failed");
+        }
+        for(unsigned i = 0; i < AD9361_SPI_BURST; i++)
+        {
+            registers[top - i] = data[i];
+        }
+    }
+}
+
+bool calibration_cache::restore(platform_context *platform, const calibration_snapshot &snapshot)
+{
+    // Clock chain, synthesizers and calibration results, in runs between the skipped registers
+    unsigned first = 0;
+    for(unsigned address = 0; address <= AD9361_REGISTER_COUNT; address++)
+    {
+        if(address == AD9361_REGISTER_COUNT || !restored_from_image((uint16_t) address))
+        {
+            if(address > first)
+            {
+                write_image(platform, snapshot.registers, (uint16_t) first, (uint16_t) (address - 1));
+            }
+            first = address + 1;
+        }
+    }
+
+    // Gain tables, FIR and fast lock profiles, in the order the driver programmed them
+    for(const spi_transaction &transaction : snapshot.init_log)
+    {
+        if(transaction.write && in_ranges(transaction.address, table_ports, sizeof(table_ports) / sizeof(table_ports[0])))
+        {
+            spi_write_burst(platform, transaction.address, transaction.data.data(), (unsigned) transaction.data.size());
+        }
+    }
+
+    write_image(platform, snapshot.registers, REG_ENSM_MODE, REG_ENSM_CONFIG_2);
+
+    for(int i = 0; i < CALIBRATION_LOCK_POLLS; i++)
+    {
+        int bbpll = spi_read_register(platform, REG_CH_1_OVERFLOW);
+        int rx = spi_read_register(platform, REG_RX_CP_OVERRANGE_VCO_LOCK);
+        int tx = spi_read_register(platform, REG_TX_CP_OVERRANGE_VCO_LOCK);
+        if(bbpll >= 0 && rx >= 0 && tx >= 0 && (bbpll & BBPLL_LOCK) && (rx & VCO_LOCK) && (tx & VCO_LOCK))
+        {
+            return true;
+        }
+        usleep(CALIBRATION_LOCK_POLL_US);
+    }
+    return false;
+}
+
+int calibration_cache::band(double temperature) const
+{
+    return (int) std::floor(temperature / _config.temperature_tolerance);
+}
+
+std::string calibration_cache::path(const std::string &serial, uint64_t config_hash, int band) const
+{
+    std::string name;
+    for(char c : serial)
+    {
+        name += isalnum((unsigned char) c) ? c : '_';
+    }
+
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), "-%016llx-%d.adcal", (unsigned long long) config_hash, band);
+    return _config.directory + "/" + name + suffix;
+}
+
+bool calibration_cache::load(const std::string &path, calibration_snapshot &snapshot)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if(file == nullptr)
+    {
+        return false;
+    }
+    std::vector<uint8_t> buf;
+    uint8_t chunk[65536];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        buf.insert(buf.end(), chunk, chunk + n);
+    }
+    fclose(file);
+
+    if(buf.size() < CALIBRATION_MAGIC_SIZE || memcmp(buf.data(), CALIBRATION_MAGIC, CALIBRATION_MAGIC_SIZE) != 0)
+    {
+        return false;
+    }
+
+    size_t offset = CALIBRATION_MAGIC_SIZE;
+    uint64_t value;
+    if(!get(buf, offset, value, 2) || offset + value > buf.size())
+    {
+        return false;
+    }
+    snapshot.serial.assign(buf.begin() + offset, buf.begin() + offset + value);
+    offset += value;
+
+    if(!get(buf, offset, snapshot.config_hash, 8) || !get(buf, offset, value, 4))
+    {
+        return false;
+    }
+    snapshot.temperature = (int32_t) (uint32_t) value / 1000.0;
+
+    if(offset + AD9361_REGISTER_COUNT > buf.size())
+    {
+        return false;
+    }
+    memcpy(snapshot.registers.data(), buf.data() + offset, AD9361_REGISTER_COUNT);
+    offset += AD9361_REGISTER_COUNT;
+
+    uint64_t count;
+    if(!get(buf, offset, count, 4))
+    {
+        return false;
+    }
+    snapshot.init_log.clear();
+    snapshot.init_log.reserve(count);
+    for(uint64_t i = 0; i < count; i++)
+    {
+        uint64_t address, flags, length;
+        if(!get(buf, offset, address, 2) || !get(buf, offset, flags, 1) || !get(buf, offset, length, 1) ||
+           offset + length > buf.size())
+        {
+            return false;
+        }
+        spi_transaction transaction;
+        transaction.address = (uint16_t) address;
+        transaction.write = (flags & CALIBRATION_WRITE) != 0;
+        transaction.data.assign(buf.begin() + offset, buf.begin() + offset + length);
+        offset += length;
+        snapshot.init_log.push_back(std::move(transaction));
+    }
+    return true;
+}
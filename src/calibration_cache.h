@@ -0,0 +1,83 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_CALIBRATION_CACHE_H__
+#define __LIBADSDR_CALIBRATION_CACHE_H__
+
+#include "adsdr.hpp"
+#include "spi_trace.h"
+
+extern "C" {
+    #include "ad9361_api.h"
+    #include "platform.h"
+}
+
+// Size of the AD9361 register space
+#define AD9361_REGISTER_COUNT 0x400
+
+namespace ADSDR
+{
+    struct calibration_snapshot
+    {
+        std::string serial;
+        uint64_t config_hash;
+        double temperature;
+        // Every register after a full init, including the calibration results and clock chain
+        std::array<uint8_t, AD9361_REGISTER_COUNT> registers;
+        // Transactions of the full init. Replayed to rebuild the driver state, and the source of
+        // the tables only reachable through address/data ports (gain tables, FIR, fast lock).
+        std::vector<spi_transaction> init_log;
+    };
+
+    // Directory of calibration snapshots, one file per serial number, configuration hash and
+    // temperature band. Device access goes through the platform SPI path like driver access.
+    class calibration_cache
+    {
+    public:
+        calibration_cache(const calibration_cache_config &config);
+
+        // Loads the snapshot closest to temperature within the tolerance, false if there is none
+        bool find(const std::string &serial, uint64_t config_hash, double temperature,
+                  calibration_snapshot &snapshot, std::string &path) const;
+
+        // Returns the path written
+        std::string store(const calibration_snapshot &snapshot) const;
+
+        // Covers the settings the driver calibrates for. Whatever else differs makes the replay
+        // of a snapshot diverge from its recorded writes, which rejects it as well.
+        static uint64_t config_hash(const AD9361_InitParam &param, const AD9361_RXFIRConfig &rx_fir,
+                                    const AD9361_TXFIRConfig &tx_fir);
+
+        // Die temperature in degrees C
+        static double read_temperature(platform_context *platform);
+        static void read_registers(platform_context *platform, std::array<uint8_t, AD9361_REGISTER_COUNT> &registers);
+
+        // Programs the snapshot into the device, true if the BBPLL and both synthesizers lock
+        static bool restore(platform_context *platform, const calibration_snapshot &snapshot);
+
+    private:
+        int band(double temperature) const;
+        std::string path(const std::string &serial, uint64_t config_hash, int band) const;
+        static bool load(const std::string &path, calibration_snapshot &snapshot);
+
+        calibration_cache_config _config;
+    };
+}
+
+#endif // __LIBADSDR_CALIBRATION_CACHE_H__
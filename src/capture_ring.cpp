@@ -0,0 +1,187 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture_ring.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CAPTURE_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+using namespace ADSDR;
+
+capture_ring::capture_ring(const capture_config &config) : _config(config)
+{
+    if(config.post_trigger_samples == 0)
+    {
+        throw std::invalid_argument("capture_ring: post_trigger_samples must not be 0");
+    }
+
+    try
+    {
+        map_ring(config.hugepages);
+    }
+    catch(const std::runtime_error &)
+    {
+        if(!config.hugepages)
+        {
+            throw;
+        }
+        // No hugepages reserved, fall back to normal pages
+        map_ring(false);
+    }
+}
+
+capture_ring::~capture_ring()
+{
+    if(_base != nullptr)
+    {
+        munmap(_base, 2 * _map_bytes);
+    }
+}
+
+void capture_ring::map_ring(bool hugepages)
+{
+    // The last block written may overshoot the post trigger window by up to one block
+    size_t samples = _config.pre_trigger_samples + _config.post_trigger_samples + ADSDR_RX_BLOCK_SIZE;
+    size_t page_size = hugepages ? CAPTURE_HUGEPAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+    size_t bytes = (samples * sizeof(sample) + page_size - 1) / page_size * page_size;
+
+    int fd = memfd_create("adsdr-capture", MFD_CLOEXEC | (hugepages ? MFD_HUGETLB : 0));
+    if(fd < 0)
+    {
+        throw std::runtime_error("capture_ring: memfd_create failed");
+    }
+
+    if(ftruncate(fd, (off_t) bytes) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("capture_ring: could not size ring buffer");
+    }
+
+    // Reserve twice the ring size, then map the same pages into both halves. Hugepage mappings
+    // must start on a hugepage boundary, so reserve one page of slack to align the base.
+    size_t slack = hugepages ? page_size : 0;
+    void *reserved = mmap(nullptr, 2 * bytes + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(reserved == MAP_FAILED)
+    {
+        close(fd);
+        throw std::runtime_error("capture_ring: could not reserve address space");
+    }
+
+    uintptr_t address = reinterpret_cast<uintptr_t>(reserved);
+    uintptr_t aligned = (address + page_size - 1) / page_size * page_size;
+    unsigned char *base = reinterpret_cast<unsigned char *>(aligned);
+    if(aligned > address)
+    {
+        munmap(reserved, aligned - address);
+    }
+    if(address + slack > aligned)
+    {
+        munmap(base + 2 * bytes, address + slack - aligned);
+    }
+
+    void *first = mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | MAP_POPULATE, fd, 0);
+    void *second = mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | MAP_POPULATE, fd, 0);
+    close(fd);
+
+    if(first == MAP_FAILED || second == MAP_FAILED)
+    {
+        munmap(base, 2 * bytes);
+        throw std::runtime_error("capture_ring: could not map ring buffer");
+    }
+
+    _base = reinterpret_cast<sample *>(base);
+    _map_bytes = bytes;
+    _size = bytes / sizeof(sample);
+    _hugepages = hugepages;
+}
+
+void capture_ring::write(const rx_block &block)
+{
+    int state = _state.load(std::memory_order_acquire);
+    if(state == RING_FROZEN)
+    {
+        return;
+    }
+
+    if(state == RING_ARMED)
+    {
+        bool fire = _trigger_requested.exchange(false);
+        if(!fire && _config.trigger)
+        {
+            fire = _config.trigger(block);
+        }
+
+        if(fire)
+        {
+            // The trigger point is the first sample of this block
+            _trigger_at = _written;
+            state = RING_TRIGGERED;
+            _state.store(state);
+        }
+    }
+
+    // Thanks to the mirror mapping a block that wraps is still a single copy
+    size_t length = block.size();
+    memcpy(_base + _written % _size, block.data(), length * sizeof(sample));
+    _written += length;
+
+    if(state == RING_TRIGGERED && _written - _trigger_at >= _config.post_trigger_samples)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _state.store(RING_FROZEN, std::memory_order_release);
+        _frozen.notify_all();
+    }
+}
+
+void capture_ring::trigger()
+{
+    _trigger_requested.store(true);
+}
+
+bool capture_ring::wait(capture_window &window, unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    bool frozen = _frozen.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() {
+        return _state.load(std::memory_order_acquire) == RING_FROZEN;
+    });
+
+    if(!frozen)
+    {
+        return false;
+    }
+
+    uint64_t pre = _trigger_at < _config.pre_trigger_samples ? _trigger_at : _config.pre_trigger_samples;
+
+    window.data = _base + (_trigger_at - pre) % _size;
+    window.pre_trigger = (unsigned long) pre;
+    window.post_trigger = _config.post_trigger_samples;
+    window.trigger_sample = _trigger_at;
+    return true;
+}
+
+void capture_ring::rearm()
+{
+    _trigger_requested.store(false);
+    _state.store(RING_ARMED, std::memory_order_release);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_CAPTURE_RING_H__
+#define __LIBADSDR_CAPTURE_RING_H__
+
+#include "adsdr.hpp"
+
+#include <condition_variable>
+#include <mutex>
+
+namespace ADSDR
+{
+    // Pre-trigger capture buffer. Decoded blocks are continuously copied into a ring
+    // that is mapped twice back to back, so any window of the ring, including one that
+    // wraps around, is a contiguous range of memory and can be handed out without
+    // copying. All memory is mapped and populated up front.
+    class capture_ring
+    {
+    public:
+        capture_ring(const capture_config &config);
+        ~capture_ring();
+
+        // Called from the libusb event thread for every decoded block
+        void write(const rx_block &block);
+
+        void trigger();
+        bool wait(capture_window &window, unsigned int timeout_ms);
+        void rearm();
+
+        bool hugepages() const { return _hugepages; }
+
+    private:
+        enum ring_state
+        {
+            RING_ARMED = 0,
+            RING_TRIGGERED,
+            RING_FROZEN
+        };
+
+        void map_ring(bool hugepages);
+
+        capture_config _config;
+
+        sample *_base = nullptr;
+        size_t _size = 0;           // In samples
+        size_t _map_bytes = 0;
+        bool _hugepages = false;
+
+        // Owned by the event thread while not frozen
+        uint64_t _written = 0;
+        uint64_t _trigger_at = 0;
+
+        std::atomic<int> _state{RING_ARMED};
+        std::atomic<bool> _trigger_requested{false};
+
+        std::mutex _lock;
+        std::condition_variable _frozen;
+    };
+}
+
+#endif // __LIBADSDR_CAPTURE_RING_H__
@@ -0,0 +1,463 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "device_registry.h"
+
+#include <algorithm>
+
+#include "usb_transport.h"
+#include "parallel.h"
+
+using namespace ADSDR;
+
+// How often the thread returns from libusb to process events and notice shutdown
+#define REGISTRY_EVENT_TIMEOUT_MS 100
+// Rescan interval without hotplug support, and retry interval for unreadable serial numbers
+#define REGISTRY_POLL_INTERVAL_MS 1000
+
+device_registry &device_registry::instance()
+{
+    static device_registry registry;
+    return registry;
+}
+
+device_registry::device_registry()
+{
+    int ret = libusb_init(&_ctx);
+    if(ret < 0)
+    {
+        throw ConnectionError("libusb init error %d: error " + std::to_string(ret));
+    }
+
+    // Set verbosity level
+    libusb_set_debug(_ctx, 3);
+
+    if(libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+    {
+        // With ENUMERATE the callback is run for every device already connected before this returns
+        ret = libusb_hotplug_register_callback(_ctx,
+                                               (libusb_hotplug_event) (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+                                               LIBUSB_HOTPLUG_ENUMERATE, ADSDR_VENDOR_ID, LIBUSB_HOTPLUG_MATCH_ANY,
+                                               LIBUSB_HOTPLUG_MATCH_ANY, hotplug_callback, this, &_callback_handle);
+        _hotplug = ret == LIBUSB_SUCCESS;
+    }
+
+    // The first enumeration is done before returning so the list is complete from the start
+    if(_hotplug)
+    {
+        process_pending();
+    }
+    else
+    {
+        poll();
+    }
+
+    _running = true;
+    _thread = std::thread(&device_registry::run, this);
+}
+
+device_registry::~device_registry()
+{
+    _running = false;
+    if(_hotplug)
+    {
+        libusb_hotplug_deregister_callback(_ctx, _callback_handle);
+    }
+    if(_thread.joinable())
+    {
+        _thread.join();
+    }
+
+    for(const pending_event &event : _pending)
+    {
+        libusb_unref_device(event.device);
+    }
+    for(const auto &device : _devices)
+    {
+        libusb_unref_device(device.first);
+    }
+
+    libusb_exit(_ctx);
+}
+
+int LIBUSB_CALL device_registry::hotplug_callback(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void *user_data)
+{
+    (void) ctx;
+    device_registry *registry = (device_registry *) user_data;
+
+    libusb_device_descriptor desc;
+    if(libusb_get_device_descriptor(device, &desc) < 0 || !matches(desc))
+    {
+        return 0;
+    }
+
+    // No synchronous transfers are allowed in here, opening the device is left to process_pending
+    libusb_ref_device(device);
+    std::lock_guard<std::mutex> lock(registry->_mutex);
+    registry->_pending.push_back({device, event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED});
+
+    // Stay registered
+    return 0;
+}
+
+bool device_registry::matches(const libusb_device_descriptor &desc)
+{
+    return (desc.idVendor == ADSDR_VENDOR_ID && desc.idProduct == ADSDR_PRODUCT_ID) ||
+           (desc.idVendor == FX3_VENDOR_ID && desc.idProduct == FX3_PRODUCT_BOOT_ID);
+}
+
+device_registry::entry device_registry::read_entry(libusb_device *device)
+{
+    entry e{};
+    e.info.bus = libusb_get_bus_number(device);
+    e.info.address = libusb_get_device_address(device);
+
+    libusb_device_descriptor desc;
+    int ret = libusb_get_device_descriptor(device, &desc);
+    if(ret < 0)
+    {
+        e.error = "libusb error getting device descriptor %d: error " + std::to_string(ret);
+        return e;
+    }
+    e.info.product_id = desc.idProduct;
+    e.info.bootloader = desc.idProduct == FX3_PRODUCT_BOOT_ID;
+
+    // A bootloader has no serial number of its own
+    if(e.info.bootloader)
+    {
+        return e;
+    }
+
+    if(!desc.iSerialNumber)
+    {
+        e.info.serial = "12345";
+        return e;
+    }
+
+    libusb_device_handle *temp_handle;
+    ret = libusb_open(device, &temp_handle);
+    if(ret != 0)
+    {
+        e.error = "libusb could not open found ADSDR USB device %d: error " + std::to_string(ret);
+        return e;
+    }
+
+    char serial_num_buf[MAX_SERIAL_LENGTH];
+    ret = libusb_get_string_descriptor_ascii(temp_handle, desc.iSerialNumber, (unsigned char *) serial_num_buf, MAX_SERIAL_LENGTH);
+    if(ret < 0)
+    {
+        e.error = "2) libusb could not read ADSDR serial number %d: error " + std::to_string(ret);
+    }
+    else
+    {
+        e.info.serial = std::string(serial_num_buf);
+    }
+
+    libusb_close(temp_handle);
+    return e;
+}
+
+void device_registry::run()
+{
+    auto last_poll = std::chrono::steady_clock::now();
+    while(_running)
+    {
+        if(_hotplug)
+        {
+            struct timeval tv = {0, REGISTRY_EVENT_TIMEOUT_MS * 1000};
+            libusb_handle_events_timeout_completed(_ctx, &tv, nullptr);
+            process_pending();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(REGISTRY_EVENT_TIMEOUT_MS));
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if(now - last_poll >= std::chrono::milliseconds(REGISTRY_POLL_INTERVAL_MS))
+        {
+            last_poll = now;
+            if(_hotplug)
+            {
+                retry_errors();
+            }
+            else
+            {
+                poll();
+            }
+        }
+    }
+}
+
+void device_registry::poll()
+{
+    libusb_device **devs;
+    int num_devs = (int) libusb_get_device_list(_ctx, &devs);
+    if(num_devs < 0)
+    {
+        return;
+    }
+
+    // libusb keeps one libusb_device per connected device while it is referenced, so a device
+    // that is still listed comes back as the same pointer
+    std::vector<libusb_device *> present;
+    for(int i = 0; i < num_devs; i++)
+    {
+        libusb_device_descriptor desc;
+        if(libusb_get_device_descriptor(devs[i], &desc) == 0 && matches(desc))
+        {
+            present.push_back(devs[i]);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(libusb_device *device : present)
+        {
+            if(_devices.find(device) == _devices.end())
+            {
+                libusb_ref_device(device);
+                _pending.push_back({device, true});
+            }
+        }
+        for(const auto &device : _devices)
+        {
+            if(std::find(present.begin(), present.end(), device.first) == present.end())
+            {
+                libusb_ref_device(device.first);
+                _pending.push_back({device.first, false});
+            }
+        }
+    }
+
+    libusb_free_device_list(devs, 1);
+
+    process_pending();
+    retry_errors();
+}
+
+void device_registry::process_pending()
+{
+    std::vector<pending_event> pending;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        pending.swap(_pending);
+    }
+    if(pending.empty())
+    {
+        return;
+    }
+
+    // Opening a device and reading its serial number takes a few control transfers, read them all at once
+    std::vector<libusb_device *> arrived;
+    for(const pending_event &event : pending)
+    {
+        if(event.arrived && std::find(arrived.begin(), arrived.end(), event.device) == arrived.end())
+        {
+            arrived.push_back(event.device);
+        }
+    }
+    std::vector<entry> entries(arrived.size());
+    run_parallel(arrived.size(), 0, [&](size_t i) {
+        entries[i] = read_entry(arrived[i]);
+    });
+
+    std::vector<hotplug_event> events;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(const pending_event &event : pending)
+        {
+            auto it = _devices.find(event.device);
+            if(event.arrived && it == _devices.end())
+            {
+                size_t i = std::find(arrived.begin(), arrived.end(), event.device) - arrived.begin();
+                entry e = entries[i];
+                e.announced = e.error.empty();
+                if(e.announced)
+                {
+                    events.push_back({DEVICE_ARRIVED, e.info});
+                }
+                libusb_ref_device(event.device);
+                _devices[event.device] = e;
+                _generation++;
+            }
+            else if(!event.arrived && it != _devices.end())
+            {
+                if(it->second.announced)
+                {
+                    events.push_back({DEVICE_LEFT, it->second.info});
+                }
+                libusb_unref_device(it->first);
+                _devices.erase(it);
+                _generation++;
+            }
+            libusb_unref_device(event.device);
+        }
+    }
+    _changed.notify_all();
+
+    notify(events);
+}
+
+void device_registry::retry_errors()
+{
+    std::vector<libusb_device *> failed;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(const auto &device : _devices)
+        {
+            if(!device.second.error.empty())
+            {
+                failed.push_back(device.first);
+            }
+        }
+    }
+    if(failed.empty())
+    {
+        return;
+    }
+
+    // Only this thread adds and removes devices, so the ones found above are still listed
+    std::vector<entry> entries(failed.size());
+    run_parallel(failed.size(), 0, [&](size_t i) {
+        entries[i] = read_entry(failed[i]);
+    });
+
+    std::vector<hotplug_event> events;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(size_t i = 0; i < failed.size(); i++)
+        {
+            entry &e = _devices[failed[i]];
+            e.info = entries[i].info;
+            e.error = entries[i].error;
+            _generation++;
+            if(e.error.empty() && !e.announced)
+            {
+                e.announced = true;
+                events.push_back({DEVICE_ARRIVED, e.info});
+            }
+        }
+    }
+    _changed.notify_all();
+
+    notify(events);
+}
+
+void device_registry::notify(const std::vector<hotplug_event> &events)
+{
+    if(events.empty())
+    {
+        return;
+    }
+
+    // Copied so a callback can unsubscribe itself
+    std::map<int, std::function<void(const hotplug_event &)>> subscribers;
+    {
+        std::lock_guard<std::mutex> lock(_subscriber_mutex);
+        subscribers = _subscribers;
+    }
+    for(const hotplug_event &event : events)
+    {
+        for(const auto &subscriber : subscribers)
+        {
+            subscriber.second(event);
+        }
+    }
+}
+
+std::vector<device_info> device_registry::devices(std::vector<std::string> *errors) const
+{
+    std::vector<entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(const auto &device : _devices)
+        {
+            entries.push_back(device.second);
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) {
+        return a.info.bus != b.info.bus ? a.info.bus < b.info.bus : a.info.address < b.info.address;
+    });
+
+    std::vector<device_info> infos;
+    for(const entry &e : entries)
+    {
+        infos.push_back(e.info);
+        if(errors != nullptr)
+        {
+            errors->push_back(e.error);
+        }
+    }
+    return infos;
+}
+
+bool device_registry::find(const std::string &serial, device_info &info) const
+{
+    for(const device_info &device : devices())
+    {
+        if(!device.bootloader && !device.serial.empty() && device.serial.find(serial) != std::string::npos)
+        {
+            info = device;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool device_registry::wait_for(const std::string &serial, std::chrono::milliseconds timeout, device_info &info)
+{
+    return wait_until([&](const std::vector<device_info> &) { return find(serial, info); }, timeout);
+}
+
+bool device_registry::wait_until(std::function<bool(const std::vector<device_info> &)> predicate, std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(true)
+    {
+        // Anything that changes after this is seen by the wait below
+        uint64_t generation = _generation;
+        lock.unlock();
+        if(predicate(devices()))
+        {
+            return true;
+        }
+        lock.lock();
+        if(!_changed.wait_until(lock, deadline, [&]() { return _generation != generation; }))
+        {
+            return false;
+        }
+    }
+}
+
+int device_registry::subscribe(std::function<void(const hotplug_event &)> callback)
+{
+    std::lock_guard<std::mutex> lock(_subscriber_mutex);
+    int id = _next_subscriber++;
+    _subscribers[id] = callback;
+    return id;
+}
+
+void device_registry::unsubscribe(int id)
+{
+    std::lock_guard<std::mutex> lock(_subscriber_mutex);
+    _subscribers.erase(id);
+}
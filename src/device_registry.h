@@ -0,0 +1,113 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_DEVICE_REGISTRY_H__
+#define __LIBADSDR_DEVICE_REGISTRY_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "libusb.h"
+
+#include "adsdr.hpp"
+
+namespace ADSDR
+{
+    // Process-wide list of connected ADSDRs and FX3 bootloaders. It is enumerated once and then
+    // kept current by libusb hotplug events on a thread of its own, so listing and counting
+    // devices does not open every board again. Where the platform has no hotplug support the
+    // thread rescans the bus once a second instead.
+    class device_registry
+    {
+    public:
+        // Created on first use, throws ConnectionError if libusb cannot be initialized
+        static device_registry &instance();
+
+        ~device_registry();
+
+        // All known devices ordered by bus and address. Devices whose serial number could not be
+        // read yet are included with an empty serial, their error is returned in errors if given.
+        std::vector<device_info> devices(std::vector<std::string> *errors = nullptr) const;
+
+        // First ADSDR (not bootloader) whose serial number contains serial, false if there is none
+        bool find(const std::string &serial, device_info &info) const;
+
+        // As find, but waits up to timeout for the device to arrive
+        bool wait_for(const std::string &serial, std::chrono::milliseconds timeout, device_info &info);
+
+        // Waits up to timeout for predicate to accept the list returned by devices()
+        bool wait_until(std::function<bool(const std::vector<device_info> &)> predicate, std::chrono::milliseconds timeout);
+
+        // The callback is run on the registry thread and must not block for long
+        int subscribe(std::function<void(const hotplug_event &)> callback);
+        void unsubscribe(int id);
+
+    private:
+        struct entry
+        {
+            device_info info;
+            std::string error;  // Why the serial number could not be read
+            bool announced;     // Arrival was sent to subscribers, held back until the serial is known
+        };
+
+        struct pending_event
+        {
+            libusb_device *device;  // Referenced until the event is processed
+            bool arrived;
+        };
+
+        device_registry();
+
+        static int LIBUSB_CALL hotplug_callback(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void *user_data);
+        static bool matches(const libusb_device_descriptor &desc);
+        static entry read_entry(libusb_device *device);
+
+        void run();
+        void poll();
+        void process_pending();
+        void retry_errors();
+        void notify(const std::vector<hotplug_event> &events);
+
+        libusb_context *_ctx = nullptr;
+        bool _hotplug = false;
+        libusb_hotplug_callback_handle _callback_handle;
+        std::atomic<bool> _running{false};
+        std::thread _thread;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _changed;
+        std::map<libusb_device *, entry> _devices;  // Each device is referenced while listed
+        std::vector<pending_event> _pending;
+        uint64_t _generation = 0;           // Counts changes to _devices for wait_for
+
+        std::mutex _subscriber_mutex;
+        std::map<int, std::function<void(const hotplug_event &)>> _subscribers;
+        int _next_subscriber = 0;
+    };
+}
+
+#endif // __LIBADSDR_DEVICE_REGISTRY_H__
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fft.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace ADSDR;
+
+fft_plan::fft_plan(size_t size) : _size(size)
+{
+    if(size < 2 || (size & (size - 1)) != 0)
+    {
+        throw std::invalid_argument("fft: size must be a power of two of at least 2");
+    }
+
+    unsigned int bits = 0;
+    while(((size_t) 1 << bits) < size)
+    {
+        bits++;
+    }
+    for(uint32_t n = 0; n < size; n++)
+    {
+        uint32_t reversed = 0;
+        for(unsigned int b = 0; b < bits; b++)
+        {
+            reversed |= ((n >> b) & 1) << (bits - 1 - b);
+        }
+        if(n < reversed)
+        {
+            _swaps.push_back(std::make_pair(n, reversed));
+        }
+    }
+
+    for(size_t half = 2; half < size; half *= 2)
+    {
+        for(size_t k = 0; k < half; k++)
+        {
+            double angle = -M_PI * k / half;
+            float re = (float) std::cos(angle);
+            float im = (float) std::sin(angle);
+            _twiddle_re.push_back(re);
+            _twiddle_re.push_back(re);
+            _twiddle_im.push_back(-im);
+            _twiddle_im.push_back(im);
+        }
+    }
+}
+
+void fft_plan::execute(std::complex<float> *data) const
+{
+    for(const std::pair<uint32_t, uint32_t> &swap : _swaps)
+    {
+        std::swap(data[swap.first], data[swap.second]);
+    }
+
+    float *x = reinterpret_cast<float *>(data);
+
+    // First stage, every twiddle is 1
+    for(size_t n = 0; n < 2 * _size; n += 4)
+    {
+        float ar = x[n], ai = x[n + 1], br = x[n + 2], bi = x[n + 3];
+        x[n] = ar + br;
+        x[n + 1] = ai + bi;
+        x[n + 2] = ar - br;
+        x[n + 3] = ai - bi;
+    }
+
+    const float *wre = _twiddle_re.data();
+    const float *wim = _twiddle_im.data();
+    for(size_t half = 2; half < _size; half *= 2)
+    {
+        for(size_t start = 0; start < _size; start += 2 * half)
+        {
+            float *a = x + 2 * start;
+            float *b = a + 2 * half;
+            size_t k = 0;
+
+#if defined(__SSE2__)
+            // Two butterflies per iteration, b * w = b * [re re] + swap(b) * [-im im]
+            for(; k < 2 * half; k += 4)
+            {
+                __m128 vb = _mm_loadu_ps(b + k);
+                __m128 swapped = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1));
+                __m128 product = _mm_add_ps(_mm_mul_ps(vb, _mm_loadu_ps(wre + k)), _mm_mul_ps(swapped, _mm_loadu_ps(wim + k)));
+                __m128 va = _mm_loadu_ps(a + k);
+                _mm_storeu_ps(a + k, _mm_add_ps(va, product));
+                _mm_storeu_ps(b + k, _mm_sub_ps(va, product));
+            }
+#endif
+
+            for(; k < 2 * half; k += 2)
+            {
+                float pr = b[k] * wre[k] + b[k + 1] * wim[k];
+                float pi = b[k + 1] * wre[k + 1] + b[k] * wim[k + 1];
+                float ar = a[k], ai = a[k + 1];
+                a[k] = ar + pr;
+                a[k + 1] = ai + pi;
+                b[k] = ar - pr;
+                b[k + 1] = ai - pi;
+            }
+        }
+        wre += 2 * half;
+        wim += 2 * half;
+    }
+}
+
+void fft_plan::execute(std::complex<float> *data, size_t count) const
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        execute(data + i * _size);
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_FFT_H__
+#define __LIBADSDR_FFT_H__
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ADSDR
+{
+    // In place radix-2 FFT of a fixed power of two size, X[k] = sum x[n] e^(-j2pi kn/N).
+    // The plan is immutable, so one plan may run on several threads at once.
+    class fft_plan
+    {
+    public:
+        explicit fft_plan(size_t size);
+
+        size_t size() const { return _size; }
+
+        void execute(std::complex<float> *data) const;
+
+        // count transforms stored back to back, sharing the twiddles while they are in cache
+        void execute(std::complex<float> *data, size_t count) const;
+
+    private:
+        size_t _size;
+        // Index pairs swapped by the bit reversal
+        std::vector<std::pair<uint32_t, uint32_t>> _swaps;
+        // Per stage twiddles as [re re] and [-im im] pairs, from the stage with 2 butterflies on
+        std::vector<float> _twiddle_re;
+        std::vector<float> _twiddle_im;
+    };
+}
+
+#endif // __LIBADSDR_FFT_H__
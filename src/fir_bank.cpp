@@ -0,0 +1,240 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fir_bank.h"
+#include "spi_burst.h"
+
+#include <cstring>
+
+// The decimation/interpolation the clock chain is run at: 1 above 30.72 MSPS,
+// 2 down to 7.68 MSPS and 4 below
+#define FIR_BANK_RATIO_1_MIN 30720000UL
+#define FIR_BANK_RATIO_2_MIN 7680000UL
+
+using namespace ADSDR;
+
+namespace
+{
+    // Kaiser windowed sinc lowpass designs, sorted by ratio and bandwidth. Ratio 1 cuts off
+    // halfway between the passband and fs/2 in 64 taps (beta 7.86). Ratios 2 and 4 cut off at
+    // fs/2, so the stopband begins where it would alias into the passband, and each uses the
+    // fewest taps and the beta that keep that stopband down 80 dB or more after rounding to Q15.
+    // Narrower passbands leave a wider transition and load with fewer taps.
+    // Passband ripple is under 0.05 dB.
+    constexpr fir_design fir_bank[] = {
+        {1, 40, 0, 64, {
+            0, -2, 3, -1, -6, 13, -9, -12,
+            35, -34, -10, 71, -90, 20, 111, -191,
+            107, 129, -339, 291, 77, -524, 626, -132,
+            -717, 1218, -692, -878, 2531, -2594, -971, 16713,
+            16713, -971, -2594, 2531, -878, -692, 1218, -717,
+            -132, 626, -524, 77, 291, -339, 129, 107,
+            -191, 111, 20, -90, 71, -10, -34, 35,
+            -12, -9, 13, -6, -1, 3, -2, 0}},
+        {1, 60, 0, 64, {
+            0, 2, -3, 3, 0, -8, 18, -25,
+            21, 0, -36, 76, -96, 74, 0, -113,
+            224, -271, 202, 0, -290, 559, -668, 495,
+            0, -725, 1450, -1840, 1506, 0, -3648, 17839,
+            17839, -3648, 0, 1506, -1840, 1450, -725, 0,
+            495, -668, 559, -290, 0, 202, -271, 224,
+            -113, 0, 74, -96, 76, -36, 0, 21,
+            -25, 18, -8, 0, 3, -3, 2, 0}},
+        {1, 80, 0, 64, {
+            1, -2, 3, -5, 6, -6, 3, 4,
+            -16, 34, -55, 79, -100, 113, -111, 88,
+            -37, -45, 156, -291, 439, -581, 694, -750,
+            717, -560, 239, 303, -1164, 2594, -5530, 18526,
+            18526, -5530, 2594, -1164, 303, 239, -560, 717,
+            -750, 694, -581, 439, -291, 156, -45, -37,
+            88, -111, 113, -100, 79, -55, 34, -16,
+            4, 3, -6, 6, -5, 3, -2, 1}},
+        {2, 40, -6, 32, {
+            0, -1, 4, 12, -31, -69, 138, 256,
+            -445, -737, 1174, 1831, -2849, -4593, 8402, 26399,
+            26399, 8402, -4593, -2849, 1831, 1174, -737, -445,
+            256, 138, -69, -31, 12, 4, -1, 0}},
+        {2, 60, -6, 32, {
+            0, -2, 9, 23, -53, -105, 194, 333,
+            -544, -854, 1304, 1962, -2969, -4690, 8465, 26418,
+            26418, 8465, -4690, -2969, 1962, 1304, -854, -544,
+            333, 194, -105, -53, 23, 9, -2, 0}},
+        {2, 80, -6, 64, {
+            0, -1, 1, 2, -4, -7, 11, 17,
+            -25, -35, 49, 67, -90, -119, 155, 199,
+            -252, -317, 395, 488, -601, -736, 899, 1099,
+            -1348, -1665, 2087, 2677, -3577, -5154, 8756, 26520,
+            26520, 8756, -5154, -3577, 2677, 2087, -1665, -1348,
+            1099, 899, -736, -601, 488, 395, -317, -252,
+            199, 155, -119, -90, 67, 49, -35, -25,
+            17, 11, -7, -4, 2, 1, -1, 0}},
+        {4, 40, -12, 48, {
+            0, -1, -4, -4, 8, 38, 67, 46,
+            -73, -271, -401, -239, 337, 1121, 1521, 843,
+            -1120, -3574, -4741, -2640, 3661, 13090, 22647, 28671,
+            28671, 22647, 13090, 3661, -2640, -4741, -3574, -1120,
+            843, 1521, 1121, 337, -239, -401, -271, -73,
+            46, 67, 38, 8, -4, -4, -1, 0}},
+        {4, 60, -12, 64, {
+            0, -2, -4, -3, 6, 22, 34, 21,
+            -31, -104, -143, -80, 106, 336, 432, 228,
+            -287, -866, -1072, -546, 668, 1967, 2393, 1207,
+            -1476, -4390, -5486, -2909, 3881, 13484, 22890, 28706,
+            28706, 22890, 13484, 3881, -2909, -5486, -4390, -1476,
+            1207, 2393, 1967, 668, -546, -1072, -866, -287,
+            228, 432, 336, 106, -80, -143, -104, -31,
+            21, 34, 22, 6, -3, -4, -2, 0}},
+        {4, 80, -12, 112, {
+            0, -2, -2, -2, 2, 7, 10, 5,
+            -7, -21, -26, -13, 16, 48, 58, 28,
+            -34, -96, -113, -55, 63, 177, 204, 97,
+            -110, -303, -344, -161, 182, 493, 553, 256,
+            -287, -772, -860, -396, 441, 1182, 1313, 605,
+            -672, -1807, -2016, -934, 1049, 2855, 3241, 1537,
+            -1779, -5048, -6062, -3109, 4040, 13763, 23059, 28729,
+            28729, 23059, 13763, 4040, -3109, -6062, -5048, -1779,
+            1537, 3241, 2855, 1049, -934, -2016, -1807, -672,
+            605, 1313, 1182, 441, -396, -860, -772, -287,
+            256, 553, 493, 182, -161, -344, -303, -110,
+            97, 204, 177, 63, -55, -113, -96, -34,
+            28, 58, 48, 16, -13, -26, -21, -7,
+            5, 10, 7, 2, -2, -2, -2, 0}}
+    };
+
+    constexpr size_t fir_bank_size = sizeof(fir_bank) / sizeof(fir_bank[0]);
+
+    constexpr bool fir_bank_valid(size_t i)
+    {
+        return i == fir_bank_size ||
+               (fir_bank[i].taps % 16 == 0 &&
+                fir_bank[i].taps <= (fir_bank[i].ratio == 1 ? 64 : FIR_BANK_MAX_TAPS) &&
+                (i == 0 || fir_bank[i - 1].ratio < fir_bank[i].ratio ||
+                 (fir_bank[i - 1].ratio == fir_bank[i].ratio && fir_bank[i - 1].bandwidth < fir_bank[i].bandwidth)) &&
+                fir_bank_valid(i + 1));
+    }
+
+    static_assert(fir_bank_valid(0), "FIR bank designs must fit the AD9361 FIR and be sorted by ratio and bandwidth");
+}
+
+const fir_design &ADSDR::select_fir_design(uint32_t samp_freq_hz, uint32_t bandwidth_hz)
+{
+    uint8_t ratio = samp_freq_hz > FIR_BANK_RATIO_1_MIN ? 1 : (samp_freq_hz > FIR_BANK_RATIO_2_MIN ? 2 : 4);
+
+    const fir_design *selected = nullptr;
+    for(const fir_design &design : fir_bank)
+    {
+        if(design.ratio != ratio)
+        {
+            continue;
+        }
+        selected = &design;
+        if((uint64_t) design.bandwidth * samp_freq_hz >= (uint64_t) bandwidth_hz * 100)
+        {
+            break;
+        }
+    }
+    return *selected;
+}
+
+int ADSDR::load_fir_design(ad9361_rf_phy *phy, platform_context *platform, bool rx, const fir_design &design)
+{
+    struct spi_device *spi = phy->spi;
+    uint32_t offs = rx ? REG_RX_FILTER_COEF_ADDR - REG_TX_FILTER_COEF_ADDR : 0;
+    uint32_t enable_reg = rx ? REG_RX_ENABLE_FILTER_CTRL : REG_TX_ENABLE_FILTER_CTRL;
+    uint8_t fir_conf = FIR_NUM_TAPS(design.taps / 16 - 1) | FIR_SELECT(FIR_TX1_TX2) | FIR_START_CLK;
+
+    ad9361_ensm_force_state(phy, ENSM_STATE_ALERT);
+
+    // The FIR is only clocked for the write while it is enabled
+    int enable = ad9361_spi_read(spi, enable_reg);
+    if(enable < 0)
+    {
+        ad9361_ensm_restore_prev_state(phy);
+        return enable;
+    }
+    ad9361_spi_write(spi, enable_reg, (enable & ~RX_FIR_ENABLE_DECIMATION(~0)) |
+                                      RX_FIR_ENABLE_DECIMATION(design.ratio == 4 ? 3 : design.ratio));
+
+    if(rx)
+    {
+        ad9361_spi_write(spi, REG_RX_FILTER_GAIN, (3 - (design.rx_gain + 12) / 6) & 0x3);
+        phy->rx_fir_dec = design.ratio;
+        phy->rx_fir_ntaps = design.taps;
+    }
+    else
+    {
+        phy->tx_fir_int = design.ratio;
+        phy->tx_fir_ntaps = design.taps;
+    }
+
+    ad9361_spi_write(spi, REG_TX_FILTER_CONF + offs, fir_conf);
+
+    // Bursts run from the configuration register down to the address register. Each one
+    // strobes the tap latched by the burst before, clocks the FIR through the read data
+    // registers like the driver's dummy writes, and latches the next tap.
+    int ret = 0;
+    uint8_t data[6] = {(uint8_t) (design.coef[0] >> 8), (uint8_t) (design.coef[0] & 0xFF), 0};
+    int status = spi_write_burst(platform, (uint16_t) (REG_TX_FILTER_COEF_WRITE_DATA_2 + offs), data, 3);
+    for(unsigned tap = 1; tap <= design.taps && status >= 0; tap++)
+    {
+        data[0] = fir_conf | FIR_WRITE;
+        data[1] = 0;
+        data[2] = 0;
+        unsigned count = 3;
+        if(tap < design.taps)
+        {
+            data[3] = (uint8_t) (design.coef[tap] >> 8);
+            data[4] = (uint8_t) (design.coef[tap] & 0xFF);
+            data[5] = (uint8_t) tap;
+            count = 6;
+        }
+        status = spi_write_burst(platform, (uint16_t) (REG_TX_FILTER_CONF + offs), data, count);
+    }
+    if(status < 0)
+    {
+        ret = status;
+    }
+
+    ad9361_spi_write(spi, REG_TX_FILTER_CONF + offs, fir_conf);
+    ad9361_spi_write(spi, REG_TX_FILTER_CONF + offs, fir_conf & ~FIR_START_CLK);
+    ad9361_spi_write(spi, enable_reg, enable);
+
+    ad9361_ensm_restore_prev_state(phy);
+    return ret;
+}
+
+void ADSDR::fir_config(const fir_design &design, AD9361_RXFIRConfig &config)
+{
+    memset(&config, 0, sizeof(config));
+    config.rx = 3;
+    config.rx_gain = design.rx_gain;
+    config.rx_dec = design.ratio;
+    memcpy(config.rx_coef, design.coef, design.taps * sizeof(design.coef[0]));
+    config.rx_coef_size = design.taps;
+}
+
+void ADSDR::fir_config(const fir_design &design, AD9361_TXFIRConfig &config)
+{
+    memset(&config, 0, sizeof(config));
+    config.tx = 3;
+    config.tx_gain = 0;
+    config.tx_int = design.ratio;
+    memcpy(config.tx_coef, design.coef, design.taps * sizeof(design.coef[0]));
+    config.tx_coef_size = design.taps;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_FIR_BANK_H__
+#define __LIBADSDR_FIR_BANK_H__
+
+#include <cstdint>
+
+extern "C" {
+    #include "ad9361_api.h"
+    #include "platform.h"
+}
+
+// Largest AD9361 FIR, 64 taps when it does not decimate or interpolate
+#define FIR_BANK_MAX_TAPS 128
+
+namespace ADSDR
+{
+    // Lowpass for the programmable FIR of either path. RX decimates by ratio, TX interpolates
+    // by ratio with the same coefficients. They are scaled for a DC gain of ratio (less 0.9 dB
+    // headroom), which zero stuffing takes out on TX and rx_gain takes out on RX.
+    struct fir_design
+    {
+        uint8_t ratio;
+        // Passband as a percentage of the sample rate
+        uint8_t bandwidth;
+        int8_t rx_gain;
+        uint8_t taps;
+        int16_t coef[FIR_BANK_MAX_TAPS];
+    };
+
+    // The ratio the clock chain can run at samp_freq_hz, then the narrowest design passing
+    // bandwidth_hz, or the widest one
+    const fir_design &select_fir_design(uint32_t samp_freq_hz, uint32_t bandwidth_hz);
+
+    // Programs design into the RX or TX FIR of both channels, without changing whether the
+    // FIR is bypassed. Does what ad9361_set_rx_fir_config/ad9361_set_tx_fir_config do, but
+    // writes each tap with one SPI burst and skips reading the coefficients back.
+    int load_fir_design(ad9361_rf_phy *phy, platform_context *platform, bool rx, const fir_design &design);
+
+    // The driver view of a design, for reading it back or hashing the configuration
+    void fir_config(const fir_design &design, AD9361_RXFIRConfig &config);
+    void fir_config(const fir_design &design, AD9361_TXFIRConfig &config);
+}
+
+#endif // __LIBADSDR_FIR_BANK_H__
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fpga_loader.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bytes per bulk transfer and how many are in flight
+#define FPGA_LOAD_CHUNK_SIZE (256 * 1024)
+#define FPGA_LOAD_QUEUE_DEPTH 4
+// Status polling starts this fast and slows down to the maximum
+#define FPGA_POLL_MIN_MS 1
+#define FPGA_POLL_MAX_MS 32
+
+using namespace ADSDR;
+
+namespace
+{
+    struct load_state
+    {
+        std::mutex lock;
+        std::condition_variable done;
+        int in_flight = 0;
+        int error = 0;
+    };
+
+    void LIBUSB_CALL load_callback(libusb_transfer *transfer)
+    {
+        load_state *state = static_cast<load_state *>(transfer->user_data);
+        std::lock_guard<std::mutex> lock(state->lock);
+        if(state->error == 0 && (transfer->status != LIBUSB_TRANSFER_COMPLETED || transfer->actual_length != transfer->length))
+        {
+            state->error = transfer->status == LIBUSB_TRANSFER_NO_DEVICE ? LIBUSB_ERROR_NO_DEVICE : LIBUSB_ERROR_IO;
+        }
+        state->in_flight--;
+        state->done.notify_all();
+    }
+}
+
+uint64_t ADSDR::fpga_bitstream_hash(const mapped_file &image)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for(size_t i = 0; i < image.size(); i++)
+    {
+        hash = (hash ^ image.data()[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+int ADSDR::send_fpga_bitstream(transport &device, const mapped_file &image)
+{
+    load_state state;
+    std::vector<libusb_transfer *> transfers(FPGA_LOAD_QUEUE_DEPTH);
+    for(libusb_transfer *&transfer : transfers)
+    {
+        transfer = libusb_alloc_transfer(0);
+    }
+
+    size_t offset = 0;
+    size_t next = 0;
+    std::unique_lock<std::mutex> lock(state.lock);
+    while(true)
+    {
+        // Transfers on one endpoint complete in order, so the next slot round robin is the free one
+        while(state.error == 0 && offset < image.size() && state.in_flight < FPGA_LOAD_QUEUE_DEPTH)
+        {
+            libusb_transfer *transfer = transfers[next];
+            next = (next + 1) % transfers.size();
+
+            int length = (int) std::min((size_t) FPGA_LOAD_CHUNK_SIZE, image.size() - offset);
+            // OUT transfers only read the buffer, so the read-only mapping is sent as it is
+            libusb_fill_bulk_transfer(transfer, device.handle(), ADSDR_FPGA_CONFIG_OUT, const_cast<unsigned char *>(image.data() + offset),
+                                      length, load_callback, &state, ADSDR_USB_TIMEOUT);
+
+            int ret = device.submit(transfer);
+            if(ret < 0)
+            {
+                state.error = ret;
+                break;
+            }
+            state.in_flight++;
+            offset += length;
+        }
+
+        if(state.in_flight == 0 && (offset == image.size() || state.error != 0))
+        {
+            break;
+        }
+        state.done.wait(lock);
+    }
+    lock.unlock();
+
+    for(libusb_transfer *transfer : transfers)
+    {
+        libusb_free_transfer(transfer);
+    }
+    return state.error;
+}
+
+bool ADSDR::wait_fpga_configured(transport &device, unsigned int timeout_ms)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    unsigned int interval_ms = FPGA_POLL_MIN_MS;
+    while(true)
+    {
+        std::array<unsigned char, ADSDR_USB_CTRL_SIZE> stat_buf{};
+        int ret = device.control(LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN, ADSDR_FPGA_CONFIG_STATUS, 0, 1, stat_buf.data(), (uint16_t) stat_buf.size(), ADSDR_USB_TIMEOUT);
+        if(ret < 0)
+        {
+            throw ConnectionError("ADSDR not responding to FPGA status request: error " + std::to_string(ret));
+        }
+        if(ret > 0 && stat_buf[0])
+        {
+            return true;
+        }
+
+        if(std::chrono::steady_clock::now() >= deadline)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+        interval_ms = std::min(interval_ms * 2, (unsigned int) FPGA_POLL_MAX_MS);
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_FPGA_LOADER_H__
+#define __LIBADSDR_FPGA_LOADER_H__
+
+#include <cstdint>
+
+#include "mapped_file.h"
+#include "transport.h"
+
+namespace ADSDR
+{
+    // FNV-1a of a bitstream, identifies the image loaded into the FPGA
+    uint64_t fpga_bitstream_hash(const mapped_file &image);
+
+    // Sends the bitstream to the FPGA configuration endpoint in large bulk transfers straight
+    // from the mapping, with several in flight. The transfers complete on the event thread
+    // of the transport, which must be running. Returns a libusb error code.
+    int send_fpga_bitstream(transport &device, const mapped_file &image);
+
+    // Polls the configuration status until the FPGA reports it is configured, backing off from
+    // a millisecond up. Returns false if it did not within timeout_ms, throws ConnectionError
+    // if the device stops responding.
+    bool wait_fpga_configured(transport &device, unsigned int timeout_ms);
+}
+
+#endif // __LIBADSDR_FPGA_LOADER_H__
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fx3_firmware.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+#include "adsdr.hpp"
+
+#define GET_LSW(v) ((unsigned short)((v) & 0xFFFF))
+#define GET_MSW(v) ((unsigned short)((v) >> 16))
+
+// Bootloader vendor request writing to or jumping into RAM
+#define FX3_RAM_REQUEST 0xA0
+// Largest RAM write the bootloader takes in one request
+#define FX3_WRITE_SIZE (2 * 1024)
+// RAM writes in flight at once
+#define FX3_UPLOAD_QUEUE_DEPTH 4
+#define FX3_HEADER_SIZE 4
+
+using namespace ADSDR;
+
+namespace
+{
+    uint32_t read_word(const mapped_file &image, size_t offset)
+    {
+        uint32_t word;
+        memcpy(&word, image.data() + offset, sizeof(word));
+        return word;
+    }
+
+    struct upload_slot
+    {
+        libusb_transfer *transfer = nullptr;
+        std::array<unsigned char, LIBUSB_CONTROL_SETUP_SIZE + FX3_WRITE_SIZE> buffer;
+        bool busy = false;
+    };
+
+    void LIBUSB_CALL upload_callback(libusb_transfer *transfer)
+    {
+        static_cast<upload_slot *>(transfer->user_data)->busy = false;
+    }
+}
+
+void ADSDR::validate_fx3_firmware(const mapped_file &image)
+{
+    if(image.size() < FX3_HEADER_SIZE || image.data()[0] != 'C' || image.data()[1] != 'Y')
+    {
+        throw std::runtime_error(image.filename() + " is not an FX3 firmware image");
+    }
+
+    size_t index = FX3_HEADER_SIZE;
+    while(true)
+    {
+        if(index + 12 > image.size())
+        {
+            throw std::runtime_error("FX3 firmware image " + image.filename() + " is truncated");
+        }
+
+        uint32_t length = read_word(image, index);
+        if(length == 0)
+        {
+            return;
+        }
+        if(length > (image.size() - index - 8) / 4)
+        {
+            throw std::runtime_error("FX3 firmware image " + image.filename() + " is truncated");
+        }
+        index += 8 + (size_t) length * 4;
+    }
+}
+
+void ADSDR::upload_fx3_firmware(libusb_context *ctx, libusb_device_handle *handle, const mapped_file &image)
+{
+    validate_fx3_firmware(image);
+
+    std::vector<upload_slot> slots(FX3_UPLOAD_QUEUE_DEPTH);
+    for(upload_slot &slot : slots)
+    {
+        slot.transfer = libusb_alloc_transfer(0);
+    }
+
+    // Position in the image: the current section and how far into it the writes have got
+    size_t index = FX3_HEADER_SIZE;
+    uint32_t section_words = read_word(image, index);
+    uint32_t address = read_word(image, index + 4);
+    uint32_t written = 0;
+    uint32_t checksum = 0;
+    std::string error;
+
+    while(true)
+    {
+        // Keep every free slot busy with the next piece of the image
+        for(upload_slot &slot : slots)
+        {
+            if(slot.busy || section_words == 0 || !error.empty())
+            {
+                continue;
+            }
+
+            const unsigned char *section = image.data() + index + 8;
+            uint32_t size = std::min(section_words * 4 - written, (uint32_t) FX3_WRITE_SIZE);
+            for(uint32_t i = 0; i < size; i += 4)
+            {
+                checksum += read_word(image, index + 8 + written + i);
+            }
+
+            libusb_fill_control_setup(slot.buffer.data(), LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT,
+                                      FX3_RAM_REQUEST, GET_LSW(address + written), GET_MSW(address + written), (uint16_t) size);
+            memcpy(slot.buffer.data() + LIBUSB_CONTROL_SETUP_SIZE, section + written, size);
+            libusb_fill_control_transfer(slot.transfer, handle, slot.buffer.data(), upload_callback, &slot, ADSDR_USB_TIMEOUT);
+
+            slot.busy = true;
+            int ret = libusb_submit_transfer(slot.transfer);
+            if(ret < 0)
+            {
+                slot.busy = false;
+                error = "FX3 firmware write via libusb control transfer failed: " + std::to_string(ret);
+                continue;
+            }
+
+            written += size;
+            if(written == section_words * 4)
+            {
+                index += 8 + (size_t) section_words * 4;
+                section_words = read_word(image, index);
+                address = read_word(image, index + 4);
+                written = 0;
+            }
+        }
+
+        bool busy = std::any_of(slots.begin(), slots.end(), [](const upload_slot &slot) { return slot.busy; });
+        if(!busy && (section_words == 0 || !error.empty()))
+        {
+            break;
+        }
+
+        struct timeval tv = {0, 100000};
+        libusb_handle_events_timeout_completed(ctx, &tv, nullptr);
+
+        // Completed writes are checked here rather than in the callback, which only frees the slot
+        for(upload_slot &slot : slots)
+        {
+            libusb_transfer *transfer = slot.transfer;
+            if(!slot.busy && transfer->buffer != nullptr && error.empty() &&
+               (transfer->status != LIBUSB_TRANSFER_COMPLETED || transfer->actual_length != transfer->length - LIBUSB_CONTROL_SETUP_SIZE))
+            {
+                error = "FX3 firmware write via libusb control transfer failed: status " + std::to_string(transfer->status);
+            }
+        }
+    }
+
+    for(upload_slot &slot : slots)
+    {
+        libusb_free_transfer(slot.transfer);
+    }
+
+    if(!error.empty())
+    {
+        throw ConnectionError(error);
+    }
+
+    // The last section holds the entry point and the expected checksum
+    if(checksum != read_word(image, index + 8))
+    {
+        throw std::runtime_error("Checksum error in firmware binary");
+    }
+
+    address = read_word(image, index + 4);
+    int r = libusb_control_transfer(handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT,
+                                    FX3_RAM_REQUEST, GET_LSW(address), GET_MSW(address), 0, 0, ADSDR_USB_TIMEOUT);
+    if(r != 0 && r != -4)
+    {
+        // Ignore this, somehow this error's but still works (??)
+    }
+}
+
+bool ADSDR::fx3_firmware_matches(const mapped_file &image, const std::string &version)
+{
+    if(version.empty())
+    {
+        return false;
+    }
+    const char *begin = reinterpret_cast<const char *>(image.data());
+    const char *end = begin + image.size();
+
+    // The whole C string with its terminator, so "1.2" does not match inside "1.2.1" or "11.2"
+    const char *needle = version.c_str();
+    const char *needle_end = needle + version.size() + 1;
+    for(const char *at = std::search(begin, end, needle, needle_end); at != end; at = std::search(at + 1, end, needle, needle_end))
+    {
+        if(at == begin || !(isdigit((unsigned char) at[-1]) || at[-1] == '.'))
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_FX3_FIRMWARE_H__
+#define __LIBADSDR_FX3_FIRMWARE_H__
+
+#include <string>
+
+#include "mapped_file.h"
+#include "libusb.h"
+
+namespace ADSDR
+{
+    // An FX3 boot image is a 4 byte header ("CY", control and type bytes) followed by sections of
+    // [length in 32 bit words][RAM address][data]. A section of length 0 ends the image, it holds
+    // the entry point and the sum of all data words.
+
+    // Checks that the image has an FX3 header and that its sections are complete, throws
+    // std::runtime_error otherwise
+    void validate_fx3_firmware(const mapped_file &image);
+
+    // Writes the image to an FX3 in bootloader mode through handle and starts it. Several
+    // vendor requests are kept in flight, events are handled on ctx while waiting for them. The
+    // checksum is summed up as sections are sent and the firmware is only started if it matches.
+    // Throws ConnectionError on transfer errors and std::runtime_error on a bad image.
+    void upload_fx3_firmware(libusb_context *ctx, libusb_device_handle *handle, const mapped_file &image);
+
+    // True if version, as reported by a running firmware, is found in the image as a whole NUL
+    // terminated string, not as the prefix or suffix of a longer version
+    bool fx3_firmware_matches(const mapped_file &image, const std::string &version);
+}
+
+#endif // __LIBADSDR_FX3_FIRMWARE_H__
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_MAPPED_FILE_H__
+#define __LIBADSDR_MAPPED_FILE_H__
+
+#include <string>
+#include <cstddef>
+
+namespace ADSDR
+{
+    // Read-only memory map of a whole file, for images that are streamed to the device as they
+    // are read. Throws std::runtime_error if the file cannot be opened or is empty.
+    class mapped_file
+    {
+    public:
+        mapped_file(const std::string &filename);
+        ~mapped_file();
+
+        mapped_file(const mapped_file &) = delete;
+        mapped_file &operator=(const mapped_file &) = delete;
+
+        const unsigned char *data() const { return _data; }
+        size_t size() const { return _size; }
+        const std::string &filename() const { return _filename; }
+
+    private:
+        std::string _filename;
+        const unsigned char *_data = nullptr;
+        size_t _size = 0;
+    };
+}
+
+#endif // __LIBADSDR_MAPPED_FILE_H__
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_PARALLEL_H__
+#define __LIBADSDR_PARALLEL_H__
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace ADSDR
+{
+    // Runs job(i) for every i below count on a pool of up to threads threads, one per job if
+    // threads is 0, and returns once every job has finished. job must not throw.
+    template<typename F>
+    void run_parallel(size_t count, unsigned int threads, F job)
+    {
+        if(threads == 0 || threads > count)
+        {
+            threads = (unsigned int) count;
+        }
+        if(threads <= 1)
+        {
+            for(size_t i = 0; i < count; i++)
+            {
+                job(i);
+            }
+            return;
+        }
+
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> pool;
+        for(unsigned int t = 0; t < threads; t++)
+        {
+            pool.emplace_back([&]() {
+                for(size_t i = next++; i < count; i = next++)
+                {
+                    job(i);
+                }
+            });
+        }
+        for(std::thread &thread : pool)
+        {
+            thread.join();
+        }
+    }
+}
+
+#endif // __LIBADSDR_PARALLEL_H__
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_block_pool.h"
+
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace ADSDR;
+
+rx_block_ref::rx_block_ref(rx_block *block) : _block(block)
+{
+    if(_block != nullptr)
+    {
+        _block->_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+rx_block_ref::rx_block_ref(const rx_block_ref &other) : rx_block_ref(other._block)
+{
+}
+
+rx_block_ref::rx_block_ref(rx_block_ref &&other) : _block(other._block)
+{
+    other._block = nullptr;
+}
+
+rx_block_ref &rx_block_ref::operator=(rx_block_ref other)
+{
+    std::swap(_block, other._block);
+    return *this;
+}
+
+rx_block_ref::~rx_block_ref()
+{
+    reset();
+}
+
+void rx_block_ref::reset()
+{
+    if(_block != nullptr)
+    {
+        if(_block->_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            _block->_pool->release(_block);
+        }
+        _block = nullptr;
+    }
+}
+
+rx_block_pool::rx_block_pool(size_t block_count, size_t block_size) : _block_size(block_size), _blocks(block_count)
+{
+    // Page aligned so that blocks can be handed to O_DIRECT writes as they are
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    void *storage = nullptr;
+    if(posix_memalign(&storage, page_size, block_count * block_size * sizeof(sample)) != 0)
+    {
+        throw std::runtime_error("could not allocate RX block pool");
+    }
+    _storage = static_cast<sample *>(storage);
+
+    _free.reserve(block_count);
+    for(size_t i = 0; i < block_count; i++)
+    {
+        _blocks[i]._data = _storage + i * block_size;
+        _blocks[i]._pool = this;
+        _free.push_back(&_blocks[i]);
+    }
+}
+
+rx_block_pool::~rx_block_pool()
+{
+    free(_storage);
+}
+
+rx_block_ref rx_block_pool::acquire()
+{
+    rx_block *block = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(_free_lock);
+        if(!_free.empty())
+        {
+            block = _free.back();
+            _free.pop_back();
+        }
+    }
+
+    if(block != nullptr)
+    {
+        block->_size = 0;
+    }
+    return rx_block_ref(block);
+}
+
+size_t rx_block_pool::available()
+{
+    std::lock_guard<std::mutex> lock(_free_lock);
+    return _free.size();
+}
+
+void rx_block_pool::release(rx_block *block)
+{
+    std::lock_guard<std::mutex> lock(_free_lock);
+    _free.push_back(block);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_RX_BLOCK_POOL_H__
+#define __LIBADSDR_RX_BLOCK_POOL_H__
+
+#include "adsdr.hpp"
+
+#include <mutex>
+
+namespace ADSDR
+{
+    // Fixed set of preallocated RX blocks. Blocks are handed out as rx_block_refs and
+    // come back to the free list when their last reference is released, so streaming
+    // never allocates.
+    class rx_block_pool
+    {
+    public:
+        rx_block_pool(size_t block_count, size_t block_size);
+        ~rx_block_pool();
+
+        // Returns an empty reference if all blocks are in use
+        rx_block_ref acquire();
+
+        size_t block_size() const { return _block_size; }
+        size_t available();
+
+        // Gives write access to a block that has just been acquired
+        static sample *writable(rx_block_ref &block) { return block._block->_data; }
+        static void set_size(rx_block_ref &block, size_t size) { block._block->_size = size; }
+        static void set_sequence(rx_block_ref &block, uint64_t sequence) { block._block->_sequence = sequence; }
+        static void set_power(rx_block_ref &block, float energy, float peak) { block._block->_energy = energy; block._block->_peak = peak; }
+        static void set_gap(rx_block_ref &block, bool gap, uint64_t lost_samples) { block._block->_gap = gap; block._block->_gap_samples = lost_samples; }
+
+    private:
+        friend class rx_block_ref;
+
+        void release(rx_block *block);
+
+        size_t _block_size;
+        sample *_storage = nullptr;
+        std::vector<rx_block> _blocks;
+
+        std::mutex _free_lock;
+        std::vector<rx_block *> _free;
+    };
+}
+
+#endif // __LIBADSDR_RX_BLOCK_POOL_H__
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_block_queue.h"
+
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace ADSDR;
+
+#define RX_QUEUE_NO_WAKEUP std::numeric_limits<size_t>::max()
+
+rx_block_queue::rx_block_queue(size_t capacity) :
+    _ring(capacity),
+    _wake_threshold(RX_QUEUE_NO_WAKEUP),
+    _low_water_mark(RX_QUEUE_NO_WAKEUP)
+{
+    _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(_event_fd < 0)
+    {
+        throw std::runtime_error("could not create RX queue eventfd");
+    }
+}
+
+rx_block_queue::~rx_block_queue()
+{
+    close(_event_fd);
+}
+
+bool rx_block_queue::push(const rx_block_ref &block)
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if(_count == _ring.size())
+        {
+            return false;
+        }
+
+        _ring[(_head + _count) % _ring.size()] = block;
+        _count++;
+    }
+
+    wake_if_needed(_queued_samples.fetch_add(block->size()) + block->size());
+    return true;
+}
+
+rx_block_ref rx_block_queue::drop_oldest()
+{
+    rx_block_ref block;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if(_count == 0)
+        {
+            return block;
+        }
+
+        block = std::move(_ring[_head]);
+        _head = (_head + 1) % _ring.size();
+        _count--;
+    }
+
+    _queued_samples.fetch_sub(block->size());
+    return block;
+}
+
+void rx_block_queue::wake_if_needed(size_t queued)
+{
+    if(queued >= _wake_threshold.load())
+    {
+        eventfd_write(_event_fd, 1);
+    }
+}
+
+bool rx_block_queue::next_block()
+{
+    rx_block_ref block;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if(_count == 0)
+        {
+            return false;
+        }
+
+        block = std::move(_ring[_head]);
+        _head = (_head + 1) % _ring.size();
+        _count--;
+    }
+
+    _queued_samples.fetch_sub(block->size());
+    _current = std::move(block);
+    _offset = 0;
+    return true;
+}
+
+bool rx_block_queue::pop(sample &s)
+{
+    while(!_current || _offset == _current->size())
+    {
+        if(!next_block())
+        {
+            return false;
+        }
+    }
+
+    s = (*_current)[_offset++];
+    return true;
+}
+
+size_t rx_block_queue::read(sample *destination, size_t max_samples)
+{
+    size_t copied = 0;
+
+    while(copied < max_samples)
+    {
+        if(!_current || _offset == _current->size())
+        {
+            if(!next_block())
+            {
+                break;
+            }
+            continue;
+        }
+
+        size_t length = std::min(max_samples - copied, _current->size() - _offset);
+        memcpy(destination + copied, _current->data() + _offset, length * sizeof(sample));
+        _offset += length;
+        copied += length;
+    }
+
+    return copied;
+}
+
+size_t rx_block_queue::available()
+{
+    size_t current = _current ? _current->size() - _offset : 0;
+    return _queued_samples.load() + current;
+}
+
+bool rx_block_queue::wait(size_t min_samples, unsigned int timeout_ms)
+{
+    if(available() >= min_samples)
+    {
+        return true;
+    }
+
+    size_t current = _current ? _current->size() - _offset : 0;
+    _wake_threshold.store(min_samples - current);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    bool ready = false;
+
+    while(!(ready = available() >= min_samples))
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if(remaining <= 0)
+        {
+            break;
+        }
+
+        pollfd pfd = {_event_fd, POLLIN, 0};
+        poll(&pfd, 1, (int) remaining);
+
+        eventfd_t value;
+        eventfd_read(_event_fd, &value);
+    }
+
+    _wake_threshold.store(_low_water_mark);
+    return ready;
+}
+
+void rx_block_queue::set_low_water_mark(size_t samples)
+{
+    _low_water_mark = samples == 0 ? RX_QUEUE_NO_WAKEUP : samples;
+    _wake_threshold.store(_low_water_mark);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_RX_BLOCK_QUEUE_H__
+#define __LIBADSDR_RX_BLOCK_QUEUE_H__
+
+#include "adsdr.hpp"
+
+#include <mutex>
+
+namespace ADSDR
+{
+    // Bounded queue of RX blocks behind the sample based receive API. The producer
+    // (libusb event thread) pushes whole blocks, the single consumer reads samples.
+    // Consumers sleep on an eventfd which the producer only signals once the number
+    // of queued samples reaches the wake threshold, so wakeups are batched per block.
+    class rx_block_queue
+    {
+    public:
+        rx_block_queue(size_t capacity);
+        ~rx_block_queue();
+
+        // Producer side. push returns false if the queue is full, drop_oldest
+        // removes the oldest queued block to make room (empty if none is queued).
+        bool push(const rx_block_ref &block);
+        rx_block_ref drop_oldest();
+
+        // Consumer side
+        bool pop(sample &s);
+        size_t read(sample *destination, size_t max_samples);
+        bool wait(size_t min_samples, unsigned int timeout_ms);
+        size_t available();
+
+        int event_fd() const { return _event_fd; }
+        void set_low_water_mark(size_t samples);
+
+    private:
+        bool next_block();
+        void wake_if_needed(size_t queued);
+
+        std::mutex _lock;
+        std::vector<rx_block_ref> _ring;
+        size_t _head = 0;
+        size_t _count = 0;
+
+        // Samples in queued blocks, not counting the block being consumed
+        std::atomic<size_t> _queued_samples{0};
+
+        std::atomic<size_t> _wake_threshold;
+        size_t _low_water_mark;
+        int _event_fd = -1;
+
+        // Owned by the consumer
+        rx_block_ref _current;
+        size_t _offset = 0;
+    };
+}
+
+#endif // __LIBADSDR_RX_BLOCK_QUEUE_H__
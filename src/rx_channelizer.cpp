@@ -0,0 +1,329 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_channelizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace ADSDR;
+
+static unsigned int checked_channels(const channelizer_config &config)
+{
+    if(config.channels < 2 || (config.channels & (config.channels - 1)) != 0)
+    {
+        throw std::invalid_argument("channelizer: channels must be a power of two of at least 2");
+    }
+    if(config.taps_per_channel == 0)
+    {
+        throw std::invalid_argument("channelizer: taps_per_channel must be at least 1");
+    }
+    for(unsigned int channel : config.outputs)
+    {
+        if(channel >= config.channels)
+        {
+            throw std::invalid_argument("channelizer: output channel " + std::to_string(channel) + " does not exist");
+        }
+    }
+    return config.channels;
+}
+
+rx_channelizer::rx_channelizer(const channelizer_config &config, std::function<void(const channelizer_block &)> callback) :
+    _channels(checked_channels(config)),
+    _decimation(config.oversampled ? config.channels / 2 : config.channels),
+    _taps(config.taps_per_channel),
+    _length((size_t) config.channels * config.taps_per_channel),
+    _outputs(config.outputs),
+    _fft(config.channels),
+    _callback(callback)
+{
+    if(_outputs.empty())
+    {
+        for(unsigned int c = 0; c < _channels; c++)
+        {
+            _outputs.push_back(c);
+        }
+    }
+
+    unsigned int stages = 0;
+    while((1u << stages) < _channels)
+    {
+        stages++;
+    }
+    _direct = _outputs.size() * 2 <= stages;
+
+    std::vector<float> prototype = design_channelizer_filter(_channels, _taps);
+    _polyphase.resize(2 * _length);
+    for(unsigned int k = 0; k < _taps; k++)
+    {
+        for(unsigned int s = 0; s < _channels; s++)
+        {
+            float h = prototype[(size_t) k * _channels + _channels - 1 - s];
+            _polyphase[2 * ((size_t) k * _channels + s)] = h;
+            _polyphase[2 * ((size_t) k * _channels + s) + 1] = h;
+        }
+    }
+
+    for(unsigned int n = 0; n < _channels; n++)
+    {
+        _rotation.push_back(std::polar(1.0f, (float) (-2.0 * M_PI * n / _channels)));
+    }
+
+    _history.assign(2 * (_length - 1), 0.0f);
+
+    unsigned int threads = config.threads != 0 ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+    _max_jobs = 2 * threads;
+    for(unsigned int t = 0; t < threads; t++)
+    {
+        _workers.emplace_back(&rx_channelizer::run, this);
+    }
+}
+
+rx_channelizer::~rx_channelizer()
+{
+    close();
+}
+
+void rx_channelizer::write(const rx_block_ref &block)
+{
+    job work;
+    work.index = _next_index++;
+    work.sequence = block->sequence();
+    work.start = _position;
+    work.gap = block->gap();
+    work.block = block;
+
+    if(_started && block->sequence() != _next_sequence)
+    {
+        _lost += block->sequence() - _next_sequence;
+        work.gap = true;
+    }
+    _started = true;
+    _next_sequence = block->sequence() + 1;
+
+    if(work.gap)
+    {
+        // Start the filters over rather than running them across the missing samples
+        std::fill(_history.begin(), _history.end(), 0.0f);
+    }
+    work.history = _history;
+
+    // The tail of this block is the history of the next one
+    size_t kept = _length - 1;
+    size_t size = block->size();
+    size_t fresh = std::min(size, kept);
+    std::copy(_history.begin() + 2 * fresh, _history.end(), _history.begin());
+    float *tail = _history.data() + 2 * (kept - fresh);
+    for(size_t n = 0; n < fresh; n++)
+    {
+        const sample &s = (*block)[size - fresh + n];
+        tail[2 * n] = s.i;
+        tail[2 * n + 1] = s.q;
+    }
+    _position += size;
+
+    std::unique_lock<std::mutex> lock(_jobs_lock);
+    _jobs_taken.wait(lock, [this]() { return _jobs.size() < _max_jobs; });
+    _jobs.push_back(std::move(work));
+    _jobs_ready.notify_one();
+}
+
+void rx_channelizer::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(_jobs_lock);
+        _closing = true;
+        _jobs_ready.notify_all();
+    }
+    for(std::thread &worker : _workers)
+    {
+        worker.join();
+    }
+    _workers.clear();
+}
+
+channelizer_stats rx_channelizer::stats() const
+{
+    channelizer_stats s = {};
+    s.blocks = _blocks.load();
+    s.lost = _lost.load();
+    return s;
+}
+
+void rx_channelizer::run()
+{
+    scratch buffers;
+    channelizer_block out;
+
+    while(true)
+    {
+        job work;
+        {
+            std::unique_lock<std::mutex> lock(_jobs_lock);
+            _jobs_ready.wait(lock, [this]() { return !_jobs.empty() || _closing; });
+            if(_jobs.empty())
+            {
+                return;
+            }
+            work = std::move(_jobs.front());
+            _jobs.pop_front();
+            _jobs_taken.notify_one();
+        }
+
+        process(work, buffers, out);
+        work.block.reset();
+        deliver(work.index, out);
+    }
+}
+
+void rx_channelizer::process(const job &work, scratch &buffers, channelizer_block &out) const
+{
+    const rx_block &block = *work.block;
+    const size_t kept = _length - 1;
+    const size_t size = block.size();
+    const size_t width = 2 * (size_t) _channels;
+
+    // History and block as one I/Q float stream
+    buffers.input.resize(2 * (kept + size));
+    std::copy(work.history.begin(), work.history.end(), buffers.input.begin());
+    float *converted = buffers.input.data() + 2 * kept;
+    for(size_t n = 0; n < size; n++)
+    {
+        converted[2 * n] = block[n].i;
+        converted[2 * n + 1] = block[n].q;
+    }
+
+    // Outputs fall on the samples t with (t + 1) % D == 0
+    uint64_t first = work.start + (_decimation - 1 - work.start % _decimation);
+    size_t count = first < work.start + size ? (size_t) ((work.start + size - 1 - first) / _decimation + 1) : 0;
+
+    buffers.branches.resize(count * _channels);
+    for(size_t o = 0; o < count; o++)
+    {
+        // Branch s sums taps k of x[t - M + 1 + s - kM], contiguous in s for every k
+        size_t newest = kept + (size_t) (first - work.start) + o * _decimation;
+        const float *x = buffers.input.data() + 2 * (newest + 1 - _channels);
+        float *v = reinterpret_cast<float *>(buffers.branches.data() + o * _channels);
+        size_t j = 0;
+
+#if defined(__SSE2__)
+        for(; j < width; j += 4)
+        {
+            __m128 acc = _mm_setzero_ps();
+            for(unsigned int k = 0; k < _taps; k++)
+            {
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(_polyphase.data() + k * width + j), _mm_loadu_ps(x - k * width + j)));
+            }
+            _mm_storeu_ps(v + j, acc);
+        }
+#endif
+
+        for(; j < width; j++)
+        {
+            float acc = 0.0f;
+            for(unsigned int k = 0; k < _taps; k++)
+            {
+                acc += _polyphase[k * width + j] * x[j - k * width];
+            }
+            v[j] = acc;
+        }
+    }
+
+    if(!_direct)
+    {
+        _fft.execute(buffers.branches.data(), count);
+    }
+
+    out.sequence = work.sequence;
+    out.gap = work.gap;
+    out.samples = count;
+    out.channels = _outputs;
+    out.data.resize(_outputs.size() * count);
+
+    for(size_t o = 0; o < count; o++)
+    {
+        // Channel c of output t is e^(-j2pi c(t + 1)/M) * FFT(v)[c]
+        uint64_t t = first + o * _decimation;
+        unsigned int phase = (unsigned int) ((t + 1) % _channels);
+        const std::complex<float> *v = buffers.branches.data() + o * _channels;
+
+        for(size_t index = 0; index < _outputs.size(); index++)
+        {
+            unsigned int c = _outputs[index];
+            std::complex<float> bin;
+            if(_direct)
+            {
+                bin = 0.0f;
+                for(unsigned int s = 0; s < _channels; s++)
+                {
+                    bin += v[s] * _rotation[(c * s) % _channels];
+                }
+            }
+            else
+            {
+                bin = v[c];
+            }
+            out.data[index * count + o] = phase == 0 ? bin : bin * _rotation[(c * phase) % _channels];
+        }
+    }
+}
+
+void rx_channelizer::deliver(uint64_t index, channelizer_block &out)
+{
+    std::lock_guard<std::mutex> lock(_deliver_lock);
+    _finished[index] = std::move(out);
+    out = channelizer_block();
+
+    // Blocks leave in order, whichever worker finishes the next one delivers it
+    while(!_finished.empty() && _finished.begin()->first == _next_delivery)
+    {
+        _callback(_finished.begin()->second);
+        _finished.erase(_finished.begin());
+        _next_delivery++;
+        _blocks++;
+    }
+}
+
+std::vector<float> ADSDR::design_channelizer_filter(unsigned int channels, unsigned int taps_per_channel)
+{
+    // Blackman window, its transition band is about half a channel with 12 taps per channel
+    size_t length = (size_t) channels * taps_per_channel;
+    const double cutoff = 0.5 / channels;
+    const double center = (length - 1) / 2.0;
+
+    std::vector<float> taps(length);
+    double sum = 0.0;
+    for(size_t n = 0; n < length; n++)
+    {
+        double x = n - center;
+        double sinc = x == 0.0 ? 2.0 * cutoff : std::sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+        double window = length > 1 ? 0.42 - 0.5 * std::cos(2.0 * M_PI * n / (length - 1)) + 0.08 * std::cos(4.0 * M_PI * n / (length - 1)) : 1.0;
+        taps[n] = (float) (sinc * window);
+        sum += taps[n];
+    }
+    for(float &tap : taps)
+    {
+        tap = (float) (tap / sum);
+    }
+    return taps;
+}
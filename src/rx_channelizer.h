@@ -0,0 +1,116 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_RX_CHANNELIZER_H__
+#define __LIBADSDR_RX_CHANNELIZER_H__
+
+#include "adsdr.hpp"
+#include "fft.h"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+
+namespace ADSDR
+{
+    // Polyphase filter bank channelizer fed by the RX block stream. Each block is filtered into
+    // M polyphase branches per output sample and the branches of a whole block go through one
+    // batch of FFTs. Blocks are independent once they carry the tail of the block before them,
+    // so they are spread over worker threads and put back in order for the callback.
+    class rx_channelizer
+    {
+    public:
+        rx_channelizer(const channelizer_config &config, std::function<void(const channelizer_block &)> callback);
+        ~rx_channelizer();
+
+        // Queues a block for the workers, waits while they are all busy. Runs on the thread of
+        // the subscriber that feeds the channelizer.
+        void write(const rx_block_ref &block);
+
+        // Finishes and delivers the queued blocks, then stops the workers
+        void close();
+
+        // Only the counters kept by the channelizer, see ADSDR_impl::stop_channelizer
+        channelizer_stats stats() const;
+
+    private:
+        struct job
+        {
+            uint64_t index;
+            uint64_t sequence;
+            uint64_t start;             // Stream position of the first sample of the block
+            bool gap;
+            rx_block_ref block;
+            std::vector<float> history; // The filter length - 1 samples before the block, as I/Q floats
+        };
+
+        struct scratch
+        {
+            std::vector<float> input;
+            std::vector<std::complex<float>> branches;
+        };
+
+        void run();
+        void process(const job &work, scratch &buffers, channelizer_block &out) const;
+        void deliver(uint64_t index, channelizer_block &out);
+
+        unsigned int _channels;
+        unsigned int _decimation;
+        unsigned int _taps;
+        size_t _length;
+        std::vector<unsigned int> _outputs;
+        // Few outputs are cheaper as single DFT bins than as a whole FFT
+        bool _direct;
+        // taps rows of 2 * channels floats, row k holds h[k * M + M - 1 - s] twice at [2s] and [2s + 1]
+        std::vector<float> _polyphase;
+        // e^(-j2pi n/M)
+        std::vector<std::complex<float>> _rotation;
+        fft_plan _fft;
+        std::function<void(const channelizer_block &)> _callback;
+
+        // Subscriber thread only
+        std::vector<float> _history;
+        uint64_t _next_index = 0;
+        uint64_t _next_sequence = 0;
+        uint64_t _position = 0;
+        bool _started = false;
+
+        std::mutex _jobs_lock;
+        std::condition_variable _jobs_ready;
+        std::condition_variable _jobs_taken;
+        std::deque<job> _jobs;
+        size_t _max_jobs;
+        bool _closing = false;
+
+        // Finished blocks waiting for the ones before them
+        std::mutex _deliver_lock;
+        std::map<uint64_t, channelizer_block> _finished;
+        uint64_t _next_delivery = 0;
+
+        std::vector<std::thread> _workers;
+        std::atomic<uint64_t> _blocks{0};
+        std::atomic<uint64_t> _lost{0};
+    };
+
+    // Windowed sinc prototype with its -6 dB point on the channel edge and a DC gain of 1
+    std::vector<float> design_channelizer_filter(unsigned int channels, unsigned int taps_per_channel);
+}
+
+#endif // __LIBADSDR_RX_CHANNELIZER_H__
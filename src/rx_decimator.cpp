@@ -0,0 +1,205 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_decimator.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace ADSDR;
+
+rx_decimator::rx_decimator(const decimation_config &config) : _factor(config.factor)
+{
+    if(config.factor == 0)
+    {
+        throw std::invalid_argument("decimation: factor must be at least 1");
+    }
+
+    std::vector<float> taps = config.taps.empty() ? design_decimation_filter(config.factor) : config.taps;
+    if(taps.size() > RX_DECIMATOR_MAX_TAPS)
+    {
+        throw std::invalid_argument("decimation: at most " + std::to_string(RX_DECIMATOR_MAX_TAPS) + " taps");
+    }
+
+    // Samples are 12 bit, so the 32 bit accumulators are safe while sum(|tap|) stays below 2^19 in Q15
+    float magnitude = 0.0f;
+    for(float tap : taps)
+    {
+        if(!(std::fabs(tap) <= 1.0f))
+        {
+            throw std::invalid_argument("decimation: taps must be within [-1, 1]");
+        }
+        magnitude += std::fabs(tap);
+    }
+    if(magnitude >= 16.0f)
+    {
+        throw std::invalid_argument("decimation: sum of |taps| must be below 16");
+    }
+
+    size_t padded = (taps.size() + 7) & ~(size_t) 7;
+    _taps.assign(padded, 0);
+    for(size_t k = 0; k < taps.size(); k++)
+    {
+        long q = std::lrint(taps[k] * 32768.0f);
+        _taps[padded - 1 - k] = (int16_t) (q > 32767 ? 32767 : q);
+    }
+
+    _history_i.assign(padded - 1 + RX_DECIMATOR_CHUNK, 0);
+    _history_q.assign(padded - 1 + RX_DECIMATOR_CHUNK, 0);
+}
+
+void rx_decimator::reset()
+{
+    std::fill(_history_i.begin(), _history_i.end(), 0);
+    std::fill(_history_q.begin(), _history_q.end(), 0);
+    _skip = 0;
+}
+
+size_t rx_decimator::decode(const unsigned char *buffer, int actual_length, sample *destination, rx_power *power,
+                            rx_nco *nco, rx_iq_correction *correction)
+{
+    int lenght = actual_length / (sizeof(short) * 2 * 2);
+    const size_t taps = _taps.size();
+    const size_t kept = taps - 1;
+
+    uint64_t energy = 0;
+    uint32_t peak = 0;
+    size_t produced = 0;
+
+    if(nco != nullptr)
+    {
+        nco->start_block();
+    }
+
+    for(int done = 0; done < lenght; )
+    {
+        int n = lenght - done < RX_DECIMATOR_CHUNK ? lenght - done : RX_DECIMATOR_CHUNK;
+        split_rx_samples(buffer + 2 * ADSDR_BYTES_PER_SAMPLE * done, n, _history_i.data() + kept, _history_q.data() + kept);
+        if(correction != nullptr)
+        {
+            correction->correct(_history_i.data() + kept, _history_q.data() + kept, n);
+        }
+        if(nco != nullptr)
+        {
+            nco->mix(_history_i.data() + kept, _history_q.data() + kept, n);
+        }
+
+        // Only the outputs that are kept get computed, which is what a polyphase split saves
+        size_t w = _skip;
+        for(; w < (size_t) n; w += _factor)
+        {
+            const int16_t *xi = _history_i.data() + w;
+            const int16_t *xq = _history_q.data() + w;
+            int32_t acc_i = 0;
+            int32_t acc_q = 0;
+            size_t k = 0;
+
+#if defined(__SSE2__)
+            __m128i sum_i = _mm_setzero_si128();
+            __m128i sum_q = _mm_setzero_si128();
+            for(; k < taps; k += 8)
+            {
+                __m128i h = _mm_loadu_si128((const __m128i *)(_taps.data() + k));
+                sum_i = _mm_add_epi32(sum_i, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(xi + k)), h));
+                sum_q = _mm_add_epi32(sum_q, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(xq + k)), h));
+            }
+            // Reduce both accumulators at once, I ends up in lane 0 and Q in lane 1
+            __m128i pair = _mm_add_epi32(_mm_unpacklo_epi32(sum_i, sum_q), _mm_unpackhi_epi32(sum_i, sum_q));
+            pair = _mm_add_epi32(pair, _mm_shuffle_epi32(pair, _MM_SHUFFLE(1, 0, 3, 2)));
+            acc_i = _mm_cvtsi128_si32(pair);
+            acc_q = _mm_cvtsi128_si32(_mm_shuffle_epi32(pair, _MM_SHUFFLE(1, 1, 1, 1)));
+#endif
+
+            for(; k < taps; k++)
+            {
+                acc_i += (int32_t) xi[k] * _taps[k];
+                acc_q += (int32_t) xq[k] * _taps[k];
+            }
+
+            sample &s = destination[produced++];
+            int32_t out_i = (acc_i + (1 << 14)) >> 15;
+            int32_t out_q = (acc_q + (1 << 14)) >> 15;
+            s.i = (int16_t) (out_i > INT16_MAX ? INT16_MAX : (out_i < INT16_MIN ? INT16_MIN : out_i));
+            s.q = (int16_t) (out_q > INT16_MAX ? INT16_MAX : (out_q < INT16_MIN ? INT16_MIN : out_q));
+
+            if(power != nullptr)
+            {
+                uint32_t p = (uint32_t) ((int32_t) s.i * s.i + (int32_t) s.q * s.q);
+                energy += p;
+                peak = p > peak ? p : peak;
+            }
+        }
+        _skip = (unsigned int) (w - n);
+
+        // The newest samples become the history of the next chunk
+        std::memmove(_history_i.data(), _history_i.data() + n, kept * sizeof(int16_t));
+        std::memmove(_history_q.data(), _history_q.data() + n, kept * sizeof(int16_t));
+        done += n;
+    }
+
+    if(correction != nullptr)
+    {
+        correction->finish_block();
+    }
+
+    if(power != nullptr)
+    {
+        power->energy = energy;
+        power->peak = peak;
+    }
+
+    return produced;
+}
+
+std::vector<float> ADSDR::design_decimation_filter(unsigned int factor)
+{
+    if(factor <= 1)
+    {
+        return std::vector<float>(1, 1.0f);
+    }
+
+    // Blackman window, about 74 dB of stopband with 16 taps per output sample
+    size_t length = 16 * (size_t) factor + 1;
+    if(length >= RX_DECIMATOR_MAX_TAPS)
+    {
+        length = RX_DECIMATOR_MAX_TAPS - 1;
+    }
+    const double cutoff = 0.4 / factor;
+    const double center = (length - 1) / 2.0;
+
+    std::vector<float> taps(length);
+    double sum = 0.0;
+    for(size_t n = 0; n < length; n++)
+    {
+        double x = n - center;
+        double sinc = x == 0.0 ? 2.0 * cutoff : std::sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+        double window = 0.42 - 0.5 * std::cos(2.0 * M_PI * n / (length - 1)) + 0.08 * std::cos(4.0 * M_PI * n / (length - 1));
+        taps[n] = (float) (sinc * window);
+        sum += taps[n];
+    }
+    for(float &tap : taps)
+    {
+        tap = (float) (tap / sum);
+    }
+    return taps;
+}
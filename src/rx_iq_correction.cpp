@@ -0,0 +1,211 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_iq_correction.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace ADSDR;
+
+// Blocks with less variance than this (in squared LSB) say nothing about the imbalance
+#define RX_IQ_MIN_VARIANCE 1.0
+
+rx_iq_correction::rx_iq_correction(const iq_correction_config &config, const iq_correction_estimate &seed) :
+    _config(config),
+    _estimate(seed)
+{
+    if(!(config.adaptation > 0.0f && config.adaptation <= 1.0f))
+    {
+        throw std::invalid_argument("iq correction: adaptation must be within (0, 1]");
+    }
+    if(!(seed.gain > 0.0f) || !(std::fabs(seed.phase) < M_PI / 4))
+    {
+        throw std::invalid_argument("iq correction: seed gain must be positive and phase within +-pi/4");
+    }
+
+    _published = _estimate;
+    update_coefficients();
+    _scratch_i.resize(RX_IQ_CORRECTION_CHUNK);
+    _scratch_q.resize(RX_IQ_CORRECTION_CHUNK);
+}
+
+void rx_iq_correction::update_coefficients()
+{
+    _dc_i = _config.dc ? (int16_t) std::lround(_estimate.dc_i) : 0;
+    _dc_q = _config.dc ? (int16_t) std::lround(_estimate.dc_q) : 0;
+
+    if(_config.iq)
+    {
+        // Q = g (I sin(phase) + Q0 cos(phase)), so Q0 = (Q - g sin(phase) I) / (g cos(phase))
+        double ci = -std::tan(_estimate.phase);
+        double cq = 1.0 / (_estimate.gain * std::cos(_estimate.phase));
+        _ci = (int16_t) std::max(-32767L, std::min(32767L, std::lround(ci * (1 << 14))));
+        _cq = (int16_t) std::max(-32767L, std::min(32767L, std::lround(cq * (1 << 14))));
+    }
+}
+
+void rx_iq_correction::correct(int16_t *i, int16_t *q, int count)
+{
+    int n = 0;
+
+#if defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i dc_i = _mm_set1_epi16(_dc_i);
+    const __m128i dc_q = _mm_set1_epi16(_dc_q);
+    const __m128i coefficients = _mm_set1_epi32((int32_t) (((uint32_t) (uint16_t) _cq << 16) | (uint16_t) _ci));
+    const __m128i half = _mm_set1_epi32(1 << 13);
+
+    while(n + 8 <= count)
+    {
+        // 32 bit lanes are flushed every 64 iterations, well before 12 bit squares can overflow them
+        __m128i si = _mm_setzero_si128(), sq = _mm_setzero_si128();
+        __m128i sii = _mm_setzero_si128(), sqq = _mm_setzero_si128(), siq = _mm_setzero_si128();
+        for(int iteration = 0; iteration < 64 && n + 8 <= count; iteration++, n += 8)
+        {
+            __m128i vi = _mm_loadu_si128((const __m128i *)(i + n));
+            __m128i vq = _mm_loadu_si128((const __m128i *)(q + n));
+            si = _mm_add_epi32(si, _mm_madd_epi16(vi, ones));
+            sq = _mm_add_epi32(sq, _mm_madd_epi16(vq, ones));
+            sii = _mm_add_epi32(sii, _mm_madd_epi16(vi, vi));
+            sqq = _mm_add_epi32(sqq, _mm_madd_epi16(vq, vq));
+            siq = _mm_add_epi32(siq, _mm_madd_epi16(vi, vq));
+
+            __m128i ci = _mm_subs_epi16(vi, dc_i);
+            __m128i cq = _mm_subs_epi16(vq, dc_q);
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(ci, cq), coefficients);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(ci, cq), coefficients);
+            lo = _mm_srai_epi32(_mm_add_epi32(lo, half), 14);
+            hi = _mm_srai_epi32(_mm_add_epi32(hi, half), 14);
+            _mm_storeu_si128((__m128i *)(i + n), ci);
+            _mm_storeu_si128((__m128i *)(q + n), _mm_packs_epi32(lo, hi));
+        }
+
+        int32_t lanes[5][4];
+        _mm_storeu_si128((__m128i *)lanes[0], si);
+        _mm_storeu_si128((__m128i *)lanes[1], sq);
+        _mm_storeu_si128((__m128i *)lanes[2], sii);
+        _mm_storeu_si128((__m128i *)lanes[3], sqq);
+        _mm_storeu_si128((__m128i *)lanes[4], siq);
+        for(int lane = 0; lane < 4; lane++)
+        {
+            _sum_i += lanes[0][lane];
+            _sum_q += lanes[1][lane];
+            _sum_ii += lanes[2][lane];
+            _sum_qq += lanes[3][lane];
+            _sum_iq += lanes[4][lane];
+        }
+    }
+#endif
+
+    for(; n < count; n++)
+    {
+        int32_t vi = i[n];
+        int32_t vq = q[n];
+        _sum_i += vi;
+        _sum_q += vq;
+        _sum_ii += vi * vi;
+        _sum_qq += vq * vq;
+        _sum_iq += vi * vq;
+
+        int32_t ci = vi - _dc_i;
+        int32_t cq = vq - _dc_q;
+        int32_t corrected = (_ci * ci + _cq * cq + (1 << 13)) >> 14;
+        i[n] = (int16_t) ci;
+        q[n] = (int16_t) (corrected > INT16_MAX ? INT16_MAX : (corrected < INT16_MIN ? INT16_MIN : corrected));
+    }
+
+    _count += count;
+}
+
+void rx_iq_correction::finish_block()
+{
+    if(_count == 0)
+    {
+        return;
+    }
+
+    double mean_i = (double) _sum_i / _count;
+    double mean_q = (double) _sum_q / _count;
+    double var_i = (double) _sum_ii / _count - mean_i * mean_i;
+    double var_q = (double) _sum_qq / _count - mean_q * mean_q;
+    double cov = (double) _sum_iq / _count - mean_i * mean_q;
+    const float alpha = _config.adaptation;
+
+    _estimate.dc_i += alpha * ((float) mean_i - _estimate.dc_i);
+    _estimate.dc_q += alpha * ((float) mean_q - _estimate.dc_q);
+    if(var_i > RX_IQ_MIN_VARIANCE && var_q > RX_IQ_MIN_VARIANCE)
+    {
+        double gain = std::sqrt(var_q / var_i);
+        double sine = cov / std::sqrt(var_i * var_q);
+        double phase = std::asin(std::max(-0.7, std::min(0.7, sine)));
+        _estimate.gain += alpha * ((float) gain - _estimate.gain);
+        _estimate.phase += alpha * ((float) phase - _estimate.phase);
+    }
+    _estimate.blocks++;
+
+    {
+        std::lock_guard<std::mutex> lock(_published_lock);
+        _published = _estimate;
+    }
+    update_coefficients();
+
+    _sum_i = _sum_q = _sum_ii = _sum_qq = _sum_iq = 0;
+    _count = 0;
+}
+
+size_t rx_iq_correction::decode(const unsigned char *buffer, int actual_length, sample *destination, rx_power *power, rx_nco *nco)
+{
+    int lenght = actual_length / (sizeof(short) * 2 * 2);
+    if(power != nullptr)
+    {
+        power->energy = 0;
+        power->peak = 0;
+    }
+    if(nco != nullptr)
+    {
+        nco->start_block();
+    }
+
+    for(int done = 0; done < lenght; )
+    {
+        int n = lenght - done < RX_IQ_CORRECTION_CHUNK ? lenght - done : RX_IQ_CORRECTION_CHUNK;
+        split_rx_samples(buffer + 2 * ADSDR_BYTES_PER_SAMPLE * done, n, _scratch_i.data(), _scratch_q.data());
+        correct(_scratch_i.data(), _scratch_q.data(), n);
+        if(nco != nullptr)
+        {
+            nco->mix(_scratch_i.data(), _scratch_q.data(), n);
+        }
+        merge_rx_samples(_scratch_i.data(), _scratch_q.data(), n, destination + done, power);
+        done += n;
+    }
+
+    finish_block();
+    return (size_t) lenght;
+}
+
+iq_correction_estimate rx_iq_correction::estimate() const
+{
+    std::lock_guard<std::mutex> lock(_published_lock);
+    return _published;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_RX_IQ_CORRECTION_H__
+#define __LIBADSDR_RX_IQ_CORRECTION_H__
+
+#include "adsdr.hpp"
+#include "rx_kernels.h"
+#include "rx_nco.h"
+
+#include <mutex>
+
+// Samples corrected per pass, the split I/Q scratch stays in L1
+#define RX_IQ_CORRECTION_CHUNK 2048
+
+namespace ADSDR
+{
+    // Blind DC offset and IQ imbalance correction. The mean and covariance of I and Q are
+    // gathered while a block is corrected with the estimates of the blocks before it, then the
+    // block's own estimates are folded in. Q is made orthogonal to I and scaled to its power
+    // (Gram-Schmidt), so I stays the reference. Runs on the libusb event thread, the estimates
+    // may be read from any thread.
+    class rx_iq_correction
+    {
+    public:
+        rx_iq_correction(const iq_correction_config &config, const iq_correction_estimate &seed);
+
+        // Gathers the statistics of count samples and corrects them in place
+        void correct(int16_t *i, int16_t *q, int count);
+
+        // Updates the estimates from the samples since the last call, at the end of every block
+        void finish_block();
+
+        // Decodes the first I/Q channel of an RX transfer, corrects it and mixes it with nco if
+        // given, for when the stream is not decimated
+        size_t decode(const unsigned char *buffer, int actual_length, sample *destination, rx_power *power = nullptr, rx_nco *nco = nullptr);
+
+        iq_correction_estimate estimate() const;
+
+    private:
+        void update_coefficients();
+
+        iq_correction_config _config;
+        iq_correction_estimate _estimate;
+
+        mutable std::mutex _published_lock;
+        iq_correction_estimate _published;
+
+        // I' = I - dc_i, Q' = (ci * I' + cq * (Q - dc_q)) / 2^14
+        int16_t _dc_i = 0;
+        int16_t _dc_q = 0;
+        int16_t _ci = 0;
+        int16_t _cq = 1 << 14;
+
+        // Raw sums of the current block
+        int64_t _sum_i = 0;
+        int64_t _sum_q = 0;
+        int64_t _sum_ii = 0;
+        int64_t _sum_qq = 0;
+        int64_t _sum_iq = 0;
+        uint64_t _count = 0;
+
+        std::vector<int16_t> _scratch_i;
+        std::vector<int16_t> _scratch_q;
+    };
+}
+
+#endif // __LIBADSDR_RX_IQ_CORRECTION_H__
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_kernels.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ADSDR
+{
+
+size_t decode_rx_transfer(const unsigned char *buffer, int actual_length, sample *destination, rx_power *power)
+{
+    const int16_t* pSamplesIn = (const int16_t*)buffer;
+    int lenght = actual_length / (sizeof(short) * 2 * 2);
+    sample* pSamplesOut = destination;
+
+    uint64_t energy = 0;
+    uint32_t peak = 0;
+    int i = 0;
+
+#if defined(__SSE2__)
+    // Four samples per iteration: keep the I/Q dwords of the first channel, then shift out the 4 padding bits
+    __m128i energy_acc = _mm_setzero_si128();
+    __m128i peak_acc = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+
+    for(; i + 4 <= lenght; i += 4)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(pSamplesIn + 4*i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(pSamplesIn + 4*i + 8));
+        a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+        b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i v = _mm_srai_epi16(_mm_unpacklo_epi64(a, b), 4);
+        _mm_storeu_si128((__m128i *)(pSamplesOut + i), v);
+
+        if(power != nullptr)
+        {
+            // i*i + q*q per sample, at most 2 * 2048^2 so it fits a signed 32 bit lane
+            __m128i p = _mm_madd_epi16(v, v);
+            energy_acc = _mm_add_epi64(energy_acc, _mm_unpacklo_epi32(p, zero));
+            energy_acc = _mm_add_epi64(energy_acc, _mm_unpackhi_epi32(p, zero));
+            __m128i greater = _mm_cmpgt_epi32(p, peak_acc);
+            peak_acc = _mm_or_si128(_mm_and_si128(greater, p), _mm_andnot_si128(greater, peak_acc));
+        }
+    }
+
+    if(power != nullptr)
+    {
+        uint64_t energy_lanes[2];
+        uint32_t peak_lanes[4];
+        _mm_storeu_si128((__m128i *)energy_lanes, energy_acc);
+        _mm_storeu_si128((__m128i *)peak_lanes, peak_acc);
+        energy = energy_lanes[0] + energy_lanes[1];
+        for(int lane = 0; lane < 4; lane++)
+        {
+            peak = peak_lanes[lane] > peak ? peak_lanes[lane] : peak;
+        }
+    }
+#endif
+
+    for(; i < lenght; i++)
+    {
+        pSamplesOut[i].i = pSamplesIn[4*i+0]>>4;
+        pSamplesOut[i].q = pSamplesIn[4*i+1]>>4;
+
+        if(power != nullptr)
+        {
+            uint32_t p = (uint32_t) ((int32_t) pSamplesOut[i].i * pSamplesOut[i].i + (int32_t) pSamplesOut[i].q * pSamplesOut[i].q);
+            energy += p;
+            peak = p > peak ? p : peak;
+        }
+    }
+
+    if(power != nullptr)
+    {
+        power->energy = energy;
+        power->peak = peak;
+    }
+
+    return (size_t) lenght;
+}
+
+void split_rx_samples(const unsigned char *buffer, int count, int16_t *i, int16_t *q)
+{
+    const int16_t* pSamplesIn = (const int16_t*)buffer;
+    int n = 0;
+
+#if defined(__SSE2__)
+    // Eight samples per iteration: pick the first channel like decode_rx_transfer, then split I and Q
+    for(; n + 8 <= count; n += 8)
+    {
+        __m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(pSamplesIn + 4*n)), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(pSamplesIn + 4*n + 8)), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i c = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(pSamplesIn + 4*n + 16)), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i d = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(pSamplesIn + 4*n + 24)), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi64(a, b), 4);
+        __m128i hi = _mm_srai_epi16(_mm_unpacklo_epi64(c, d), 4);
+        __m128i i_lanes = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(lo, 16), 16), _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16));
+        __m128i q_lanes = _mm_packs_epi32(_mm_srai_epi32(lo, 16), _mm_srai_epi32(hi, 16));
+        _mm_storeu_si128((__m128i *)(i + n), i_lanes);
+        _mm_storeu_si128((__m128i *)(q + n), q_lanes);
+    }
+#endif
+
+    for(; n < count; n++)
+    {
+        i[n] = pSamplesIn[4*n+0]>>4;
+        q[n] = pSamplesIn[4*n+1]>>4;
+    }
+}
+
+void merge_rx_samples(const int16_t *i, const int16_t *q, int count, sample *destination, rx_power *power)
+{
+    int n = 0;
+
+#if defined(__SSE2__)
+    for(; n + 8 <= count; n += 8)
+    {
+        __m128i vi = _mm_loadu_si128((const __m128i *)(i + n));
+        __m128i vq = _mm_loadu_si128((const __m128i *)(q + n));
+        _mm_storeu_si128((__m128i *)(destination + n), _mm_unpacklo_epi16(vi, vq));
+        _mm_storeu_si128((__m128i *)(destination + n + 4), _mm_unpackhi_epi16(vi, vq));
+    }
+#endif
+
+    for(; n < count; n++)
+    {
+        destination[n].i = i[n];
+        destination[n].q = q[n];
+    }
+
+    if(power != nullptr)
+    {
+        uint64_t energy = 0;
+        uint32_t peak = power->peak;
+        for(n = 0; n < count; n++)
+        {
+            uint32_t p = (uint32_t) ((int32_t) i[n] * i[n] + (int32_t) q[n] * q[n]);
+            energy += p;
+            peak = p > peak ? p : peak;
+        }
+        power->energy += energy;
+        power->peak = peak;
+    }
+}
+
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_RX_KERNELS_H__
+#define __LIBADSDR_RX_KERNELS_H__
+
+#include "adsdr.hpp"
+
+// Full scale of the 12 bit AD9361 samples
+#define ADSDR_SAMPLE_FULL_SCALE 2048
+
+namespace ADSDR
+{
+    // Raw |x|^2 statistics of a block, in squared sample units
+    struct rx_power
+    {
+        uint64_t energy;
+        uint32_t peak;
+    };
+
+    // Decodes the first I/Q channel of an RX transfer into destination and returns the
+    // number of samples. If power is given, the block's energy and peak are measured in
+    // the same pass while the samples are still in registers.
+    size_t decode_rx_transfer(const unsigned char *buffer, int actual_length, sample *destination, rx_power *power = nullptr);
+
+    // Decodes count samples of the first I/Q channel into separate I and Q arrays, for the
+    // stages that filter or mix the stream before it is interleaved again
+    void split_rx_samples(const unsigned char *buffer, int count, int16_t *i, int16_t *q);
+
+    // Interleaves split I/Q samples back into destination. If power is given, their energy is
+    // added to it and the peak raised, so a block can be merged in several chunks.
+    void merge_rx_samples(const int16_t *i, const int16_t *q, int count, sample *destination, rx_power *power = nullptr);
+}
+
+#endif // __LIBADSDR_RX_KERNELS_H__
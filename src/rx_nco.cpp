@@ -0,0 +1,157 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_nco.h"
+
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace ADSDR;
+
+#define RX_NCO_TABLE_SIZE (1 << RX_NCO_TABLE_BITS)
+
+// One cycle of cos in Q15, sin is read a quarter cycle later
+static const int16_t *cos_table()
+{
+    static const std::vector<int16_t> table = []() {
+        std::vector<int16_t> t(RX_NCO_TABLE_SIZE);
+        for(int n = 0; n < RX_NCO_TABLE_SIZE; n++)
+        {
+            t[n] = (int16_t) std::lrint(32767.0 * std::cos(2.0 * M_PI * n / RX_NCO_TABLE_SIZE));
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+rx_nco::rx_nco(double offset_hz, double sample_rate_hz)
+{
+    set_frequency(offset_hz, sample_rate_hz);
+    _step = _next_step.load();
+    _scratch_i.resize(RX_NCO_CHUNK);
+    _scratch_q.resize(RX_NCO_CHUNK);
+}
+
+void rx_nco::set_frequency(double offset_hz, double sample_rate_hz)
+{
+    if(!(sample_rate_hz > 0.0) || std::fabs(offset_hz) >= sample_rate_hz / 2)
+    {
+        throw std::invalid_argument("frequency shift: offset must be within +-sample rate / 2");
+    }
+
+    // Turns per sample in 32 bit fixed point, negative to bring offset_hz down to 0 Hz
+    double turns = -offset_hz / sample_rate_hz;
+    _next_step.store((uint32_t) (int64_t) std::llround(turns * 4294967296.0));
+    _offset_hz.store(offset_hz);
+}
+
+void rx_nco::start_block()
+{
+    _step = _next_step.load(std::memory_order_relaxed);
+}
+
+void rx_nco::mix(int16_t *i, int16_t *q, int count)
+{
+    const int16_t *table = cos_table();
+    const uint32_t round = 1u << (31 - RX_NCO_TABLE_BITS);
+    const int quarter = RX_NCO_TABLE_SIZE / 4;
+    uint32_t phase = _phase;
+    int n = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi32(1 << 14);
+
+    for(; n + 8 <= count; n += 8)
+    {
+        int16_t c[8], s[8];
+        for(int lane = 0; lane < 8; lane++)
+        {
+            uint32_t index = (phase + round) >> (32 - RX_NCO_TABLE_BITS);
+            c[lane] = table[index];
+            s[lane] = table[(index - quarter) & (RX_NCO_TABLE_SIZE - 1)];
+            phase += _step;
+        }
+
+        // (i + jq)(c + js) with one madd per part: [i q] . [c -s] and [i q] . [s c]
+        __m128i vi = _mm_loadu_si128((const __m128i *)(i + n));
+        __m128i vq = _mm_loadu_si128((const __m128i *)(q + n));
+        __m128i vc = _mm_loadu_si128((const __m128i *)c);
+        __m128i vs = _mm_loadu_si128((const __m128i *)s);
+        __m128i iq_lo = _mm_unpacklo_epi16(vi, vq);
+        __m128i iq_hi = _mm_unpackhi_epi16(vi, vq);
+        __m128i re_lo = _mm_unpacklo_epi16(vc, _mm_sub_epi16(zero, vs));
+        __m128i re_hi = _mm_unpackhi_epi16(vc, _mm_sub_epi16(zero, vs));
+        __m128i im_lo = _mm_unpacklo_epi16(vs, vc);
+        __m128i im_hi = _mm_unpackhi_epi16(vs, vc);
+
+        __m128i out_i = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(iq_lo, re_lo), half), 15),
+                                        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(iq_hi, re_hi), half), 15));
+        __m128i out_q = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(iq_lo, im_lo), half), 15),
+                                        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(iq_hi, im_hi), half), 15));
+        _mm_storeu_si128((__m128i *)(i + n), out_i);
+        _mm_storeu_si128((__m128i *)(q + n), out_q);
+    }
+#endif
+
+    for(; n < count; n++)
+    {
+        uint32_t index = (phase + round) >> (32 - RX_NCO_TABLE_BITS);
+        int32_t c = table[index];
+        int32_t s = table[(index - quarter) & (RX_NCO_TABLE_SIZE - 1)];
+        int32_t re = i[n] * c - q[n] * s;
+        int32_t im = i[n] * s + q[n] * c;
+        i[n] = (int16_t) ((re + (1 << 14)) >> 15);
+        q[n] = (int16_t) ((im + (1 << 14)) >> 15);
+        phase += _step;
+    }
+
+    _phase = phase;
+}
+
+void rx_nco::skip(size_t count)
+{
+    _phase += (uint32_t) (_next_step.load(std::memory_order_relaxed) * (uint64_t) count);
+}
+
+size_t rx_nco::decode(const unsigned char *buffer, int actual_length, sample *destination, rx_power *power)
+{
+    int lenght = actual_length / (sizeof(short) * 2 * 2);
+    if(power != nullptr)
+    {
+        power->energy = 0;
+        power->peak = 0;
+    }
+
+    start_block();
+
+    for(int done = 0; done < lenght; )
+    {
+        int n = lenght - done < RX_NCO_CHUNK ? lenght - done : RX_NCO_CHUNK;
+        split_rx_samples(buffer + 2 * ADSDR_BYTES_PER_SAMPLE * done, n, _scratch_i.data(), _scratch_q.data());
+        mix(_scratch_i.data(), _scratch_q.data(), n);
+        merge_rx_samples(_scratch_i.data(), _scratch_q.data(), n, destination + done, power);
+        done += n;
+    }
+
+    return (size_t) lenght;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_RX_NCO_H__
+#define __LIBADSDR_RX_NCO_H__
+
+#include "adsdr.hpp"
+#include "rx_kernels.h"
+
+// Phase bits resolved by the sine table, spurs stay near -72 dBc like the 12 bit samples
+#define RX_NCO_TABLE_BITS 12
+// Samples mixed per pass, the split I/Q scratch stays in L1
+#define RX_NCO_CHUNK 2048
+
+namespace ADSDR
+{
+    // Table driven oscillator that shifts the RX stream in frequency. The phase is kept across
+    // blocks, mixing runs on the libusb event thread and the frequency may be set from any thread.
+    class rx_nco
+    {
+    public:
+        rx_nco(double offset_hz, double sample_rate_hz);
+
+        // Moves a signal at offset_hz from the LO to 0 Hz, from the next block on
+        void set_frequency(double offset_hz, double sample_rate_hz);
+        double frequency() const { return _offset_hz.load(); }
+
+        // Latches the frequency for the block about to be mixed
+        void start_block();
+
+        // Multiplies count samples in place by the oscillator and advances its phase
+        void mix(int16_t *i, int16_t *q, int count);
+
+        // Advances the phase over samples that were lost, so the oscillator stays coherent
+        void skip(size_t count);
+
+        // Decodes the first I/Q channel of an RX transfer and mixes it in one pass, for when
+        // the stream is not decimated. Power is measured on the mixed samples.
+        size_t decode(const unsigned char *buffer, int actual_length, sample *destination, rx_power *power = nullptr);
+
+    private:
+        std::atomic<uint32_t> _next_step;
+        std::atomic<double> _offset_hz;
+        uint32_t _step = 0;
+        uint32_t _phase = 0;
+
+        std::vector<int16_t> _scratch_i;
+        std::vector<int16_t> _scratch_q;
+    };
+}
+
+#endif // __LIBADSDR_RX_NCO_H__
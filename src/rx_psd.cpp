@@ -0,0 +1,295 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_psd.h"
+#include "rx_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace ADSDR;
+
+static std::vector<float> design_window(psd_window window, size_t size)
+{
+    std::vector<float> w(size);
+    for(size_t n = 0; n < size; n++)
+    {
+        double x = 2.0 * M_PI * n / size;
+        switch(window)
+        {
+        case PSD_WINDOW_BLACKMAN_HARRIS:
+            w[n] = (float) (0.35875 - 0.48829 * std::cos(x) + 0.14128 * std::cos(2 * x) - 0.01168 * std::cos(3 * x));
+            break;
+        case PSD_WINDOW_RECTANGULAR:
+            w[n] = 1.0f;
+            break;
+        default:
+            w[n] = (float) (0.5 - 0.5 * std::cos(x));
+            break;
+        }
+    }
+    return w;
+}
+
+static size_t checked_size(const psd_config &config)
+{
+    if(config.fft_size < 4 || (config.fft_size & (config.fft_size - 1)) != 0)
+    {
+        throw std::invalid_argument("psd: fft_size must be a power of two of at least 4");
+    }
+    if(!(config.overlap >= 0.0f && config.overlap < 1.0f))
+    {
+        throw std::invalid_argument("psd: overlap must be within [0, 1)");
+    }
+    if(!(config.frame_rate > 0.0) || config.segment_decimation == 0 || config.time_constant == 0)
+    {
+        throw std::invalid_argument("psd: frame_rate, segment_decimation and time_constant must be positive");
+    }
+    return config.fft_size;
+}
+
+rx_psd::rx_psd(const psd_config &config, double sample_rate, std::function<void(const psd_frame &)> callback) :
+    _config(config),
+    _size(checked_size(config)),
+    _fft(config.fft_size),
+    _window(design_window(config.window, config.fft_size)),
+    _callback(callback)
+{
+    size_t hop = std::max<size_t>(1, (size_t) std::lround(_size * (1.0 - config.overlap)));
+    _stride = hop * config.segment_decimation;
+    double segment_rate = sample_rate / _stride;
+    _frame_segments = (unsigned int) std::max(1.0, std::round(segment_rate / config.frame_rate));
+    _alpha = 1.0f / config.time_constant;
+
+    double gain = 0.0;
+    for(float w : _window)
+    {
+        gain += w;
+    }
+    gain *= ADSDR_SAMPLE_FULL_SCALE;
+    _reference = (float) (1.0 / (gain * gain));
+
+    _segment.resize(2 * _size);
+    _batch.resize(RX_PSD_BATCH * _size);
+    _sum.assign(_size, 0.0f);
+    _average.assign(_size, 0.0f);
+    _max.assign(_size, 0.0f);
+    _frame.sequence = 0;
+    _frame.power.resize(_size);
+    if(config.max_hold)
+    {
+        _frame.max_hold.resize(_size);
+    }
+}
+
+void rx_psd::write(const rx_block &block)
+{
+    if(block.gap() || (_started && block.sequence() != _next_sequence))
+    {
+        // Segments never span lost samples
+        if(_started && block.sequence() > _next_sequence)
+        {
+            _lost += block.sequence() - _next_sequence;
+        }
+        _fill = 0;
+        _skip = 0;
+    }
+    _started = true;
+    _next_sequence = block.sequence() + 1;
+
+    const size_t size = block.size();
+    size_t n = 0;
+    while(n < size)
+    {
+        if(_skip > 0)
+        {
+            size_t skipped = std::min(_skip, size - n);
+            _skip -= skipped;
+            n += skipped;
+            continue;
+        }
+
+        size_t take = std::min(_size - _fill, size - n);
+        float *segment = _segment.data() + 2 * _fill;
+        for(size_t k = 0; k < take; k++)
+        {
+            segment[2 * k] = block[n + k].i;
+            segment[2 * k + 1] = block[n + k].q;
+        }
+        _fill += take;
+        n += take;
+
+        if(_fill == _size)
+        {
+            // Window the segment into the next batch slot
+            float *slot = reinterpret_cast<float *>(_batch.data() + _batched * _size);
+            for(size_t k = 0; k < _size; k++)
+            {
+                slot[2 * k] = _segment[2 * k] * _window[k];
+                slot[2 * k + 1] = _segment[2 * k + 1] * _window[k];
+            }
+            if(++_batched == RX_PSD_BATCH)
+            {
+                transform_batch(block.sequence());
+            }
+
+            // The next segment starts _stride samples after this one
+            if(_stride < _size)
+            {
+                std::copy(_segment.begin() + 2 * _stride, _segment.end(), _segment.begin());
+                _fill = _size - _stride;
+            }
+            else
+            {
+                _fill = 0;
+                _skip = _stride - _size;
+            }
+        }
+    }
+
+    transform_batch(block.sequence());
+}
+
+void rx_psd::transform_batch(uint64_t rx_sequence)
+{
+    _fft.execute(_batch.data(), _batched);
+    for(size_t b = 0; b < _batched; b++)
+    {
+        accumulate(_batch.data() + b * _size);
+        if(++_frame_count == _frame_segments)
+        {
+            emit(rx_sequence);
+        }
+    }
+    _segments += _batched;
+    _batched = 0;
+}
+
+void rx_psd::accumulate(const std::complex<float> *spectrum)
+{
+    const float *x = reinterpret_cast<const float *>(spectrum);
+    const bool exponential = _config.averaging == PSD_AVERAGE_EXPONENTIAL;
+    const bool first = exponential && !_average_valid;
+    const bool max_hold = _config.max_hold;
+    if(max_hold && _reset_max_hold.exchange(false))
+    {
+        std::fill(_max.begin(), _max.end(), 0.0f);
+    }
+    float *sum = _sum.data();
+    float *average = _average.data();
+    float *peak = _max.data();
+    size_t k = 0;
+
+#if defined(__SSE2__)
+    // |X|^2 of four bins from two registers of interleaved I/Q, folded into every trace in the same pass
+    const __m128 alpha = _mm_set1_ps(_alpha);
+    for(; k + 4 <= _size; k += 4)
+    {
+        __m128 a = _mm_loadu_ps(x + 2 * k);
+        __m128 b = _mm_loadu_ps(x + 2 * k + 4);
+        a = _mm_mul_ps(a, a);
+        b = _mm_mul_ps(b, b);
+        __m128 p = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        if(first)
+        {
+            _mm_storeu_ps(average + k, p);
+        }
+        else if(exponential)
+        {
+            __m128 avg = _mm_loadu_ps(average + k);
+            _mm_storeu_ps(average + k, _mm_add_ps(avg, _mm_mul_ps(alpha, _mm_sub_ps(p, avg))));
+        }
+        else
+        {
+            _mm_storeu_ps(sum + k, _mm_add_ps(_mm_loadu_ps(sum + k), p));
+        }
+        if(max_hold)
+        {
+            _mm_storeu_ps(peak + k, _mm_max_ps(_mm_loadu_ps(peak + k), p));
+        }
+    }
+#endif
+
+    for(; k < _size; k++)
+    {
+        float p = x[2 * k] * x[2 * k] + x[2 * k + 1] * x[2 * k + 1];
+        if(first)
+        {
+            average[k] = p;
+        }
+        else if(exponential)
+        {
+            average[k] += _alpha * (p - average[k]);
+        }
+        else
+        {
+            sum[k] += p;
+        }
+        if(max_hold)
+        {
+            peak[k] = std::max(peak[k], p);
+        }
+    }
+    _average_valid = true;
+}
+
+void rx_psd::emit(uint64_t rx_sequence)
+{
+    const bool exponential = _config.averaging == PSD_AVERAGE_EXPONENTIAL;
+    const float scale = exponential ? _reference : _reference / _frame_count;
+    const size_t half = _size / 2;
+
+    for(size_t k = 0; k < _size; k++)
+    {
+        // Bin half is -rate / 2
+        size_t bin = (k + half) & (_size - 1);
+        float p = exponential ? _average[bin] : _sum[bin];
+        _frame.power[k] = 10.0f * std::log10(p * scale + 1e-20f);
+        if(_config.max_hold)
+        {
+            _frame.max_hold[k] = 10.0f * std::log10(_max[bin] * _reference + 1e-20f);
+        }
+    }
+
+    _frame.rx_sequence = rx_sequence;
+    _frame.segments = _frame_count;
+    _callback(_frame);
+    _frame.sequence++;
+    _frames++;
+
+    _frame_count = 0;
+    if(!exponential)
+    {
+        std::fill(_sum.begin(), _sum.end(), 0.0f);
+    }
+}
+
+psd_stats rx_psd::stats() const
+{
+    psd_stats s = {};
+    s.frames = _frames.load();
+    s.segments = _segments.load();
+    s.lost = _lost.load();
+    return s;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_RX_PSD_H__
+#define __LIBADSDR_RX_PSD_H__
+
+#include "adsdr.hpp"
+#include "fft.h"
+
+// Segments transformed together, the batch stays in L2 for fft_size 4096
+#define RX_PSD_BATCH 16
+
+namespace ADSDR
+{
+    // Averaged power spectra of the RX block stream. Runs on the thread of the subscriber that
+    // feeds it: segments are windowed as they are cut from the blocks, transformed in batches
+    // and folded into the averages in the same pass that takes their magnitude.
+    class rx_psd
+    {
+    public:
+        rx_psd(const psd_config &config, double sample_rate, std::function<void(const psd_frame &)> callback);
+
+        void write(const rx_block &block);
+
+        // Safe from any thread, takes effect at the next segment
+        void reset_max_hold() { _reset_max_hold.store(true); }
+
+        // Only the counters kept by the PSD, see ADSDR_impl::stop_psd
+        psd_stats stats() const;
+
+    private:
+        void transform_batch(uint64_t rx_sequence);
+        void accumulate(const std::complex<float> *spectrum);
+        void emit(uint64_t rx_sequence);
+
+        psd_config _config;
+        size_t _size;
+        // Samples from the start of one transformed segment to the next
+        size_t _stride;
+        unsigned int _frame_segments;
+        float _alpha;
+        // Power of a full scale tone through the window
+        float _reference;
+
+        fft_plan _fft;
+        std::vector<float> _window;
+        std::function<void(const psd_frame &)> _callback;
+
+        // Samples of the segment being cut, as I/Q floats
+        std::vector<float> _segment;
+        size_t _fill = 0;
+        size_t _skip = 0;
+
+        std::vector<std::complex<float>> _batch;
+        size_t _batched = 0;
+
+        // In FFT bin order, the frame is shifted to put DC in the middle
+        std::vector<float> _sum;
+        std::vector<float> _average;
+        std::vector<float> _max;
+        unsigned int _frame_count = 0;
+        bool _average_valid = false;
+        std::atomic<bool> _reset_max_hold{true};
+
+        bool _started = false;
+        uint64_t _next_sequence = 0;
+        psd_frame _frame;
+
+        std::atomic<uint64_t> _frames{0};
+        std::atomic<uint64_t> _segments{0};
+        std::atomic<uint64_t> _lost{0};
+    };
+}
+
+#endif // __LIBADSDR_RX_PSD_H__
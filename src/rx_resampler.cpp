@@ -0,0 +1,163 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_resampler.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace ADSDR;
+
+// Dot product of taps with I and Q, taps is a multiple of 8 long
+static inline void dot(const int16_t *taps, const int16_t *i, const int16_t *q, size_t length, int32_t &acc_i, int32_t &acc_q)
+{
+    acc_i = 0;
+    acc_q = 0;
+    size_t k = 0;
+
+#if defined(__SSE2__)
+    __m128i sum_i = _mm_setzero_si128();
+    __m128i sum_q = _mm_setzero_si128();
+    for(; k < length; k += 8)
+    {
+        __m128i h = _mm_loadu_si128((const __m128i *)(taps + k));
+        sum_i = _mm_add_epi32(sum_i, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(i + k)), h));
+        sum_q = _mm_add_epi32(sum_q, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(q + k)), h));
+    }
+    __m128i pair = _mm_add_epi32(_mm_unpacklo_epi32(sum_i, sum_q), _mm_unpackhi_epi32(sum_i, sum_q));
+    pair = _mm_add_epi32(pair, _mm_shuffle_epi32(pair, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc_i = _mm_cvtsi128_si32(pair);
+    acc_q = _mm_cvtsi128_si32(_mm_shuffle_epi32(pair, _MM_SHUFFLE(1, 1, 1, 1)));
+#endif
+
+    for(; k < length; k++)
+    {
+        acc_i += (int32_t) i[k] * taps[k];
+        acc_q += (int32_t) q[k] * taps[k];
+    }
+}
+
+static inline int16_t saturate(double value)
+{
+    long v = std::lround(value);
+    return (int16_t) (v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v));
+}
+
+rx_resampler::rx_resampler(double ratio) : _ratio(ratio)
+{
+    if(!(ratio >= 1.0 / 16 && ratio <= 1.0))
+    {
+        throw std::invalid_argument("resampler: ratio must be within [1/16, 1]");
+    }
+
+    // 32 taps at ratio 1, longer as the cutoff comes down
+    _taps = ((size_t) std::lround(32.0 / ratio) + 7) & ~(size_t) 7;
+    _step = (uint64_t) std::llround(4294967296.0 / ratio);
+
+    // Blackman windowed sinc with its cutoff at 45% of the output rate
+    const double cutoff = 0.45 * ratio;
+    const double half = _taps / 2.0;
+    _bank.resize((RX_RESAMPLER_PHASES + 1) * _taps);
+    std::vector<double> row(_taps);
+    for(size_t p = 0; p <= RX_RESAMPLER_PHASES; p++)
+    {
+        double sum = 0.0;
+        for(size_t k = 0; k < _taps; k++)
+        {
+            // Tap k weighs input w + k for an output at w + half - 1 + p / PHASES
+            double x = (double) p / RX_RESAMPLER_PHASES + half - 1 - k;
+            double sinc = x == 0.0 ? 2.0 * cutoff : std::sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+            double window = std::fabs(x) >= half ? 0.0 : 0.42 + 0.5 * std::cos(M_PI * x / half) + 0.08 * std::cos(2.0 * M_PI * x / half);
+            row[k] = sinc * window;
+            sum += row[k];
+        }
+        // Unity DC gain for every phase, so the fractional delay does not modulate the level
+        for(size_t k = 0; k < _taps; k++)
+        {
+            _bank[p * _taps + k] = saturate(row[k] / sum * 32768.0);
+        }
+    }
+
+    _history_i.assign(_taps - 1 + RX_RESAMPLER_CHUNK, 0);
+    _history_q.assign(_taps - 1 + RX_RESAMPLER_CHUNK, 0);
+}
+
+void rx_resampler::reset()
+{
+    std::fill(_history_i.begin(), _history_i.end(), 0);
+    std::fill(_history_q.begin(), _history_q.end(), 0);
+    _position = 0;
+}
+
+size_t rx_resampler::process(sample *samples, size_t count, rx_power *power)
+{
+    const size_t kept = _taps - 1;
+    size_t produced = 0;
+    uint64_t energy = 0;
+    uint32_t peak = 0;
+
+    for(size_t done = 0; done < count; )
+    {
+        size_t n = count - done < RX_RESAMPLER_CHUNK ? count - done : RX_RESAMPLER_CHUNK;
+        int16_t *hi = _history_i.data() + kept;
+        int16_t *hq = _history_q.data() + kept;
+        for(size_t k = 0; k < n; k++)
+        {
+            hi[k] = samples[done + k].i;
+            hq[k] = samples[done + k].q;
+        }
+
+        // Outputs never overtake the inputs read so far, so they can be written over the block
+        while((_position >> 32) + _taps <= kept + n)
+        {
+            size_t start = (size_t) (_position >> 32);
+            uint64_t fraction = (_position & 0xFFFFFFFFu) * RX_RESAMPLER_PHASES;
+            size_t phase = (size_t) (fraction >> 32);
+            double blend = (fraction & 0xFFFFFFFFu) / 4294967296.0;
+
+            int32_t i0, q0, i1, q1;
+            dot(_bank.data() + phase * _taps, _history_i.data() + start, _history_q.data() + start, _taps, i0, q0);
+            dot(_bank.data() + (phase + 1) * _taps, _history_i.data() + start, _history_q.data() + start, _taps, i1, q1);
+
+            sample &s = samples[produced++];
+            s.i = saturate((i0 + (i1 - i0) * blend) / 32768.0);
+            s.q = saturate((q0 + (q1 - q0) * blend) / 32768.0);
+            uint32_t p = (uint32_t) ((int32_t) s.i * s.i + (int32_t) s.q * s.q);
+            energy += p;
+            peak = p > peak ? p : peak;
+            _position += _step;
+        }
+
+        std::memmove(_history_i.data(), _history_i.data() + n, kept * sizeof(int16_t));
+        std::memmove(_history_q.data(), _history_q.data() + n, kept * sizeof(int16_t));
+        _position -= (uint64_t) n << 32;
+        done += n;
+    }
+
+    if(power != nullptr)
+    {
+        power->energy = energy;
+        power->peak = peak;
+    }
+    return produced;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_RX_RESAMPLER_H__
+#define __LIBADSDR_RX_RESAMPLER_H__
+
+#include "adsdr.hpp"
+#include "rx_kernels.h"
+
+// Filter phases per input sample, outputs between two phases are interpolated linearly
+#define RX_RESAMPLER_PHASES 128
+// Samples resampled per pass, the split I/Q history stays in L1
+#define RX_RESAMPLER_CHUNK 2048
+
+namespace ADSDR
+{
+    // Arbitrary ratio polyphase resampler for the decoded RX stream, ratio = output / input rate
+    // at most 1. Each output is the linear blend of the two nearest of 128 filter phases, which
+    // keeps the interpolation error below the 12 bit sample noise. The position and history carry
+    // over between blocks, the latency is half the filter length. Runs on the libusb event thread.
+    class rx_resampler
+    {
+    public:
+        explicit rx_resampler(double ratio);
+
+        // Resamples count samples in place and returns the number of outputs, within one of
+        // count * ratio. An output never overtakes the inputs, so they fit the block. When power
+        // is given it receives the energy and peak of the outputs.
+        size_t process(sample *samples, size_t count, rx_power *power = nullptr);
+
+        // Forget the history, for when samples were lost
+        void reset();
+
+        double ratio() const { return _ratio; }
+        // Input samples from an input to the output it shows up in
+        size_t latency() const { return _taps / 2; }
+
+    private:
+        double _ratio;
+        size_t _taps;
+        // Input samples per output in 32.32 fixed point
+        uint64_t _step;
+        // Where the next output's window starts in the history, in 32.32 fixed point
+        uint64_t _position = 0;
+        // RX_RESAMPLER_PHASES + 1 rows of _taps Q15 taps, row p is for a fractional delay of p / PHASES
+        std::vector<int16_t> _bank;
+        std::vector<int16_t> _history_i;
+        std::vector<int16_t> _history_q;
+    };
+}
+
+#endif // __LIBADSDR_RX_RESAMPLER_H__
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_squelch.h"
+
+#include <cmath>
+
+using namespace ADSDR;
+
+rx_squelch::rx_squelch(const squelch_config &config) : _config(config)
+{
+    if(config.close_dbfs > config.open_dbfs)
+    {
+        throw std::invalid_argument("squelch: close threshold must not be above the open threshold");
+    }
+
+    // Compare in linear power to avoid a log10 per block
+    _open_level = std::pow(10.0f, config.open_dbfs / 10.0f);
+    _close_level = std::pow(10.0f, config.close_dbfs / 10.0f);
+}
+
+bool rx_squelch::update(const rx_block &block)
+{
+    float level = _config.detector == SQUELCH_PEAK_POWER ? block.peak_power() : block.mean_power();
+
+    if(level >= _open_level)
+    {
+        _open = true;
+        _hang = _config.hang_blocks;
+    }
+    else if(_open && level < _close_level)
+    {
+        if(_hang > 0)
+        {
+            _hang--;
+        }
+        else
+        {
+            _open = false;
+        }
+    }
+
+    _open_flag.store(_open, std::memory_order_relaxed);
+    if(_open)
+    {
+        _passed++;
+    }
+    else
+    {
+        _gated++;
+    }
+    return _open;
+}
+
+squelch_stats rx_squelch::stats() const
+{
+    squelch_stats s;
+    s.open = _open_flag.load();
+    s.passed = _passed.load();
+    s.gated = _gated.load();
+    return s;
+}
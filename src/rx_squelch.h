@@ -0,0 +1,53 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_RX_SQUELCH_H__
+#define __LIBADSDR_RX_SQUELCH_H__
+
+#include "adsdr.hpp"
+#include "rx_kernels.h"
+
+namespace ADSDR
+{
+    // Power gate for the RX stream. Runs on the libusb event thread only.
+    class rx_squelch
+    {
+    public:
+        rx_squelch(const squelch_config &config);
+
+        // Returns true if the block should be delivered
+        bool update(const rx_block &block);
+
+        squelch_stats stats() const;
+
+    private:
+        squelch_config _config;
+        float _open_level;
+        float _close_level;
+
+        bool _open = false;
+        unsigned int _hang = 0;
+
+        std::atomic<bool> _open_flag{false};
+        std::atomic<uint64_t> _passed{0};
+        std::atomic<uint64_t> _gated{0};
+    };
+}
+
+#endif // __LIBADSDR_RX_SQUELCH_H__
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rx_subscriber.h"
+
+using namespace ADSDR;
+
+rx_subscriber::rx_subscriber(std::function<void(const rx_block_ref &)> callback, backpressure_policy policy, unsigned int queue_depth) :
+    _callback(callback),
+    _policy(policy),
+    _queue(queue_depth),
+    _slots(queue_depth)
+{
+    _worker.reset(new std::thread([this]() {
+        run();
+    }));
+}
+
+rx_subscriber::~rx_subscriber()
+{
+    close();
+}
+
+void rx_subscriber::push(const rx_block_ref &block)
+{
+    if(_closed.load())
+    {
+        return;
+    }
+
+    if(!_slots.tryWait())
+    {
+        if(_policy == BACKPRESSURE_DROP)
+        {
+            _dropped++;
+            return;
+        }
+
+        // BACKPRESSURE_BLOCK: stall the event thread until the consumer frees a slot
+        _stalled++;
+        _slots.wait();
+        if(_closed.load())
+        {
+            return;
+        }
+    }
+
+    // Cannot fail, _slots bounds the number of queued blocks
+    _queue.try_enqueue(block);
+    _items.signal();
+}
+
+void rx_subscriber::close(bool flush)
+{
+    _flush.store(flush);
+    if(_closed.exchange(true))
+    {
+        return;
+    }
+
+    // Wake up both the worker and a producer waiting for a free slot
+    _items.signal();
+    _slots.signal();
+
+    if(_worker != nullptr && _worker->joinable())
+    {
+        _worker->join();
+    }
+
+    rx_block_ref block;
+    while(_queue.try_dequeue(block))
+    {
+        block.reset();
+    }
+}
+
+rx_subscription_stats rx_subscriber::stats() const
+{
+    rx_subscription_stats s;
+    s.delivered = _delivered.load();
+    s.dropped = _dropped.load();
+    s.stalled = _stalled.load();
+    return s;
+}
+
+void rx_subscriber::run()
+{
+    while(true)
+    {
+        _items.wait();
+
+        rx_block_ref block;
+        if(_closed.load())
+        {
+            while(_flush.load() && _queue.try_dequeue(block))
+            {
+                _callback(block);
+                _delivered++;
+            }
+            break;
+        }
+
+        if(_queue.try_dequeue(block))
+        {
+            _callback(block);
+            _delivered++;
+
+            // Release the block before freeing the slot so a blocked producer finds it back in the pool
+            block.reset();
+            _slots.signal();
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_RX_SUBSCRIBER_H__
+#define __LIBADSDR_RX_SUBSCRIBER_H__
+
+#include "adsdr.hpp"
+#include "readerwriterqueue/readerwriterqueue.h"
+
+namespace ADSDR
+{
+    // One consumer of the RX block stream. Blocks are pushed from the libusb event
+    // thread and handed to the callback on the subscriber's own thread.
+    class rx_subscriber
+    {
+    public:
+        rx_subscriber(std::function<void(const rx_block_ref &)> callback, backpressure_policy policy, unsigned int queue_depth);
+        ~rx_subscriber();
+
+        // Producer side, called for every decoded block
+        void push(const rx_block_ref &block);
+
+        // Stops the worker thread and releases all queued blocks, or hands them to the callback first if flush is set
+        void close(bool flush = false);
+
+        rx_subscription_stats stats() const;
+
+    private:
+        void run();
+
+        std::function<void(const rx_block_ref &)> _callback;
+        backpressure_policy _policy;
+
+        moodycamel::ReaderWriterQueue<rx_block_ref> _queue;
+        moodycamel::spsc_sema::LightweightSemaphore _items;
+        moodycamel::spsc_sema::LightweightSemaphore _slots;
+
+        std::atomic<bool> _closed{false};
+        std::atomic<bool> _flush{false};
+        std::atomic<uint64_t> _delivered{0};
+        std::atomic<uint64_t> _dropped{0};
+        std::atomic<uint64_t> _stalled{0};
+
+        std::unique_ptr<std::thread> _worker;
+    };
+}
+
+#endif // __LIBADSDR_RX_SUBSCRIBER_H__
@@ -0,0 +1,273 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sigmf_recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+// Covers the logical block size of any disk O_DIRECT may be used with
+#define SIGMF_IO_ALIGNMENT 4096
+#define SIGMF_TAIL_SIZE (ADSDR_RX_BLOCK_SIZE * sizeof(sample) + SIGMF_IO_ALIGNMENT)
+
+using namespace ADSDR;
+
+static std::string json_escape(const std::string &value)
+{
+    std::string escaped;
+    for(char c : value)
+    {
+        switch(c)
+        {
+        case '"': escaped += "\\\""; break;
+        case '\\': escaped += "\\\\"; break;
+        case '\n': escaped += "\\n"; break;
+        case '\r': escaped += "\\r"; break;
+        case '\t': escaped += "\\t"; break;
+        default:
+            if((unsigned char) c < 0x20)
+            {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", c);
+                escaped += code;
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+    }
+    return escaped;
+}
+
+sigmf_recorder::sigmf_recorder(const recording_config &config, uint32_t sample_rate, uint64_t frequency) :
+    _config(config),
+    _sample_rate(sample_rate),
+    _frequency(frequency)
+{
+    if(config.path.empty())
+    {
+        throw std::invalid_argument("sigmf_recorder: no path given");
+    }
+
+    std::string data_path = config.path + ".sigmf-data";
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    if(config.direct_io)
+    {
+        _fd = open(data_path.c_str(), flags | O_DIRECT, 0644);
+        // tmpfs and some network file systems refuse O_DIRECT
+        _direct_io = _fd >= 0;
+    }
+    if(_fd < 0)
+    {
+        _fd = open(data_path.c_str(), flags, 0644);
+    }
+    if(_fd < 0)
+    {
+        throw std::runtime_error("sigmf_recorder: could not open " + data_path + ": " + strerror(errno));
+    }
+
+    if(posix_memalign((void **) &_tail, SIGMF_IO_ALIGNMENT, SIGMF_TAIL_SIZE) != 0)
+    {
+        ::close(_fd);
+        throw std::bad_alloc();
+    }
+}
+
+sigmf_recorder::~sigmf_recorder()
+{
+    if(_fd >= 0)
+    {
+        ::close(_fd);
+    }
+    free(_tail);
+}
+
+void sigmf_recorder::write(const rx_block &block)
+{
+    if(_error != 0)
+    {
+        return;
+    }
+
+    // Anything missing in between was dropped by an overflow, the squelch or a full queue. Blocks
+    // shrink with decimation and resampling, so the missing ones are counted at this block's size.
+    if(_started && block.sequence() != _next_sequence)
+    {
+        uint64_t samples = (block.sequence() - _next_sequence) * block.size();
+        _gaps.push_back({_samples.load(), samples});
+        _lost += samples;
+    }
+    // A recovered stream keeps its sequence numbers, the block says how much went missing
+    if(block.gap() && block.gap_samples() > 0)
+    {
+        _gaps.push_back({_samples.load(), block.gap_samples()});
+        _lost += block.gap_samples();
+    }
+    _started = true;
+    _next_sequence = block.sequence() + 1;
+
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(block.data());
+    size_t bytes = block.size() * sizeof(sample);
+
+    if(_tail_bytes == 0 && bytes % SIGMF_IO_ALIGNMENT == 0)
+    {
+        // Straight from the pool, no copy
+        write_aligned(data, bytes);
+    }
+    else
+    {
+        // Only after a short transfer, every block after that is staged
+        while(bytes > 0 && _error == 0)
+        {
+            size_t chunk = std::min(bytes, SIGMF_TAIL_SIZE - _tail_bytes);
+            memcpy(_tail + _tail_bytes, data, chunk);
+            _tail_bytes += chunk;
+            data += chunk;
+            bytes -= chunk;
+
+            size_t aligned = _tail_bytes / SIGMF_IO_ALIGNMENT * SIGMF_IO_ALIGNMENT;
+            if(aligned > 0)
+            {
+                write_aligned(_tail, aligned);
+                memmove(_tail, _tail + aligned, _tail_bytes - aligned);
+                _tail_bytes -= aligned;
+            }
+        }
+    }
+
+    _blocks++;
+    _samples += block.size();
+}
+
+void sigmf_recorder::write_aligned(const unsigned char *data, size_t bytes)
+{
+    while(bytes > 0)
+    {
+        ssize_t ret = ::write(_fd, data, bytes);
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            _error = errno;
+            return;
+        }
+        data += ret;
+        bytes -= (size_t) ret;
+    }
+}
+
+void sigmf_recorder::close()
+{
+    if(_fd < 0)
+    {
+        return;
+    }
+
+    if(_tail_bytes > 0 && _error == 0)
+    {
+        // O_DIRECT only writes whole blocks, pad the last one and cut the file back afterwards
+        size_t padded = (_tail_bytes + SIGMF_IO_ALIGNMENT - 1) / SIGMF_IO_ALIGNMENT * SIGMF_IO_ALIGNMENT;
+        memset(_tail + _tail_bytes, 0, padded - _tail_bytes);
+        write_aligned(_tail, padded);
+        _tail_bytes = 0;
+
+        if(_error == 0 && ftruncate(_fd, (off_t) (_samples.load() * sizeof(sample))) != 0)
+        {
+            _error = errno;
+        }
+    }
+
+    if(_error == 0 && fdatasync(_fd) != 0)
+    {
+        _error = errno;
+    }
+
+    ::close(_fd);
+    _fd = -1;
+
+    if(_error != 0)
+    {
+        throw std::runtime_error("sigmf_recorder: writing " + _config.path + ".sigmf-data failed: " + strerror(_error));
+    }
+
+    write_meta();
+}
+
+void sigmf_recorder::write_meta()
+{
+    std::ostringstream meta;
+    meta << "{\n";
+    meta << "    \"global\": {\n";
+    meta << "        \"core:datatype\": \"ci16_le\",\n";
+    meta << "        \"core:sample_rate\": " << _sample_rate << ",\n";
+    meta << "        \"core:version\": \"1.0.0\",\n";
+    meta << "        \"core:hw\": \"ADSDR\",\n";
+    meta << "        \"core:recorder\": \"libadsdr\"";
+    if(!_config.description.empty())
+    {
+        meta << ",\n        \"core:description\": \"" << json_escape(_config.description) << "\"";
+    }
+    meta << "\n    },\n";
+    meta << "    \"captures\": [\n";
+    meta << "        {\n";
+    meta << "            \"core:sample_start\": 0,\n";
+    meta << "            \"core:frequency\": " << _frequency << "\n";
+    meta << "        }\n";
+    meta << "    ],\n";
+    meta << "    \"annotations\": [";
+    for(size_t i = 0; i < _gaps.size(); i++)
+    {
+        meta << (i == 0 ? "\n" : ",\n");
+        meta << "        {\n";
+        meta << "            \"core:sample_start\": " << _gaps[i].sample_start << ",\n";
+        meta << "            \"core:comment\": \"" << _gaps[i].samples << " samples not recorded\"\n";
+        meta << "        }";
+    }
+    meta << (_gaps.empty() ? "]\n" : "\n    ]\n");
+    meta << "}\n";
+
+    std::string meta_path = _config.path + ".sigmf-meta";
+    std::ofstream file(meta_path, std::ios::trunc);
+    file << meta.str();
+    file.close();
+    if(!file)
+    {
+        throw std::runtime_error("sigmf_recorder: could not write " + meta_path);
+    }
+}
+
+recording_stats sigmf_recorder::stats() const
+{
+    recording_stats s = {};
+    s.blocks = _blocks.load();
+    s.samples = _samples.load();
+    s.lost = _lost.load();
+    s.direct_io = _direct_io;
+    return s;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_SIGMF_RECORDER_H__
+#define __LIBADSDR_SIGMF_RECORDER_H__
+
+#include "adsdr.hpp"
+
+namespace ADSDR
+{
+    // Writes the RX block stream to a SigMF data/meta pair. Runs on the thread of the
+    // subscriber that feeds it, so the subscriber queue is the write-behind queue.
+    // Pool blocks are page aligned and a whole number of pages long, so with O_DIRECT
+    // they are written straight from the pool without going through the page cache.
+    class sigmf_recorder
+    {
+    public:
+        sigmf_recorder(const recording_config &config, uint32_t sample_rate, uint64_t frequency);
+        ~sigmf_recorder();
+
+        void write(const rx_block &block);
+
+        // Flushes the data file and writes the metadata file. Throws if any write failed.
+        void close();
+
+        // Only the counters written by this recorder, see ADSDR_impl::recording_status
+        recording_stats stats() const;
+
+    private:
+        struct gap
+        {
+            uint64_t sample_start;
+            uint64_t samples;
+        };
+
+        void write_aligned(const unsigned char *data, size_t bytes);
+        void write_meta();
+
+        recording_config _config;
+        uint32_t _sample_rate;
+        uint64_t _frequency;
+
+        int _fd = -1;
+        bool _direct_io = false;
+        int _error = 0;
+
+        // Staging for a short block, after which the file offset is no longer aligned
+        unsigned char *_tail = nullptr;
+        size_t _tail_bytes = 0;
+
+        bool _started = false;
+        uint64_t _next_sequence = 0;
+        std::vector<gap> _gaps;
+
+        std::atomic<uint64_t> _blocks{0};
+        std::atomic<uint64_t> _samples{0};
+        std::atomic<uint64_t> _lost{0};
+    };
+}
+
+#endif // __LIBADSDR_SIGMF_RECORDER_H__
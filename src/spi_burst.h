@@ -0,0 +1,64 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_SPI_BURST_H__
+#define __LIBADSDR_SPI_BURST_H__
+
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+    #include "platform.h"
+}
+
+// AD9361 instruction word, bursts of up to 8 bytes count down from the given address
+#define AD9361_SPI_WRITE 0x8000
+#define AD9361_SPI_COUNT(n) ((((n) - 1) & 0x7) << 12)
+#define AD9361_SPI_BURST 8
+
+namespace ADSDR
+{
+    // Multi byte AD9361 register access through the platform SPI path, so it is traced and
+    // counted like driver access. data[0] is the register at address, the highest one.
+    inline int spi_write_burst(platform_context *platform, uint16_t address, const uint8_t *data, unsigned count)
+    {
+        uint8_t buf[2 + AD9361_SPI_BURST];
+        uint16_t cmd = (uint16_t) (AD9361_SPI_WRITE | AD9361_SPI_COUNT(count) | (address & 0x3FF));
+        buf[0] = (uint8_t) (cmd >> 8);
+        buf[1] = (uint8_t) (cmd & 0xFF);
+        memcpy(buf + 2, data, count);
+        return platform_spi_write_then_read(platform, buf, 2 + count, nullptr, 0);
+    }
+
+    inline int spi_read_burst(platform_context *platform, uint16_t address, uint8_t *data, unsigned count)
+    {
+        uint16_t cmd = (uint16_t) (AD9361_SPI_COUNT(count) | (address & 0x3FF));
+        uint8_t buf[2] = {(uint8_t) (cmd >> 8), (uint8_t) (cmd & 0xFF)};
+        return platform_spi_write_then_read(platform, buf, 2, data, count);
+    }
+
+    inline int spi_read_register(platform_context *platform, uint16_t address)
+    {
+        uint8_t value = 0;
+        int ret = spi_read_burst(platform, address, &value, 1);
+        return ret < 0 ? ret : value;
+    }
+}
+
+#endif // __LIBADSDR_SPI_BURST_H__
@@ -0,0 +1,314 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spi_trace.h"
+
+#include <cstring>
+
+extern "C" {
+    #include "platform.h"
+}
+
+// Trace file: the magic, then one record per transaction, all little endian
+//   uint64 timestamp in ns since the recording started
+//   uint16 register address
+//   uint8  flags, bit 0 set for a write
+//   uint8  number of data bytes
+//   data bytes written to or read from the register and those below it
+#define SPI_TRACE_MAGIC "ADSPITR1"
+#define SPI_TRACE_MAGIC_SIZE 8
+#define SPI_TRACE_RECORD_HEADER 12
+#define SPI_TRACE_WRITE 0x01
+
+// AD9361 instruction word: write flag, byte count - 1, register address
+#define SPI_CMD_WRITE(cmd) (((cmd) >> 15) & 0x1)
+#define SPI_CMD_ADDRESS(cmd) ((cmd) & 0x3FF)
+
+using namespace ADSDR;
+
+spi_trace::~spi_trace()
+{
+    close_file();
+}
+
+void spi_trace::record(const std::string &filename)
+{
+    FILE *file = fopen(filename.c_str(), "wb");
+    if(file == nullptr)
+    {
+        throw std::runtime_error("spi_trace: could not create " + filename);
+    }
+    fwrite(SPI_TRACE_MAGIC, 1, SPI_TRACE_MAGIC_SIZE, file);
+
+    std::lock_guard<std::mutex> lock(_lock);
+    close_file();
+    _reads.clear();
+    _file = file;
+    _start = std::chrono::steady_clock::now();
+    _mode = TRACE_RECORD;
+}
+
+void spi_trace::replay(const std::string &filename)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if(file == nullptr)
+    {
+        throw std::runtime_error("spi_trace: could not open " + filename);
+    }
+
+    char magic[SPI_TRACE_MAGIC_SIZE];
+    if(fread(magic, 1, SPI_TRACE_MAGIC_SIZE, file) != SPI_TRACE_MAGIC_SIZE || memcmp(magic, SPI_TRACE_MAGIC, SPI_TRACE_MAGIC_SIZE) != 0)
+    {
+        fclose(file);
+        throw std::runtime_error("spi_trace: " + filename + " is not an SPI trace");
+    }
+
+    std::vector<spi_transaction> transactions;
+    uint8_t header[SPI_TRACE_RECORD_HEADER];
+    while(fread(header, 1, SPI_TRACE_RECORD_HEADER, file) == SPI_TRACE_RECORD_HEADER)
+    {
+        spi_transaction transaction;
+        transaction.address = (uint16_t) (header[8] | (header[9] << 8));
+        transaction.write = (header[10] & SPI_TRACE_WRITE) != 0;
+        transaction.data.resize(header[11]);
+        if(fread(transaction.data.data(), 1, transaction.data.size(), file) != transaction.data.size())
+        {
+            break;
+        }
+        transactions.push_back(std::move(transaction));
+    }
+    fclose(file);
+
+    replay(transactions);
+}
+
+void spi_trace::replay(const std::vector<spi_transaction> &transactions)
+{
+    std::unordered_map<uint16_t, register_reads> reads;
+    std::vector<spi_transaction> writes;
+    for(const spi_transaction &transaction : transactions)
+    {
+        if(transaction.write)
+        {
+            writes.push_back(transaction);
+        }
+        else
+        {
+            reads[transaction.address].values.push_back(transaction.data);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(_lock);
+    close_file();
+    _reads.swap(reads);
+    _expected_writes.swap(writes);
+    _write_index = 0;
+    _diverged = false;
+    _mode = TRACE_REPLAY;
+}
+
+void spi_trace::capture()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    close_file();
+    _reads.clear();
+    _captured.clear();
+    _mode = TRACE_CAPTURE;
+}
+
+std::vector<spi_transaction> spi_trace::take_capture()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    std::vector<spi_transaction> captured;
+    captured.swap(_captured);
+    if(_mode == TRACE_CAPTURE)
+    {
+        _mode = TRACE_PASS_THROUGH;
+    }
+    return captured;
+}
+
+bool spi_trace::passing_through()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _mode == TRACE_PASS_THROUGH;
+}
+
+bool spi_trace::replay_matched()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _mode == TRACE_REPLAY && !_diverged && _write_index == _expected_writes.size();
+}
+
+void spi_trace::stop()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    close_file();
+    _reads.clear();
+    _captured.clear();
+    _expected_writes.clear();
+    _mode = TRACE_PASS_THROUGH;
+}
+
+spi_stats spi_trace::stats()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _stats;
+}
+
+void spi_trace::reset_stats()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _stats = spi_stats();
+}
+
+int spi_trace::write_then_read(platform_context *platform, void *user, const unsigned char *txbuf, unsigned n_tx,
+                               unsigned char *rxbuf, unsigned n_rx)
+{
+    return static_cast<spi_trace *>(user)->transfer(platform, txbuf, n_tx, rxbuf, n_rx);
+}
+
+int spi_trace::transfer(platform_context *platform, const unsigned char *txbuf, unsigned n_tx, unsigned char *rxbuf, unsigned n_rx)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+    uint16_t cmd = (uint16_t) ((txbuf[0] << 8) | txbuf[1]);
+    uint16_t address = SPI_CMD_ADDRESS(cmd);
+    bool write = SPI_CMD_WRITE(cmd);
+
+    int ret = 0;
+    if(_mode == TRACE_REPLAY)
+    {
+        if(!write)
+        {
+            answer(address, rxbuf, n_rx);
+        }
+        else
+        {
+            check_write(address, txbuf + 2, n_tx - 2);
+        }
+    }
+    else
+    {
+        ret = fx3_spi_write_then_read(platform, txbuf, n_tx, rxbuf, n_rx);
+        if(ret == 0 && _mode == TRACE_RECORD)
+        {
+            if(write)
+            {
+                write_record(address, true, txbuf + 2, n_tx - 2);
+            }
+            else
+            {
+                write_record(address, false, rxbuf, n_rx);
+            }
+        }
+        else if(ret == 0 && _mode == TRACE_CAPTURE)
+        {
+            spi_transaction transaction;
+            transaction.address = address;
+            transaction.write = write;
+            if(write)
+            {
+                transaction.data.assign(txbuf + 2, txbuf + n_tx);
+            }
+            else
+            {
+                transaction.data.assign(rxbuf, rxbuf + n_rx);
+            }
+            _captured.push_back(std::move(transaction));
+        }
+    }
+
+    _stats.transactions++;
+    if(write)
+    {
+        _stats.writes++;
+        _stats.bytes += n_tx - 2;
+    }
+    else
+    {
+        _stats.reads++;
+        _stats.bytes += n_rx;
+    }
+    _stats.busy_ns += (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+
+    return ret;
+}
+
+void spi_trace::answer(uint16_t address, unsigned char *rxbuf, unsigned n_rx)
+{
+    memset(rxbuf, 0, n_rx);
+
+    auto it = _reads.find(address);
+    if(it == _reads.end())
+    {
+        return;
+    }
+
+    register_reads &reads = it->second;
+    if(!reads.values.empty())
+    {
+        reads.last.swap(reads.values.front());
+        reads.values.pop_front();
+    }
+    memcpy(rxbuf, reads.last.data(), min((size_t) n_rx, reads.last.size()));
+}
+
+void spi_trace::check_write(uint16_t address, const unsigned char *data, unsigned length)
+{
+    if(_write_index >= _expected_writes.size())
+    {
+        _diverged = true;
+        return;
+    }
+
+    const spi_transaction &expected = _expected_writes[_write_index++];
+    if(expected.address != address || expected.data.size() != length || memcmp(expected.data.data(), data, length) != 0)
+    {
+        _diverged = true;
+    }
+}
+
+void spi_trace::write_record(uint16_t address, bool write, const unsigned char *data, unsigned length)
+{
+    uint64_t timestamp = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+
+    uint8_t header[SPI_TRACE_RECORD_HEADER];
+    for(int i = 0; i < 8; i++)
+    {
+        header[i] = (uint8_t) (timestamp >> (8 * i));
+    }
+    header[8] = (uint8_t) (address & 0xFF);
+    header[9] = (uint8_t) (address >> 8);
+    header[10] = write ? SPI_TRACE_WRITE : 0;
+    header[11] = (uint8_t) length;
+
+    fwrite(header, 1, SPI_TRACE_RECORD_HEADER, _file);
+    fwrite(data, 1, length, _file);
+}
+
+void spi_trace::close_file()
+{
+    if(_file != nullptr)
+    {
+        fclose(_file);
+        _file = nullptr;
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_SPI_TRACE_H__
+#define __LIBADSDR_SPI_TRACE_H__
+
+#include "adsdr.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+struct platform_context;
+
+namespace ADSDR
+{
+    struct spi_transaction
+    {
+        uint16_t address;
+        bool write;
+        // Bytes written to or read from the register and those below it
+        std::vector<uint8_t> data;
+    };
+
+    // SPI backend of the platform layer. Counts every AD9361 register transaction and either
+    // passes it on to the FX3, records it to a trace file on the way, or answers it from a
+    // previously recorded trace without touching any device.
+    class spi_trace
+    {
+    public:
+        ~spi_trace();
+
+        void record(const std::string &filename);
+        void replay(const std::string &filename);
+        void replay(const std::vector<spi_transaction> &transactions);
+
+        // Pass-through that keeps every transaction in memory until take_capture()
+        void capture();
+        std::vector<spi_transaction> take_capture();
+
+        bool passing_through();
+
+        // True while a replay saw exactly the recorded writes, in order, and all of them
+        bool replay_matched();
+
+        // Back to plain pass-through, closes a recording
+        void stop();
+
+        spi_stats stats();
+        void reset_stats();
+
+        // SPI backend of a platform_context, user is the spi_trace
+        static int write_then_read(platform_context *platform, void *user, const unsigned char *txbuf, unsigned n_tx,
+                                   unsigned char *rxbuf, unsigned n_rx);
+
+    private:
+        enum trace_mode
+        {
+            TRACE_PASS_THROUGH = 0,
+            TRACE_RECORD,
+            TRACE_REPLAY,
+            TRACE_CAPTURE
+        };
+
+        struct register_reads
+        {
+            std::deque<std::vector<uint8_t>> values;
+            std::vector<uint8_t> last;
+        };
+
+        int transfer(platform_context *platform, const unsigned char *txbuf, unsigned n_tx, unsigned char *rxbuf, unsigned n_rx);
+        void answer(uint16_t address, unsigned char *rxbuf, unsigned n_rx);
+        void check_write(uint16_t address, const unsigned char *data, unsigned length);
+        void write_record(uint16_t address, bool write, const unsigned char *data, unsigned length);
+        void close_file();
+
+        std::mutex _lock;
+        trace_mode _mode = TRACE_PASS_THROUGH;
+
+        FILE *_file = nullptr;
+        std::chrono::steady_clock::time_point _start;
+
+        // Replayed read results per register, handed out in recorded order, the last one repeats
+        std::unordered_map<uint16_t, register_reads> _reads;
+
+        std::vector<spi_transaction> _captured;
+
+        // Recorded writes of a replay, to tell whether the driver went down the same path
+        std::vector<spi_transaction> _expected_writes;
+        size_t _write_index = 0;
+        bool _diverged = false;
+
+        spi_stats _stats = {};
+    };
+}
+
+#endif // __LIBADSDR_SPI_TRACE_H__
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "telemetry_sampler.h"
+#include "spi_burst.h"
+
+extern "C" {
+    #include "ad9361_api.h"
+}
+
+using namespace ADSDR;
+
+static int64_t steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int ADSDR::read_telemetry_registers(platform_context *platform, uint8_t auxadc_config, telemetry_registers &registers)
+{
+    // Like ad9361_get_temp and ad9361_get_auxadc, but frozen once for both and without the
+    // read-modify-write of the config register
+    uint8_t frozen = auxadc_config | AUXADC_POWER_DOWN;
+    int ret = spi_write_burst(platform, REG_AUXADC_CONFIG, &frozen, 1);
+
+    // AuxADC LSB, then the MSB below it
+    uint8_t word[2] = {0, 0};
+    if(ret >= 0)
+    {
+        ret = spi_read_burst(platform, REG_AUXADC_LSB, word, 2);
+    }
+    if(ret >= 0)
+    {
+        ret = spi_read_register(platform, REG_TEMPERATURE);
+        registers.temperature = (uint8_t) ret;
+    }
+    // Thawed even when a read failed
+    int thawed = spi_write_burst(platform, REG_AUXADC_CONFIG, &auxadc_config, 1);
+    if(ret < 0 || thawed < 0)
+    {
+        return ret < 0 ? ret : thawed;
+    }
+    registers.auxadc = (uint16_t) ((word[1] << 4) | AUXADC_WORD_LSB(word[0]));
+
+    return spi_read_burst(platform, REG_PREAMBLE_LSB, registers.rssi, sizeof(registers.rssi));
+}
+
+void ADSDR::decode_rx_rssi(const uint8_t *rssi, double &symbol_db, double &preamble_db)
+{
+    symbol_db = 0.25 * ((rssi[5] << 1) + (rssi[1] & 0x01));
+    preamble_db = 0.25 * ((rssi[4] << 1) + (rssi[0] & 0x01));
+}
+
+telemetry_sampler::telemetry_sampler(const telemetry_config &config, std::function<telemetry_read(telemetry_registers &)> read) :
+    _config(config),
+    _read(read)
+{
+    if(_config.period_ms == 0)
+    {
+        throw std::invalid_argument("telemetry_sampler: period_ms must be positive");
+    }
+
+    _worker = std::thread([this]() {
+        run();
+    });
+}
+
+telemetry_sampler::~telemetry_sampler()
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _running = false;
+    }
+    _wake.notify_all();
+    _worker.join();
+}
+
+telemetry_snapshot telemetry_sampler::snapshot() const
+{
+    telemetry_snapshot snapshot;
+    uint32_t sequence;
+    do
+    {
+        sequence = _sequence.load(std::memory_order_acquire);
+        snapshot.samples = _samples.load(std::memory_order_relaxed);
+        snapshot.age_seconds = (steady_ns() - _taken_ns.load(std::memory_order_relaxed)) * 1e-9;
+        snapshot.temperature = _temperature.load(std::memory_order_relaxed);
+        snapshot.rssi_symbol_db = _rssi_symbol_db.load(std::memory_order_relaxed);
+        snapshot.rssi_preamble_db = _rssi_preamble_db.load(std::memory_order_relaxed);
+        snapshot.auxadc = _auxadc.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    while((sequence & 1) != 0 || _sequence.load(std::memory_order_relaxed) != sequence);
+
+    if(snapshot.samples == 0)
+    {
+        snapshot.age_seconds = 0.0;
+    }
+    snapshot.skipped = _skipped.load(std::memory_order_relaxed);
+    snapshot.errors = _errors.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+void telemetry_sampler::run()
+{
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(_lock);
+    while(_running)
+    {
+        lock.unlock();
+        telemetry_registers registers;
+        telemetry_read result = _read(registers);
+        lock.lock();
+
+        if(result == TELEMETRY_SAMPLED)
+        {
+            publish(registers);
+            next += std::chrono::milliseconds(_config.period_ms);
+        }
+        else if(result == TELEMETRY_SKIPPED)
+        {
+            // Try again once a retune has settled, but not more often than the period asks for
+            _skipped.fetch_add(1, std::memory_order_relaxed);
+            next += std::chrono::milliseconds(min(max(_config.retune_holdoff_ms, 1u), _config.period_ms));
+        }
+        else
+        {
+            _errors.fetch_add(1, std::memory_order_relaxed);
+            next += std::chrono::milliseconds(_config.period_ms);
+        }
+
+        // A late sampler does not try to catch up with a burst of samples
+        next = max(next, std::chrono::steady_clock::now());
+        _wake.wait_until(lock, next, [this]() { return !_running; });
+    }
+}
+
+void telemetry_sampler::publish(const telemetry_registers &registers)
+{
+    // Same scale as ad9361_get_temp
+    double temperature = registers.temperature / 1.14;
+    double symbol, preamble;
+    decode_rx_rssi(registers.rssi, symbol, preamble);
+
+    uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+    _sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    _samples.store(_samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    _taken_ns.store(steady_ns(), std::memory_order_relaxed);
+    _temperature.store(temperature, std::memory_order_relaxed);
+    _rssi_symbol_db.store(symbol, std::memory_order_relaxed);
+    _rssi_preamble_db.store(preamble, std::memory_order_relaxed);
+    _auxadc.store(registers.auxadc, std::memory_order_relaxed);
+
+    _sequence.store(sequence + 2, std::memory_order_release);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_TELEMETRY_SAMPLER_H__
+#define __LIBADSDR_TELEMETRY_SAMPLER_H__
+
+#include "adsdr.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct platform_context;
+
+namespace ADSDR
+{
+    // Registers behind one telemetry sample, as read from the AD9361
+    struct telemetry_registers
+    {
+        uint8_t temperature;
+        uint16_t auxadc;
+        // Preamble LSB, symbol LSB, RX2 preamble, RX2 symbol, RX1 preamble, RX1 symbol
+        uint8_t rssi[6];
+    };
+
+    // Reads the registers of one sample in the fewest SPI transactions: the AuxADC is frozen with
+    // auxadc_config, the previously read value of its config register, while the temperature
+    // and AuxADC words are read, then the RSSI words come in one burst. Negative on SPI errors.
+    int read_telemetry_registers(platform_context *platform, uint8_t auxadc_config, telemetry_registers &registers);
+
+    // RX1 symbol and preamble RSSI in dB from the 6 registers read down from REG_PREAMBLE_LSB,
+    // on the scale of ad9361_read_rssi
+    void decode_rx_rssi(const uint8_t *rssi, double &symbol_db, double &preamble_db);
+
+    enum telemetry_read
+    {
+        TELEMETRY_SAMPLED = 0,
+        TELEMETRY_SKIPPED,      // The SPI bus was busy or settling, nothing was read
+        TELEMETRY_FAILED
+    };
+
+    // Takes a telemetry sample every period on its own thread and publishes it through a
+    // sequence lock: the sampler is the only writer, readers copy the fields and retry if the
+    // sequence moved meanwhile, so they never wait on the sampler or the SPI bus.
+    class telemetry_sampler
+    {
+    public:
+        telemetry_sampler(const telemetry_config &config, std::function<telemetry_read(telemetry_registers &)> read);
+        ~telemetry_sampler();
+
+        telemetry_snapshot snapshot() const;
+
+    private:
+        void run();
+        void publish(const telemetry_registers &registers);
+
+        telemetry_config _config;
+        std::function<telemetry_read(telemetry_registers &)> _read;
+
+        // Odd while the sampler writes the fields below
+        std::atomic<uint32_t> _sequence{0};
+        std::atomic<uint64_t> _samples{0};
+        std::atomic<int64_t> _taken_ns{0};
+        std::atomic<double> _temperature{0.0};
+        std::atomic<double> _rssi_symbol_db{0.0};
+        std::atomic<double> _rssi_preamble_db{0.0};
+        std::atomic<uint16_t> _auxadc{0};
+
+        // Counters only ever grow, they are read without the sequence lock
+        std::atomic<uint64_t> _skipped{0};
+        std::atomic<uint64_t> _errors{0};
+
+        std::mutex _lock;
+        std::condition_variable _wake;
+        bool _running = true;
+        std::thread _worker;
+    };
+}
+
+#endif // __LIBADSDR_TELEMETRY_SAMPLER_H__
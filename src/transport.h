@@ -0,0 +1,74 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_TRANSPORT_H__
+#define __LIBADSDR_TRANSPORT_H__
+
+#include "adsdr.hpp"
+#include "libusb.h"
+
+#include <chrono>
+#include <memory>
+
+namespace ADSDR
+{
+    // Carries bulk/interrupt transfers and control requests between ADSDR_impl and a device.
+    // Transfers are plain libusb_transfer structures on every transport and always complete
+    // through their callback, from within handle_events() on the event thread.
+    // Functions return libusb error codes.
+    class transport
+    {
+    public:
+        virtual ~transport() {}
+
+        virtual int submit(libusb_transfer *transfer) = 0;
+        virtual int cancel(libusb_transfer *transfer) = 0;
+        virtual int control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                            unsigned char *data, uint16_t length, unsigned int timeout_ms) = 0;
+
+        // One iteration of the event loop, runs the callbacks of completed transfers
+        virtual void handle_events() = 0;
+
+        // Makes handle_events() return so the event thread can be joined. No transfer is
+        // submitted after this.
+        virtual void interrupt() = 0;
+
+        // Device handle to fill transfers with, nullptr if there is no USB device
+        virtual libusb_device_handle *handle() const { return nullptr; }
+
+        // Serial number of the device, identifies it across processes
+        virtual std::string serial() const = 0;
+
+        // Clears a halt or stall on an endpoint, with no transfer in flight on it
+        virtual int clear_halt(unsigned char endpoint) { (void) endpoint; return LIBUSB_ERROR_NOT_SUPPORTED; }
+
+        // Opens the same device again after it re-enumerated, waiting up to timeout for it to
+        // come back. Returns nullptr if it did not or the transport cannot be reopened.
+        virtual std::unique_ptr<transport> reopen(std::chrono::milliseconds timeout) { (void) timeout; return nullptr; }
+
+        // Control transfer entry point for the platform layer, user is the transport
+        static int platform_control(void *user, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                                    uint8_t *data, uint16_t length, unsigned int timeout_ms)
+        {
+            return static_cast<transport *>(user)->control(request_type, request, value, index, data, length, timeout_ms);
+        }
+    };
+}
+
+#endif // __LIBADSDR_TRANSPORT_H__
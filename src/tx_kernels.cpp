@@ -0,0 +1,89 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tx_kernels.h"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ADSDR
+{
+
+void encode_tx_transfer(const sample *source, size_t count, unsigned char *buffer)
+{
+    size_t n = 0;
+
+#if defined(__SSE2__)
+    // Four samples per iteration, negative values become ((-x) ^ 0xFFF) + 1 exactly like the scalar path
+    const __m128i mask = _mm_set1_epi16(0xFFF);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+
+    for(; n + 4 <= count; n += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(source + n));
+        __m128i negative = _mm_cmplt_epi16(v, zero);
+        __m128i complement = _mm_add_epi16(_mm_xor_si128(_mm_sub_epi16(zero, v), mask), one);
+        v = _mm_or_si128(_mm_and_si128(negative, complement), _mm_andnot_si128(negative, v));
+
+        // Swap I and Q within each sample
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i *)(buffer + n * ADSDR_BYTES_PER_SAMPLE), v);
+    }
+#endif
+
+    for(; n < count; n++)
+    {
+        int16_t signed_i = source[n].i;
+        int16_t signed_q = source[n].q;
+
+        // Unsigned 16-bit ints holding the two's-complement 12-bit sample values
+        uint16_t raw_i;
+        uint16_t raw_q;
+
+        if(signed_i >= 0)
+        {
+            raw_i = (uint16_t) signed_i;
+        }
+        else
+        {
+            raw_i = (((uint16_t) (-signed_i)) ^ ((uint16_t) 0xFFF)) + (uint16_t) 1;
+        }
+
+        if(signed_q >= 0)
+        {
+            raw_q = (uint16_t) signed_q;
+        }
+        else
+        {
+            raw_q = (((uint16_t) (-signed_q)) ^ ((uint16_t) 0xFFF)) + (uint16_t) 1;
+        }
+
+        // Copy raw i/q data into the buffer
+        unsigned char *out = buffer + n * ADSDR_BYTES_PER_SAMPLE;
+        memcpy(out, &raw_q, sizeof(raw_q));
+        memcpy(out + sizeof(raw_q), &raw_i, sizeof(raw_i));
+    }
+}
+
+}
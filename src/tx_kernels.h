@@ -0,0 +1,32 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_TX_KERNELS_H__
+#define __LIBADSDR_TX_KERNELS_H__
+
+#include "adsdr.hpp"
+
+namespace ADSDR
+{
+    // Encodes count samples into a TX transfer buffer: Q then I, each as an unsigned 16 bit
+    // word holding the 12 bit two's complement value
+    void encode_tx_transfer(const sample *source, size_t count, unsigned char *buffer);
+}
+
+#endif // __LIBADSDR_TX_KERNELS_H__
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "usb_transport.h"
+#include "device_registry.h"
+
+// Wait between attempts to open a board that is still re-enumerating
+#define USB_REOPEN_RETRY_MS 100
+
+using namespace ADSDR;
+
+usb_transport::usb_transport(std::string serial_number)
+{
+    // The registry already knows every connected ADSDR and its serial number, so only the
+    // matching device is opened here
+    device_registry &registry = device_registry::instance();
+    device_info info;
+    if(!registry.find(serial_number, info))
+    {
+        std::vector<std::string> errors;
+        std::vector<device_info> devices = registry.devices(&errors);
+        bool found = false;
+        for(size_t i = 0; i < devices.size(); i++)
+        {
+            if(devices[i].bootloader)
+            {
+                continue;
+            }
+            if(!errors[i].empty())
+            {
+                throw ConnectionError(errors[i]);
+            }
+            found = true;
+        }
+
+        if(found)
+        {
+            throw ConnectionError("ADSDR device(s) were found, but did not match specified serial number");
+        }
+        throw ConnectionError("no ADSDR device found");
+    }
+
+    libusb_device **devs;
+
+    int ret = libusb_init(&_ctx);
+
+    if(ret < 0)
+    {
+        throw ConnectionError("libusb init error %d: error " + std::to_string(ret));
+    }
+
+    // Set verbosity level
+    libusb_set_debug(_ctx, 3);
+
+    // Retrieve device list
+    int num_devs = (int) libusb_get_device_list(_ctx, &devs);
+    if(num_devs < 0)
+    {
+        throw ConnectionError("libusb device list retrieval error");
+    }
+
+    // Find the ADSDR device at the bus address the registry has for it
+    for(int i = 0; i < num_devs; i++)
+    {
+        if(libusb_get_bus_number(devs[i]) != info.bus || libusb_get_device_address(devs[i]) != info.address)
+        {
+            continue;
+        }
+
+        libusb_device_descriptor desc;
+        int ret = libusb_get_device_descriptor(devs[i], &desc);
+        if(ret < 0)
+        {
+            libusb_free_device_list(devs, 1);
+            throw ConnectionError("libusb error getting device descriptor %d: error " + std::to_string(ret));
+        }
+
+        if(desc.idVendor == ADSDR_VENDOR_ID && desc.idProduct == ADSDR_PRODUCT_ID)
+        {
+            int ret = libusb_open(devs[i], &_adsdr_handle);
+            if(ret != 0)
+            {
+                libusb_free_device_list(devs, 1);
+                throw ConnectionError("libusb could not open found ADSDR USB device %d: error " + std::to_string(ret));
+            }
+            _serial = info.serial;
+        }
+        break;
+    }
+
+    // Free the list, unref the devices in it
+    libusb_free_device_list(devs, 1);
+
+    if(_adsdr_handle == nullptr)
+    {
+        // Disconnected since the registry last saw it
+        throw ConnectionError("no ADSDR device found");
+    }
+
+    // Found a ADSDR device and opened it. Now claim its interface (ID 0).
+    ret = libusb_claim_interface(_adsdr_handle, 0);
+    if(ret < 0)
+    {
+        throw ConnectionError("could not claim ADSDR interface");
+    }
+}
+
+usb_transport::~usb_transport()
+{
+    interrupt();
+
+    if(_ctx != nullptr)
+    {
+        libusb_exit(_ctx); // close the session
+    }
+}
+
+int usb_transport::submit(libusb_transfer *transfer)
+{
+    return libusb_submit_transfer(transfer);
+}
+
+int usb_transport::cancel(libusb_transfer *transfer)
+{
+    return libusb_cancel_transfer(transfer);
+}
+
+int usb_transport::control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                           unsigned char *data, uint16_t length, unsigned int timeout_ms)
+{
+    if(_adsdr_handle == nullptr)
+    {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    return libusb_control_transfer(_adsdr_handle, request_type, request, value, index, data, length, timeout_ms);
+}
+
+int usb_transport::clear_halt(unsigned char endpoint)
+{
+    if(_adsdr_handle == nullptr)
+    {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    return libusb_clear_halt(_adsdr_handle, endpoint);
+}
+
+std::unique_ptr<transport> usb_transport::reopen(std::chrono::milliseconds timeout)
+{
+    // Right after a disconnect the registry may still list the old device, so opening can fail
+    // until it has seen the board leave and come back
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    device_registry &registry = device_registry::instance();
+    device_info info;
+    while(registry.wait_for(_serial, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()), info))
+    {
+        try
+        {
+            return std::unique_ptr<transport>(new usb_transport(_serial));
+        }
+        catch(const ConnectionError &)
+        {
+            if(std::chrono::steady_clock::now() >= deadline)
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(USB_REOPEN_RETRY_MS));
+        }
+    }
+    return nullptr;
+}
+
+void usb_transport::handle_events()
+{
+    libusb_handle_events(_ctx);
+}
+
+void usb_transport::interrupt()
+{
+    if(_adsdr_handle != nullptr)
+    {
+        libusb_release_interface(_adsdr_handle, 0);
+
+        // This will cause libusb_handle_events() to return once
+        libusb_close(_adsdr_handle);
+        _adsdr_handle = nullptr;
+    }
+}
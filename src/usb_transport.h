@@ -0,0 +1,59 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_USB_TRANSPORT_H__
+#define __LIBADSDR_USB_TRANSPORT_H__
+
+#include "transport.h"
+
+#define MAX_SERIAL_LENGTH 256
+
+namespace ADSDR
+{
+    // Transport to a physical ADSDR over libusb
+    class usb_transport : public transport
+    {
+    public:
+        // Opens the first ADSDR whose serial number contains serial_number and claims its interface
+        usb_transport(std::string serial_number);
+        ~usb_transport();
+
+        int submit(libusb_transfer *transfer) override;
+        int cancel(libusb_transfer *transfer) override;
+        int control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                    unsigned char *data, uint16_t length, unsigned int timeout_ms) override;
+
+        void handle_events() override;
+        void interrupt() override;
+
+        libusb_device_handle *handle() const override { return _adsdr_handle; }
+
+        std::string serial() const override { return _serial; }
+
+        int clear_halt(unsigned char endpoint) override;
+        std::unique_ptr<transport> reopen(std::chrono::milliseconds timeout) override;
+
+    private:
+        libusb_context *_ctx = nullptr;
+        libusb_device_handle *_adsdr_handle = nullptr;
+        std::string _serial;
+    };
+}
+
+#endif // __LIBADSDR_USB_TRANSPORT_H__
@@ -18,76 +18,48 @@
  */
 
 #include "adsdr.hpp"
+#include <algorithm>
+#include <array>
 #include <fstream>
 #include <vector>
 #include "libusb.h"
+#include "device_registry.h"
+#include "fx3_firmware.h"
+#include "mapped_file.h"
 
-#define GET_LSW(v) ((unsigned short)((v) & 0xFFFF))
-#define GET_MSW(v) ((unsigned short)((v) >> 16))
-#define MAX_WRITE_SIZE (2 * 1024)
+// How long a board takes to come back in bootloader mode after a reset
+#define FX3_RESET_TIMEOUT_MS 10000
 
 using namespace ADSDR;
 using namespace std;
 
-void ram_write(libusb_device_handle *fx3_handle, unsigned char *buf, unsigned int ramAddress, int len)
-{
-    int index = 0;
-
-    while(len > 0)
-    {
-        int size = (len > MAX_WRITE_SIZE) ? MAX_WRITE_SIZE : len;
-        int r = libusb_control_transfer(fx3_handle, 0x40, 0xA0, GET_LSW(ramAddress), GET_MSW(ramAddress), &buf[index], size, ADSDR_USB_TIMEOUT);
-        if(r != size)
-        {
-            throw ConnectionError("FX3 firmware write via libusb control transfer failed: " + std::to_string(r));
-        }
-
-        ramAddress += size;
-        index += size;
-        len -= size;
-    }
-}
-
 int ADSDR::Util::get_device_count()
 {
-    libusb_context* ctx = nullptr;
-    libusb_device_handle* fx3_handle = nullptr;
-    int dev_count = 0;
-
-    int ret = libusb_init(&ctx);
-    if(ret < 0)
+    try
     {
-	cerr << "libusb init error: error " << std::to_string(ret) << endl;
-        return ret;
+        return (int) ADSDR::connected_devices().size();
     }
-
-    libusb_device **devs;
-    int num_devs = (int) libusb_get_device_list(ctx, &devs);
-    if(num_devs < 0)
+    catch(runtime_error &e)
     {
-        cerr << "libusb device list retrieval error" << endl;
-        return ret;
+        cerr << e.what() << endl;
+        return -1;
     }
+}
 
-    for(int i = 0; i < num_devs; i++)
-    {
-        libusb_device_descriptor desc;
-        int ret = libusb_get_device_descriptor(devs[i], &desc);
-        if(ret < 0)
-        {
-            cerr << "libusb error getting device descriptor: error " << std::to_string(ret);
-        }
+int32_t ADSDR::Util::find_fx3() {
+    int32_t retv = -1;
 
-        if(desc.idVendor == FX3_VENDOR_ID && (desc.idProduct == FX3_PRODUCT_BOOT_ID || desc.idProduct == ADSDR_PRODUCT_ID))
-		dev_count++;
+    for(const device_info &device : ADSDR::connected_devices())
+    {
+        retv = device.product_id;
     }
 
-    return dev_count;
+    return retv;
 }
 
-int32_t ADSDR::Util::find_fx3() {
+void ADSDR::Util::reset_fx3() {
     libusb_context *ctx = nullptr;
-    int32_t retv = -1;
+    libusb_device_handle *handle = nullptr;
 
     try {
         int ret = libusb_init(&ctx);
@@ -108,12 +80,25 @@ int32_t ADSDR::Util::find_fx3() {
                 throw ConnectionError("libusb error getting device descriptor: error " + std::to_string(ret));
             }
 
-            if (desc.idVendor == FX3_VENDOR_ID &&
-                (desc.idProduct == FX3_PRODUCT_BOOT_ID || desc.idProduct == ADSDR_PRODUCT_ID)) {
-                retv = desc.idProduct;
+            if (desc.idVendor == FX3_VENDOR_ID && desc.idProduct == ADSDR_PRODUCT_ID) {
+                ret = libusb_open(devs[i], &handle);
+                if(ret < 0) {
+                    throw ConnectionError("libusb error opening device: error " + std::to_string(ret));
+                }
+                uint8_t data[3] = {0xFF, 0xFF, 0xFF};
+                ret = libusb_control_transfer(handle, LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT, 0xB3, 0, 0, data, 3, ADSDR_USB_TIMEOUT);
+                if(ret < 0) {
+                    throw ConnectionError("libusb error resetting device: error " + std::to_string(ret));
+                }
             }
         }
     } catch (runtime_error &e) {
+        if(handle != nullptr)
+        {
+            libusb_release_interface(handle, 0);
+            libusb_close(handle);
+        }
+
         if(ctx != nullptr)
         {
             libusb_exit(ctx);
@@ -122,14 +107,21 @@ int32_t ADSDR::Util::find_fx3() {
         throw e;
     }
 
+    if(handle != nullptr)
+    {
+        libusb_release_interface(handle, 0);
+        libusb_close(handle);
+    }
+
     if(ctx != nullptr)
     {
         libusb_exit(ctx);
     }
-    return retv;
 }
 
-void ADSDR::Util::reset_fx3() {
+// Opens the device at the bus address the registry has for it and runs job on it
+static void with_device(const device_info &device, std::function<void(libusb_device_handle *)> job)
+{
     libusb_context *ctx = nullptr;
     libusb_device_handle *handle = nullptr;
 
@@ -145,29 +137,24 @@ void ADSDR::Util::reset_fx3() {
             throw ConnectionError("libusb device list retrieval error");
         }
 
-        for (int i = 0; i < num_devs; i++) {
-            libusb_device_descriptor desc;
-            int ret = libusb_get_device_descriptor(devs[i], &desc);
-            if (ret < 0) {
-                throw ConnectionError("libusb error getting device descriptor: error " + std::to_string(ret));
-            }
-
-            if (desc.idVendor == FX3_VENDOR_ID && desc.idProduct == ADSDR_PRODUCT_ID) {
+        for (int i = 0; i < num_devs && handle == nullptr; i++) {
+            if (libusb_get_bus_number(devs[i]) == device.bus && libusb_get_device_address(devs[i]) == device.address) {
                 ret = libusb_open(devs[i], &handle);
                 if(ret < 0) {
+                    libusb_free_device_list(devs, 1);
                     throw ConnectionError("libusb error opening device: error " + std::to_string(ret));
                 }
-                uint8_t data[3] = {0xFF, 0xFF, 0xFF};
-                ret = libusb_control_transfer(handle, LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT, 0xB3, 0, 0, data, 3, ADSDR_USB_TIMEOUT);
-                if(ret < 0) {
-                    throw ConnectionError("libusb error resetting device: error " + std::to_string(ret));
-                }
             }
         }
+        libusb_free_device_list(devs, 1);
+
+        if(handle == nullptr) {
+            throw ConnectionError("device disconnected");
+        }
+        job(handle);
     } catch (runtime_error &e) {
         if(handle != nullptr)
         {
-            libusb_release_interface(handle, 0);
             libusb_close(handle);
         }
 
@@ -176,24 +163,19 @@ void ADSDR::Util::reset_fx3() {
             libusb_exit(ctx);
         }
 
-        throw e;
-    }
-
-    if(handle != nullptr)
-    {
-        libusb_release_interface(handle, 0);
-        libusb_close(handle);
+        throw;
     }
 
-    if(ctx != nullptr)
-    {
-        libusb_exit(ctx);
-    }
+    libusb_close(handle);
+    libusb_exit(ctx);
 }
 
-void ADSDR::Util::flash_fx3(std::string filename) {
+// Uploads the image to every FX3 in bootloader mode, returns how many there were
+static int flash_bootloaders(const mapped_file &image)
+{
     libusb_context *ctx = nullptr;
     libusb_device_handle *handle = nullptr;
+    int flashed = 0;
 
     try {
         int ret = libusb_init(&ctx);
@@ -211,70 +193,28 @@ void ADSDR::Util::flash_fx3(std::string filename) {
             libusb_device_descriptor desc;
             int ret = libusb_get_device_descriptor(devs[i], &desc);
             if (ret < 0) {
+                libusb_free_device_list(devs, 1);
                 throw ConnectionError("libusb error getting device descriptor: error " + std::to_string(ret));
             }
 
-            if (desc.idVendor == FX3_VENDOR_ID &&desc.idProduct == FX3_PRODUCT_BOOT_ID) {
+            if (desc.idVendor == FX3_VENDOR_ID && desc.idProduct == FX3_PRODUCT_BOOT_ID) {
                 ret = libusb_open(devs[i], &handle);
                 if(ret < 0) {
+                    libusb_free_device_list(devs, 1);
                     throw ConnectionError("libusb error opening device: error " + std::to_string(ret));
                 }
-                // Open ifstream for firmware file
-                std::ifstream stream;
-                stream.exceptions(std::ios::failbit | std::ios::badbit);
-                stream.open(filename, std::ios::binary | std::ios::ate);
-                std::streamsize size = stream.tellg();
-                stream.seekg(0, std::ios::beg);
-
-                // Read firmware into vector
-                std::vector<char> firmware_buffer((size_t) size);
-                if(!stream.read(firmware_buffer.data(), size))
-                {
-                    // Could not load file into buffer
-                    throw std::runtime_error("Could not load FX3 firmware file into buffer!");
-                }
 
-                uint32_t filesize = static_cast<uint32_t>(size);
-
-                // Write firmware to RAM
-                uint32_t index = 4;
-                uint32_t checksum = 0;
-                while(index < filesize)
-                {
-                    unsigned int *data_p  = (unsigned int *)(firmware_buffer.data() + index);
-                    int length = data_p[0];
-                    int address = data_p[1];
-                    if(length != 0)
-                    {
-                        for (int i = 0; i < length; i++)
-                        {
-                            checksum += data_p[2+i];
-                        }
-
-                        ram_write(handle, (unsigned char *) firmware_buffer.data() + index + 8, (unsigned int) address, length * 4);
-                    }
-                    else
-                    {
-                        if(checksum != data_p[2])
-                        {
-                            throw std::runtime_error("Checksum error in firmware binary");
-                        }
-                        int r = libusb_control_transfer(handle, 0x40, 0xA0, GET_LSW(address), GET_MSW(address), 0, 0, ADSDR_USB_TIMEOUT);
-                        if(r != 0 && r != -4)
-                        {
-                            // Ignore this, somehow this error's but still works (??): cerr << "Error in control transfer: " << r << endl;
-                        }
-                        break;
-                    }
-
-                    index += (8 + length * 4);
-                }
+                upload_fx3_firmware(ctx, handle, image);
+                flashed++;
+
+                libusb_close(handle);
+                handle = nullptr;
             }
         }
+        libusb_free_device_list(devs, 1);
     } catch (runtime_error &e) {
         if(handle != nullptr)
         {
-            libusb_release_interface(handle, 0);
             libusb_close(handle);
         }
 
@@ -283,19 +223,78 @@ void ADSDR::Util::flash_fx3(std::string filename) {
             libusb_exit(ctx);
         }
 
-        throw e;
+        throw;
     }
 
-    if(handle != nullptr)
+    if(ctx != nullptr)
     {
-        libusb_release_interface(handle, 0);
-        libusb_close(handle);
+        libusb_exit(ctx);
     }
+    return flashed;
+}
 
-    if(ctx != nullptr)
+void ADSDR::Util::flash_fx3(std::string filename) {
+    mapped_file image(filename);
+    flash_bootloaders(image);
+}
+
+bool ADSDR::Util::update_fx3(std::string filename) {
+    mapped_file image(filename);
+    validate_fx3_firmware(image);
+
+    // Boards running a different firmware are reset into the bootloader first
+    size_t bootloaders = 0;
+    size_t stale = 0;
+    for(const device_info &device : ADSDR::connected_devices())
     {
-        libusb_exit(ctx);
+        if(device.bootloader)
+        {
+            bootloaders++;
+            continue;
+        }
+
+        std::string version;
+        with_device(device, [&](libusb_device_handle *handle) {
+            std::array<unsigned char, ADSDR_USB_CTRL_SIZE + 1> data{};
+            int ret = libusb_control_transfer(handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN, ADSDR_GET_VERSION_REQ, 0, 0, data.data(), ADSDR_USB_CTRL_SIZE, ADSDR_USB_TIMEOUT);
+            if(ret > 0)
+            {
+                version = std::string((const char *) data.data());
+            }
+        });
+        if(fx3_firmware_matches(image, version))
+        {
+            continue;
+        }
+
+        with_device(device, [](libusb_device_handle *handle) {
+            uint8_t data[3] = {0xFF, 0xFF, 0xFF};
+            int ret = libusb_control_transfer(handle, LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT, 0xB3, 0, 0, data, 3, ADSDR_USB_TIMEOUT);
+            if(ret < 0) {
+                throw ConnectionError("libusb error resetting device: error " + std::to_string(ret));
+            }
+        });
+        stale++;
+    }
+
+    if(bootloaders + stale == 0)
+    {
+        return false;
     }
+
+    if(stale > 0)
+    {
+        bool reset = device_registry::instance().wait_until([&](const std::vector<device_info> &devices) {
+            size_t waiting = (size_t) std::count_if(devices.begin(), devices.end(), [](const device_info &device) { return device.bootloader; });
+            return waiting >= bootloaders + stale;
+        }, std::chrono::milliseconds(FX3_RESET_TIMEOUT_MS));
+        if(!reset)
+        {
+            throw ConnectionError("FX3 did not come back in bootloader mode after reset");
+        }
+    }
+
+    return flash_bootloaders(image) > 0;
 }
 
 //bool ADSDR::Util::find_fx3(bool upload_firmware, std::string filename, bool reset)
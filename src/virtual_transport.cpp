@@ -0,0 +1,322 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "virtual_transport.h"
+#include "rx_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+    #include "fx3cmd.h"
+}
+
+// Bytes per sample in a transfer: I/Q of both channels, 12 bit values in the upper bits of 16
+#define VIRTUAL_RAW_SAMPLE_SIZE (2 * ADSDR_BYTES_PER_SAMPLE)
+// Length of the synthesized signal, it repeats seamlessly after that
+#define VIRTUAL_TABLE_SAMPLES (16 * ADSDR_RX_BLOCK_SIZE)
+
+using namespace ADSDR;
+
+virtual_transport::virtual_transport(const virtual_device_config &config) : _config(config)
+{
+    if(config.sample_rate <= 0)
+    {
+        throw std::invalid_argument("virtual_transport: sample_rate must be positive");
+    }
+
+    if(config.source == VIRTUAL_SOURCE_RAW_FILE || config.source == VIRTUAL_SOURCE_CI16_FILE)
+    {
+        map_file();
+    }
+    else
+    {
+        synthesize();
+    }
+
+    if(config.throttle)
+    {
+        _period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(ADSDR_RX_BLOCK_SIZE / config.sample_rate));
+    }
+    else
+    {
+        _period = clock::duration::zero();
+    }
+}
+
+virtual_transport::~virtual_transport()
+{
+    if(_map != nullptr)
+    {
+        munmap(_map, _map_bytes);
+    }
+}
+
+void virtual_transport::synthesize()
+{
+    double amplitude = (ADSDR_SAMPLE_FULL_SCALE - 1) * std::pow(10.0, _config.amplitude_dbfs / 20.0);
+
+    // Round the tone to a whole number of periods over the table
+    double cycles = std::round(_config.tone_frequency * VIRTUAL_TABLE_SAMPLES / _config.sample_rate);
+
+    std::mt19937 generator(1);
+    std::normal_distribution<double> noise(0.0, amplitude / std::sqrt(2.0));
+
+    _table.assign(VIRTUAL_TABLE_SAMPLES * VIRTUAL_RAW_SAMPLE_SIZE, 0);
+    int16_t *out = reinterpret_cast<int16_t *>(_table.data());
+
+    for(size_t n = 0; n < VIRTUAL_TABLE_SAMPLES; n++)
+    {
+        double i, q;
+        if(_config.source == VIRTUAL_SOURCE_NOISE)
+        {
+            i = noise(generator);
+            q = noise(generator);
+        }
+        else
+        {
+            double phase = 2.0 * M_PI * cycles * n / VIRTUAL_TABLE_SAMPLES;
+            i = amplitude * std::cos(phase);
+            q = amplitude * std::sin(phase);
+        }
+
+        i = std::max(-(double) ADSDR_SAMPLE_FULL_SCALE, std::min((double) ADSDR_SAMPLE_FULL_SCALE - 1, std::round(i)));
+        q = std::max(-(double) ADSDR_SAMPLE_FULL_SCALE, std::min((double) ADSDR_SAMPLE_FULL_SCALE - 1, std::round(q)));
+        out[4 * n + 0] = (int16_t) (i * 16);
+        out[4 * n + 1] = (int16_t) (q * 16);
+    }
+
+    _source = _table.data();
+    _source_samples = VIRTUAL_TABLE_SAMPLES;
+}
+
+void virtual_transport::map_file()
+{
+    int fd = open(_config.filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        throw std::runtime_error("virtual_transport: could not open " + _config.filename);
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("virtual_transport: could not stat " + _config.filename);
+    }
+
+    _source_ci16 = _config.source == VIRTUAL_SOURCE_CI16_FILE;
+    _source_samples = (size_t) st.st_size / (_source_ci16 ? sizeof(sample) : VIRTUAL_RAW_SAMPLE_SIZE);
+    if(_source_samples == 0)
+    {
+        close(fd);
+        throw std::runtime_error("virtual_transport: " + _config.filename + " holds no samples");
+    }
+
+    _map_bytes = (size_t) st.st_size;
+    _map = mmap(nullptr, _map_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(_map == MAP_FAILED)
+    {
+        _map = nullptr;
+        throw std::runtime_error("virtual_transport: could not map " + _config.filename);
+    }
+    madvise(_map, _map_bytes, MADV_SEQUENTIAL);
+
+    _source = static_cast<const unsigned char *>(_map);
+}
+
+void virtual_transport::fill(unsigned char *buffer, int length)
+{
+    size_t samples = (size_t) length / VIRTUAL_RAW_SAMPLE_SIZE;
+
+    while(samples > 0)
+    {
+        size_t chunk = std::min(samples, _source_samples - _position);
+
+        if(_source_ci16)
+        {
+            const int16_t *in = reinterpret_cast<const int16_t *>(_source) + 2 * _position;
+            int16_t *out = reinterpret_cast<int16_t *>(buffer);
+            for(size_t n = 0; n < chunk; n++)
+            {
+                out[4 * n + 0] = (int16_t) (in[2 * n + 0] * 16);
+                out[4 * n + 1] = (int16_t) (in[2 * n + 1] * 16);
+                out[4 * n + 2] = 0;
+                out[4 * n + 3] = 0;
+            }
+        }
+        else
+        {
+            memcpy(buffer, _source + _position * VIRTUAL_RAW_SAMPLE_SIZE, chunk * VIRTUAL_RAW_SAMPLE_SIZE);
+        }
+
+        buffer += chunk * VIRTUAL_RAW_SAMPLE_SIZE;
+        samples -= chunk;
+        _position = (_position + chunk) % _source_samples;
+    }
+}
+
+void virtual_transport::skip(uint64_t samples)
+{
+    _position = (size_t) ((_position + samples) % _source_samples);
+}
+
+int virtual_transport::submit(libusb_transfer *transfer)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if(_interrupted)
+    {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+
+    if(transfer->endpoint == ADSDR_RX_IN && transfer->type == LIBUSB_TRANSFER_TYPE_BULK)
+    {
+        _rx_pending.push_back(transfer);
+    }
+    else
+    {
+        _other_pending.push_back(transfer);
+    }
+    _wake.notify_all();
+    return 0;
+}
+
+int virtual_transport::cancel(libusb_transfer *transfer)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    for(std::deque<libusb_transfer *> *pending : {&_rx_pending, &_other_pending})
+    {
+        for(auto it = pending->begin(); it != pending->end(); ++it)
+        {
+            if(*it == transfer)
+            {
+                pending->erase(it);
+                _cancelled.push_back(transfer);
+                _wake.notify_all();
+                return 0;
+            }
+        }
+    }
+
+    return LIBUSB_ERROR_NOT_FOUND;
+}
+
+int virtual_transport::control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                               unsigned char *data, uint16_t length, unsigned int timeout_ms)
+{
+    (void) value;
+    (void) index;
+    (void) timeout_ms;
+
+    if(request_type & LIBUSB_ENDPOINT_IN)
+    {
+        memset(data, 0, length);
+        if(request == ADSDR_FPGA_CONFIG_STATUS && length > 0)
+        {
+            data[0] = 1;
+        }
+    }
+    else if(request == DEVICE_START || request == DEVICE_STOP)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _streaming = request == DEVICE_START;
+        _next_due = clock::now() + _period;
+        _wake.notify_all();
+    }
+
+    return length;
+}
+
+void virtual_transport::handle_events()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+
+    if(!_cancelled.empty())
+    {
+        libusb_transfer *transfer = _cancelled.front();
+        _cancelled.pop_front();
+        lock.unlock();
+
+        transfer->status = LIBUSB_TRANSFER_CANCELLED;
+        transfer->actual_length = 0;
+        transfer->callback(transfer);
+        return;
+    }
+
+    if(_interrupted)
+    {
+        return;
+    }
+
+    if(!_streaming || (_period == clock::duration::zero() && _rx_pending.empty()))
+    {
+        _wake.wait(lock);
+        return;
+    }
+
+    if(_period != clock::duration::zero())
+    {
+        clock::time_point now = clock::now();
+        if(now < _next_due)
+        {
+            _wake.wait_until(lock, _next_due);
+            return;
+        }
+
+        // Everything that became due beyond the submitted transfers had nowhere to go on the device
+        uint64_t due = (uint64_t) ((now - _next_due) / _period) + 1;
+        if(due > _rx_pending.size())
+        {
+            uint64_t missed = due - _rx_pending.size();
+            _next_due += missed * _period;
+            skip(missed * ADSDR_RX_BLOCK_SIZE);
+        }
+
+        if(_rx_pending.empty())
+        {
+            return;
+        }
+        _next_due += _period;
+    }
+
+    libusb_transfer *transfer = _rx_pending.front();
+    _rx_pending.pop_front();
+    lock.unlock();
+
+    // Only the event thread touches the source
+    fill(transfer->buffer, transfer->length);
+    transfer->actual_length = transfer->length - transfer->length % VIRTUAL_RAW_SAMPLE_SIZE;
+    transfer->status = LIBUSB_TRANSFER_COMPLETED;
+    transfer->callback(transfer);
+}
+
+void virtual_transport::interrupt()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _interrupted = true;
+    _wake.notify_all();
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBADSDR_VIRTUAL_TRANSPORT_H__
+#define __LIBADSDR_VIRTUAL_TRANSPORT_H__
+
+#include "transport.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace ADSDR
+{
+    // Stands in for a device without any hardware. Once the device is started, RX bulk transfers
+    // are filled from a capture file or a synthesized signal in the same format the FX3 sends,
+    // paced at the configured sample rate. Like the FX3, data produced while no transfer is
+    // submitted is lost. Other transfers only ever complete when cancelled. Control requests
+    // succeed without effect, except for the FPGA status, which always reports a loaded FPGA.
+    class virtual_transport : public transport
+    {
+    public:
+        virtual_transport(const virtual_device_config &config);
+        ~virtual_transport();
+
+        int submit(libusb_transfer *transfer) override;
+        int cancel(libusb_transfer *transfer) override;
+        int control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                    unsigned char *data, uint16_t length, unsigned int timeout_ms) override;
+
+        void handle_events() override;
+        void interrupt() override;
+
+        std::string serial() const override { return "virtual"; }
+
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        void synthesize();
+        void map_file();
+
+        // Copies the next samples of the source into buffer in the device transfer format
+        void fill(unsigned char *buffer, int length);
+        void skip(uint64_t samples);
+
+        virtual_device_config _config;
+
+        // Source in the device format (8 bytes per sample), or a CI16 file expanded while filling
+        const unsigned char *_source = nullptr;
+        size_t _source_samples = 0;
+        bool _source_ci16 = false;
+        std::vector<unsigned char> _table;
+        void *_map = nullptr;
+        size_t _map_bytes = 0;
+        size_t _position = 0;
+
+        std::mutex _lock;
+        std::condition_variable _wake;
+        std::deque<libusb_transfer *> _rx_pending;
+        std::deque<libusb_transfer *> _other_pending;
+        std::deque<libusb_transfer *> _cancelled;
+        bool _streaming = false;
+        bool _interrupted = false;
+
+        // Pacing, one transfer worth of samples becomes due every _period
+        clock::duration _period;
+        clock::time_point _next_due;
+    };
+}
+
+#endif // __LIBADSDR_VIRTUAL_TRANSPORT_H__
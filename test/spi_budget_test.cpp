@@ -0,0 +1,102 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <adsdr.hpp>
+
+#include <cstdio>
+#include <iostream>
+
+using namespace ADSDR;
+
+// Replays an SPI trace on a virtual device and fails when a step issues more AD9361 register
+// transactions than its budget. The trace in test/data answers the reads of init_sdr followed by
+// the commands below. It was recorded against a register model that echoes writes and reports the
+// PLLs locked and the calibrations done, record_spi_trace on hardware running the same steps
+// produces a drop-in replacement.
+
+struct spi_budget
+{
+    const char *step;
+    command_id cmd;
+    uint64_t param;
+    uint64_t transactions;
+};
+
+// cmd is ignored for init_sdr, the first step
+static const spi_budget budgets[] = {
+    {"init_sdr", SET_RX_LO_FREQ, 0, 2544},
+    {"SET_RX_LO_FREQ", SET_RX_LO_FREQ, 2400000000ULL, 9},
+    {"SET_RX_SAMP_FREQ", SET_RX_SAMP_FREQ, 5000000, 726},
+};
+
+int main(int argc, char *argv[])
+{
+    if(argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <trace>" << std::endl;
+        return 1;
+    }
+
+    int failures = 0;
+    try
+    {
+        ADSDR::ADSDR dev(virtual_device_config{});
+        dev.replay_spi_trace(argv[1]);
+
+        for(size_t k = 0; k < sizeof(budgets) / sizeof(budgets[0]); k++)
+        {
+            const spi_budget &budget = budgets[k];
+            dev.reset_spi_statistics();
+
+            bool ok;
+            if(k == 0)
+            {
+                ok = dev.init_sdr();
+            }
+            else
+            {
+                command cmd;
+                cmd.cmd = budget.cmd;
+                cmd.param = budget.param;
+                ok = dev.send_cmd(cmd).error == CMD_OK;
+            }
+            uint64_t transactions = dev.spi_statistics().transactions;
+
+            fflush(stdout);
+            std::cerr << budget.step << ": " << transactions << " transactions, budget " << budget.transactions << std::endl;
+            if(!ok)
+            {
+                std::cerr << "FAIL: " << budget.step << " failed on the replayed trace" << std::endl;
+                return 1;
+            }
+            if(transactions > budget.transactions)
+            {
+                std::cerr << "FAIL: " << budget.step << " is over its SPI budget" << std::endl;
+                failures++;
+            }
+        }
+    }
+    catch(const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
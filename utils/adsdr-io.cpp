@@ -0,0 +1,181 @@
+/*
+ * Copyright 2017 by Lukas Lao Beyer <lukas@electronics.kitchen>
+ *
+ * This file is part of libfreesrp.
+ *
+ * libfreesrp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * libfreesrp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with libfreesrp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <adsdr.hpp>
+
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+
+using namespace ADSDR;
+
+static std::atomic<bool> stop_requested{false};
+
+static void handle_signal(int)
+{
+    stop_requested.store(true);
+}
+
+static void usage(const char *name)
+{
+    std::cerr << "Usage: " << name << " [options] -o <path>\n"
+              << "Records received samples to <path>.sigmf-data and <path>.sigmf-meta\n\n"
+              << "  -d <serial>     Device serial number\n"
+              << "  -l <bitstream>  Load the FPGA with this bitstream if it is not configured\n"
+              << "  -f <hz>         RX LO frequency\n"
+              << "  -r <hz>         RX sample rate\n"
+              << "  -b <hz>         RX RF bandwidth\n"
+              << "  -g <db>         RX gain, enables manual gain control\n"
+              << "  -n <samples>    Stop after this many samples\n"
+              << "  -t <seconds>    Stop after this many seconds\n"
+              << "  -q <blocks>     Write queue depth (default " << ADSDR_RECORDER_QUEUE_SIZE << ")\n"
+              << "  -D              Drop blocks instead of stalling the stream when the disk falls behind\n"
+              << "  -B              Buffered writes through the page cache instead of O_DIRECT\n"
+              << "  -c <text>       Description stored in the metadata\n";
+}
+
+static bool send(ADSDR::ADSDR &dev, command_id id, double param)
+{
+    response res = dev.send_cmd(dev.make_command(id, param));
+    if(res.error != CMD_OK)
+    {
+        std::cerr << "Command failed: " << res << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string serial;
+    std::string bitstream;
+    double frequency = 0, sample_rate = 0, bandwidth = 0, gain = 0;
+    bool set_gain = false;
+    unsigned long long max_samples = 0;
+    double max_seconds = 0;
+    recording_config config;
+
+    int opt;
+    while((opt = getopt(argc, argv, "d:l:f:r:b:g:n:t:q:DBc:o:h")) != -1)
+    {
+        switch(opt)
+        {
+        case 'd': serial = optarg; break;
+        case 'l': bitstream = optarg; break;
+        case 'f': frequency = atof(optarg); break;
+        case 'r': sample_rate = atof(optarg); break;
+        case 'b': bandwidth = atof(optarg); break;
+        case 'g': gain = atof(optarg); set_gain = true; break;
+        case 'n': max_samples = strtoull(optarg, nullptr, 0); break;
+        case 't': max_seconds = atof(optarg); break;
+        case 'q': config.queue_depth = (unsigned int) strtoul(optarg, nullptr, 0); break;
+        case 'D': config.policy = BACKPRESSURE_DROP; break;
+        case 'B': config.direct_io = false; break;
+        case 'c': config.description = optarg; break;
+        case 'o': config.path = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(config.path.empty())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        ADSDR::ADSDR dev(serial);
+
+        if(!dev.fpga_loaded())
+        {
+            if(bitstream.empty() || dev.load_fpga(bitstream) == FPGA_CONFIG_ERROR)
+            {
+                std::cerr << "FPGA is not configured" << std::endl;
+                return 1;
+            }
+        }
+
+        if(!dev.init_sdr())
+        {
+            std::cerr << "AD9361 initialization failed" << std::endl;
+            return 1;
+        }
+
+        if((sample_rate > 0 && !send(dev, SET_RX_SAMP_FREQ, sample_rate)) ||
+           (bandwidth > 0 && !send(dev, SET_RX_RF_BANDWIDTH, bandwidth)) ||
+           (frequency > 0 && !send(dev, SET_RX_LO_FREQ, frequency)) ||
+           (set_gain && !send(dev, SET_RX_GC_MODE, RF_GAIN_MGC)) ||
+           (set_gain && !send(dev, SET_RX_RF_GAIN, gain)) ||
+           !send(dev, SET_DATAPATH_EN, 1))
+        {
+            return 1;
+        }
+
+        signal(SIGINT, handle_signal);
+        signal(SIGTERM, handle_signal);
+
+        dev.start_recording(config);
+        dev.start_rx();
+
+        auto start = std::chrono::steady_clock::now();
+        auto last_report = start;
+        while(!stop_requested.load())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            auto now = std::chrono::steady_clock::now();
+            recording_stats stats = dev.recording_status();
+            if(max_samples > 0 && stats.samples >= max_samples)
+            {
+                break;
+            }
+            if(max_seconds > 0 && std::chrono::duration<double>(now - start).count() >= max_seconds)
+            {
+                break;
+            }
+
+            if(now - last_report >= std::chrono::seconds(1))
+            {
+                std::cerr << "\r" << stats.samples << " samples, " << stats.lost << " lost, "
+                          << stats.stalled << " stalls, " << dev.rx_overflow_count() << " overflows" << std::flush;
+                last_report = now;
+            }
+        }
+
+        dev.stop_rx();
+        recording_stats stats = dev.stop_recording();
+
+        std::cerr << "\nWrote " << stats.samples << " samples in " << stats.blocks << " blocks"
+                  << (stats.direct_io ? " (O_DIRECT)" : " (buffered)") << ", "
+                  << stats.lost << " samples lost, " << stats.stalled << " stalls, "
+                  << stats.dropped << " blocks dropped" << std::endl;
+    }
+    catch(const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}